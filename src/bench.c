@@ -0,0 +1,15 @@
+#include "bench/enum_bench.h"
+#include "bench/file_bench.h"
+#include "bench/hash_bench.h"
+#include "bench/sync_bench.h"
+#include "bench/walk_bench.h"
+
+int main(int argc, char **argv) {
+    int code = 0;
+    code |= enum_bench();
+    code |= file_bench();
+    code |= hash_bench();
+    code |= sync_bench();
+    code |= walk_bench();
+    return code;
+}
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../main/array.h"
+#include "../main/enum.h"
+#include "../test/sim_device.h"
+#include "enum_bench.h"
+
+// Simulated round trip of a single request, typical of USB 2.0 MTP devices
+#define ENUM_BENCH_LATENCY_US 2000
+
+static EnumVisitCode count_visit(EnumEntry* e, const char* path, void* data) {
+    (*(size_t*)data)++;
+    return ENUM_VISIT_CONTINUE;
+}
+
+static double elapsed_ms(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Builds a tree of folders, each containing the given number of files.
+static SimDevice* build_device(unsigned latency_us, size_t folders, size_t files) {
+    SimDevice* sd = sim_device_new(latency_us);
+    if (!sd) return NULL;
+
+    char name[32];
+    uint32_t parent = 0;
+    for (size_t i = 0; i < folders; i++) {
+        sprintf(name, "folder%zu", i);
+        uint32_t id = sim_device_add(sd, parent, name, 0, 1);
+
+        for (size_t j = 0; j < files; j++) {
+            sprintf(name, "file%zu", j);
+            sim_device_add(sd, id, name, 1024 * j, 0);
+        }
+
+        // alternate between nesting and adding siblings
+        if (i % 2 == 0) parent = id;
+    }
+
+    return sd;
+}
+
+static void run(SimDevice* sd, size_t folders, size_t files, EnumStrategy strategy) {
+    EnumSource src = sim_device_source(sd);
+    size_t visited = 0;
+    struct timespec start;
+
+    sim_device_requests(sd);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    EnumStatusCode code = enum_tree(&src, 0, "/", strategy, count_visit, &visited);
+    double ms = elapsed_ms(&start);
+
+    printf("enum %-4s folders=%-5zu files/folder=%-4zu objects=%-7zu requests=%-5zu %10.2f ms%s\n",
+        strategy == ENUM_STRATEGY_BULK ? "bulk" : "walk", folders, files, visited,
+        sim_device_requests(sd), ms, code == ENUM_STATUS_OK ? "" : " (FAILED)");
+}
+
+int enum_bench() {
+    char* env = getenv("MTPSYNC_BENCH_LATENCY_US");
+    unsigned latency_us = env ? atoi(env) : ENUM_BENCH_LATENCY_US;
+
+    size_t shapes[][2] = { { 10, 100 }, { 100, 10 }, { 500, 2 } };
+
+    printf("enum: simulated latency %u us per request\n", latency_us);
+    for (size_t i = 0; i < ARRAY_LEN(shapes); i++) {
+        SimDevice* sd = build_device(latency_us, shapes[i][0], shapes[i][1]);
+        if (!sd) return 1;
+        run(sd, shapes[i][0], shapes[i][1], ENUM_STRATEGY_WALK);
+        run(sd, shapes[i][0], shapes[i][1], ENUM_STRATEGY_BULK);
+        sim_device_free(sd);
+    }
+
+    return 0;
+}
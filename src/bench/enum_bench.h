@@ -0,0 +1,6 @@
+#ifndef _ENUM_BENCH_H_
+#define _ENUM_BENCH_H_
+
+int enum_bench();
+
+#endif
@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../main/arena.h"
+#include "../main/array.h"
+#include "../main/file.h"
+#include "../main/fs.h"
+#include "../main/intern.h"
+#include "../main/list.h"
+#include "file_bench.h"
+
+#define FILE_BENCH_COUNT 1000000
+
+typedef File* (*FileBenchFn)(Arena* arena, const char* path, List* files, size_t i);
+
+static double elapsed_ms(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Creates a file as file_new_arena did before, resolving every path and
+// looking up the working directory for each relative one.
+static File* file_new_resolved(Arena* arena, const char* path) {
+    char* cwd = NULL;
+    if (path[0] != '/') {
+        cwd = getcwd(NULL, 0);
+        if (!cwd) return NULL;
+    }
+
+    char* path_r = fs_resolve_cwd(cwd, path);
+    free(cwd);
+    if (!path_r) return NULL;
+
+    char* path_i = intern_path(path_r);
+    free(path_r);
+    if (!path_i) return NULL;
+
+    File* file = file_new_interned(arena, path_i, 0, NULL);
+    intern_release(path_i);
+    return file;
+}
+
+static File* bench_resolve(Arena* arena, const char* path, List* files, size_t i) {
+    return file_new_resolved(arena, path);
+}
+
+static File* bench_new(Arena* arena, const char* path, List* files, size_t i) {
+    return file_new_arena(arena, path, 0, NULL);
+}
+
+static File* bench_canonical(Arena* arena, const char* path, List* files, size_t i) {
+    return file_new_canonical(arena, path, 0, NULL);
+}
+
+static File* bench_dup(Arena* arena, const char* path, List* files, size_t i) {
+    return file_dup(arena, list_get(files, i));
+}
+
+static int run(const char* name, char** paths, List* files, FileBenchFn fn) {
+    struct timespec start;
+    Arena* arena = arena_new(1024 * 1024);
+    if (!arena) return 1;
+
+    size_t created = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < FILE_BENCH_COUNT; i++) {
+        if (!fn(arena, paths[i], files, i)) break;
+        created++;
+    }
+    double ms = elapsed_ms(&start);
+
+    printf("file %-9s paths=%-8zu %10.2f ms%s\n",
+        name, created, ms, created == FILE_BENCH_COUNT ? "" : " (FAILED)");
+
+    arena_free(arena);
+    return created == FILE_BENCH_COUNT ? 0 : 1;
+}
+
+int file_bench() {
+    int code = 1;
+    Arena* arena = arena_new(1024 * 1024);
+    char** paths = malloc(FILE_BENCH_COUNT * sizeof(char*));
+    char** relative = malloc(FILE_BENCH_COUNT * sizeof(char*));
+    List* files = list_new(FILE_BENCH_COUNT);
+    if (!arena || !paths || !relative || !files) goto done;
+
+    // paths like those of a device, canonical as most paths are by the time
+    // a File is made for them
+    for (size_t i = 0; i < FILE_BENCH_COUNT; i++) {
+        char buf[256];
+        int len = sprintf(buf, "/Music/Artist %zu/Album %zu/%02zu Track.mp3", i / 1000, i / 20 % 50, i % 20);
+        paths[i] = arena_alloc(arena, len + 1);
+        if (!paths[i]) goto done;
+        memcpy(paths[i], buf, len + 1);
+        relative[i] = paths[i] + 1;
+
+        File* f = file_new_canonical(arena, paths[i], 0, NULL);
+        if (!f || list_push(files, f) != LIST_STATUS_OK) goto done;
+    }
+
+    code = 0;
+    code |= run("resolve", paths, files, bench_resolve);
+    code |= run("new", paths, files, bench_new);
+    code |= run("canonical", paths, files, bench_canonical);
+    code |= run("dup", paths, files, bench_dup);
+    code |= run("rel-old", relative, files, bench_resolve);
+    code |= run("rel-new", relative, files, bench_new);
+
+done:
+    if (code) printf("file: benchmark failed\n");
+    list_free(files);
+    free(paths);
+    free(relative);
+    arena_free(arena);
+    return code;
+}
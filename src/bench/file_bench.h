@@ -0,0 +1,6 @@
+#ifndef _FILE_BENCH_H_
+#define _FILE_BENCH_H_
+
+int file_bench();
+
+#endif
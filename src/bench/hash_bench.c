@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../main/array.h"
+#include "../main/hash.h"
+#include "hash_bench.h"
+
+// Separately chained table, as hash.c was implemented before, for comparison
+typedef struct ChainEntry {
+    size_t hc;
+    struct ChainEntry* next;
+    void* key;
+    void* value;
+} ChainEntry;
+
+typedef struct {
+    ChainEntry** items;
+    size_t capacity;
+    size_t size;
+} Chain;
+
+static Chain* chain_new(size_t capacity) {
+    Chain* c = malloc(sizeof(Chain));
+    if (!c) return NULL;
+
+    c->items = calloc(capacity, sizeof(ChainEntry*));
+    if (!c->items) {
+        free(c);
+        return NULL;
+    }
+    c->capacity = capacity;
+    c->size = 0;
+    return c;
+}
+
+static void chain_link(Chain* c, ChainEntry* e) {
+    size_t idx = e->hc % c->capacity;
+    e->next = c->items[idx];
+    c->items[idx] = e;
+}
+
+static int chain_put(Chain* c, void* key, void* value) {
+    size_t hc = hash_code_str(key);
+    for (ChainEntry* e = c->items[hc % c->capacity]; e; e = e->next) {
+        if (hash_cmp_str(e->key, key) == 0) {
+            e->value = value;
+            return 0;
+        }
+    }
+
+    ChainEntry* e = malloc(sizeof(ChainEntry));
+    if (!e) return -1;
+    e->hc = hc;
+    e->key = key;
+    e->value = value;
+    chain_link(c, e);
+    c->size++;
+
+    if (c->size * 4 > c->capacity * 3) {
+        ChainEntry** old = c->items;
+        size_t old_capacity = c->capacity;
+
+        c->items = calloc(old_capacity * 2, sizeof(ChainEntry*));
+        if (!c->items) {
+            c->items = old;
+            return -1;
+        }
+        c->capacity = old_capacity * 2;
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            for (ChainEntry* it = old[i]; it; ) {
+                ChainEntry* next = it->next;
+                chain_link(c, it);
+                it = next;
+            }
+        }
+        free(old);
+    }
+    return 0;
+}
+
+static void* chain_get(Chain* c, void* key) {
+    size_t hc = hash_code_str(key);
+    for (ChainEntry* e = c->items[hc % c->capacity]; e; e = e->next) {
+        if (hash_cmp_str(e->key, key) == 0) return e->value;
+    }
+    return NULL;
+}
+
+static void chain_free(Chain* c) {
+    if (c) {
+        for (size_t i = 0; i < c->capacity; i++) {
+            for (ChainEntry* e = c->items[i]; e; ) {
+                ChainEntry* next = e->next;
+                free(e);
+                e = next;
+            }
+        }
+        free(c->items);
+    }
+    free(c);
+}
+
+// String hash used by hash.c before wyhash, for comparison
+static size_t hash_code_legacy(void* val) {
+    char* str = (char*)val;
+    size_t hc = 0;
+    for (size_t i = 0; i < strlen(str); i++) {
+        hc *= 7;
+        hc += str[i];
+    }
+    return hc;
+}
+
+static double elapsed_ms(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void report(const char* table, const char* op, size_t count, double ms) {
+    printf("hash %-5s %-6s keys=%-8zu %10.2f ms %8.2f Mops/s\n",
+        table, op, count, ms, ms > 0 ? count / ms / 1e3 : 0.0);
+}
+
+typedef void (*PathFn)(char* buf, size_t i);
+
+static void path_music(char* buf, size_t i) {
+    sprintf(buf, "/Music/Artist %zu/Album %zu/%02zu Track.mp3", i / 1000, i / 20 % 50, i % 20);
+}
+
+static void path_activity(char* buf, size_t i) {
+    size_t minutes = i * 37;
+    sprintf(buf, "/GARMIN/Activity/2026-%02zu-%02zu-%02zu-%02zu-%02zu.fit",
+        minutes / 43200 % 12 + 1, minutes / 1440 % 30 + 1, minutes / 60 % 24, minutes % 60, i % 60);
+}
+
+static void path_camera(char* buf, size_t i) {
+    sprintf(buf, "/DCIM/Camera/IMG_2026%04zu_%06zu.jpg", i / 500 % 10000, i * 7 % 1000000);
+}
+
+// Path sets shaped like real devices, with long shared prefixes
+static struct {
+    const char* name;
+    PathFn fn;
+} path_sets[] = {
+    { "music", path_music },
+    { "activity", path_activity },
+    { "camera", path_camera },
+};
+
+static char** make_keys(size_t count, PathFn fn) {
+    char** keys = malloc(count * sizeof(char*));
+    if (!keys) return NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = malloc(64);
+        if (!keys[i]) return NULL;
+        fn(keys[i], i);
+    }
+    return keys;
+}
+
+static void free_keys(char** keys, size_t count) {
+    for (size_t i = 0; keys && i < count; i++) free(keys[i]);
+    free(keys);
+}
+
+static int cmp_size(const void* a, const void* b) {
+    size_t aa = *(const size_t*)a;
+    size_t bb = *(const size_t*)b;
+    return aa < bb ? -1 : aa > bb;
+}
+
+// Reports the speed of a hash function, and how evenly the low bits of its
+// hash codes spread the keys over a table with a load factor of 0.75. For
+// uniformly random codes, chi2/df is close to 1.
+static void report_distribution(const char* set, const char* name, HashCodeFn fn, char** keys, size_t count) {
+    struct timespec start;
+    size_t capacity = 1;
+    size_t* codes = malloc(count * sizeof(size_t));
+    size_t* buckets = NULL;
+    size_t distinct = 0;
+    size_t empty = 0;
+    size_t max_load = 0;
+    double chi2 = 0;
+
+    while (capacity * 3 / 4 < count) capacity *= 2;
+    buckets = calloc(capacity, sizeof(size_t));
+    if (!codes || !buckets) goto done;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++) codes[i] = fn(keys[i]);
+    double ms = elapsed_ms(&start);
+
+    for (size_t i = 0; i < count; i++) buckets[codes[i] & (capacity - 1)]++;
+
+    double expected = (double)count / capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        if (!buckets[i]) empty++;
+        if (buckets[i] > max_load) max_load = buckets[i];
+        chi2 += (buckets[i] - expected) * (buckets[i] - expected) / expected;
+    }
+
+    qsort(codes, count, sizeof(size_t), cmp_size);
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || codes[i] != codes[i - 1]) distinct++;
+    }
+
+    printf("hash fn %-6s %-8s keys=%-8zu %6.1f ns/key distinct=%-8zu empty=%5.1f%% max=%-5zu chi2/df=%.2f\n",
+        name, set, count, ms * 1e6 / count, distinct, 100.0 * empty / capacity, max_load, chi2 / (capacity - 1));
+
+done:
+    free(codes);
+    free(buckets);
+}
+
+static void run(char** keys, char** probes, size_t count) {
+    struct timespec start;
+    size_t found = 0;
+
+    Chain* c = chain_new(1);
+    if (!c) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++) chain_put(c, keys[i], keys[i]);
+    report("chain", "insert", count, elapsed_ms(&start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++) found += chain_get(c, probes[i]) != NULL;
+    report("chain", "lookup", count, elapsed_ms(&start));
+    chain_free(c);
+
+    Hash* h = hash_new_str(1);
+    if (!h) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++) hash_entry_free(hash_put(h, keys[i], keys[i]).old_entry);
+    report("open", "insert", count, elapsed_ms(&start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++) found += hash_get(h, probes[i]) != NULL;
+    report("open", "lookup", count, elapsed_ms(&start));
+    hash_free(h);
+
+    if (found != count * 2) printf("hash: lookups found %zu of %zu keys\n", found, count * 2);
+}
+
+int hash_bench() {
+    size_t counts[] = { 10000, 100000, 1000000 };
+
+    for (size_t i = 0; i < ARRAY_LEN(path_sets); i++) {
+        size_t count = 100000;
+        char** keys = make_keys(count, path_sets[i].fn);
+        if (!keys) return 1;
+
+        report_distribution(path_sets[i].name, "legacy", hash_code_legacy, keys, count);
+        report_distribution(path_sets[i].name, "wyhash", hash_code_str, keys, count);
+        free_keys(keys, count);
+    }
+
+    for (size_t i = 0; i < ARRAY_LEN(counts); i++) {
+        size_t count = counts[i];
+        char** keys = make_keys(count, path_music);
+        char** probes = make_keys(count, path_music);
+        if (!keys || !probes) return 1;
+
+        // look up equal keys at different addresses, in a different order
+        for (size_t j = count - 1; j > 0; j--) {
+            size_t k = rand() % (j + 1);
+            char* tmp = probes[j];
+            probes[j] = probes[k];
+            probes[k] = tmp;
+        }
+
+        run(keys, probes, count);
+
+        free_keys(keys, count);
+        free_keys(probes, count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _HASH_BENCH_H_
+#define _HASH_BENCH_H_
+
+int hash_bench();
+
+#endif
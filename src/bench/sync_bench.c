@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../main/arena.h"
+#include "../main/array.h"
+#include "../main/file.h"
+#include "../main/list.h"
+#include "../main/sync.h"
+#include "sync_bench.h"
+
+static double elapsed_ms(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static int push_file(Arena* arena, List* files, const char* root, size_t i) {
+    char buf[256];
+    sprintf(buf, "%s/Music/Artist %zu/Album %zu/%02zu Track.mp3", root, i / 1000, i / 20 % 50, i % 20);
+
+    File* f = file_new_arena(arena, buf, 0, NULL);
+    return f && list_push(files, f) == LIST_STATUS_OK ? 0 : -1;
+}
+
+static int run(size_t count) {
+    int code = 1;
+    Arena* arena = NULL;
+    List* source_files = NULL;
+    List* target_files = NULL;
+    List* specs = NULL;
+
+    arena = arena_new(1024 * 1024);
+    source_files = list_new(count);
+    target_files = list_new(count);
+    if (!arena || !source_files || !target_files) goto done;
+
+    // most files are already present, a few are new and a few are stray
+    for (size_t i = 0; i < count; i++) {
+        if (push_file(arena, source_files, "/src", i) != 0) goto done;
+        if (i % 10 && push_file(arena, target_files, "/tgt", i) != 0) goto done;
+        if (i % 50 == 0 && push_file(arena, target_files, "/tgt/Stray", i) != 0) goto done;
+    }
+
+    specs = sync_spec_create(arena, source_files, "/src", "/tgt");
+    if (!specs) goto done;
+
+    SyncPlanner planners[] = { SYNC_PLANNER_HASH, SYNC_PLANNER_MERGE };
+    char* names[] = { "hash", "merge" };
+
+    for (size_t i = 0; i < ARRAY_LEN(planners); i++) {
+        struct timespec start;
+        Arena* plan_arena = arena_new(64 * 1024);
+        if (!plan_arena) goto done;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        List* plans = sync_plan_push(plan_arena, source_files, target_files, specs, 1, SYNC_COMPARE_EXISTS, planners[i]);
+        double ms = elapsed_ms(&start);
+
+        if (plans) {
+            printf("sync %-5s files=%-8zu plans=%-8zu %10.2f ms\n", names[i], count, list_size(plans), ms);
+        }
+        list_free(plans);
+        arena_free(plan_arena);
+        if (!plans) goto done;
+    }
+
+    code = 0;
+
+done:
+    list_free(specs);
+    list_free(source_files);
+    list_free(target_files);
+    arena_free(arena);
+    return code;
+}
+
+int sync_bench() {
+    size_t counts[] = { 10000, 100000, 1000000 };
+
+    for (size_t i = 0; i < ARRAY_LEN(counts); i++) {
+        if (run(counts[i]) != 0) return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _SYNC_BENCH_H_
+#define _SYNC_BENCH_H_
+
+int sync_bench();
+
+#endif
@@ -0,0 +1,138 @@
+#ifdef __linux__
+#define _XOPEN_SOURCE 700
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../main/array.h"
+#include "../main/arena.h"
+#include "../main/file.h"
+#include "../main/fs.h"
+#include "../main/list.h"
+#include "../main/walk.h"
+#include "walk_bench.h"
+
+// Files collected by nftw_collect, as fs_collect_files did before, for comparison
+static List* nftw_files = NULL;
+static Arena* nftw_arena = NULL;
+
+static int nftw_callback(const char* fpath, const struct stat* s, int tflag, struct FTW* ftwbuf) {
+    if (S_ISDIR(s->st_mode)) return 0;
+
+    File* file = file_new_arena(nftw_arena, fpath, 0, NULL);
+    if (!file) return -1;
+    file->size = s->st_size;
+    file->mtime = s->st_mtime;
+    return list_push(nftw_files, file) == LIST_STATUS_OK ? 0 : -1;
+}
+
+static List* nftw_collect(Arena* arena, char* path) {
+    nftw_files = list_new(128);
+    nftw_arena = arena;
+    if (nftw_files && nftw(path, nftw_callback, 16, 0) != 0) {
+        list_free(nftw_files);
+        nftw_files = NULL;
+    }
+    return nftw_files;
+}
+
+static int remove_callback(const char* fpath, const struct stat* s, int tflag, struct FTW* ftwbuf) {
+    return remove(fpath);
+}
+
+static double elapsed_ms(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Builds a tree of folders, each containing the given number of files.
+static int build_tree(char* dir, size_t folders, size_t files) {
+    char path[256];
+    char parent[256];
+
+    if (strlen(dir) >= sizeof(parent)) return -1;
+    strcpy(parent, dir);
+    for (size_t i = 0; i < folders; i++) {
+        int n = snprintf(path, sizeof(path), "%s/folder%zu", parent, i);
+        if (n < 0 || (size_t)n >= sizeof(path)) return -1;
+        if (mkdir(path, 0755) != 0) return -1;
+
+        // alternate between nesting and adding siblings, a few levels deep
+        if (i % 2 == 0) strcpy(parent, path);
+        if (i % 16 == 15) strcpy(parent, dir);
+
+        size_t len = strlen(path);
+        for (size_t j = 0; j < files; j++) {
+            n = snprintf(path + len, sizeof(path) - len, "/file%zu", j);
+            if (n < 0 || (size_t)n >= sizeof(path) - len) return -1;
+            int fd = open(path, O_WRONLY | O_CREAT, 0644);
+            if (fd < 0) return -1;
+            close(fd);
+        }
+    }
+
+    return 0;
+}
+
+static void run(char* path, const char* name, size_t threads, int uring) {
+    struct timespec start;
+    Arena* arena = arena_new(64 * 1024);
+    if (!arena) return;
+
+    if (uring) {
+        setenv("MTPSYNC_IO_URING", "1", 1);
+    } else {
+        unsetenv("MTPSYNC_IO_URING");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    List* files = threads ? walk_collect_files(arena, path, threads) : nftw_collect(arena, path);
+    double ms = elapsed_ms(&start);
+
+    printf("walk %-5s threads=%-3zu files=%-8zu %10.2f ms%s\n",
+        name, threads ? threads : 1, list_size(files), ms, files ? "" : " (FAILED)");
+
+    list_free(files);
+    arena_free(arena);
+    unsetenv("MTPSYNC_IO_URING");
+}
+
+int walk_bench() {
+    char dir[] = "/tmp/mtpsync_walk_bench_XXXXXX";
+    char* path = getenv("MTPSYNC_BENCH_WALK_PATH");
+    char* total = getenv("MTPSYNC_BENCH_WALK_FILES");
+    size_t threads[] = { 1, 4, 16 };
+
+    // a million files or so shows the difference io_uring makes, but takes
+    // a while to generate, so fewer are walked unless asked for
+    size_t files = total ? strtoul(total, NULL, 10) : 0;
+    if (!files) files = 20000;
+
+    // walks a generated tree unless another is given, such as one on NFS
+    if (!path) {
+        if (!mkdtemp(dir) || build_tree(dir, (files + 49) / 50, 50) != 0) {
+            printf("walk: failed to build tree in %s\n", dir);
+            return 1;
+        }
+        path = dir;
+    }
+
+    printf("walk: %s\n", path);
+    run(path, "nftw", 0, 0);
+    for (size_t i = 0; i < ARRAY_LEN(threads); i++) run(path, "walk", threads[i], 0);
+    for (size_t i = 0; i < ARRAY_LEN(threads); i++) run(path, "uring", threads[i], 1);
+
+    if (path == dir && nftw(dir, remove_callback, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+        printf("walk: failed to remove %s\n", dir);
+    }
+
+    return 0;
+}
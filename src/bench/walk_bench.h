@@ -0,0 +1,6 @@
+#ifndef _WALK_BENCH_H_
+#define _WALK_BENCH_H_
+
+int walk_bench();
+
+#endif
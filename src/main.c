@@ -10,6 +10,8 @@
 #include "main/mtp_ls.h"
 #include "main/mtp_rm.h"
 #include "main/mtp_devices.h"
+#include "main/mtp_hash.h"
+#include "main/mtp_clone.h"
 #include "main/str.h"
 #include "main/fs.h"
 #include "main/io.h"
@@ -27,15 +29,22 @@ typedef struct {
 } Command;
 
 static void usage(char* name) {
-    fprintf(stderr, "USAGE: %s <push|pull|rm> [options..] <path/to/file..>\n\n", name);
+    fprintf(stderr, "USAGE: %s <push|pull|clone|rm|hash> [options..] <path/to/file..>\n\n", name);
     fprintf(stderr, "    Sync files between filesystem and an MTP device\n\n");
     fprintf(stderr, "OPTIONS:\n\n");
-    fprintf(stderr, "    -d [device_id]   Operate on a specific device ID\n");
+    fprintf(stderr, "    -c [policy]      Replace files which exist on both sides when they differ\n");
+    fprintf(stderr, "                     by: exists (never, default), size, mtime, or always\n");
+    fprintf(stderr, "    -d [device_id]   Operate on a specific device ID, given twice for clone\n");
+    fprintf(stderr, "    -j [jobs]        Push to or remove from this many devices at once\n");
+    fprintf(stderr, "    -m               Plan by merging sorted file lists, using less memory\n");
+    fprintf(stderr, "    -r               Rescan the device, ignoring the cached index\n");
     fprintf(stderr, "    -s [storage_id]  Operate on a specific storage volume\n");
     fprintf(stderr, "    -x               Remove stray files after push/pull\n");
     fprintf(stderr, "    -y               Assume yes, do not prompt for interaction\n\n");
     fprintf(stderr, "COMMANDS:\n\n");
+    fprintf(stderr, "    clone    Sends files/folders from one device to another\n");
     fprintf(stderr, "    devices  Show available devices\n");
+    fprintf(stderr, "    hash     Prints content digests of local files\n");
     fprintf(stderr, "    ls       List files and folders on the device\n");
     fprintf(stderr, "    push     Sends local files/folders to the device\n");
     fprintf(stderr, "    pull     Pulls files/folders from device\n");
@@ -66,6 +75,18 @@ static MtpStatusCode push_impl(int argc, char** argv, MtpArgs* args) {
     return mtp_push(args, from_path, to_path);
 }
 
+static MtpStatusCode clone_impl(int argc, char** argv, MtpArgs* args) {
+    if (argc < 3) {
+        fprintf(stderr, "Specify a path to clone\n");
+        return MTP_STATUS_ESYNTAX;
+    }
+
+    char* from_path = argv[2];
+    char* to_path = argc < 4 ? NULL : argv[3];
+
+    return mtp_clone(args, from_path, to_path);
+}
+
 static MtpStatusCode rm_impl(int argc, char** argv, MtpArgs* args) {
     MtpStatusCode code = MTP_STATUS_ENOMEM;
     List* rm_paths = NULL;
@@ -99,6 +120,15 @@ static MtpStatusCode ls_impl(int argc, char** argv, MtpArgs* args) {
     return mtp_ls(args, argv[2]);
 }
 
+static MtpStatusCode hash_impl(int argc, char** argv, MtpArgs* args) {
+    if (argc < 3) {
+        fprintf(stderr, "Specify a local path to hash\n");
+        return MTP_STATUS_ESYNTAX;
+    }
+
+    return mtp_hash(args, argv[2]);
+}
+
 static MtpStatusCode devices_impl(int argc, char** argv, MtpArgs* args) {
     return mtp_devices(args);
 }
@@ -111,7 +141,34 @@ static ArgStatusCode device_arg(int argc, char** argv, int* i, void* data) {
         return ARG_STATUS_ESYNTAX;
     }
 
-    args->device_id = argv[*i];
+    // a second device is the target of a clone
+    if (args->target_id) {
+        fprintf(stderr, "Please specify at most two device IDs\n");
+        return ARG_STATUS_ESYNTAX;
+    } else if (args->device_id) {
+        args->target_id = argv[*i];
+    } else {
+        args->device_id = argv[*i];
+    }
+    return ARG_STATUS_OK;
+}
+
+static ArgStatusCode jobs_arg(int argc, char** argv, int* i, void* data) {
+    MtpArgs* args = data;
+    char* endptr = NULL;
+
+    if (++(*i) >= argc) {
+        fprintf(stderr, "Please specify a number of jobs\n");
+        return ARG_STATUS_ESYNTAX;
+    }
+
+    long jobs = strtol(argv[*i], &endptr, 10);
+    if (!*argv[*i] || *endptr || jobs < 1) {
+        fprintf(stderr, "Invalid number of jobs: %s\n", argv[*i]);
+        return ARG_STATUS_ESYNTAX;
+    }
+
+    args->jobs = jobs;
     return ARG_STATUS_OK;
 }
 
@@ -133,6 +190,47 @@ static ArgStatusCode cleanup_arg(int argc, char** argv, int* i, void* data) {
     return ARG_STATUS_OK;
 }
 
+static ArgStatusCode compare_arg(int argc, char** argv, int* i, void* data) {
+    MtpArgs* args = data;
+
+    struct {
+        char* name;
+        SyncCompare compare;
+    } policies[] = {
+        { "exists", SYNC_COMPARE_EXISTS },
+        { "size", SYNC_COMPARE_SIZE },
+        { "mtime", SYNC_COMPARE_MTIME },
+        { "always", SYNC_COMPARE_ALWAYS },
+    };
+
+    if (++(*i) >= argc) {
+        fprintf(stderr, "Please specify a compare policy\n");
+        return ARG_STATUS_ESYNTAX;
+    }
+
+    for (size_t j = 0; j < ARRAY_LEN(policies); j++) {
+        if (strcmp(policies[j].name, argv[*i]) == 0) {
+            args->compare = policies[j].compare;
+            return ARG_STATUS_OK;
+        }
+    }
+
+    fprintf(stderr, "Unknown compare policy: %s, use exists, size, mtime, or always\n", argv[*i]);
+    return ARG_STATUS_ESYNTAX;
+}
+
+static ArgStatusCode merge_arg(int argc, char** argv, int* i, void* data) {
+    MtpArgs* args = data;
+    args->planner = SYNC_PLANNER_MERGE;
+    return ARG_STATUS_OK;
+}
+
+static ArgStatusCode rescan_arg(int argc, char** argv, int* i, void* data) {
+    MtpArgs* args = data;
+    args->rescan = 1;
+    return ARG_STATUS_OK;
+}
+
 static ArgStatusCode yes_arg(int argc, char** argv, int* i, void* data) {
     MtpArgs* args = data;
     args->yes = 1;
@@ -143,7 +241,9 @@ static MtpStatusCode mtpsync(int argc, char** argv, MtpArgs* args) {
     MtpStatusCode code = MTP_STATUS_ENOCMD;
 
     Command cmds[] = {
+        { .cmd_name = "clone", .cmd_fn = clone_impl },
         { .cmd_name = "devices", .cmd_fn = devices_impl },
+        { .cmd_name = "hash", .cmd_fn = hash_impl },
         { .cmd_name = "ls", .cmd_fn = ls_impl },
         { .cmd_name = "push", .cmd_fn = push_impl },
         { .cmd_name = "pull", .cmd_fn = pull_impl },
@@ -156,6 +256,11 @@ static MtpStatusCode mtpsync(int argc, char** argv, MtpArgs* args) {
     }
 
     char* cmd_name = argv[1];
+    if (args->target_id && strcmp(cmd_name, "clone") != 0) {
+        fprintf(stderr, "Only clone operates on two devices\n");
+        return MTP_STATUS_ESYNTAX;
+    }
+
     size_t cmds_size = ARRAY_LEN(cmds);
     for (size_t i = 0; i < cmds_size; i++) {
         Command c = cmds[i];
@@ -174,7 +279,11 @@ int main(int argc, char** argv) {
 
     ArgDefinition defv[] = {
         { .arg_long = "cleanup", .arg_short = 'x', .arg_fn = cleanup_arg },
+        { .arg_long = "compare", .arg_short = 'c', .arg_fn = compare_arg },
         { .arg_long = "device", .arg_short = 'd', .arg_fn = device_arg },
+        { .arg_long = "jobs", .arg_short = 'j', .arg_fn = jobs_arg },
+        { .arg_long = "merge", .arg_short = 'm', .arg_fn = merge_arg },
+        { .arg_long = "rescan", .arg_short = 'r', .arg_fn = rescan_arg },
         { .arg_long = "storage", .arg_short = 's', .arg_fn = storage_arg },
         { .arg_long = "yes", .arg_short = 'y', .arg_fn = yes_arg },
     };
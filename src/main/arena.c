@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+// Allocations larger than this fraction of a block get a block of their own
+#define ARENA_LARGE_DIVISOR 4
+
+// Items passed to a callback registered with arena_defer_batch at once
+#define ARENA_BATCH_SIZE 256
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;  // Next block, which is full
+    size_t size;              // Usable size of the block
+    size_t used;              // Bytes of the block allocated so far
+    max_align_t data[];       // Memory allocations are made from
+} ArenaBlock;
+
+typedef struct ArenaCleanup {
+    ArenaCleanupFn fn;          // Callback to execute, NULL for a batch
+    ArenaBatchFn batch_fn;      // Callback to execute for a batch, or NULL
+    void* data;                 // Data to pass to the callback
+    void** items;               // Data to pass to the batch callback
+    size_t count;               // Number of items in the batch
+    struct ArenaCleanup* next;  // Callback registered before this one
+} ArenaCleanup;
+
+struct Arena {
+    ArenaBlock* blocks;      // Blocks, the one being allocated from first
+    ArenaCleanup* cleanups;  // Callbacks, the last registered first
+    size_t block_size;       // Usable size of each new block
+    size_t size;             // Bytes allocated so far
+    int is_debug;            // Truthy to give every allocation its own block
+};
+
+static inline size_t arena_round(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static ArenaBlock* arena_block_new(size_t size) {
+    ArenaBlock* b = malloc(sizeof(ArenaBlock) + size);
+    if (!b) return NULL;
+
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+Arena* arena_new(size_t block_size) {
+    Arena* a = malloc(sizeof(Arena));
+    if (!a) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    char* debug = getenv("MTPSYNC_ARENA_DEBUG");
+
+    a->blocks = NULL;
+    a->cleanups = NULL;
+    a->block_size = arena_round(block_size ? block_size : ARENA_ALIGN);
+    a->size = 0;
+    a->is_debug = debug && *debug && strcmp(debug, "0") != 0;
+    return a;
+}
+
+// Gives an allocation a block of its own, which exactly fits it.
+static void* arena_alloc_block(Arena* a, size_t size) {
+    ArenaBlock* b = arena_block_new(size);
+    if (!b) return NULL;
+    b->used = size;
+
+    // keep allocating from the current block
+    if (a->blocks && !a->is_debug) {
+        b->next = a->blocks->next;
+        a->blocks->next = b;
+    } else {
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+
+    a->size += size;
+    return b->data;
+}
+
+void* arena_alloc(Arena* a, size_t size) {
+    ArenaBlock* b = a->blocks;
+    void* p = NULL;
+
+    // not rounded up, so that debugging tools see the end of the allocation
+    if (a->is_debug) {
+        p = arena_alloc_block(a, size);
+        if (!p) goto error;
+        return p;
+    }
+
+    size = arena_round(size ? size : 1);
+
+    if (size > a->block_size / ARENA_LARGE_DIVISOR) {
+        p = arena_alloc_block(a, size);
+        if (!p) goto error;
+        return p;
+    }
+
+    if (!b || b->size - b->used < size) {
+        b = arena_block_new(a->block_size);
+        if (!b) goto error;
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+
+    p = (char*)b->data + b->used;
+    b->used += size;
+    a->size += size;
+    return p;
+
+error:
+    errno = ENOMEM;
+    return NULL;
+}
+
+char* arena_strdup(Arena* a, const char* str) {
+    size_t len = strlen(str);
+    char* copy = arena_alloc(a, len + 1);
+    if (copy) memcpy(copy, str, len + 1);
+    return copy;
+}
+
+ArenaStatusCode arena_defer(Arena* a, ArenaCleanupFn fn, void* data) {
+    ArenaCleanup* c = arena_alloc(a, sizeof(ArenaCleanup));
+    if (!c) return ARENA_STATUS_ENOMEM;
+
+    c->fn = fn;
+    c->batch_fn = NULL;
+    c->data = data;
+    c->items = NULL;
+    c->count = 0;
+    c->next = a->cleanups;
+    a->cleanups = c;
+    return ARENA_STATUS_OK;
+}
+
+ArenaStatusCode arena_defer_batch(Arena* a, ArenaBatchFn fn, void* data) {
+    ArenaCleanup* c = a->cleanups;
+
+    if (!c || c->batch_fn != fn || c->count == ARENA_BATCH_SIZE) {
+        c = arena_alloc(a, sizeof(ArenaCleanup));
+        if (!c) return ARENA_STATUS_ENOMEM;
+
+        c->items = arena_alloc(a, ARENA_BATCH_SIZE * sizeof(void*));
+        if (!c->items) return ARENA_STATUS_ENOMEM;
+
+        c->fn = NULL;
+        c->batch_fn = fn;
+        c->data = NULL;
+        c->count = 0;
+        c->next = a->cleanups;
+        a->cleanups = c;
+    }
+
+    c->items[c->count++] = data;
+    return ARENA_STATUS_OK;
+}
+
+size_t arena_size(Arena* a) {
+    return a ? a->size : 0;
+}
+
+void arena_free(Arena* a) {
+    if (!a) return;
+
+    for (ArenaCleanup* c = a->cleanups; c; c = c->next) {
+        if (c->batch_fn) {
+            c->batch_fn(c->items, c->count);
+        } else {
+            c->fn(c->data);
+        }
+    }
+
+    for (ArenaBlock* b = a->blocks; b; ) {
+        ArenaBlock* next = b->next;
+        free(b);
+        b = next;
+    }
+    free(a);
+}
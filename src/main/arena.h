@@ -0,0 +1,106 @@
+/**
+ * @file arena.h
+ * Region allocator for objects which share a lifetime, like everything built
+ * while running a single command. Allocations are carved out of large blocks
+ * by bumping a pointer, and are all released at once by arena_free, rather
+ * than being freed one by one.
+ *
+ * Set the MTPSYNC_ARENA_DEBUG environment variable to give every allocation
+ * its own block instead, so that tools like valgrind can still detect reads
+ * and writes past the end of an object.
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/**
+ * Status codes for arena operations.
+ */
+typedef enum {
+    ARENA_STATUS_OK,      ///< Operation successful
+    ARENA_STATUS_ENOMEM,  ///< Failed due to allocation error
+} ArenaStatusCode;
+
+/**
+ * Callback executed when an arena is freed, to release resources held by
+ * objects within the arena.
+ * @param data  opaque data passed to arena_defer
+ */
+typedef void (*ArenaCleanupFn)(void* data);
+
+/**
+ * Callback executed when an arena is freed, for a batch of data registered
+ * with arena_defer_batch.
+ * @param data  opaque data passed to arena_defer_batch, in registered order
+ * @param n     number of items in the batch
+ */
+typedef void (*ArenaBatchFn)(void** data, size_t n);
+
+/**
+ * A region of memory. Use arena_new to create one.
+ */
+typedef struct Arena Arena;
+
+/**
+ * Create a new arena. Free it with arena_free when done.
+ * @param block_size  size of each block of memory allocations are made from
+ * @return            new arena, or NULL in case of failure
+ */
+Arena* arena_new(size_t block_size);
+
+/**
+ * Allocate memory from the arena, aligned for any type. The memory is not
+ * initialized, and remains valid until the arena is freed.
+ * @param a     arena to allocate from
+ * @param size  number of bytes to allocate
+ * @return      the allocated memory, or NULL in case of failure
+ */
+void* arena_alloc(Arena* a, size_t size);
+
+/**
+ * Copy a string in to the arena.
+ * @param a    arena to allocate from
+ * @param str  string to copy
+ * @return     the copy, or NULL in case of failure
+ */
+char* arena_strdup(Arena* a, const char* str);
+
+/**
+ * Register a callback to execute when the arena is freed. Callbacks are
+ * executed in the reverse order they were registered.
+ * @param a     arena to register the callback with
+ * @param fn    callback to execute
+ * @param data  opaque data to pass to the callback
+ * @return      status code of the operation
+ */
+ArenaStatusCode arena_defer(Arena* a, ArenaCleanupFn fn, void* data);
+
+/**
+ * Register data to pass to a callback when the arena is freed, like
+ * arena_defer, except that data registered for the same callback one after
+ * another is passed to it in batches. Use this when a callback does its work
+ * more cheaply for many items at once, like taking a lock only once.
+ * @param a     arena to register the data with
+ * @param fn    callback to execute
+ * @param data  opaque data to pass to the callback
+ * @return      status code of the operation
+ */
+ArenaStatusCode arena_defer_batch(Arena* a, ArenaBatchFn fn, void* data);
+
+/**
+ * Retrieve the number of bytes allocated from the arena so far.
+ * @param a  arena to check
+ * @return   number of bytes allocated
+ */
+size_t arena_size(Arena* a);
+
+/**
+ * Free the arena and everything allocated from it, after executing any
+ * callbacks registered with arena_defer or arena_defer_batch. Accepts NULL.
+ * @param a  arena to free
+ */
+void arena_free(Arena* a);
+
+#endif
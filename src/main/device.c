@@ -3,36 +3,34 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
-#include <libmtp.h>
 
 #include "hash.h"
 #include "device.h"
+#include "enum.h"
+#include "index.h"
+#include "intern.h"
 #include "fs.h"
 #include "str.h"
 #include "sync.h"
 
 #define DEVICE_HASH_INIT_SIZE 512
+#define DEVICE_ARENA_BLOCK_SIZE (256 * 1024)
 
-static inline int file_sort_alpha(const void* a, const void* b) {
-    const File* aa = *(const File**)a;
-    const File* bb = *(const File**)b;
-    int result = strcmp(aa->path, bb->path);
-    return result;
-}
+// Number of folders to list when checking that the on-disk index is current
+#define DEVICE_INDEX_SPOT_CHECKS 4
 
-void device_file_free(DeviceFile* f) {
-    if (f) {
-        free(f->path);
-        free(f);
-    }
-}
+// Number of unlisted folders below a path for listing the whole storage to pay
+// off, when loading something other than the root folder
+#define DEVICE_BULK_MIN_FOLDERS 64
 
 void device_hash_entry_free(HashEntry* e) {
     if (e) {
+        // the files themselves live in the device's arena
         File* f = hash_entry_value(e);
-        if (f) {
-            device_file_free(f->data);
-            file_free(f);
+        if (f && f->data) {
+            DeviceFile* df = f->data;
+            list_free(df->children);
+            df->children = NULL;
         }
         hash_entry_free(e);
     }
@@ -46,93 +44,584 @@ static void free_files(LIBMTP_file_t* files) {
     }
 }
 
-static DeviceStatusCode device_load_files_recursive(
-    Device* d,
-    DeviceFile* parent,
-    uint32_t file_id
-);
+DeviceFile* device_file_new(Arena* arena, uint32_t id, uint32_t parent_id, uint64_t size, int is_folder, const char* path) {
+    DeviceFile* df = arena_alloc(arena, sizeof(DeviceFile));
+    if (!df) return NULL;
+
+    df->path = intern_path_arena(arena, path);
+    if (!df->path) return NULL;
+
+    df->id = id;
+    df->parent_id = parent_id;
+    df->size = size;
+    df->mtime = 0;
+    df->is_folder = is_folder;
+    df->is_loaded = 0;
+    df->parent = NULL;
+    df->children = NULL;
+    return df;
+}
 
-static DeviceStatusCode device_load_files_recursive(
-    Device* d,
-    DeviceFile* parent,
-    uint32_t file_id
-) {
-    int code = DEVICE_STATUS_EFAIL;
-    LIBMTP_file_t* files = NULL;
-    char* path = NULL;
-    DeviceFile* device_file = NULL;
+static inline const char* device_file_name(File* f) {
+    return f->path + fs_path_name(f->path).offset;
+}
 
-    LIBMTP_mtpdevice_t* device = d->device;
-    LIBMTP_devicestorage_t* storage = d->storage;
+// Binary search for a child of a folder by name. Returns the position of the
+// child, or the position to insert it at if the folder has no such child.
+static size_t device_find_child(DeviceFile* folder, const char* name, int* is_found) {
+    size_t lo = 0;
+    size_t hi = list_size(folder->children);
+
+    *is_found = 0;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(device_file_name(list_get(folder->children, mid)), name);
+        if (cmp == 0) {
+            *is_found = 1;
+            return mid;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
-    files = LIBMTP_Get_Files_And_Folders(device, storage->id, file_id);
-    if (LIBMTP_Get_Errorstack(device)) {
-        LIBMTP_Dump_Errorstack(device);
-        LIBMTP_Clear_Errorstack(device);
-        goto done;
+static DeviceFile* device_find_parent(Device* d, char* path) {
+    char* parent_path = intern_parent(path);
+    if (!parent_path) return NULL;
+    if (parent_path == d->root->path) return d->root;
+
+    File* parent = hash_get_hc(d->files, parent_path, intern_hc(parent_path));
+    return parent && parent->is_folder ? parent->data : NULL;
+}
+
+static DeviceStatusCode device_link_file(Device* d, File* file) {
+    DeviceFile* df = file->data;
+    int is_found = 0;
+
+    DeviceFile* parent = device_find_parent(d, file->path);
+    if (!parent) return DEVICE_STATUS_EFAIL;
+
+    if (!parent->children) {
+        parent->children = list_new(4);
+        if (!parent->children) return DEVICE_STATUS_EFAIL;
+    }
+
+    size_t i = device_find_child(parent, device_file_name(file), &is_found);
+    if (is_found) return DEVICE_STATUS_EFAIL;
+    if (list_insert(parent->children, i, file) != LIST_STATUS_OK) return DEVICE_STATUS_EFAIL;
+
+    df->parent = parent;
+    return DEVICE_STATUS_OK;
+}
+
+static void device_unlink_file(File* file) {
+    DeviceFile* df = file->data;
+    DeviceFile* parent = df->parent;
+    int is_found = 0;
+
+    if (!parent) return;
+
+    size_t i = device_find_child(parent, device_file_name(file), &is_found);
+    if (is_found && list_get(parent->children, i) == file) list_remove(parent->children, i);
+    df->parent = NULL;
+}
+
+// Removes and frees every descendant of a folder.
+static void device_drop_children(Device* d, DeviceFile* folder) {
+    while (list_size(folder->children)) {
+        File* child = list_pop(folder->children);
+        device_drop_children(d, child->data);
+        device_hash_entry_free(hash_remove_hc(d->files, child->path, child->hc));
+    }
+    list_free(folder->children);
+    folder->children = NULL;
+}
+
+// Adds a file to the files hash as part of loading, not a change to the device.
+// Any file previously at the same path is replaced, along with its descendants.
+static DeviceStatusCode device_put_file(Device* d, DeviceFile* dfile) {
+    DeviceStatusCode code = DEVICE_STATUS_EFAIL;
+    File* file = NULL;
+
+    file = file_new_interned(d->arena, dfile->path, dfile->is_folder, dfile);
+    if (!file) goto done;
+    file->size = dfile->size;
+    file->mtime = dfile->mtime;
+
+    HashPutResult r = hash_put_hc(d->files, file->path, file->hc, file);
+    if (r.old_entry) {
+        File* old = hash_entry_value(r.old_entry);
+        device_drop_children(d, old->data);
+        device_unlink_file(old);
+        device_hash_entry_free(r.old_entry);
     }
+    if (r.status != HASH_STATUS_OK) goto done;
 
-    if (!files) {
-        code = DEVICE_STATUS_OK;
+    if (device_link_file(d, file) != DEVICE_STATUS_OK) {
+        hash_entry_free(hash_remove_hc(d->files, file->path, file->hc));
         goto done;
     }
 
+    d->is_dirty = 1;
+    code = DEVICE_STATUS_OK;
+
+done:
+    return code;
+}
+
+static int device_mtp_error(LIBMTP_mtpdevice_t* device, int is_verbose) {
+    if (!LIBMTP_Get_Errorstack(device)) return 0;
+    if (is_verbose) LIBMTP_Dump_Errorstack(device);
+    LIBMTP_Clear_Errorstack(device);
+    return 1;
+}
+
+static EnumStatusCode device_mtp_list_folder(void* data, uint32_t folder_id, List** out) {
+    EnumStatusCode code = ENUM_STATUS_EFAIL;
+    Device* d = data;
+    LIBMTP_file_t* files = NULL;
+    List* entries = NULL;
+
+    uint32_t list_id = folder_id ? folder_id : LIBMTP_FILES_AND_FOLDERS_ROOT;
+    files = LIBMTP_Get_Files_And_Folders(d->device, d->storage->id, list_id);
+    if (device_mtp_error(d->device, 1)) goto done;
+
+    code = ENUM_STATUS_ENOMEM;
+    entries = list_new(16);
+    if (!entries) goto done;
+
     for (LIBMTP_file_t* file = files; file; file = file->next) {
-        char* parent_path = parent ? parent->path : "/";
+        int is_folder = file->filetype == LIBMTP_FILETYPE_FOLDER;
+        EnumEntry* e = enum_entry_new(file->item_id, folder_id, file->filesize, is_folder, file->filename);
+        if (!e) goto done;
+        e->mtime = file->modificationdate;
+        if (list_push(entries, e) != LIST_STATUS_OK) {
+            enum_entry_free(e);
+            goto done;
+        }
+    }
 
-        path = fs_path_join(parent_path, file->filename);
-        if (!path) goto done;
+    *out = entries;
+    entries = NULL;
+    code = ENUM_STATUS_OK;
 
-        printf("\33[2K\r\33[1mFILE\33[0m: %u: %s", file->item_id, path);
-        fflush(stdout);
+done:
+    list_free_deep(entries, (ListItemFreeFn)enum_entry_free);
+    free_files(files);
+    return code;
+}
 
-        device_file = malloc(sizeof(DeviceFile));
-        if (!device_file) goto done;
+static EnumStatusCode device_mtp_add_folders(List* entries, LIBMTP_folder_t* folders) {
+    for (LIBMTP_folder_t* f = folders; f; f = f->sibling) {
+        EnumEntry* e = enum_entry_new(f->folder_id, f->parent_id, 0, 1, f->name);
+        if (!e) return ENUM_STATUS_ENOMEM;
+        if (list_push(entries, e) != LIST_STATUS_OK) {
+            enum_entry_free(e);
+            return ENUM_STATUS_ENOMEM;
+        }
+        if (device_mtp_add_folders(entries, f->child) != ENUM_STATUS_OK) return ENUM_STATUS_ENOMEM;
+    }
+    return ENUM_STATUS_OK;
+}
 
-        device_file->id = file->item_id;
-        device_file->size = file->filesize;
-        device_file->path = path;
-        device_file->is_folder = (file->filetype == LIBMTP_FILETYPE_FOLDER);
+// The folder list and file listing each read every object on the device with
+// as few requests as the device allows, rather than one request per folder.
+static EnumStatusCode device_mtp_list_all(void* data, List** out) {
+    EnumStatusCode code = ENUM_STATUS_EUNSUPPORTED;
+    Device* d = data;
+    LIBMTP_folder_t* folders = NULL;
+    LIBMTP_file_t* files = NULL;
+    List* entries = NULL;
 
-        if (device_file->is_folder) {
-            if (device_load_files_recursive(d, device_file, file->item_id) != DEVICE_STATUS_OK) goto done;
+    folders = LIBMTP_Get_Folder_List_For_Storage(d->device, d->storage->id);
+    if (device_mtp_error(d->device, 0)) goto done;
+
+    files = LIBMTP_Get_Filelisting_With_Callback(d->device, NULL, NULL);
+    if (device_mtp_error(d->device, 0)) goto done;
+
+    code = ENUM_STATUS_ENOMEM;
+    entries = list_new(512);
+    if (!entries) goto done;
+
+    if (device_mtp_add_folders(entries, folders) != ENUM_STATUS_OK) goto done;
+
+    for (LIBMTP_file_t* file = files; file; file = file->next) {
+        // the file listing covers every storage volume of the device
+        if (file->storage_id != d->storage->id) continue;
+        if (file->filetype == LIBMTP_FILETYPE_FOLDER) continue;
+
+        EnumEntry* e = enum_entry_new(file->item_id, file->parent_id, file->filesize, 0, file->filename);
+        if (!e) goto done;
+        e->mtime = file->modificationdate;
+        if (list_push(entries, e) != LIST_STATUS_OK) {
+            enum_entry_free(e);
+            goto done;
         }
+    }
 
-        if (device_add_file(d, device_file) != DEVICE_STATUS_OK) goto done;
+    *out = entries;
+    entries = NULL;
+    code = ENUM_STATUS_OK;
 
-        path = NULL;
-        device_file = NULL;
+done:
+    list_free_deep(entries, (ListItemFreeFn)enum_entry_free);
+    LIBMTP_destroy_folder_t(folders);
+    free_files(files);
+    return code;
+}
+
+typedef struct {
+    Device* d;         // Device being loaded
+    int is_recursive;  // Truthy to descend in to folders
+    int is_bulk;       // Truthy if every object is listed, loaded or not
+} DeviceVisit;
+
+static EnumVisitCode device_visit(EnumEntry* e, const char* path, void* data) {
+    DeviceVisit* v = data;
+    Device* d = v->d;
+
+    if (d->is_loading) progress_tick(d->progress, "Loading", path);
+
+    File* existing = hash_get(d->files, (char*)path);
+    DeviceFile* child = existing ? existing->data : NULL;
+
+    if (!child || child->id != e->id) {
+        child = device_file_new(d->arena, e->id, e->parent_id, e->size, e->is_folder, path);
+        if (!child) return ENUM_VISIT_ABORT;
+        child->mtime = e->mtime;
+
+        if (device_put_file(d, child) != DEVICE_STATUS_OK) return ENUM_VISIT_ABORT;
+    }
+
+    if (!child->is_folder || !v->is_recursive) return ENUM_VISIT_SKIP;
+
+    // folders loaded from the index need not be listed again
+    if (child->is_loaded && !v->is_bulk) return ENUM_VISIT_SKIP;
+
+    child->is_loaded = 1;
+    return ENUM_VISIT_CONTINUE;
+}
+
+static DeviceStatusCode device_list_folder(Device* d, DeviceFile* folder, int is_recursive) {
+    DeviceVisit v = { .d = d, .is_recursive = is_recursive, .is_bulk = 0 };
+
+    EnumStatusCode code = enum_tree(&d->source, folder->id, folder->path, ENUM_STRATEGY_WALK, device_visit, &v);
+    if (code != ENUM_STATUS_OK) return DEVICE_STATUS_EFAIL;
+
+    folder->is_loaded = 1;
+    d->is_dirty = 1;
+    return DEVICE_STATUS_OK;
+}
+
+static EnumStatusCode device_list_all(Device* d) {
+    DeviceVisit v = { .d = d, .is_recursive = 1, .is_bulk = 1 };
+
+    EnumStatusCode code = enum_tree(&d->source, 0, "/", ENUM_STRATEGY_BULK, device_visit, &v);
+    if (code != ENUM_STATUS_OK) return code;
+
+    d->root->is_loaded = 1;
+    d->is_dirty = 1;
+    return ENUM_STATUS_OK;
+}
+
+static size_t device_count_unloaded(List* files) {
+    size_t n = 0;
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        DeviceFile* df = f->data;
+        if (df->is_folder && !df->is_loaded) n++;
+    }
+    return n;
+}
+
+static DeviceStatusCode device_load_subtree(Device* d, DeviceFile* folder) {
+    DeviceStatusCode code = DEVICE_STATUS_EFAIL;
+    List* files = NULL;
+    size_t unloaded = 0;
+
+    if (folder->is_loaded) {
+        files = device_filter_files(d, folder->path);
+        if (!files) goto done;
+
+        unloaded = device_count_unloaded(files);
+        if (!unloaded) {
+            code = DEVICE_STATUS_OK;
+            goto done;
+        }
+    }
+
+    // one listing of the whole storage beats a round trip for every folder,
+    // but not when only a small part of the storage is wanted
+    if (d->has_bulk && (folder == d->root || unloaded >= DEVICE_BULK_MIN_FOLDERS)) {
+        EnumStatusCode bulk = device_list_all(d);
+        if (bulk == ENUM_STATUS_OK) {
+            code = DEVICE_STATUS_OK;
+            goto done;
+        }
+        if (bulk == ENUM_STATUS_ENOMEM) goto done;
+        d->has_bulk = 0;
+    }
+
+    if (!folder->is_loaded && device_list_folder(d, folder, 1) != DEVICE_STATUS_OK) goto done;
+
+    // folders read from the index may still have descendants that were never listed
+    list_free(files);
+    files = device_filter_files(d, folder->path);
+    if (!files) goto done;
+
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        DeviceFile* df = f->data;
+        if (df->is_folder && !df->is_loaded) {
+            if (device_list_folder(d, df, 1) != DEVICE_STATUS_OK) goto done;
+        }
     }
 
     code = DEVICE_STATUS_OK;
 
 done:
-    free(path);
-    free(device_file);
-    free_files(files);
+    list_free(files);
+    return code;
+}
+
+// Lists each unloaded folder along the path, and optionally everything below it.
+static DeviceStatusCode device_resolve(Device* d, const char* path, int load_subtree) {
+    DeviceStatusCode code = DEVICE_STATUS_EFAIL;
+    DeviceFile* folder = d->root;
+    char* buf = NULL;
+
+    buf = strdup(path);
+    if (!buf) goto done;
+
+    for (char* p = buf; strcmp(buf, "/") != 0 && *p; ) {
+        if (!folder->is_loaded && device_list_folder(d, folder, 0) != DEVICE_STATUS_OK) goto done;
+
+        char* end = strchr(p+1, '/');
+        if (end) *end = 0;
+        File* f = hash_get(d->files, buf);
+        if (end) *end = '/';
+
+        // nothing further to load when the path does not exist or is a file
+        if (!f || !f->is_folder) {
+            code = DEVICE_STATUS_OK;
+            goto done;
+        }
+
+        folder = f->data;
+        if (!end) break;
+        p = end;
+    }
+
+    if (load_subtree && device_load_subtree(d, folder) != DEVICE_STATUS_OK) goto done;
+
+    code = DEVICE_STATUS_OK;
+
+done:
+    free(buf);
     return code;
 }
 
 File* device_get_file(Device* d, char* path) {
+    if (!d->files) return NULL;
+
+    File* f = hash_get(d->files, path);
+    if (f) return f;
+
+    // fault in any folders along the path which have not been listed yet
+    if (device_resolve(d, path, 0) != DEVICE_STATUS_OK) return NULL;
     return hash_get(d->files, path);
 }
 
 DeviceStatusCode device_add_file(Device* d, DeviceFile* dfile) {
+    DeviceStatusCode code = device_put_file(d, dfile);
+    if (code == DEVICE_STATUS_OK) d->is_modified = 1;
+    return code;
+}
+
+HashEntry* device_remove_file(Device* d, char* path) {
+    File* f = hash_get(d->files, path);
+    if (!f) return NULL;
+
+    device_drop_children(d, f->data);
+    device_unlink_file(f);
+
+    d->is_dirty = 1;
+    d->is_modified = 1;
+    return hash_remove_hc(d->files, f->path, f->hc);
+}
+
+static inline IndexFingerprint device_fingerprint(Device* d, int is_stale) {
+    IndexFingerprint fp = {
+        .free_space = d->storage->FreeSpaceInBytes,
+        .max_capacity = d->storage->MaxCapacity,
+        .is_stale = is_stale,
+    };
+    return fp;
+}
+
+static DeviceStatusCode device_save_index(Device* d, int is_stale) {
     DeviceStatusCode code = DEVICE_STATUS_EFAIL;
-    File* file = NULL;
+    IndexWriter* w = NULL;
+    List* files = NULL;
 
-    file = file_new_data(dfile->path, dfile->is_folder, dfile);
-    if (!file) goto done;
+    if (!d->index_path || !d->files) return DEVICE_STATUS_OK;
 
-    HashPutResult r = hash_put(d->files, file->path, file);
-    device_hash_entry_free(r.old_entry);
-    if (r.status != HASH_STATUS_OK) goto done;
+    w = index_writer_new(device_fingerprint(d, is_stale));
+    if (!w) goto done;
+
+    IndexEntry root = {
+        .id = d->root->id,
+        .parent_id = d->root->parent_id,
+        .size = 0,
+        .is_folder = 1,
+        .is_loaded = d->root->is_loaded,
+        .path = d->root->path,
+    };
+    if (index_writer_add(w, &root) != INDEX_STATUS_OK) goto done;
+
+    // depth first, so that folders are loaded before their children
+    files = device_filter_files(d, "/");
+    if (!files) goto done;
+
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        DeviceFile* df = f->data;
+        IndexEntry e = {
+            .id = df->id,
+            .parent_id = df->parent_id,
+            .size = df->size,
+            .mtime = df->mtime,
+            .is_folder = df->is_folder,
+            .is_loaded = df->is_loaded,
+            .path = df->path,
+        };
+        if (index_writer_add(w, &e) != INDEX_STATUS_OK) goto done;
+    }
+
+    if (index_writer_save(w, d->index_path) != INDEX_STATUS_OK) goto done;
+
+    d->is_dirty = 0;
+    code = DEVICE_STATUS_OK;
+
+done:
+    if (code != DEVICE_STATUS_OK) progress_error(d->progress, "Failed to save device index: %s\n", d->index_path);
+    list_free(files);
+    index_writer_free(w);
+    return code;
+}
+
+DeviceStatusCode device_save(Device* d) {
+    return d->is_dirty ? device_save_index(d, d->is_modified) : DEVICE_STATUS_OK;
+}
+
+DeviceStatusCode device_stamp(Device* d) {
+    if (!d->index_path) return DEVICE_STATUS_OK;
+    if (index_stamp(d->index_path, device_fingerprint(d, 0)) != INDEX_STATUS_OK) return DEVICE_STATUS_EFAIL;
+    return DEVICE_STATUS_OK;
+}
+
+// Lists a folder on the device and checks that it matches the files hash.
+static int device_verify_folder(Device* d, uint32_t folder_id, const char* folder_path, size_t expected) {
+    int is_match = 0;
+    LIBMTP_file_t* files = NULL;
+    char* path = NULL;
+    size_t count = 0;
+
+    uint32_t list_id = folder_id ? folder_id : LIBMTP_FILES_AND_FOLDERS_ROOT;
+    files = LIBMTP_Get_Files_And_Folders(d->device, d->storage->id, list_id);
+    if (LIBMTP_Get_Errorstack(d->device)) {
+        LIBMTP_Clear_Errorstack(d->device);
+        goto done;
+    }
+
+    for (LIBMTP_file_t* file = files; file; file = file->next, count++) {
+        path = fs_path_join(folder_path, file->filename);
+        if (!path) goto done;
+
+        File* f = hash_get(d->files, path);
+        if (!f) goto done;
+
+        DeviceFile* df = f->data;
+        int is_folder = file->filetype == LIBMTP_FILETYPE_FOLDER;
+        if (df->id != file->item_id || df->is_folder != is_folder) goto done;
+        if (!is_folder && df->size != file->filesize) goto done;
+
+        free(path);
+        path = NULL;
+    }
+
+    is_match = count == expected;
+
+done:
+    free(path);
+    free_files(files);
+    return is_match;
+}
+
+static DeviceStatusCode device_load_index(Device* d) {
+    DeviceStatusCode code = DEVICE_STATUS_EFAIL;
+    DeviceIndex* idx = NULL;
+
+    // spot check a spread of the folders which were listed when indexed
+    uint32_t check_ids[DEVICE_INDEX_SPOT_CHECKS] = { 0 };
+    const char* check_paths[DEVICE_INDEX_SPOT_CHECKS] = { NULL };
+    size_t check_counts[DEVICE_INDEX_SPOT_CHECKS] = { 0 };
+    size_t checks = 0;
+
+    if (!d->index_path) goto done;
+
+    idx = index_open(d->index_path);
+    if (!idx) goto done;
+
+    IndexFingerprint fp = index_fingerprint(idx);
+    if (fp.is_stale) goto done;
+    if (fp.free_space != d->storage->FreeSpaceInBytes) goto done;
+    if (fp.max_capacity != d->storage->MaxCapacity) goto done;
+
+    size_t size = index_size(idx);
+    size_t stride = size / DEVICE_INDEX_SPOT_CHECKS + 1;
+
+    for (size_t i = 0; i < size && checks < DEVICE_INDEX_SPOT_CHECKS; i++) {
+        IndexEntry e = index_get(idx, i);
+        if (e.is_loaded && i >= checks * stride) {
+            check_ids[checks] = e.id;
+            check_paths[checks] = e.path;
+            checks++;
+        }
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        IndexEntry e = index_get(idx, i);
+
+        if (strcmp(e.path, "/") == 0) {
+            d->root->is_loaded = e.is_loaded;
+            continue;
+        }
+
+        for (size_t j = 0; j < checks; j++) {
+            if (e.parent_id == check_ids[j]) check_counts[j]++;
+        }
+
+        DeviceFile* device_file = device_file_new(d->arena, e.id, e.parent_id, e.size, e.is_folder, e.path);
+        if (!device_file) goto done;
+        device_file->mtime = e.mtime;
+        device_file->is_loaded = e.is_loaded;
+
+        if (device_put_file(d, device_file) != DEVICE_STATUS_OK) goto done;
+    }
+
+    for (size_t j = 0; j < checks; j++) {
+        if (!device_verify_folder(d, check_ids[j], check_paths[j], check_counts[j])) goto done;
+    }
 
     code = DEVICE_STATUS_OK;
-    file = NULL;
 
 done:
-    file_free(file);
+    index_close(idx);
     return code;
 }
 
@@ -151,7 +640,20 @@ Device* device_new(int number, LIBMTP_mtpdevice_t* device, LIBMTP_devicestorage_
     d->device = device;
     d->storage = storage;
     d->files = NULL;
+    d->arena = NULL;
+    d->root = NULL;
     d->serial = serial;
+    d->index_path = index_path(serial, storage->id);
+    d->rescan = 0;
+    d->is_dirty = 0;
+    d->is_modified = 0;
+    d->has_bulk = 1;
+    d->is_loading = 0;
+    d->progress = NULL;
+    d->clone_from = NULL;
+    d->source.list_folder = device_mtp_list_folder;
+    d->source.list_all = device_mtp_list_all;
+    d->source.data = d;
 
     return d;
 
@@ -161,69 +663,123 @@ error:
     return NULL;
 }
 
-DeviceStatusCode device_load(Device* d) {
-    Hash* new_files = NULL;
-
+// Frees the files hash along with the arena holding every loaded file.
+static void device_free_files(Device* d) {
     hash_free_deep(d->files, device_hash_entry_free);
+    if (d->root) list_free(d->root->children);
+    arena_free(d->arena);
     d->files = NULL;
+    d->root = NULL;
+    d->arena = NULL;
+}
 
-    new_files = hash_new_str(DEVICE_HASH_INIT_SIZE);
-    if (!new_files) goto error;
-    d->files = new_files;
+static DeviceStatusCode device_reset_files(Device* d) {
+    device_free_files(d);
+    d->is_dirty = 0;
 
-    if (device_load_files_recursive(d, NULL, LIBMTP_FILES_AND_FOLDERS_ROOT) != 0) {
-        printf("\33[2K\rFailed!\n");
+    d->arena = arena_new(DEVICE_ARENA_BLOCK_SIZE);
+    if (!d->arena) return DEVICE_STATUS_EFAIL;
+
+    d->root = device_file_new(d->arena, 0, 0, 0, 1, "/");
+    if (!d->root) return DEVICE_STATUS_EFAIL;
+
+    d->files = hash_new_str(DEVICE_HASH_INIT_SIZE);
+    return d->files ? DEVICE_STATUS_OK : DEVICE_STATUS_EFAIL;
+}
+
+static DeviceStatusCode device_init_files(Device* d) {
+    if (device_reset_files(d) != DEVICE_STATUS_OK) return DEVICE_STATUS_EFAIL;
+
+    if (!d->rescan && device_load_index(d) == DEVICE_STATUS_OK) {
+        d->is_dirty = 0;
+        progress_log(d->progress, "Loaded %zu files from index.\n", hash_size(d->files));
+        return DEVICE_STATUS_OK;
+    }
+
+    return device_reset_files(d);
+}
+
+DeviceStatusCode device_load_path(Device* d, char* path) {
+    if (!d->files && device_init_files(d) != DEVICE_STATUS_OK) goto error;
+
+    size_t prev_size = hash_size(d->files);
+    int was_dirty = d->is_dirty;
+    d->is_dirty = 0;
+
+    progress_start(d->progress, 0, 0);
+    d->is_loading = 1;
+    DeviceStatusCode code = device_resolve(d, path, 1);
+    d->is_loading = 0;
+    progress_end(d->progress);
+
+    if (code != DEVICE_STATUS_OK) {
+        progress_log(d->progress, "Failed!\n");
         goto error;
     }
-    printf("\33[2K\rDone, received %zu files.\n", hash_size(new_files));
+
+    if (d->is_dirty) {
+        progress_log(d->progress, "Done, received %zu files.\n", hash_size(d->files) - prev_size);
+    }
+
+    d->is_dirty = d->is_dirty || was_dirty;
+    device_save(d);
 
     return DEVICE_STATUS_OK;
 
 error:
-    hash_free_deep(new_files, device_hash_entry_free);
-    d->files = NULL;
+    device_free_files(d);
     return DEVICE_STATUS_EFAIL;
 }
 
+DeviceStatusCode device_load(Device* d) {
+    return device_load_path(d, "/");
+}
+
 void device_free(Device* d) {
     if (d) {
         free(d->serial);
-        hash_free_deep(d->files, device_hash_entry_free);
+        free(d->index_path);
+        device_free_files(d);
     }
     free(d);
 }
 
-static int is_within_path(void* item, void* data) {
-    File* f = item;
-    char* path = data;
-    size_t i = 0;
-
-    if (strcmp("/", path) == 0) return 1;
-
-    // check that the file_path begins with the path
-    char* file_path = f->path;
-    for (i = 0; file_path[i] && path[i] && file_path[i] == path[i]; i++);
-    if (path[i]) return 0;
-
-    // check that next char in file_path is a null byte or path separator
-    return file_path[i] == '/' || !file_path[i];
-}
-
-List* device_filter_files(Device* dev, char* path) {
+List* device_filter_files(Device* d, char* path) {
     List* files = NULL;
-    List* filtered = NULL;
-    List* sorted = NULL;
+    List* stack = NULL;
+    DeviceFile* folder = d->root;
+
+    files = list_new(16);
+    if (!files) goto error;
+
+    if (strcmp(path, "/") != 0) {
+        File* f = hash_get(d->files, path);
+        if (!f) return files;
+        if (list_push(files, f) != LIST_STATUS_OK) goto error;
+        if (!f->is_folder) return files;
+        folder = f->data;
+    }
 
-    files = hash_values(dev->files);
-    if (!files) goto done;
+    stack = list_new(16);
+    if (!stack) goto error;
 
-    filtered = list_filter_data(files, is_within_path, path);
-    if (!filtered) goto done;
+    // depth first, visiting the children of each folder in order of name
+    for (DeviceFile* df = folder; df; ) {
+        for (size_t i = list_size(df->children); i > 0; i--) {
+            if (list_push(stack, list_get(df->children, i - 1)) != LIST_STATUS_OK) goto error;
+        }
 
-    sorted = list_sort(filtered, file_sort_alpha);
+        File* f = list_pop(stack);
+        if (!f) break;
+        if (list_push(files, f) != LIST_STATUS_OK) goto error;
+        df = f->data;
+    }
 
-done:
+    list_free(stack);
+    return files;
+
+error:
+    list_free(stack);
     list_free(files);
-    list_free(filtered);
-    return sorted;
+    return NULL;
 }
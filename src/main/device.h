@@ -8,8 +8,11 @@
 
 #include <libmtp.h>
 
+#include "arena.h"
+#include "enum.h"
 #include "file.h"
 #include "hash.h"
+#include "progress.h"
 
 /**
  * Status codes for device operations
@@ -22,28 +25,45 @@ typedef enum {
 /**
  * Container for a specific MTP device and storage volume.
  */
-typedef struct {
+typedef struct Device {
     int number;                       ///< Index of the device
     char* serial;                     ///< Serial number
-    Hash* files;                      ///< Hash of all files on the device
+    Hash* files;                      ///< Hash of all loaded files on the device
+    Arena* arena;                     ///< Holds every loaded file, freed with the files hash
     uint64_t capacity;                ///< Remaining storage capacity in bytes
     LIBMTP_mtpdevice_t* device;       ///< Raw MTP device
     LIBMTP_devicestorage_t* storage;  ///< Raw MTP storage volume
+    char* index_path;                 ///< Path of the on-disk index, or NULL
+    int rescan;                       ///< If truthy, ignore the on-disk index
+    int is_dirty;                     ///< Truthy if the index needs to be saved
+    int is_modified;                  ///< Truthy if files were added or removed
+    struct DeviceFile* root;          ///< Root folder, not present in the hash, NULL until loaded
+    EnumSource source;                ///< Lists objects from the storage volume
+    int has_bulk;                     ///< Falsy once bulk listing has failed
+    int is_loading;                   ///< Truthy while device_load_path runs
+    Progress* progress;               ///< Reports progress, may be NULL
+    struct Device* clone_from;        ///< Device to send files from instead of the local system, or NULL
 } Device;
 
 /**
  * Represents a folder or file on the MTP device.
  */
-typedef struct {
-    uint32_t id;    ///< Unique ID of the file
-    uint64_t size;  ///< Size of the file in bytes
-    int is_folder;  ///< Truthy if this represents a folder
-    char* path;     ///< Full, canonical path of the file
+typedef struct DeviceFile {
+    uint32_t id;                ///< Unique ID of the file
+    uint32_t parent_id;         ///< ID of the parent folder, zero for the root folder
+    uint64_t size;              ///< Size of the file in bytes
+    time_t mtime;               ///< Time the file was last modified, zero if unknown
+    int is_folder;              ///< Truthy if this represents a folder
+    int is_loaded;              ///< Truthy if all children of the folder are loaded
+    char* path;                 ///< Full, canonical path of the file, interned
+    struct DeviceFile* parent;  ///< Parent folder, once added to the device
+    List* children;             ///< Files within the folder sorted by name, or NULL
 } DeviceFile;
 
 /**
  * Create a new device container for a specific MTP device and storage
- * combination. The files hash will be NULL until device_load is called.
+ * combination. The files hash and root folder will be NULL until device_load is
+ * called.
  * Free it with device_free when done.
  * @param number   index of the device
  * @param device   raw MTP device
@@ -53,14 +73,53 @@ typedef struct {
 Device* device_new(int number, LIBMTP_mtpdevice_t* device, LIBMTP_devicestorage_t* storage);
 
 /**
- * Loads files from the device in to the files hash. This can be slow.
+ * Loads all files from the device in to the files hash. If an on-disk index of
+ * the device is available and still matches the storage, it is used instead of
+ * listing the device. Otherwise the device is listed, which can be slow, and
+ * the index is saved for the next run.
  * @param d  device to load files for
  * @return   status code of the operation
  */
 DeviceStatusCode device_load(Device* d);
 
 /**
- * Returns all files within the specified path. Call device_load first.
+ * Loads the files within a specific path in to the files hash. Only the folders
+ * leading to the path are listed, followed by everything below the path, so
+ * this is much cheaper than device_load for paths deep within the device. The
+ * on-disk index is used in the same way as device_load. Other files will be
+ * loaded on demand by device_get_file. Everything below the root folder, or
+ * below a path known from the index to hold many unlisted folders, is read
+ * with a single bulk listing of the storage where the device supports it.
+ * Other paths, and devices without bulk listing, are listed folder by folder.
+ * @param d     device to load files for
+ * @param path  canonical path to load
+ * @return      status code of the operation
+ */
+DeviceStatusCode device_load_path(Device* d, char* path);
+
+/**
+ * Saves the files hash to the on-disk index if any files were added or removed
+ * since the device was loaded. The free space of the storage is not known
+ * after such changes, so the index is marked stale until device_stamp is
+ * called with freshly read storage information.
+ * @param d  device to save the index of
+ * @return   status code of the operation
+ */
+DeviceStatusCode device_save(Device* d);
+
+/**
+ * Records the current free space of the storage in a stale on-disk index, so
+ * that it may be used by the next run.
+ * @param d  device with up-to-date storage information
+ * @return   status code of the operation
+ */
+DeviceStatusCode device_stamp(Device* d);
+
+/**
+ * Returns all loaded files within the specified path, including the path
+ * itself. Files are ordered depth first, with the children of each folder in
+ * order of name. This takes time proportional to the number of files returned.
+ * Call device_load or device_load_path for the path first.
  * @param d     device to load files for
  * @param path  path to search for files in
  * @return      list of all matching file, or NULL in case of failure
@@ -68,7 +127,9 @@ DeviceStatusCode device_load(Device* d);
 List* device_filter_files(Device* d, char* path);
 
 /**
- * Gets a file from the device. Call device_load first.
+ * Gets a file from the device. Call device_load or device_load_path first. If
+ * the file is not loaded, any folders leading to it that have not been listed
+ * yet are loaded from the device.
  * @param d  device to get the file from
  * @param f  path to get
  * @return   matching file or NULL if not found
@@ -87,19 +148,38 @@ File* device_get_file(Device* d, char* f);
 DeviceStatusCode device_add_file(Device* d, DeviceFile* f);
 
 /**
- * Frees the device and any associated data, including the files hash.
- * @param d  device to free
+ * Removes a file from the device's files hash, along with all of its
+ * descendants. Like device_add_file, this does not touch the attached MTP
+ * device. Free the returned entry with device_hash_entry_free when done.
+ * @param d     device to remove the file from
+ * @param path  path of the file to remove
+ * @return      the removed hash entry, or NULL if there was none
  */
-void device_free(Device* d);
+HashEntry* device_remove_file(Device* d, char* path);
+
+/**
+ * Create a new device file in an arena, with an unknown modification time.
+ * Add it to a device with device_add_file. The file lives until the arena is
+ * freed.
+ * @param arena      arena to allocate the file from, normally the device's
+ * @param id         unique ID of the file
+ * @param parent_id  ID of the parent folder, zero for the root folder
+ * @param size       size of the file in bytes
+ * @param is_folder  truthy if the file is a folder
+ * @param path       full, canonical path of the file, will be interned
+ * @return           new device file, or NULL in case of failure
+ */
+DeviceFile* device_file_new(Arena* arena, uint32_t id, uint32_t parent_id, uint64_t size, int is_folder, const char* path);
 
 /**
- * Free a device file.
- * @param df  device file to free
+ * Frees the device and any associated data, including the files hash.
+ * @param d  device to free
  */
-void device_file_free(DeviceFile* df);
+void device_free(Device* d);
 
 /**
- * Free a hash entry from the device file hash.
+ * Free a hash entry from the device file hash. The file itself remains valid
+ * until the device is freed.
  * @param e  device file hash entry to free
  */
 void device_hash_entry_free(HashEntry* e);
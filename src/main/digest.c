@@ -0,0 +1,782 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "digest.h"
+#include "file.h"
+#include "fs.h"
+#include "hash.h"
+#include "index.h"
+#include "queue.h"
+#include "str.h"
+#include "sync.h"
+#include "walk.h"
+
+#define DIGEST_MAGIC "MTPSDGT"
+#define DIGEST_VERSION 2
+#define DIGEST_MANIFEST_NAME "digests"
+#define DIGEST_ARENA_BLOCK_SIZE (64 * 1024)
+#define DIGEST_FILE_BUF_SIZE 128
+
+// Folders modified this close to a walk may change again without their
+// modification time changing, so they are listed again by the next walk
+#define DIGEST_RACY_NANOS 2000000000LL
+
+// The record is of a folder, with the digest of the names within it
+#define DIGEST_FLAG_FOLDER 1
+
+enum DigestFolderState {
+    DIGEST_FOLDER_UNKNOWN,    // Not checked yet
+    DIGEST_FOLDER_CHANGED,    // Changed since the manifest was saved
+    DIGEST_FOLDER_UNCHANGED,  // Unchanged since the manifest was saved
+    DIGEST_FOLDER_VISITED,    // Listed again or found unchanged by the current walk
+};
+
+typedef struct {
+    char magic[8];          // DIGEST_MAGIC, null terminated
+    uint32_t version;       // DIGEST_VERSION
+    uint32_t reserved;      // Zero
+    uint64_t count;         // Number of records following the header
+    uint64_t strings_size;  // Size of the string table following the records
+} DigestHeader;
+
+typedef struct {
+    uint64_t dev;          // Device of the file system holding the file
+    uint64_t ino;          // Inode of the file
+    uint64_t size;         // Size of the file in bytes
+    int64_t mtime;         // Modification time of the file in nanoseconds
+    uint64_t digest;       // Digest of the contents of the file
+    uint32_t path_offset;  // Offset of the path within the string table
+    uint32_t flags;        // DIGEST_FLAG_* bits
+    uint64_t folders;      // Number of folders directly within a folder
+} DigestRecord;
+
+typedef struct DigestEntry {
+    DigestRecord record;           // Key and digest of the file, path_offset unused
+    char* path;                    // Path of the file, allocated from the arena
+    struct DigestEntry* children;  // First folder within a folder, as loaded
+    struct DigestEntry* next;      // Next folder within the same folder, as loaded
+    enum DigestFolderState state;  // Whether a folder changed, once checked
+    unsigned walk;                 // Walk the state was determined by
+} DigestEntry;
+
+struct DigestManifest {
+    Arena* arena;    // Holds the entries and their paths
+    Hash* entries;   // Entries by path
+    int is_dirty;    // Truthy if the manifest changed since it was opened
+    unsigned walk;   // Counts walks, so states of earlier walks are ignored
+};
+
+typedef struct {
+    const char* path;       // Path of the file
+    struct stat st;         // Status of the file when it was digested
+    uint64_t digest;        // Digest of the file
+    int is_cached;          // Truthy if the digest was taken from the manifest
+    DigestStatusCode code;  // Result of digesting the file
+} DigestJob;
+
+typedef struct {
+    DigestManifest* m;  // Manifest to look up digests in, may be NULL
+    Queue* jobs;        // Jobs waiting for a thread
+} DigestPool;
+
+// A folder reached by a walk, either listed or found unchanged.
+typedef struct DigestFolder {
+    char* path;                     // Canonical path of the folder
+    struct stat st;                 // Status of the folder
+    DigestEntry* e;                 // Entry of the folder, once unchanged or recorded
+    uint64_t digest;                // Digest of the names within the folder
+    uint64_t folders;               // Number of folders directly within the folder
+    struct DigestFolder* children;  // First folder directly within the folder
+    struct DigestFolder* next;      // Next folder within the same folder
+} DigestFolder;
+
+typedef struct {
+    DigestManifest* m;     // Manifest to look up and record folders in
+    pthread_mutex_t lock;  // Guards the manifest, folders and error while walking
+    Arena* folder_arena;   // Holds the folders reached
+    List* folders;         // DigestFolder of every folder reached, the first is the root
+    Hash* by_path;         // Folders reached by path, once the walk is done
+    char* parent;          // Buffer holding the path of a parent folder
+    size_t parent_size;    // Size of parent
+    int error;             // errno of the first failure, or zero
+    int64_t start;         // Time the walk started, in nanoseconds
+} DigestWalk;
+
+static inline int64_t digest_mtime(struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static inline uint64_t digest_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int digest_is_same(DigestRecord* r, struct stat* st) {
+    return r->dev == (uint64_t)st->st_dev
+        && r->ino == (uint64_t)st->st_ino
+        && r->size == (uint64_t)st->st_size
+        && r->mtime == digest_mtime(st);
+}
+
+// Finds the digest of an unchanged file in the manifest. Only reads the
+// manifest, so it may be called from any thread while nothing updates it.
+static DigestEntry* digest_lookup(DigestManifest* m, const char* path, struct stat* st) {
+    if (!m) return NULL;
+
+    DigestEntry* e = hash_get(m->entries, (void*)path);
+    if (!e || (e->record.flags & DIGEST_FLAG_FOLDER)) return NULL;
+
+    return digest_is_same(&e->record, st) ? e : NULL;
+}
+
+// The state of a folder as determined by the current walk.
+static enum DigestFolderState digest_state(DigestManifest* m, DigestEntry* e) {
+    return e->walk == m->walk ? e->state : DIGEST_FOLDER_UNKNOWN;
+}
+
+static void digest_set_state(DigestManifest* m, DigestEntry* e, enum DigestFolderState state) {
+    e->state = state;
+    e->walk = m->walk;
+}
+
+// Records the digest of a file, returning the entry or NULL in case of failure.
+static DigestEntry* digest_put(DigestManifest* m, const char* path, struct stat* st, uint64_t digest) {
+    DigestEntry* e = hash_get(m->entries, (void*)path);
+    if (!e) {
+        e = arena_alloc(m->arena, sizeof(DigestEntry));
+        if (!e) return NULL;
+
+        e->path = arena_strdup(m->arena, path);
+        e->children = NULL;
+        e->next = NULL;
+        if (!e->path) return NULL;
+
+        HashPutResult r = hash_put(m->entries, e->path, e);
+        if (r.status != HASH_STATUS_OK) return NULL;
+    }
+
+    memset(&e->record, 0, sizeof(DigestRecord));
+    e->record.dev = st->st_dev;
+    e->record.ino = st->st_ino;
+    e->record.size = st->st_size;
+    e->record.mtime = digest_mtime(st);
+    e->record.digest = digest;
+    digest_set_state(m, e, DIGEST_FOLDER_VISITED);
+    m->is_dirty = 1;
+
+    return e;
+}
+
+// Digests a single file, using the manifest if the file did not change.
+static void digest_job_run(DigestManifest* m, DigestJob* job) {
+    int fd = -1;
+
+    job->code = DIGEST_STATUS_EFAIL;
+
+    if (stat(job->path, &job->st) != 0) goto done;
+
+    DigestEntry* e = digest_lookup(m, job->path, &job->st);
+    if (e) {
+        job->digest = e->record.digest;
+        job->is_cached = 1;
+        job->code = DIGEST_STATUS_OK;
+        goto done;
+    }
+
+    fd = open(job->path, O_RDONLY);
+    if (fd < 0) goto done;
+
+    // the file may have changed since, and the key must match what was read
+    if (fstat(fd, &job->st) != 0) goto done;
+
+    FsStatusCode code = fs_hash_fd(fd, job->st.st_size, &job->digest);
+    if (code != FS_STATUS_OK) {
+        job->code = code == FS_STATUS_ENOMEM ? DIGEST_STATUS_ENOMEM : DIGEST_STATUS_EFAIL;
+        goto done;
+    }
+
+    job->code = DIGEST_STATUS_OK;
+
+done:
+    if (fd >= 0) close(fd);
+}
+
+static void* digest_thread(void* data) {
+    DigestPool* p = data;
+    DigestJob* job = NULL;
+
+    while (queue_pop(p->jobs, (void**)&job) == QUEUE_STATUS_OK) digest_job_run(p->m, job);
+
+    return NULL;
+}
+
+char* digest_manifest_path() {
+    return index_cache_path(DIGEST_MANIFEST_NAME);
+}
+
+// Links each folder to the folder holding it, so that whole trees of folders
+// can be checked without listing them.
+static DigestStatusCode digest_link_folders(DigestManifest* m) {
+    List* entries = hash_values(m->entries);
+    if (!entries) return DIGEST_STATUS_ENOMEM;
+
+    for (size_t i = 0; i < list_size(entries); i++) {
+        DigestEntry* e = list_get(entries, i);
+        if (!(e->record.flags & DIGEST_FLAG_FOLDER)) continue;
+
+        char* slash = strrchr(e->path, '/');
+        if (!slash || !slash[1]) continue;
+
+        DigestEntry* parent = NULL;
+        if (slash == e->path) {
+            parent = hash_get(m->entries, "/");
+        } else {
+            *slash = 0;
+            parent = hash_get(m->entries, e->path);
+            *slash = '/';
+        }
+
+        if (parent && (parent->record.flags & DIGEST_FLAG_FOLDER)) {
+            e->next = parent->children;
+            parent->children = e;
+        }
+    }
+
+    list_free(entries);
+    return DIGEST_STATUS_OK;
+}
+
+// Reads the entries of a manifest file, leaving the manifest empty if the file
+// is missing or not valid.
+static DigestStatusCode digest_manifest_load(DigestManifest* m, const char* path) {
+    DigestStatusCode code = DIGEST_STATUS_OK;
+    void* map = MAP_FAILED;
+    size_t map_size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) goto done;
+
+    struct stat s;
+    if (fstat(fd, &s) != 0) goto done;
+    if ((size_t)s.st_size < sizeof(DigestHeader)) goto done;
+
+    map_size = s.st_size;
+    map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) goto done;
+
+    const DigestHeader* h = map;
+    if (memcmp(h->magic, DIGEST_MAGIC, sizeof(DIGEST_MAGIC)) != 0) goto done;
+    if (h->version != DIGEST_VERSION) goto done;
+
+    // sizes are checked against what remains, as their sum could wrap around
+    size_t records_size = h->count * sizeof(DigestRecord);
+    if (h->count > map_size / sizeof(DigestRecord)) goto done;
+    if (records_size > map_size - sizeof(DigestHeader)) goto done;
+    if (h->strings_size != map_size - sizeof(DigestHeader) - records_size) goto done;
+
+    const DigestRecord* records = (const DigestRecord*)(h + 1);
+    const char* strings = (const char*)(records + h->count);
+
+    // all paths must be terminated within the string table
+    if (h->count && (!h->strings_size || strings[h->strings_size-1])) goto done;
+
+    for (size_t i = 0; i < h->count; i++) {
+        if (records[i].path_offset >= h->strings_size) continue;
+
+        DigestEntry* e = arena_alloc(m->arena, sizeof(DigestEntry));
+        if (!e) goto error;
+
+        e->path = arena_strdup(m->arena, strings + records[i].path_offset);
+        if (!e->path) goto error;
+        e->record = records[i];
+        e->children = NULL;
+        e->next = NULL;
+        e->state = DIGEST_FOLDER_UNKNOWN;
+        e->walk = 0;
+
+        HashPutResult r = hash_put(m->entries, e->path, e);
+        if (r.status != HASH_STATUS_OK) goto error;
+    }
+
+    if (digest_link_folders(m) != DIGEST_STATUS_OK) goto error;
+
+    goto done;
+
+error:
+    code = DIGEST_STATUS_ENOMEM;
+
+done:
+    if (map != MAP_FAILED) munmap(map, map_size);
+    if (fd >= 0) close(fd);
+    return code;
+}
+
+DigestManifest* digest_manifest_open(const char* path) {
+    DigestManifest* m = malloc(sizeof(DigestManifest));
+    if (!m) return NULL;
+
+    m->is_dirty = 0;
+    m->walk = 0;
+    m->arena = arena_new(DIGEST_ARENA_BLOCK_SIZE);
+    m->entries = hash_new_str(64);
+    if (!m->arena || !m->entries) goto error;
+
+    if (path && digest_manifest_load(m, path) != DIGEST_STATUS_OK) goto error;
+
+    return m;
+
+error:
+    digest_manifest_free(m);
+    return NULL;
+}
+
+inline size_t digest_manifest_size(DigestManifest* m) {
+    return m ? hash_size(m->entries) : 0;
+}
+
+DigestStatusCode digest_manifest_prune(DigestManifest* m, const char* root, List* files) {
+    DigestStatusCode code = DIGEST_STATUS_ENOMEM;
+    Hash* present = NULL;
+    List* paths = NULL;
+    size_t root_len = strlen(root);
+
+    present = hash_new_str(list_size(files) * 2);
+    if (!present) goto done;
+
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        if (hash_put(present, f->path, f).status != HASH_STATUS_OK) goto done;
+    }
+
+    paths = hash_keys(m->entries);
+    if (!paths) goto done;
+
+    for (size_t i = 0; i < list_size(paths); i++) {
+        char* path = list_get(paths, i);
+        DigestEntry* e = hash_get(m->entries, path);
+        if (e->record.flags & DIGEST_FLAG_FOLDER) continue;
+
+        int is_within = strcmp(root, "/") == 0
+            || strcmp(path, root) == 0
+            || (strncmp(path, root, root_len) == 0 && path[root_len] == '/');
+
+        if (is_within && !hash_get(present, path)) {
+            hash_entry_free(hash_remove(m->entries, path));
+            m->is_dirty = 1;
+        }
+    }
+
+    code = DIGEST_STATUS_OK;
+
+done:
+    hash_free(present);
+    list_free(paths);
+    return code;
+}
+
+DigestStatusCode digest_manifest_save(DigestManifest* m, const char* path) {
+    DigestStatusCode code = DIGEST_STATUS_EFAIL;
+    List* entries = NULL;
+    DigestRecord* records = NULL;
+    char* dir = NULL;
+    char* tmp_path = NULL;
+    int fd = -1;
+
+    if (!m->is_dirty) return DIGEST_STATUS_OK;
+
+    entries = hash_values(m->entries);
+    if (!entries) goto done;
+
+    records = calloc(list_size(entries) + 1, sizeof(DigestRecord));
+    if (!records) goto done;
+
+    DigestHeader h = { .version = DIGEST_VERSION, .count = list_size(entries) };
+    memcpy(h.magic, DIGEST_MAGIC, sizeof(DIGEST_MAGIC));
+
+    for (size_t i = 0; i < list_size(entries); i++) {
+        DigestEntry* e = list_get(entries, i);
+        if (h.strings_size > UINT32_MAX) goto done;
+
+        records[i] = e->record;
+        records[i].path_offset = h.strings_size;
+        h.strings_size += strlen(e->path) + 1;
+    }
+
+    dir = fs_dirname((char*)path);
+    if (!dir) goto done;
+    if (fs_mkdirp(dir) != FS_STATUS_OK) goto done;
+
+    tmp_path = str_join(2, path, ".tmp");
+    if (!tmp_path) goto done;
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) goto done;
+
+    if (fs_write_all(fd, &h, sizeof(DigestHeader)) != 0) goto done;
+    if (fs_write_all(fd, records, h.count * sizeof(DigestRecord)) != 0) goto done;
+    for (size_t i = 0; i < list_size(entries); i++) {
+        DigestEntry* e = list_get(entries, i);
+        if (fs_write_all(fd, e->path, strlen(e->path) + 1) != 0) goto done;
+    }
+
+    if (close(fd) != 0) {
+        fd = -1;
+        goto done;
+    }
+    fd = -1;
+
+    if (rename(tmp_path, path) != 0) goto done;
+
+    m->is_dirty = 0;
+    code = DIGEST_STATUS_OK;
+
+done:
+    if (fd >= 0) close(fd);
+    if (code != DIGEST_STATUS_OK && tmp_path) unlink(tmp_path);
+    free(tmp_path);
+    free(dir);
+    free(records);
+    list_free(entries);
+    return code;
+}
+
+void digest_manifest_free(DigestManifest* m) {
+    if (m) {
+        hash_free(m->entries);
+        arena_free(m->arena);
+    }
+    free(m);
+}
+
+DigestStatusCode digest_file(DigestManifest* m, const char* path, uint64_t* digest) {
+    DigestJob job = { .path = path, .digest = 0, .is_cached = 0 };
+
+    digest_job_run(m, &job);
+    if (job.code != DIGEST_STATUS_OK) return job.code;
+
+    if (m && !job.is_cached && !digest_put(m, path, &job.st, job.digest)) return DIGEST_STATUS_ENOMEM;
+
+    *digest = job.digest;
+    return DIGEST_STATUS_OK;
+}
+
+DigestStatusCode digest_files(DigestManifest* m, List* files, size_t threads, uint64_t* digests, DigestStats* stats) {
+    DigestStatusCode code = DIGEST_STATUS_ENOMEM;
+    DigestPool p = { .m = m, .jobs = NULL };
+    DigestJob* jobs = NULL;
+    pthread_t* pool = NULL;
+    size_t started = 0;
+    size_t n = list_size(files);
+    uint64_t start = digest_now();
+
+    if (threads < 1) threads = 1;
+
+    jobs = calloc(n + 1, sizeof(DigestJob));
+    pool = calloc(threads, sizeof(pthread_t));
+    p.jobs = queue_new(n + 1);
+    if (!jobs || !pool || !p.jobs) goto done;
+
+    for (size_t i = 0; i < n; i++) {
+        File* f = list_get(files, i);
+        jobs[i].path = f->path;
+        jobs[i].code = DIGEST_STATUS_OK;
+        if (f->is_folder) continue;
+
+        if (queue_push(p.jobs, &jobs[i]) != QUEUE_STATUS_OK) goto done;
+    }
+    queue_close(p.jobs);
+
+    code = DIGEST_STATUS_EFAIL;
+    for (; started < threads; started++) {
+        if (pthread_create(&pool[started], NULL, digest_thread, &p) != 0) break;
+    }
+    if (!started) goto done;
+
+    // the manifest is only read while the threads run
+    for (size_t i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    started = 0;
+
+    DigestStats s = { 0 };
+    code = DIGEST_STATUS_OK;
+    for (size_t i = 0; i < n; i++) {
+        File* f = list_get(files, i);
+        DigestJob* job = &jobs[i];
+        digests[i] = 0;
+        if (f->is_folder) continue;
+
+        if (job->code != DIGEST_STATUS_OK) {
+            fprintf(stderr, "Failed to digest file: %s\n", job->path);
+            code = job->code;
+            continue;
+        }
+
+        digests[i] = job->digest;
+        s.files++;
+        s.bytes += job->st.st_size;
+
+        if (job->is_cached) {
+            s.cached++;
+        } else {
+            s.read += job->st.st_size;
+            if (m && !digest_put(m, job->path, &job->st, job->digest)) code = DIGEST_STATUS_ENOMEM;
+        }
+    }
+
+    s.nanos = digest_now() - start;
+    if (stats) *stats = s;
+
+done:
+    if (p.jobs && started) {
+        // discard anything not digested yet, then wait for the files in flight
+        queue_close(p.jobs);
+        void* job = NULL;
+        while (queue_pop(p.jobs, &job) == QUEUE_STATUS_OK);
+    }
+    for (size_t i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    queue_free(p.jobs);
+    free(pool);
+    free(jobs);
+    return code;
+}
+
+// Truthy if no folder within a tree changed since the manifest was saved, so
+// the names within the tree are all the same. Pass the status of the folder
+// if it is known already.
+static int digest_is_unchanged(DigestManifest* m, DigestEntry* e, struct stat* st) {
+    enum DigestFolderState state = digest_state(m, e);
+    if (state != DIGEST_FOLDER_UNKNOWN) return state != DIGEST_FOLDER_CHANGED;
+    digest_set_state(m, e, DIGEST_FOLDER_CHANGED);
+
+    struct stat s;
+    if (!st) {
+        if (stat(e->path, &s) != 0) return 0;
+        st = &s;
+    }
+    if (!S_ISDIR(st->st_mode) || !digest_is_same(&e->record, st)) return 0;
+
+    uint64_t folders = 0;
+    for (DigestEntry* c = e->children; c; c = c->next, folders++) {
+        if (!digest_is_unchanged(m, c, NULL)) return 0;
+    }
+    if (folders != e->record.folders) return 0;
+
+    digest_set_state(m, e, DIGEST_FOLDER_UNCHANGED);
+    return 1;
+}
+
+// Forgets a folder which no longer exists, along with the folders within it.
+static void digest_forget(DigestManifest* m, DigestEntry* e) {
+    for (DigestEntry* c = e->children; c; c = c->next) digest_forget(m, c);
+
+    // entries stay allocated, so the links of other folders remain valid
+    hash_entry_free(hash_remove(m->entries, e->path));
+    digest_set_state(m, e, DIGEST_FOLDER_CHANGED);
+    m->is_dirty = 1;
+}
+
+// Decides whether to list a folder reached by the walk, which is not needed
+// while no folder within it changed.
+static WalkFolderAction digest_walk_folder(void* data, const char* path, struct stat* st) {
+    DigestWalk* w = data;
+    WalkFolderAction action = WALK_FOLDER_LIST;
+
+    pthread_mutex_lock(&w->lock);
+
+    DigestFolder* f = arena_alloc(w->folder_arena, sizeof(DigestFolder));
+    if (f) {
+        memset(f, 0, sizeof(DigestFolder));
+        f->path = arena_strdup(w->folder_arena, path);
+        f->st = *st;
+    }
+    if (!f || !f->path || list_push(w->folders, f) != LIST_STATUS_OK) {
+        w->error = ENOMEM;
+        action = WALK_FOLDER_SKIP;
+        goto done;
+    }
+
+    DigestEntry* e = hash_get(w->m->entries, (void*)path);
+    if (e && !(e->record.flags & DIGEST_FLAG_FOLDER)) e = NULL;
+
+    // the folder where the walk starts is always listed, and it is reached
+    // first, since the others are found by listing it
+    if (list_size(w->folders) > 1 && e && digest_is_unchanged(w->m, e, st)) {
+        digest_set_state(w->m, e, DIGEST_FOLDER_VISITED);
+        f->e = e;
+        f->digest = e->record.digest;
+        action = f->digest ? WALK_FOLDER_COLLECT : WALK_FOLDER_SKIP;
+    }
+
+done:
+    pthread_mutex_unlock(&w->lock);
+    return action;
+}
+
+// Finds the folder holding a path among the folders reached by the walk,
+// setting parent to NULL if it is not one of them. Returns non-zero in case
+// of allocation failure.
+static int digest_walk_parent(DigestWalk* w, const char* path, DigestFolder** parent) {
+    // the path of a file within the root folder keeps its slash
+    size_t offset = fs_path_name(path).offset;
+    size_t len = offset > 1 ? offset - 1 : offset;
+
+    if (len >= w->parent_size) {
+        free(w->parent);
+        w->parent_size = len * 2 + 1;
+        w->parent = malloc(w->parent_size);
+        if (!w->parent) {
+            w->parent_size = 0;
+            return -1;
+        }
+    }
+    memcpy(w->parent, path, len);
+    w->parent[len] = 0;
+
+    *parent = hash_get(w->by_path, w->parent);
+    return 0;
+}
+
+static int digest_folder_cmp(const void* a, const void* b) {
+    DigestFolder* fa = *(DigestFolder**)a;
+    DigestFolder* fb = *(DigestFolder**)b;
+    return fs_path_cmp(fa->path, fb->path);
+}
+
+// Records each folder listed by the walk in the manifest, along with the
+// digest of the names within it.
+static DigestStatusCode digest_walk_record(DigestWalk* w, List* files) {
+    List* sorted = NULL;
+    DigestStatusCode code = DIGEST_STATUS_ENOMEM;
+
+    w->by_path = hash_new_str(list_size(w->folders) * 2 + 1);
+    if (!w->by_path) goto done;
+    for (size_t i = 0; i < list_size(w->folders); i++) {
+        DigestFolder* f = list_get(w->folders, i);
+        if (hash_put(w->by_path, f->path, f).status != HASH_STATUS_OK) goto done;
+    }
+
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* file = list_get(files, i);
+        if (file->is_folder) continue;
+
+        DigestFolder* parent = NULL;
+        if (digest_walk_parent(w, file->path, &parent) != 0) goto done;
+        if (parent) parent->digest += sync_tree_entry(file->path + fs_path_name(file->path).offset, 0, 0);
+    }
+
+    // folders come after the folders holding them, so going backwards each
+    // folder is complete before it is added to the folder holding it
+    sorted = list_sort(w->folders, digest_folder_cmp);
+    if (!sorted) goto done;
+
+    for (size_t i = list_size(sorted); i > 0; i--) {
+        DigestFolder* f = list_get(sorted, i - 1);
+
+        if (!f->e) {
+            // folders which were not seen again no longer exist
+            DigestEntry* e = hash_get(w->m->entries, f->path);
+            if (e && (e->record.flags & DIGEST_FLAG_FOLDER)) {
+                for (DigestEntry* c = e->children; c; c = c->next) {
+                    if (digest_state(w->m, c) != DIGEST_FOLDER_VISITED) digest_forget(w->m, c);
+                }
+            }
+
+            f->e = digest_put(w->m, f->path, &f->st, f->digest);
+            if (!f->e) goto done;
+            f->e->record.flags = DIGEST_FLAG_FOLDER;
+            f->e->record.folders = f->folders;
+            if (f->e->record.mtime > w->start - DIGEST_RACY_NANOS) f->e->record.mtime = INT64_MIN;
+
+            // the folders within are checked through these links by later walks
+            f->e->children = NULL;
+            for (DigestFolder* c = f->children; c; c = c->next) {
+                c->e->next = f->e->children;
+                f->e->children = c->e;
+            }
+        }
+
+        DigestFolder* parent = NULL;
+        if (digest_walk_parent(w, f->path, &parent) != 0) goto done;
+        if (!parent || parent == f) continue;
+
+        // folders holding no files are not synced, so they are left out
+        if (f->digest) parent->digest += sync_tree_entry(f->path + fs_path_name(f->path).offset, 1, f->digest);
+        parent->folders++;
+        f->next = parent->children;
+        parent->children = f;
+    }
+
+    code = DIGEST_STATUS_OK;
+
+done:
+    list_free(sorted);
+    return code;
+}
+
+List* digest_collect_files(DigestManifest* m, Arena* arena, char* path) {
+    List* files = NULL;
+    int error = ENOMEM;
+
+    DigestWalk w = {
+        .m = m,
+        .folder_arena = arena_new(DIGEST_ARENA_BLOCK_SIZE),
+        .folders = list_new(DIGEST_FILE_BUF_SIZE),
+        .by_path = NULL,
+        .parent = NULL,
+        .parent_size = 0,
+        .error = 0,
+    };
+    pthread_mutex_init(&w.lock, NULL);
+    m->walk++;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    w.start = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    if (!w.folder_arena || !w.folders) goto done;
+
+    files = walk_collect(arena, path, 0, digest_walk_folder, &w);
+    if (!files) {
+        error = errno;
+        goto done;
+    }
+    if (w.error || digest_walk_record(&w, files) != DIGEST_STATUS_OK) goto error;
+
+    goto done;
+
+error:
+    if (arena) {
+        list_free(files);
+    } else {
+        list_free_deep(files, (ListItemFreeFn)file_free);
+    }
+    files = NULL;
+
+done:
+    hash_free(w.by_path);
+    list_free(w.folders);
+    arena_free(w.folder_arena);
+    free(w.parent);
+    pthread_mutex_destroy(&w.lock);
+    if (!files) errno = error;
+    return files;
+}
+
+int digest_folder(DigestManifest* m, const char* path, uint64_t* digest) {
+    DigestEntry* e = hash_get(m->entries, (void*)path);
+    if (!e || !(e->record.flags & DIGEST_FLAG_FOLDER)) return 0;
+
+    *digest = e->record.digest;
+    return 1;
+}
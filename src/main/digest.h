@@ -0,0 +1,149 @@
+/**
+ * @file digest.h
+ * Content digests of local files. Files are read and hashed on a pool of
+ * threads, and the digests are kept in an on-disk manifest, so that files
+ * which did not change since they were last hashed are not read again. A file
+ * is considered unchanged while its device, inode, size, modification time
+ * and path all match the manifest.
+ *
+ * The manifest also keeps a digest of the names within each folder listed by
+ * digest_collect_files, computed like sync_tree_entry with SYNC_COMPARE_EXISTS.
+ * A folder whose modification time did not change still holds the same names,
+ * so a whole tree of unchanged folders need not be listed again.
+ */
+
+#ifndef _DIGEST_H_
+#define _DIGEST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "list.h"
+
+/**
+ * Status codes for digest operations.
+ */
+typedef enum {
+    DIGEST_STATUS_OK,      ///< Operation successful
+    DIGEST_STATUS_EFAIL,   ///< Failed due to a general runtime error
+    DIGEST_STATUS_ENOMEM,  ///< Failed due to allocation error
+} DigestStatusCode;
+
+/**
+ * Digests of local files, keyed by path. Use digest_manifest_open to create
+ * one.
+ */
+typedef struct DigestManifest DigestManifest;
+
+/**
+ * Statistics of digesting a list of files.
+ */
+typedef struct {
+    size_t files;    ///< Number of files digested
+    size_t cached;   ///< Number of files whose digest was taken from the manifest
+    uint64_t bytes;  ///< Total size of the files
+    uint64_t read;   ///< Number of bytes read and hashed
+    uint64_t nanos;  ///< Time taken, in nanoseconds
+} DigestStats;
+
+/**
+ * Determine where the manifest is kept, in the same directory as the device
+ * indexes. Allocates the result on the heap, free it when done.
+ * @return  path of the manifest, or NULL if none can be determined
+ */
+char* digest_manifest_path();
+
+/**
+ * Load a manifest from disk. A manifest which does not exist or is not valid
+ * is treated as empty. Free it with digest_manifest_free when done.
+ * @param path  path of the manifest
+ * @return      the manifest, or NULL in case of allocation failure
+ */
+DigestManifest* digest_manifest_open(const char* path);
+
+/**
+ * Retrieve the number of files and folders in a manifest.
+ * @param m  manifest to operate on
+ * @return   number of entries
+ */
+size_t digest_manifest_size(DigestManifest* m);
+
+/**
+ * Forget the files within a folder which are not in a list, normally because
+ * they were deleted since the manifest was saved. Folders are kept, since
+ * digest_collect_files forgets those which were deleted itself.
+ * @param m      manifest to operate on
+ * @param root   canonical path of the folder
+ * @param files  every file within the folder
+ * @return       status code of the operation
+ */
+DigestStatusCode digest_manifest_prune(DigestManifest* m, const char* root, List* files);
+
+/**
+ * Write a manifest to disk, if anything changed since it was opened. The file
+ * is replaced atomically, and any missing parent directories are created.
+ * @param m     manifest to save
+ * @param path  path of the manifest
+ * @return      status code of the operation
+ */
+DigestStatusCode digest_manifest_save(DigestManifest* m, const char* path);
+
+/**
+ * Free a manifest.
+ * @param m  manifest to free
+ */
+void digest_manifest_free(DigestManifest* m);
+
+/**
+ * Compute the digest of a single file on the calling thread, unless the
+ * manifest has a digest of the unchanged file. The manifest is updated.
+ * @param m       manifest to use, may be NULL
+ * @param path    path of the file
+ * @param digest  set to the digest of the file
+ * @return        status code of the operation
+ */
+DigestStatusCode digest_file(DigestManifest* m, const char* path, uint64_t* digest);
+
+/**
+ * Compute the digests of a list of files on a pool of threads, reading only
+ * the files which are not in the manifest or changed since. The manifest is
+ * updated once all files are digested. Folders are skipped.
+ * @param m        manifest to use, may be NULL
+ * @param files    files to digest
+ * @param threads  number of threads to read files on, at least one
+ * @param digests  set to the digest of each file, in order, or zero for folders
+ *                 and files which could not be read
+ * @param stats    set to statistics of the operation, may be NULL
+ * @return         status code of the operation, DIGEST_STATUS_EFAIL if any
+ *                 file could not be read
+ */
+DigestStatusCode digest_files(DigestManifest* m, List* files, size_t threads, uint64_t* digests, DigestStats* stats);
+
+/**
+ * Collect all regular files within a path into a list, like fs_collect_files
+ * and on the same threads, except that each folder within the path which
+ * holds the same names as when the manifest was last updated is listed as a
+ * folder, rather than by the files within it. Such folders are found by checking the modification time
+ * of each folder within them, without listing any of them. The path itself is
+ * always listed, so pass one of those folders to list it in turn. The
+ * manifest is updated with each folder which is listed.
+ * @param m      manifest to look up and record folders in
+ * @param arena  arena to allocate the files from, or NULL to allocate them
+ *               normally, in which case free them with file_free
+ * @param path   canonical path to collect files from
+ * @return       list of files and unchanged folders, or NULL in case of failure
+ */
+List* digest_collect_files(DigestManifest* m, Arena* arena, char* path);
+
+/**
+ * Look up the digest of the names within a folder, as last listed by
+ * digest_collect_files. Folders holding no files have a digest of zero.
+ * @param m       manifest to look in
+ * @param path    canonical path of the folder
+ * @param digest  set to the digest of the folder
+ * @return        truthy if the folder is in the manifest
+ */
+int digest_folder(DigestManifest* m, const char* path, uint64_t* digest);
+
+#endif
@@ -0,0 +1,345 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "enum.h"
+#include "fs.h"
+#include "hash.h"
+#include "list.h"
+#include "queue.h"
+
+#define ENUM_ID_KEY(id) ((void*)(uintptr_t)(id))
+
+// Marks objects in the bulk listing which are not below the enumerated folder
+static char enum_outside[] = "";
+
+typedef struct {
+    uint32_t id;          // ID of the folder
+    char* path;           // Canonical path of the folder
+    List* entries;        // Children of the folder, once listed
+    EnumStatusCode code;  // Status of listing the folder
+} EnumFolder;
+
+typedef struct {
+    EnumSource* src;  // Source to list folders from
+    Queue* pending;   // Folders waiting to be listed
+    Queue* listed;    // Folders listed, waiting to be visited
+} EnumPipeline;
+
+typedef struct {
+    EnumEntry* entry;  // Listed object
+    char* path;        // Resolved path of the object, owned by the paths hash
+} EnumVisit;
+
+static size_t enum_hc_id(void* key) {
+    return (uintptr_t)key;
+}
+
+static int enum_cmp_id(void* a, void* b) {
+    return a != b;
+}
+
+static void enum_path_entry_free(HashEntry* e) {
+    if (e) {
+        char* path = hash_entry_value(e);
+        if (path != enum_outside) free(path);
+        hash_entry_free(e);
+    }
+}
+
+static int enum_visit_sort(const void* a, const void* b) {
+    const EnumVisit* aa = a;
+    const EnumVisit* bb = b;
+    return strcmp(aa->path, bb->path);
+}
+
+EnumEntry* enum_entry_new(uint32_t id, uint32_t parent_id, uint64_t size, int is_folder, const char* name) {
+    EnumEntry* e = NULL;
+
+    e = malloc(sizeof(EnumEntry));
+    if (!e) goto error;
+
+    e->name = strdup(name ? name : "");
+    if (!e->name) goto error;
+
+    e->id = id;
+    e->parent_id = parent_id;
+    e->size = size;
+    e->mtime = 0;
+    e->is_folder = is_folder;
+    return e;
+
+error:
+    free(e);
+    return NULL;
+}
+
+void enum_entry_free(EnumEntry* e) {
+    if (e) free(e->name);
+    free(e);
+}
+
+static EnumFolder* enum_folder_new(uint32_t id, char* path) {
+    EnumFolder* folder = malloc(sizeof(EnumFolder));
+    if (!folder) return NULL;
+
+    folder->id = id;
+    folder->path = path;
+    folder->entries = NULL;
+    folder->code = ENUM_STATUS_EFAIL;
+    return folder;
+}
+
+static void enum_folder_free(EnumFolder* folder) {
+    if (folder) {
+        free(folder->path);
+        list_free_deep(folder->entries, (ListItemFreeFn)enum_entry_free);
+    }
+    free(folder);
+}
+
+// Lists folders from the source back to back, as soon as they are queued.
+static void* enum_list_thread(void* data) {
+    EnumPipeline* p = data;
+    EnumFolder* folder = NULL;
+
+    while (queue_pop(p->pending, (void**)&folder) == QUEUE_STATUS_OK) {
+        folder->code = p->src->list_folder(p->src->data, folder->id, &folder->entries);
+        if (queue_push(p->listed, folder) != QUEUE_STATUS_OK) {
+            // the walk waits on every queued folder, so stop it
+            enum_folder_free(folder);
+            queue_close(p->listed);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Walks the tree breadth first. A separate thread issues the listing requests
+// while this thread visits the listed entries, so that visiting is hidden
+// behind the latency of the device.
+static EnumStatusCode enum_walk(EnumSource* src, uint32_t folder_id, const char* path, EnumVisitFn visit, void* data) {
+    EnumStatusCode code = ENUM_STATUS_ENOMEM;
+    EnumPipeline p = { .src = src, .pending = NULL, .listed = NULL };
+    EnumFolder* folder = NULL;
+    char* child_path = NULL;
+    pthread_t thread;
+    int is_started = 0;
+    size_t outstanding = 0;
+
+    p.pending = queue_new(16);
+    p.listed = queue_new(16);
+    if (!p.pending || !p.listed) goto done;
+
+    child_path = strdup(path);
+    if (!child_path) goto done;
+
+    folder = enum_folder_new(folder_id, child_path);
+    if (!folder) goto done;
+    child_path = NULL;
+
+    if (queue_push(p.pending, folder) != QUEUE_STATUS_OK) goto done;
+    folder = NULL;
+    outstanding++;
+
+    code = ENUM_STATUS_EFAIL;
+    if (pthread_create(&thread, NULL, enum_list_thread, &p) != 0) goto done;
+    is_started = 1;
+
+    while (outstanding) {
+        if (queue_pop(p.listed, (void**)&folder) != QUEUE_STATUS_OK) goto done;
+        outstanding--;
+
+        if (folder->code != ENUM_STATUS_OK) {
+            code = folder->code;
+            goto done;
+        }
+
+        for (size_t i = 0; i < list_size(folder->entries); i++) {
+            EnumEntry* e = list_get(folder->entries, i);
+
+            child_path = fs_path_join(folder->path, e->name);
+            if (!child_path) {
+                code = ENUM_STATUS_ENOMEM;
+                goto done;
+            }
+
+            EnumVisitCode r = visit(e, child_path, data);
+            if (r == ENUM_VISIT_ABORT) goto done;
+
+            if (e->is_folder && r == ENUM_VISIT_CONTINUE) {
+                EnumFolder* child = enum_folder_new(e->id, child_path);
+                if (!child || queue_push(p.pending, child) != QUEUE_STATUS_OK) {
+                    free(child);
+                    code = ENUM_STATUS_ENOMEM;
+                    goto done;
+                }
+                outstanding++;
+            } else {
+                free(child_path);
+            }
+            child_path = NULL;
+        }
+
+        enum_folder_free(folder);
+        folder = NULL;
+    }
+
+    code = ENUM_STATUS_OK;
+
+done:
+    free(child_path);
+    enum_folder_free(folder);
+
+    if (p.pending) {
+        // discard anything not listed yet, then wait for the request in flight
+        queue_close(p.pending);
+        while (queue_pop(p.pending, (void**)&folder) == QUEUE_STATUS_OK) enum_folder_free(folder);
+    }
+    if (is_started) pthread_join(thread, NULL);
+    if (p.listed) {
+        queue_close(p.listed);
+        while (queue_pop(p.listed, (void**)&folder) == QUEUE_STATUS_OK) enum_folder_free(folder);
+    }
+
+    queue_free(p.pending);
+    queue_free(p.listed);
+    return code;
+}
+
+// Determines the path of an object from its ancestors, memoizing the path of
+// every ancestor along the way. Objects outside of the folder resolve to the
+// enum_outside marker, as do objects with missing parents or cyclic links.
+static char* enum_resolve_path(Hash* by_id, Hash* paths, uint32_t folder_id, EnumEntry* e, size_t depth) {
+    char* path = hash_get(paths, ENUM_ID_KEY(e->id));
+    if (path) return path;
+
+    char* parent_path = NULL;
+    if (e->parent_id == folder_id) {
+        parent_path = hash_get(paths, ENUM_ID_KEY(folder_id));
+    } else if (e->parent_id == 0 || depth > hash_size(by_id)) {
+        parent_path = enum_outside;
+    } else {
+        EnumEntry* parent = hash_get(by_id, ENUM_ID_KEY(e->parent_id));
+        if (!parent || !parent->is_folder) {
+            parent_path = enum_outside;
+        } else {
+            parent_path = enum_resolve_path(by_id, paths, folder_id, parent, depth + 1);
+            if (!parent_path) return NULL;
+        }
+    }
+
+    if (parent_path == enum_outside) {
+        path = enum_outside;
+    } else {
+        path = fs_path_join(parent_path, e->name);
+        if (!path) return NULL;
+    }
+
+    HashPutResult r = hash_put(paths, ENUM_ID_KEY(e->id), path);
+    enum_path_entry_free(r.old_entry);
+    if (r.status != HASH_STATUS_OK) {
+        if (path != enum_outside) free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+static EnumStatusCode enum_bulk(EnumSource* src, uint32_t folder_id, const char* path, EnumVisitFn visit, void* data) {
+    EnumStatusCode code = ENUM_STATUS_ENOMEM;
+    List* entries = NULL;
+    Hash* by_id = NULL;
+    Hash* paths = NULL;
+    Hash* skipped = NULL;
+    EnumVisit* visits = NULL;
+    size_t visit_count = 0;
+    char* root_path = NULL;
+
+    if (!src->list_all) return ENUM_STATUS_EUNSUPPORTED;
+
+    code = src->list_all(src->data, &entries);
+    if (code != ENUM_STATUS_OK) goto done;
+    code = ENUM_STATUS_ENOMEM;
+
+    size_t size = list_size(entries);
+
+    by_id = hash_new(size, enum_hc_id, enum_cmp_id);
+    paths = hash_new(size, enum_hc_id, enum_cmp_id);
+    skipped = hash_new(16, enum_hc_id, enum_cmp_id);
+    visits = malloc((size ? size : 1) * sizeof(EnumVisit));
+    if (!by_id || !paths || !skipped || !visits) goto done;
+
+    for (size_t i = 0; i < size; i++) {
+        EnumEntry* e = list_get(entries, i);
+        HashPutResult r = hash_put(by_id, ENUM_ID_KEY(e->id), e);
+        hash_entry_free(r.old_entry);
+        if (r.status != HASH_STATUS_OK) goto done;
+    }
+
+    root_path = strdup(path);
+    if (!root_path) goto done;
+
+    HashPutResult r = hash_put(paths, ENUM_ID_KEY(folder_id), root_path);
+    if (r.status != HASH_STATUS_OK) goto done;
+    root_path = NULL;
+
+    // rebuild the hierarchy below the folder from the parent of each object
+    for (size_t i = 0; i < size; i++) {
+        EnumEntry* e = list_get(entries, i);
+        if (e->id == folder_id) continue;
+
+        char* entry_path = enum_resolve_path(by_id, paths, folder_id, e, 0);
+        if (!entry_path) goto done;
+        if (entry_path == enum_outside) continue;
+
+        visits[visit_count].entry = e;
+        visits[visit_count].path = entry_path;
+        visit_count++;
+    }
+
+    // a folder's path is a prefix of its children's, so it sorts before them
+    qsort(visits, visit_count, sizeof(EnumVisit), enum_visit_sort);
+
+    code = ENUM_STATUS_EFAIL;
+
+    for (size_t i = 0; i < visit_count; i++) {
+        EnumEntry* e = visits[i].entry;
+        int is_skipped = hash_contains_key(skipped, ENUM_ID_KEY(e->parent_id));
+
+        EnumVisitCode vr = is_skipped ? ENUM_VISIT_SKIP : visit(e, visits[i].path, data);
+        if (vr == ENUM_VISIT_ABORT) goto done;
+
+        if (e->is_folder && vr == ENUM_VISIT_SKIP) {
+            HashPutResult sr = hash_put(skipped, ENUM_ID_KEY(e->id), e);
+            hash_entry_free(sr.old_entry);
+            if (sr.status != HASH_STATUS_OK) {
+                code = ENUM_STATUS_ENOMEM;
+                goto done;
+            }
+        }
+    }
+
+    code = ENUM_STATUS_OK;
+
+done:
+    free(root_path);
+    free(visits);
+    hash_free(skipped);
+    hash_free_deep(paths, enum_path_entry_free);
+    hash_free(by_id);
+    list_free_deep(entries, (ListItemFreeFn)enum_entry_free);
+    return code;
+}
+
+EnumStatusCode enum_tree(EnumSource* src, uint32_t folder_id, const char* path, EnumStrategy strategy, EnumVisitFn visit, void* data) {
+    switch (strategy) {
+        case ENUM_STRATEGY_BULK:
+            return enum_bulk(src, folder_id, path, visit, data);
+        case ENUM_STRATEGY_WALK:
+        default:
+            return enum_walk(src, folder_id, path, visit, data);
+    }
+}
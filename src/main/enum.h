@@ -0,0 +1,132 @@
+/**
+ * @file enum.h
+ * Enumeration of the objects on a storage volume. Objects may be listed one
+ * folder at a time, which costs a device round trip per folder, or with a
+ * single bulk listing of the whole storage from which the folder hierarchy is
+ * rebuilt in memory using the parent ID of each object.
+ */
+
+#ifndef _ENUM_H_
+#define _ENUM_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "list.h"
+
+/**
+ * Status codes for enumeration operations.
+ */
+typedef enum {
+    ENUM_STATUS_OK,           ///< Operation successful
+    ENUM_STATUS_EFAIL,        ///< Failed due to a general runtime error
+    ENUM_STATUS_ENOMEM,       ///< Failed due to allocation error
+    ENUM_STATUS_EUNSUPPORTED, ///< Bulk listing is not supported by the source
+} EnumStatusCode;
+
+/**
+ * Strategies for enumerating a folder tree.
+ */
+typedef enum {
+    ENUM_STRATEGY_WALK,  ///< List each folder individually
+    ENUM_STRATEGY_BULK,  ///< List the whole storage in one go
+} EnumStrategy;
+
+/**
+ * Result of visiting an object during enumeration.
+ */
+typedef enum {
+    ENUM_VISIT_CONTINUE,  ///< Continue, including the children of a folder
+    ENUM_VISIT_SKIP,      ///< Continue, but skip the children of this folder
+    ENUM_VISIT_ABORT,     ///< Stop the enumeration and fail
+} EnumVisitCode;
+
+/**
+ * A single object listed from a storage volume.
+ */
+typedef struct {
+    uint32_t id;         ///< Unique ID of the object
+    uint32_t parent_id;  ///< ID of the parent folder, zero for the root folder
+    uint64_t size;       ///< Size of the object in bytes
+    time_t mtime;        ///< Time the object was last modified, zero if unknown
+    int is_folder;       ///< Truthy if this represents a folder
+    char* name;          ///< Name of the object within its parent folder
+} EnumEntry;
+
+/**
+ * Lists the children of a single folder. The list is populated with EnumEntry
+ * items, which are owned by the caller. During a walk this is called from a
+ * separate thread, but never concurrently with itself.
+ * @param data       opaque data of the source
+ * @param folder_id  ID of the folder to list, zero for the root folder
+ * @param out        populated with the listed entries
+ * @return           status code of the operation
+ */
+typedef EnumStatusCode (*EnumListFolderFn)(void* data, uint32_t folder_id, List** out);
+
+/**
+ * Lists every object on the storage volume. The list is populated with
+ * EnumEntry items in no particular order, which are owned by the caller.
+ * @param data  opaque data of the source
+ * @param out   populated with the listed entries
+ * @return      status code of the operation, ENUM_STATUS_EUNSUPPORTED if the
+ *              source is not able to list everything at once
+ */
+typedef EnumStatusCode (*EnumListAllFn)(void* data, List** out);
+
+/**
+ * Callback executed for each object found during enumeration. Folders are
+ * always visited before their children.
+ * @param e     the object
+ * @param path  full, canonical path of the object
+ * @param data  opaque context data passed to enum_tree
+ * @return      whether to continue the enumeration
+ */
+typedef EnumVisitCode (*EnumVisitFn)(EnumEntry* e, const char* path, void* data);
+
+/**
+ * A storage volume that objects can be listed from.
+ */
+typedef struct {
+    EnumListFolderFn list_folder;  ///< Lists the children of one folder
+    EnumListAllFn list_all;        ///< Lists the whole storage, may be NULL
+    void* data;                    ///< Opaque data passed to the functions
+} EnumSource;
+
+/**
+ * Create a new entry. The name is copied and the modification time is left
+ * unknown. Free it with enum_entry_free.
+ * @param id         unique ID of the object
+ * @param parent_id  ID of the parent folder
+ * @param size       size of the object in bytes
+ * @param is_folder  truthy if the object is a folder
+ * @param name       name of the object
+ * @return           new entry, or NULL in case of failure
+ */
+EnumEntry* enum_entry_new(uint32_t id, uint32_t parent_id, uint64_t size, int is_folder, const char* name);
+
+/**
+ * Free an entry.
+ * @param e  entry to free
+ */
+void enum_entry_free(EnumEntry* e);
+
+/**
+ * Enumerate every object below a folder. The visit callback is executed on the
+ * calling thread for each descendant of the folder, but not for the folder
+ * itself. With ENUM_STRATEGY_WALK, the tree is walked breadth first and the
+ * next folders are listed while the entries of earlier ones are visited. With
+ * ENUM_STRATEGY_BULK, the whole storage is listed at once, regardless of which
+ * folder is enumerated, and ENUM_STATUS_EUNSUPPORTED is returned without
+ * visiting anything if the source does not support it.
+ * @param src        source to list objects from
+ * @param folder_id  ID of the folder to enumerate, zero for the root folder
+ * @param path       canonical path of the folder
+ * @param strategy   how to list the objects
+ * @param visit      callback to execute for each object
+ * @param data       opaque context data to pass to the callback
+ * @return           status code of the operation
+ */
+EnumStatusCode enum_tree(EnumSource* src, uint32_t folder_id, const char* path, EnumStrategy strategy, EnumVisitFn visit, void* data);
+
+#endif
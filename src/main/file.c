@@ -6,16 +6,17 @@
 #include "fs.h"
 #include "file.h"
 #include "hash.h"
+#include "intern.h"
 
 inline size_t file_hc(void* item) {
     File* sf = item;
-    return hash_code_str(sf->path);
+    return sf->hc;
 }
 
 inline int file_cmp(void* a, void* b) {
     File* aa = a;
     File* bb = b;
-    return hash_cmp_str(aa->path, bb->path);
+    return aa->path != bb->path;
 }
 
 inline void file_hash_entry_free(HashEntry* e) {
@@ -25,37 +26,78 @@ inline void file_hash_entry_free(HashEntry* e) {
 
 void file_free(File* f) {
     if (f) {
-        free(f->path);
+        intern_release(f->path);
         free(f);
     }
 }
 
 File* file_new_data(const char* path, const int is_folder, void* data) {
-    char* path_dup = NULL;
-    File* file = NULL;
+    return file_new_arena(NULL, path, is_folder, data);
+}
+
+File* file_new_arena(Arena* arena, const char* path, const int is_folder, void* data) {
+    // most paths are canonical already, so resolving them is skipped
+    if (fs_is_canonical(path)) return file_new_canonical(arena, path, is_folder, data);
+
+    char* path_r = fs_resolve(path);
+    if (!path_r) return NULL;
 
-    path_dup = fs_resolve(path);
-    if (!path_dup) goto error;
+    File* file = file_new_canonical(arena, path_r, is_folder, data);
+    free(path_r);
+    return file;
+}
+
+File* file_new_canonical(Arena* arena, const char* path, const int is_folder, void* data) {
+    char* path_i = intern_path(path);
+    if (!path_i) return NULL;
+
+    File* file = file_new_interned(arena, path_i, is_folder, data);
+    intern_release(path_i);
+    return file;
+}
 
-    file = malloc(sizeof(File));
-    if (!file) goto error;
-    file->path = path_dup;
+File* file_new_interned(Arena* arena, char* path, const int is_folder, void* data) {
+    File* file = arena ? arena_alloc(arena, sizeof(File)) : malloc(sizeof(File));
+    if (!file) return NULL;
+
+    file->path = arena ? intern_ref_arena(arena, path) : intern_ref(path);
+    if (!file->path) {
+        if (!arena) free(file);
+        return NULL;
+    }
+
+    file->hc = intern_hc(path);
     file->is_folder = is_folder;
+    file->size = 0;
+    file->mtime = 0;
+    file->mode = 0;
+    file->ino = 0;
     file->data = data;
     return file;
-
-error:
-    free(path_dup);
-    free(file);
-    return NULL;
 }
 
 File* file_new(const char* path, const int is_folder) {
     return file_new_data(path, is_folder, NULL);
 }
 
-File* file_dup(File* f) {
-    return f ? file_new_data(f->path, f->is_folder, f->data) : NULL;
+File* file_dup(Arena* arena, File* f) {
+    if (!f) return NULL;
+
+    File* copy = file_new_interned(arena, f->path, f->is_folder, f->data);
+    if (!copy) return NULL;
+
+    copy->size = f->size;
+    copy->mtime = f->mtime;
+    copy->mode = f->mode;
+    copy->ino = f->ino;
+    return copy;
+}
+
+void file_set_stat(File* f, struct stat* st) {
+    f->size = st->st_size;
+    f->mtime = st->st_mtime;
+    f->mode = st->st_mode;
+    f->ino = st->st_ino;
 }
 
 List* file_unique(List* files) {
@@ -6,6 +6,12 @@
 #ifndef _FILE_H_
 #define _FILE_H_
 
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "arena.h"
 #include "list.h"
 #include "hash.h"
 
@@ -13,8 +19,13 @@
  * A file or folder. May be on the local filesystem or the remote device.
  */
 typedef struct {
-    char* path;    ///< Canonical path of the file
+    char* path;    ///< Canonical path of the file, interned with intern_path
+    size_t hc;     ///< Hash code of the path, as returned by hash_code_str
     int is_folder; ///< Truthy if this is a folder
+    uint64_t size; ///< Size of the file in bytes, zero if unknown
+    time_t mtime;  ///< Time the file was last modified, zero if unknown
+    mode_t mode;   ///< Type and permissions of a local file, zero if unknown
+    uint64_t ino;  ///< Inode of a local file, zero if unknown
     void* data;    ///< Additional data related to the file
 } File;
 
@@ -26,7 +37,7 @@ void file_free(File* f);
 
 /**
  * Create a new File. Returns NULL in case of failure. Free it when done.
- * @param path       canonical path of the file, will be copied
+ * @param path       path of the file, will be resolved and interned
  * @param is_folder  truthy if this is a folder
  * @return           a new File, or NULL in case of an error
  */
@@ -35,7 +46,7 @@ File* file_new(const char* path, const int is_folder);
 /**
  * Create a new File with attachd data. Returns NULL in case of failure.
  * Free it when done.
- * @param path       canonical path of the file, will be copied
+ * @param path       path of the file, will be resolved and interned
  * @param is_folder  truthy if this is a folder
  * @param data       pointer to additional data to store with the file
  * @return           a new File, or NULL in case of an error
@@ -43,22 +54,70 @@ File* file_new(const char* path, const int is_folder);
 File* file_new_data(const char* path, const int is_folder, void* data);
 
 /**
- * Duplicates a File. The path will also be duplicated. Returns NULL in case of
- * failure. Free it when done.
- * @param f  to duplicate
- * @return   a copy of the file, or NULL in case of an error
+ * Record the status of a local file, as returned by stat, in a File. Local
+ * files are stat'ed once while collecting them, and later steps use what was
+ * recorded rather than calling stat again.
+ * @param f   file to update
+ * @param st  status of the file
+ */
+void file_set_stat(File* f, struct stat* st);
+
+/**
+ * Create a new File within an arena. It remains valid until the arena is
+ * freed, and must not be freed with file_free.
+ * @param arena      arena to allocate from, or NULL to allocate normally
+ * @param path       path of the file, will be resolved and interned
+ * @param is_folder  truthy if this is a folder
+ * @param data       pointer to additional data to store with the file
+ * @return           a new File, or NULL in case of an error
+ */
+File* file_new_arena(Arena* arena, const char* path, const int is_folder, void* data);
+
+/**
+ * Create a new File for a path which is already canonical, as returned by
+ * fs_resolve, interning it without resolving it again.
+ * @param arena      arena to allocate from, or NULL to allocate normally
+ * @param path       canonical path of the file, will be interned
+ * @param is_folder  truthy if this is a folder
+ * @param data       pointer to additional data to store with the file
+ * @return           a new File, or NULL in case of an error
+ */
+File* file_new_canonical(Arena* arena, const char* path, const int is_folder, void* data);
+
+/**
+ * Create a new File for a path which is already interned, taking another
+ * reference to it rather than resolving it again. Files allocated from an
+ * arena remain valid until the arena is freed, others should be freed with
+ * file_free when done.
+ * @param arena      arena to allocate from, or NULL to allocate normally
+ * @param path       interned path of the file
+ * @param is_folder  truthy if this is a folder
+ * @param data       pointer to additional data to store with the file
+ * @return           a new File, or NULL in case of an error
+ */
+File* file_new_interned(Arena* arena, char* path, const int is_folder, void* data);
+
+/**
+ * Duplicates a File, including its size and modification time. The path is
+ * shared with the original. Returns NULL in case of failure. Free it when
+ * done, unless it was allocated from an arena.
+ * @param arena  arena to allocate the copy from, or NULL to use the heap
+ * @param f      to duplicate
+ * @return       a copy of the file, or NULL in case of an error
  */
-File* file_dup(File* f);
+File* file_dup(Arena* arena, File* f);
 
 /**
- * Create a hashcode for a file based on path.
+ * Create a hashcode for a file based on path. The hash code is cached with the
+ * file, so this does not hash the path again.
  * @param item  to create a hashcode for
  * @return      hashcode based on file path
  */
 size_t file_hc(void* item);
 
 /**
- * Compare the paths of two files
+ * Compare the paths of two files. Since paths are interned, this only
+ * compares pointers.
  * @param a  to compare
  * @param b  to compare
  * @return   zero if the paths are equal
@@ -1,11 +1,13 @@
 #ifdef __linux__
-#define _XOPEN_SOURCE 500
+#define _XOPEN_SOURCE 700
 #endif
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,16 +15,21 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <ftw.h>
 
 #include "file.h"
 #include "fs.h"
 #include "str.h"
 #include "list.h"
+#include "hash.h"
+#include "uring.h"
+#include "walk.h"
 
-#define FS_FILE_BUF_SIZE 128
 #define FS_DIR_BUF_SIZE 32
-#define FS_OPEN_FILES 16
+#define FS_HASH_CHUNK_SIZE (1024 * 1024)
+
+// Working directory used by fs_resolve, looked up when first needed
+static pthread_mutex_t fs_cwd_lock = PTHREAD_MUTEX_INITIALIZER;
+static char* fs_cwd = NULL;
 
 enum FsPathState {
     FS_PATH_START,
@@ -32,52 +39,79 @@ enum FsPathState {
     FS_PATH_DOTDOT,
 };
 
-// used to collect file listing with nftw and nftw_callback
-static _Thread_local List* g_files = NULL;
-
-static inline int nftw_callback(const char* fpath, const struct stat* s, int tflag, struct FTW* ftwbuf) {
-    int e = ENOMEM;
+static FsStatusCode handle_ancestor(Arena* arena, List* ancestors, char* path, struct stat* s, int error) {
+    FsStatusCode status = FS_STATUS_EFAIL;
     File* file = NULL;
-    int is_folder = S_ISDIR(s->st_mode);
-
-    if (!is_folder) {
-        file = file_new(fpath, is_folder);
-        if (!file) goto done;
 
-        if (list_push(g_files, file) != LIST_STATUS_OK) goto done;
+    if (!error) {
+        file = file_new_canonical(arena, path, S_ISDIR(s->st_mode), NULL);
+        if (!file) goto error;
+        if (list_push(ancestors, file) != LIST_STATUS_OK) goto error;
         file = NULL;
+        status = FS_STATUS_OK;
+    } else if (error == ENOENT) {
+        status = FS_STATUS_ENOENT;
     }
 
-    e = 0;
-
-done:
-    file_free(file);
-    return e;
+error:
+    if (!arena) file_free(file);
+    return status;
 }
 
-static FsStatusCode handle_ancestor(List* ancestors, char* path) {
+// Looks up every ancestor with a single io_uring submission, rather than a
+// call each. Returns FS_STATUS_EFAIL without adding any if io_uring cannot
+// be used, so that they are looked up one by one instead.
+static FsStatusCode handle_ancestors_uring(Arena* arena, List* ancestors, char* path) {
     FsStatusCode status = FS_STATUS_EFAIL;
-    File* file = NULL;
+    Uring* ring = NULL;
+    char* prefixes = NULL;
+    const char** names = NULL;
+    struct stat* st = NULL;
+    int* results = NULL;
+
+    size_t len = strlen(path);
+    size_t count = 0;
+    for (char* p = path+1; *p; p++) {
+        if (*p == '/') count++;
+    }
+    count++;
+
+    ring = uring_new(count);
+    if (!ring) goto done;
+
+    prefixes = malloc(count * (len + 1));
+    names = malloc(count * sizeof(char*));
+    st = malloc(count * sizeof(struct stat));
+    results = malloc(count * sizeof(int));
+    if (!prefixes || !names || !st || !results) goto done;
+
+    size_t n = 0;
+    for (size_t i = 1; i <= len; i++) {
+        if (i == len || path[i] == '/') {
+            char* prefix = prefixes + n * (len + 1);
+            memcpy(prefix, path, i);
+            prefix[i] = 0;
+            names[n++] = prefix;
+        }
+    }
 
-    struct stat s;
-    int lstat_code = lstat(path, &s);
+    if (uring_stat(ring, AT_FDCWD, names, count, AT_SYMLINK_NOFOLLOW, st, results) != 0) goto done;
 
-    if (lstat_code == 0) {
-        file = file_new(path, S_ISDIR(s.st_mode));
-        if (!file) goto error;
-        if (list_push(ancestors, file) != LIST_STATUS_OK) goto error;
-        file = NULL;
-        status = FS_STATUS_OK;
-    } else if (errno == ENOENT) {
-        status = FS_STATUS_ENOENT;
+    for (size_t i = 0; i < count; i++) {
+        status = handle_ancestor(arena, ancestors, (char*)names[i], &st[i], -results[i]);
+        if (status != FS_STATUS_OK) break;
     }
 
-error:
-    file_free(file);
+done:
+    uring_free(ring);
+    free(prefixes);
+    free(names);
+    free(st);
+    free(results);
     return status;
 }
 
-List* fs_collect_ancestors(char* path) {
+List* fs_collect_ancestors(Arena* arena, char* path) {
     List* ancestors = NULL;
     File* root = NULL;
     char* path_r = NULL;
@@ -88,16 +122,25 @@ List* fs_collect_ancestors(char* path) {
     ancestors = list_new(FS_DIR_BUF_SIZE);
     if (!ancestors) goto error;
 
-    root = file_new("/", 1);
+    root = file_new_canonical(arena, "/", 1, NULL);
     if (!root) goto error;
 
     if (list_push(ancestors, root) != LIST_STATUS_OK) goto error;
     root = NULL;
 
+    struct stat s;
+    FsStatusCode code;
+    if (uring_is_enabled()) {
+        size_t size = list_size(ancestors);
+        code = handle_ancestors_uring(arena, ancestors, path_r);
+        if (code == FS_STATUS_ENOENT || code == FS_STATUS_OK) goto done;
+        if (list_size(ancestors) != size) goto error;
+    }
+
     for (char* p = path_r+1; *p; p++) {
         if (*p == '/') {
             *p = 0;
-            FsStatusCode code = handle_ancestor(ancestors, path_r);
+            code = handle_ancestor(arena, ancestors, path_r, &s, lstat(path_r, &s) == 0 ? 0 : errno);
             *p = '/';
 
             if (code == FS_STATUS_ENOENT) goto done;
@@ -105,90 +148,52 @@ List* fs_collect_ancestors(char* path) {
         }
     }
 
-    FsStatusCode code = handle_ancestor(ancestors, path_r);
+    code = handle_ancestor(arena, ancestors, path_r, &s, lstat(path_r, &s) == 0 ? 0 : errno);
     if (code == FS_STATUS_ENOENT || code == FS_STATUS_OK) goto done;
 
 error:
-    list_free_deep(ancestors, free);
+    if (arena) {
+        list_free(ancestors);
+    } else {
+        list_free_deep(ancestors, (ListItemFreeFn)file_free);
+    }
     ancestors = NULL;
 
 done:
-    file_free(root);
+    if (!arena) file_free(root);
     free(path_r);
     return ancestors;
 
 }
 
-List* fs_collect_files(char *path) {
-    int e = ENOMEM;
-    File* file = NULL;
-    g_files = NULL;
-
-    struct stat s;
-    int lstat_code = lstat(path, &s);
-    if (lstat_code != 0) {
-        e = errno; // save the errno from lstat
-        goto error;
-    }
-
-    g_files = list_new(FS_FILE_BUF_SIZE);
-    if (!g_files) goto error;
-
-    if (S_ISDIR(s.st_mode)) {
-        int nftw_code = nftw(path, nftw_callback, FS_OPEN_FILES, 0);
-        if (nftw_code != 0) {
-            e = nftw_code;
-            goto error;
-        }
-    } else {
-        file = file_new(path, 0);
-        if (!file) goto error;
-
-        if (list_push(g_files, file) != LIST_STATUS_OK) goto error;
-        file = NULL;
-    }
-
-    return g_files;
-
-error:
-    file_free(file);
-    list_free_deep(g_files, (ListItemFreeFn)file_free);
-    errno = e;
-    return NULL;
+List* fs_collect_files(Arena* arena, char *path) {
+    return walk_collect_files(arena, path, 0);
 }
 
 FsStatusCode fs_rm(char* path) {
-    struct stat s;
-    int lstat_code = lstat(path, &s);
+    // most removals are files, so try that before looking at what it is
+    if (unlink(path) == 0) return FS_STATUS_OK;
+    if (errno != EISDIR && errno != EPERM) return FS_STATUS_EFAIL;
 
-    if (lstat_code != 0) return FS_STATUS_EFAIL;
-
-    if (S_ISDIR(s.st_mode)) {
-        if (rmdir(path) != 0) return FS_STATUS_EFAIL;
-    } else {
-        if (unlink(path) != 0) return FS_STATUS_EFAIL;
+    int e = errno;
+    if (rmdir(path) != 0) {
+        if (errno == ENOTDIR) errno = e;
+        return FS_STATUS_EFAIL;
     }
 
     return FS_STATUS_OK;
 }
 
 FsStatusCode fs_mkdir(char* path) {
-    struct stat s;
-    int lstat_code = lstat(path, &s);
-
-    if (lstat_code == 0) {
-        if (!S_ISDIR(s.st_mode)) {
-            errno = ENOTDIR;
-            return FS_STATUS_EFAIL;
-        }
-        return FS_STATUS_OK;
-    }
+    // most folders made are new, so try that before looking at what exists
+    if (mkdir(path, S_IRWXU) == 0) return FS_STATUS_OK;
+    if (errno != EEXIST) return FS_STATUS_EFAIL;
 
-    if (errno != ENOENT) {
-        return FS_STATUS_EFAIL;
-    }
+    struct stat s;
+    if (lstat(path, &s) != 0) return FS_STATUS_EFAIL;
 
-    if (mkdir(path, S_IRWXU) != 0) {
+    if (!S_ISDIR(s.st_mode)) {
+        errno = ENOTDIR;
         return FS_STATUS_EFAIL;
     }
 
@@ -221,6 +226,88 @@ done:
     return result;
 }
 
+FsStatusCode fs_set_mtime(char* path, time_t mtime) {
+    struct timespec times[2] = {
+        { .tv_sec = 0, .tv_nsec = UTIME_OMIT },
+        { .tv_sec = mtime, .tv_nsec = 0 },
+    };
+
+    return utimensat(AT_FDCWD, path, times, 0) == 0 ? FS_STATUS_OK : FS_STATUS_EFAIL;
+}
+
+FsStatusCode fs_hash_fd(int fd, uint64_t size, uint64_t* digest) {
+    FsStatusCode code = FS_STATUS_EFAIL;
+    char* buf = NULL;
+    uint64_t h = 0;
+
+    // small files only need a small buffer, the digest is the same
+    size_t buf_size = size < FS_HASH_CHUNK_SIZE ? size + 1 : FS_HASH_CHUNK_SIZE;
+    buf = malloc(buf_size);
+    if (!buf) {
+        code = FS_STATUS_ENOMEM;
+        goto done;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // each whole chunk seeds the next, so the digest covers the whole file,
+    // however the reads are split
+    for (;;) {
+        size_t len = 0;
+        while (len < FS_HASH_CHUNK_SIZE) {
+            // the file grew since its size was known, so a chunk is needed
+            if (len == buf_size) {
+                char* grown = realloc(buf, FS_HASH_CHUNK_SIZE);
+                if (!grown) {
+                    code = FS_STATUS_ENOMEM;
+                    goto done;
+                }
+                buf = grown;
+                buf_size = FS_HASH_CHUNK_SIZE;
+            }
+
+            ssize_t n = read(fd, buf + len, buf_size - len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) goto done;
+            if (n == 0) break;
+            len += n;
+        }
+
+        if (len) h = hash_bytes(buf, len, h);
+        if (len < FS_HASH_CHUNK_SIZE) break;
+    }
+
+    *digest = h;
+    code = FS_STATUS_OK;
+
+done:
+    free(buf);
+    return code;
+}
+
+FsStatusCode fs_hash_file(char* path, uint64_t* digest) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno == ENOENT ? FS_STATUS_ENOENT : FS_STATUS_EFAIL;
+
+    struct stat s;
+    FsStatusCode code = FS_STATUS_EFAIL;
+    if (fstat(fd, &s) == 0) code = fs_hash_fd(fd, s.st_size, digest);
+    close(fd);
+    return code;
+}
+
+int fs_write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
 size_t fs_path_append(char* result, const size_t len, const char* path) {
     size_t i = 0;
     size_t j = len;
@@ -323,25 +410,55 @@ error:
     return NULL;
 }
 
+int fs_is_canonical(const char* path) {
+    if (!path || path[0] != '/') return 0;
+    if (!path[1]) return 1;
+
+    // every segment must be a name other than "." or "..", so an empty one
+    // rules out repeated and trailing slashes
+    for (const char* p = path; *p; ) {
+        const char* name = ++p;
+        while (*p && *p != '/') p++;
+
+        size_t len = p - name;
+        if (!len) return 0;
+        if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))) return 0;
+    }
+
+    return 1;
+}
+
 char* fs_resolve(const char* path) {
     char* result = NULL;
-    char* cwd = NULL;
 
-    if (!path || path[0] != '/') {
-        cwd = getcwd(NULL, 0);
-        if (!cwd) goto error;
-    }
+    if (path && path[0] == '/') return fs_resolve_cwd(NULL, path);
 
-    result = fs_resolve_cwd(cwd, path);
-    if (!result) goto error;
+    // the working directory rarely changes, so it is only looked up once
+    pthread_mutex_lock(&fs_cwd_lock);
+    if (!fs_cwd) fs_cwd = getcwd(NULL, 0);
+    if (fs_cwd) result = fs_resolve_cwd(fs_cwd, path);
+    pthread_mutex_unlock(&fs_cwd_lock);
 
-    free(cwd);
     return result;
+}
 
-error:
-    free(cwd);
-    free(result);
-    return NULL;
+void fs_forget_cwd() {
+    pthread_mutex_lock(&fs_cwd_lock);
+    free(fs_cwd);
+    fs_cwd = NULL;
+    pthread_mutex_unlock(&fs_cwd_lock);
+}
+
+static inline int fs_path_rank(unsigned char c) {
+    return c == '/' ? 1 : c ? c + 1 : 0;
+}
+
+int fs_path_cmp(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return fs_path_rank(*a) - fs_path_rank(*b);
 }
 
 char* fs_path_join(const char* head, const char* tail) {
@@ -359,6 +476,50 @@ char* fs_path_join(const char* head, const char* tail) {
     return result;
 }
 
+FsPathView fs_path_parent(const char* path) {
+    const char* slash = strrchr(path, '/');
+    FsPathView view = { .offset = 0, .len = 0 };
+    if (slash) view.len = slash == path ? 1 : slash - path;
+    return view;
+}
+
+FsPathView fs_path_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    size_t len = strlen(path);
+    FsPathView view = { .offset = 0, .len = len };
+    if (slash && slash[1]) {
+        view.offset = slash + 1 - path;
+        view.len = len - view.offset;
+    }
+    return view;
+}
+
+FsPathView fs_path_ext(const char* path) {
+    FsPathView name = fs_path_name(path);
+    FsPathView view = { .offset = name.offset + name.len, .len = 0 };
+
+    const char* dot = strrchr(path + name.offset, '.');
+    if (dot && dot != path + name.offset) {
+        view.offset = dot - path;
+        view.len = name.offset + name.len - view.offset;
+    }
+    return view;
+}
+
+FsPathView fs_path_component(const char* path, size_t n) {
+    const char* p = path;
+    if (*p == '/') p++;
+
+    for (; *p && n; n--) {
+        while (*p && *p != '/') p++;
+        if (*p) p++;
+    }
+
+    FsPathView view = { .offset = p - path, .len = 0 };
+    while (p[view.len] && p[view.len] != '/') view.len++;
+    return view;
+}
+
 char* fs_basename(char* path) {
     if (!path) return NULL;
     char* path_dup = strdup(path);
@@ -6,6 +6,11 @@
 #ifndef _FS_H_
 #define _FS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "arena.h"
 #include "list.h"
 
 /**
@@ -19,18 +24,32 @@ typedef enum {
 } FsStatusCode;
 
 /**
- * Collect all regular files within a specified path into a list.
- * @param path  to collect files from
- * @return      list of all files under the provided path
+ * A slice of a canonical path, such as its parent or its name, found without
+ * copying the path. A slice which extends to the end of the path may be used
+ * as a string in place, path + offset.
  */
-List* fs_collect_files(char* path);
+typedef struct {
+    size_t offset;  ///< Offset of the slice from the start of the path
+    size_t len;     ///< Length of the slice, zero if there is none
+} FsPathView;
+
+/**
+ * Collect all regular files within a specified path into a list, listing the
+ * folders on several threads. See walk_collect_files.
+ * @param arena  arena to allocate the files from, or NULL to allocate them
+ *               normally, in which case free them with file_free
+ * @param path   to collect files from
+ * @return       list of all files under the provided path
+ */
+List* fs_collect_files(Arena* arena, char* path);
 
 /**
  * Collect all existing parent directories for a given path into a list.
- * @param path  to collect ancestors of
- * @return      list of all ancestor directories
+ * @param arena  arena to allocate the files from, as fs_collect_files
+ * @param path   to collect ancestors of
+ * @return       list of all ancestor directories
  */
-List* fs_collect_ancestors(char* path);
+List* fs_collect_ancestors(Arena* arena, char* path);
 
 /**
  * Remove a file or directory
@@ -54,6 +73,44 @@ FsStatusCode fs_mkdir(char* path);
  */
 FsStatusCode fs_mkdirp(char* path);
 
+/**
+ * Set the modification time of a file, leaving its access time as is.
+ * @param path   path of the file
+ * @param mtime  new modification time
+ * @return       status of operation
+ */
+FsStatusCode fs_set_mtime(char* path, time_t mtime);
+
+/**
+ * Compute a 64-bit digest of the contents of a file. Files with different
+ * digests certainly differ, files with the same digest very likely do not.
+ * The file is read sequentially in large chunks.
+ * @param path    path of the file
+ * @param digest  set to the digest of the file
+ * @return        status of operation
+ */
+FsStatusCode fs_hash_file(char* path, uint64_t* digest);
+
+/**
+ * Compute the digest of the contents of an open file, like fs_hash_file. The
+ * file is read from its current offset until its end, whatever its size.
+ * @param fd      descriptor of the file
+ * @param size    size of the file as last known, which only decides how large
+ *                a buffer to read with
+ * @param digest  set to the digest of the file
+ * @return        status of operation
+ */
+FsStatusCode fs_hash_fd(int fd, uint64_t size, uint64_t* digest);
+
+/**
+ * Write a whole buffer to a file, retrying short and interrupted writes.
+ * @param fd   descriptor to write to
+ * @param buf  data to write
+ * @param len  number of bytes to write
+ * @return     zero on success, -1 on failure
+ */
+int fs_write_all(int fd, const void* buf, size_t len);
+
 /**
  * Resolve a path to a canonicalized form. This includes the following:
  *  - Convert to absolute path relative to the current working directory
@@ -61,12 +118,29 @@ FsStatusCode fs_mkdirp(char* path);
  *  - Any "." segments in the path are removed
  *  - Any ".." segments are resolved
  *  - All trailing slashes are removed
- * Allocates the result on the heap, free it when done.
+ * Allocates the result on the heap, free it when done. The current working
+ * directory is looked up the first time it is needed, and reused after that,
+ * call fs_forget_cwd after changing it.
  * @param path  to resolve
  * @return      resolved path or NULL if an error
  */
 char* fs_resolve(const char* path);
 
+/**
+ * Forget the working directory used by fs_resolve, so that it is looked up
+ * again when next needed. Call this after changing the working directory.
+ */
+void fs_forget_cwd();
+
+/**
+ * Determine whether a path is already in the form returned by fs_resolve:
+ * absolute, without repeated or trailing slashes, and without any "." or
+ * ".." segments. This is much cheaper than resolving the path again.
+ * @param path  to check
+ * @return      truthy if the path is canonical
+ */
+int fs_is_canonical(const char* path);
+
 /**
  * Resolve a path relative to a specific directory. This works the same
  * as the fs_resolve function, uses the specified cwd to resolve relative
@@ -91,6 +165,53 @@ char* fs_resolve_cwd(const char* cwd, const char* path);
  */
 char* fs_path_join(const char* a, const char* b);
 
+/**
+ * Compares two canonical paths, ordering slashes before any other character.
+ * In this order every folder is directly followed by everything within it,
+ * like a depth first walk visiting the children of each folder by name.
+ * @param a  first path
+ * @param b  second path
+ * @return   negative if a sorts before b, zero if equal, positive otherwise
+ */
+int fs_path_cmp(const char* a, const char* b);
+
+/**
+ * Find the parent folder of a canonical path, like fs_dirname but without
+ * allocating. The parent of a top level path, or of the root folder, is "/".
+ * @param path  canonical path, as returned by fs_resolve
+ * @return      slice of the parent folder, empty if the path has no slash
+ */
+FsPathView fs_path_parent(const char* path);
+
+/**
+ * Find the name of a canonical path, like fs_basename but without allocating.
+ * The name is the end of the path, so path + offset is the name by itself.
+ * The name of the root folder is "/".
+ * @param path  canonical path, as returned by fs_resolve
+ * @return      slice of the name
+ */
+FsPathView fs_path_name(const char* path);
+
+/**
+ * Find the extension of a canonical path, including the dot, such as ".mp3".
+ * A name which only starts with a dot, such as ".profile", has none. The
+ * extension is the end of the path, so path + offset is the extension by
+ * itself.
+ * @param path  canonical path, as returned by fs_resolve
+ * @return      slice of the extension, empty at the end of the path if none
+ */
+FsPathView fs_path_ext(const char* path);
+
+/**
+ * Find a component of a canonical path, counting from the top, so that
+ * component zero of "/a/b" is "a" and component one is "b".
+ * @param path  canonical path, as returned by fs_resolve
+ * @param n     index of the component
+ * @return      slice of the component, empty at the end of the path if the
+ *              path has fewer components
+ */
+FsPathView fs_path_component(const char* path, size_t n);
+
 /**
  * Determines the basename of the provided path. Does not mutate the original
  * path. Allocates the result on the heap, free it when done.
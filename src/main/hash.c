@@ -2,142 +2,264 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include "list.h"
 #include "hash.h"
 
-// Max load factor for the hash before automatically expanding capacity
-#define HASH_LOAD_FACTOR 0.75
+// Max load factor for the hash before automatically expanding capacity, as a
+// number of eighths
+#define HASH_LOAD_EIGHTHS 6
+
+// Smallest number of slots in a hash
+#define HASH_MIN_CAPACITY 8
+
+// Probe length marking an entry which has been detached from the hash
+#define HASH_DETACHED UINT32_MAX
+
+// Fibonacci hashing constant, 2^64 divided by the golden ratio
+#define HASH_FIB_MUL 0x9E3779B97F4A7C15ull
+
+// Seed for string hash codes. Keys come from the local filesystem and the
+// attached device, so there is no need to randomize it per process.
+#define HASH_STR_SEED 0x6d747073796e6321ull
+
+// Secret of wyhash, from its reference implementation
+static const uint64_t hash_wyp[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
 
 struct Hash {
     HashCodeFn hc_fn;   // Function used to determine hash codes for keys
-    HashCmpFn cmp_fn;   // Functoin used to compare keys fore equality
-    HashEntry** items;  // Array of hash buckets
-    size_t capacity;    // Maximum capacity of the hash
+    HashCmpFn cmp_fn;   // Function used to compare keys for equality
+    HashEntry* slots;   // Array of entries, stored inline
+    size_t capacity;    // Number of slots, always a power of two
+    unsigned shift;     // Shift mapping a mixed hash code to a slot
     size_t size;        // Current number of entries in the hash
 };
 
 struct HashEntry {
-    size_t hc;        // Hash code for the item
-    HashEntry* next;  // Next item in the same hash bucket
-    void* key;        // Key for the hash entry
-    void* value;      // Value for the hash entry
+    size_t hc;     // Hash code for the item
+    void* key;     // Key for the hash entry
+    void* value;   // Value for the hash entry
+    uint32_t psl;  // Distance from the preferred slot plus one, zero if empty
 };
 
+// Spreads the hash code over the high bits, so that weak hash codes still use
+// every slot of the power of two sized table.
+static inline size_t hash_slot(Hash* h, size_t hc) {
+    return (size_t)(((uint64_t)hc * HASH_FIB_MUL) >> h->shift);
+}
+
+static inline int hash_keys_equal(Hash* h, HashEntry* e, size_t hc, void* key) {
+    if (e->hc != hc) return 0;
+    if (e->key == key) return 1;
+    // avoid the indirect call for the most common kind of key
+    if (h->cmp_fn == hash_cmp_str) return strcmp(e->key, key) == 0;
+    return h->cmp_fn(e->key, key) == 0;
+}
+
+static size_t hash_capacity_for(size_t size) {
+    size_t capacity = HASH_MIN_CAPACITY;
+    while (capacity * HASH_LOAD_EIGHTHS / 8 < size) capacity *= 2;
+    return capacity;
+}
+
+static unsigned hash_shift_for(size_t capacity) {
+    unsigned bits = 0;
+    while (((size_t)1 << bits) < capacity) bits++;
+    return 64 - bits;
+}
+
+static inline void hash_wymum(uint64_t* a, uint64_t* b) {
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hash_wymix(uint64_t a, uint64_t b) {
+    hash_wymum(&a, &b);
+    return a ^ b;
+}
+
+// Unaligned little endian reads, which compile to single loads on x86 and ARM
+static inline uint64_t hash_wyr8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_wyr4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_wyr3(const uint8_t* p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static HashEntry* hash_find(Hash* h, size_t hc, void* key) {
+    size_t mask = h->capacity - 1;
+    size_t i = hash_slot(h, hc);
+
+    // entries are ordered by probe length, so stop at the first shorter one
+    for (uint32_t psl = 1; ; psl++, i = (i + 1) & mask) {
+        HashEntry* e = &h->slots[i];
+        if (e->psl < psl) return NULL;
+        if (hash_keys_equal(h, e, hc, key)) return e;
+    }
+}
+
+// Inserts an entry known not to be present. The table must have a free slot.
+// Returns the slot the entry ends up in.
+static HashEntry* hash_insert(Hash* h, size_t hc, void* key, void* value) {
+    size_t mask = h->capacity - 1;
+    size_t i = hash_slot(h, hc);
+    HashEntry carry = { .hc = hc, .key = key, .value = value, .psl = 1 };
+    HashEntry* placed = NULL;
+
+    for (;; carry.psl++, i = (i + 1) & mask) {
+        HashEntry* e = &h->slots[i];
+        if (e->psl == 0) {
+            *e = carry;
+            h->size++;
+            return placed ? placed : e;
+        }
+        if (e->psl < carry.psl) {
+            // take the slot from the entry closer to home, and move that on
+            HashEntry tmp = *e;
+            *e = carry;
+            carry = tmp;
+            if (!placed) placed = e;
+        }
+    }
+}
+
+static HashEntry* hash_detach(HashEntry* e) {
+    HashEntry* copy = malloc(sizeof(HashEntry));
+    if (!copy) return NULL;
+
+    *copy = *e;
+    copy->psl = HASH_DETACHED;
+    return copy;
+}
+
 Hash* hash_new(size_t capacity, HashCodeFn hc_fn, HashCmpFn cmp_fn) {
     Hash* h = NULL;
-    HashEntry** items = NULL;
+    HashEntry* slots = NULL;
 
-    capacity = capacity < 1 ? 1 : capacity;
+    capacity = hash_capacity_for(capacity);
 
     h = malloc(sizeof(Hash));
-    items = malloc(capacity * sizeof(HashEntry*));
-
-    if (!h || !items) goto error;
+    slots = calloc(capacity, sizeof(HashEntry));
 
-    for (size_t i = 0; i < capacity; i++) items[i] = NULL;
+    if (!h || !slots) goto error;
 
     h->hc_fn = hc_fn;
     h->cmp_fn = cmp_fn;
     h->capacity = capacity;
+    h->shift = hash_shift_for(capacity);
     h->size = 0;
-    h->items = items;
+    h->slots = slots;
     return h;
 
 error:
     free(h);
-    free(items);
+    free(slots);
     errno = ENOMEM;
     return NULL;
 }
 
-HashEntry* hash_put_entry(Hash* h, HashEntry* e) {
-    size_t capacity = h->capacity;
-    size_t idx = e->hc % capacity;
-    void* key = e->key;
-
-    HashEntry** head = &h->items[idx];
-    for (HashEntry* entry = *head; entry != NULL; head = &entry->next, entry = *head) {
-        if (h->cmp_fn(entry->key, key) == 0) {
-            *head = e;
-            e->next = entry->next;
-            return entry;
-        }
-    }
-    *head = e;
-    e->next = NULL;
-    h->size++;
-    return NULL;
+HashPutResult hash_put(Hash* h, void* key, void* value) {
+    return hash_put_hc(h, key, h->hc_fn(key), value);
 }
 
-HashPutResult hash_put(Hash* h, void* key, void* value) {
+HashPutResult hash_put_hc(Hash* h, void* key, size_t hc, void* value) {
     HashPutResult result = {
         .old_entry = NULL,
         .new_entry = NULL,
         .status = HASH_STATUS_ENOMEM,
     };
 
-    result.new_entry = malloc(sizeof(HashEntry));
-    if (!result.new_entry) goto error;
-    result.new_entry->key = key;
-    result.new_entry->value = value;
-    result.new_entry->hc = h->hc_fn(key);
-    result.old_entry = hash_put_entry(h, result.new_entry);
-
-    #ifdef HASH_LOAD_FACTOR
-    float load_factor = (float)h->size / (float)h->capacity;
-    if (load_factor > HASH_LOAD_FACTOR) {
-        result.status = hash_resize(h, h->capacity * 2);
-        if (result.status != HASH_STATUS_OK) goto error;
+    HashEntry* e = hash_find(h, hc, key);
+    if (e) {
+        result.old_entry = hash_detach(e);
+        if (!result.old_entry) goto error;
+        e->key = key;
+        e->value = value;
+        result.new_entry = e;
+        result.status = HASH_STATUS_OK;
+        return result;
     }
-    #endif
 
-    result.status = HASH_STATUS_OK;
+    if ((h->size + 1) * 8 > h->capacity * HASH_LOAD_EIGHTHS) {
+        if (hash_resize(h, h->capacity * 2) != HASH_STATUS_OK) goto error;
+    }
 
+    result.new_entry = hash_insert(h, hc, key, value);
+    result.status = HASH_STATUS_OK;
     return result;
 
 error:
-    free(result.new_entry);
-    result.new_entry = NULL;
     errno = ENOMEM;
     return result;
 }
 
 HashEntry* hash_remove(Hash* h, void* key) {
-    size_t hc = h->hc_fn(key);
-    size_t capacity = h->capacity;
-    size_t idx = hc % capacity;
-
-    HashEntry** head = &h->items[idx];
-    for (HashEntry* entry = *head; entry != NULL; head = &entry->next, entry = *head) {
-        if (h->cmp_fn(entry->key, key) == 0) {
-            *head = entry->next;
-            h->size--;
-            return entry;
-        }
+    return hash_remove_hc(h, key, h->hc_fn(key));
+}
+
+// Empties the slot of an entry, which must be within the hash.
+static void hash_unlink(Hash* h, HashEntry* e) {
+    size_t mask = h->capacity - 1;
+
+    // shift the following entries back a slot, rather than leaving a tombstone
+    size_t i = e - h->slots;
+    for (;;) {
+        size_t next = (i + 1) & mask;
+        if (h->slots[next].psl <= 1) break;
+        h->slots[i] = h->slots[next];
+        h->slots[i].psl--;
+        i = next;
     }
-    return NULL;
+    h->slots[i].psl = 0;
+    h->size--;
 }
 
-HashEntry* hash_get_entry(Hash* h, void* key) {
-    size_t hc = h->hc_fn(key);
-    size_t idx = hc % h->capacity;
+HashEntry* hash_remove_hc(Hash* h, void* key, size_t hc) {
+    HashEntry* e = hash_find(h, hc, key);
+    if (!e) return NULL;
 
-    for (HashEntry* entry = h->items[idx]; entry != NULL; entry = entry->next) {
-        if (h->cmp_fn(entry->key, key) == 0) {
-            return entry;
-        }
+    HashEntry* removed = hash_detach(e);
+    if (!removed) {
+        errno = ENOMEM;
+        return NULL;
     }
-    return NULL;
+
+    hash_unlink(h, e);
+    return removed;
+}
+
+int hash_delete_hc(Hash* h, void* key, size_t hc) {
+    HashEntry* e = hash_find(h, hc, key);
+    if (!e) return 0;
+
+    hash_unlink(h, e);
+    return 1;
 }
 
 void* hash_get(Hash* h, void* key) {
-    HashEntry* e = hash_get_entry(h, key);
+    return hash_get_hc(h, key, h->hc_fn(key));
+}
+
+void* hash_get_hc(Hash* h, void* key, size_t hc) {
+    HashEntry* e = hash_find(h, hc, key);
     return e == NULL ? NULL : e->value;
 }
 
 int hash_contains_key(Hash* h, void* key) {
-    return hash_get_entry(h, key) != NULL;
+    return hash_find(h, h->hc_fn(key), key) != NULL;
 }
 
 List* hash_entries(Hash* h) {
@@ -145,9 +267,8 @@ List* hash_entries(Hash* h) {
     if (!entries) goto error;
 
     for (size_t i = 0; i < h->capacity; i++) {
-        for (HashEntry* entry = h->items[i]; entry != NULL; entry = entry->next) {
-            if (list_push(entries, entry) != LIST_STATUS_OK) goto error;
-        }
+        if (h->slots[i].psl == 0) continue;
+        if (list_push(entries, &h->slots[i]) != LIST_STATUS_OK) goto error;
     }
 
     return entries;
@@ -191,34 +312,33 @@ List* hash_values(Hash* h) {
 }
 
 HashStatusCode hash_resize(Hash* h, size_t capacity) {
-    HashEntry** new_items = NULL;
+    HashEntry* new_slots = NULL;
 
     size_t old_capacity = h->capacity;
-    HashEntry** old_items = h->items;
+    HashEntry* old_slots = h->slots;
 
-    new_items = malloc(capacity * sizeof(HashEntry*));
-    if (!new_items) goto error;
+    // never shrink below what the current entries need
+    if (capacity < h->size) capacity = h->size;
+    capacity = hash_capacity_for(capacity);
 
-    for (size_t i = 0; i < capacity; i++) new_items[i] = NULL;
+    new_slots = calloc(capacity, sizeof(HashEntry));
+    if (!new_slots) goto error;
 
     h->size = 0;
-    h->items = new_items;
+    h->slots = new_slots;
     h->capacity = capacity;
+    h->shift = hash_shift_for(capacity);
 
     for (size_t i = 0; i < old_capacity; i++) {
-        for (HashEntry* entry = old_items[i]; entry; ) {
-            HashEntry* tmp_next = entry->next;
-            entry->next = NULL;
-            hash_put_entry(h, entry);
-            entry = tmp_next;
-        }
+        HashEntry* e = &old_slots[i];
+        if (e->psl) hash_insert(h, e->hc, e->key, e->value);
     }
 
-    free(old_items);
+    free(old_slots);
     return HASH_STATUS_OK;
 
 error:
-    free(new_items);
+    free(new_slots);
     errno = ENOMEM;
     return HASH_STATUS_ENOMEM;
 }
@@ -227,8 +347,9 @@ inline size_t hash_size(Hash* h) {
     return h ? h->size : 0;
 }
 
-void hash_entry_free(HashEntry* h) {
-    free(h);
+void hash_entry_free(HashEntry* e) {
+    // entries still within a hash are freed along with it
+    if (e && e->psl == HASH_DETACHED) free(e);
 }
 
 void hash_free(Hash* h) {
@@ -237,27 +358,62 @@ void hash_free(Hash* h) {
 
 void hash_free_deep(Hash* h, HashEntryFreeFn fn) {
     if (h != NULL) {
-        HashEntry** items = h->items;
         for (size_t i = 0; i < h->capacity; i++) {
-            for (HashEntry* entry = items[i]; entry != NULL; ) {
-                HashEntry* next = entry->next;
-                fn(entry);
-                entry = next;
-            }
+            if (h->slots[i].psl) fn(&h->slots[i]);
         }
-        free(items);
+        free(h->slots);
     }
     free(h);
 }
 
-size_t hash_code_str(void* val) {
-    char* str = (char*)val;
-    size_t hc = 0;
-    for (size_t i = 0; i < strlen(str); i++) {
-        hc *= 7;
-        hc += str[i];
+// wyhash (final version 4), which reads the input eight or sixteen bytes at a
+// time and mixes with a single 64x64 to 128 bit multiply per step.
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = data;
+    uint64_t a = 0;
+    uint64_t b = 0;
+
+    seed ^= hash_wymix(seed ^ hash_wyp[0], hash_wyp[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (hash_wyr4(p) << 32) | hash_wyr4(p + ((len >> 3) << 2));
+            b = (hash_wyr4(p + len - 4) << 32) | hash_wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = hash_wyr3(p, len);
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do {
+                seed = hash_wymix(hash_wyr8(p) ^ hash_wyp[1], hash_wyr8(p + 8) ^ seed);
+                see1 = hash_wymix(hash_wyr8(p + 16) ^ hash_wyp[2], hash_wyr8(p + 24) ^ see1);
+                see2 = hash_wymix(hash_wyr8(p + 32) ^ hash_wyp[3], hash_wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = hash_wymix(hash_wyr8(p) ^ hash_wyp[1], hash_wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = hash_wyr8(p + i - 16);
+        b = hash_wyr8(p + i - 8);
     }
-    return hc;
+
+    a ^= hash_wyp[1];
+    b ^= seed;
+    hash_wymum(&a, &b);
+    return hash_wymix(a ^ hash_wyp[0] ^ len, b ^ hash_wyp[1]);
+}
+
+size_t hash_code_str(void* val) {
+    const char* str = val;
+    return (size_t)hash_bytes(str, strlen(str), HASH_STR_SEED);
 }
 
 inline int hash_cmp_str(void* a, void* b) {
@@ -6,6 +6,8 @@
 #ifndef _HASH_H_
 #define _HASH_H_
 
+#include <stdint.h>
+
 #include "list.h"
 
 /**
@@ -51,7 +53,7 @@ typedef struct HashEntry HashEntry;
  */
 typedef struct {
     HashEntry* old_entry;  ///< The prior entry for this key, or NULL if empty
-    HashEntry* new_entry;  ///< The new hash entry created
+    HashEntry* new_entry;  ///< The new entry, valid until the hash is modified
     HashStatusCode status; ///< Status of the hash_put operation
 } HashPutResult;
 
@@ -71,10 +73,13 @@ typedef void (*HashEntryFreeFn)(HashEntry* entry);
  * Allocate a new hash.
  * Implements a hash table for efficiently storing key/value pairs.
  * Amortized expansion when the capacity reaches a defined load capacity.
- * The put/get/remove operations are constant time in best cases but degrade
- * into linear time when collissions occur. Collissions are stored in a linked
- * list and searched linearly. Free it with hash_free when you're done.
- * @param capacity  initial hash capacity
+ * Entries are stored inline in a single array using open addressing with
+ * Robin Hood probing, so the put/get/remove operations are constant time on
+ * average and do not allocate, other than to expand the hash or to return a
+ * replaced or removed entry. Hash codes are cached with each entry, so keys
+ * are only compared when their hash codes match. Free it with hash_free when
+ * you're done.
+ * @param capacity  number of entries to make room for initially
  * @param hc_fn     hash code function to use when inserting into the hash
  * @param cmp_fn    equality function to use when hash collisions occur
  * @return          pointer to the new Hash, or NULL in case of failure
@@ -99,15 +104,46 @@ size_t hash_size(Hash* h);
  */
 HashPutResult hash_put(Hash* h, void* key, void* value);
 
+/**
+ * Insert or replace the value for a specific key, whose hash code is already
+ * known. Saves hashing the key again, like when it is cached with the key.
+ * @param h      hash to operate on
+ * @param key    to update in the map
+ * @param hc     hash code of the key, as returned by the hash's HashCodeFn
+ * @param value  to update in the map
+ * @return       struct containing the result of the operation
+ */
+HashPutResult hash_put_hc(Hash* h, void* key, size_t hc, void* value);
+
 /**
  * Remove and return the entry for the specific key. This operation does not
  * free the hash entry, so use hash_free_entry when you are done.
  * @param h    hash to operate on
  * @param key  key for the entry to remove
- * @return     the removed hash entry, or NULL if there was none
+ * @return     the removed hash entry, or NULL if there was none or the entry
+ *             could not be allocated, in which case the hash is unchanged
  */
 HashEntry* hash_remove(Hash* h, void* key);
 
+/**
+ * Remove and return the entry for a key whose hash code is already known.
+ * @param h    hash to operate on
+ * @param key  key for the entry to remove
+ * @param hc   hash code of the key, as returned by the hash's HashCodeFn
+ * @return     the removed hash entry, as hash_remove
+ */
+HashEntry* hash_remove_hc(Hash* h, void* key, size_t hc);
+
+/**
+ * Remove the entry for a key whose hash code is already known, without
+ * returning it. Nothing is allocated, so this cannot fail.
+ * @param h    hash to operate on
+ * @param key  key for the entry to remove
+ * @param hc   hash code of the key, as returned by the hash's HashCodeFn
+ * @return     truthy if the key was present
+ */
+int hash_delete_hc(Hash* h, void* key, size_t hc);
+
 /**
  * Retrieve the value for the specified hash key.
  * @param h    hash to operate on
@@ -116,6 +152,15 @@ HashEntry* hash_remove(Hash* h, void* key);
  */
 void* hash_get(Hash* h, void* key);
 
+/**
+ * Retrieve the value for a key whose hash code is already known.
+ * @param h    hash to operate on
+ * @param key  to retrieve
+ * @param hc   hash code of the key, as returned by the hash's HashCodeFn
+ * @return     value for the key, or NULL if the key is not present
+ */
+void* hash_get_hc(Hash* h, void* key, size_t hc);
+
 /**
  * Check if the hash contains a specific key.
  * @param h    hash to operate on
@@ -125,9 +170,10 @@ void* hash_get(Hash* h, void* key);
 int hash_contains_key(Hash* h, void* key);
 
 /**
- * Resizes the internal capacity of the hash.
+ * Resizes the internal capacity of the hash. Never shrinks it below what the
+ * current entries need.
  * @param h         hash to resize
- * @param capacity  new capacity for the hash
+ * @param capacity  number of entries to make room for
  * @return          hash status
  */
 HashStatusCode hash_resize(Hash* h, size_t capacity);
@@ -147,7 +193,8 @@ void* hash_entry_key(HashEntry* e);
 void* hash_entry_value(HashEntry* e);
 
 /**
- * Retrieve a list of all HashEntry entries present in the hash.
+ * Retrieve a list of all HashEntry entries present in the hash. The entries
+ * belong to the hash and are only valid until it is next modified.
  * This allocats a new list, free it with list_free when you're done.
  * @param h  hash to operate on
  * @return   list of HashEntry, or NULL if an error occurred
@@ -177,6 +224,16 @@ List* hash_values(Hash* h);
  */
 Hash* hash_new_str(size_t capacity);
 
+/**
+ * Hash a block of bytes with wyhash, a fast, well distributed hash which
+ * processes eight bytes at a time. Not suitable for cryptographic use.
+ * @param data  bytes to hash
+ * @param len   number of bytes to hash
+ * @param seed  seed to vary the hash codes by
+ * @return      hash code
+ */
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed);
+
 /**
  * HashCodeFn for string values.
  * @param val  string to calculate a hash code for
@@ -202,7 +259,8 @@ void hash_free(Hash* h);
 /**
  * Free an individual HashEntry. Use it with hash_put and hash_remove to free
  * any replaced/removed entries from those functions. This does not free any
- * keys or values contiained in the hash.
+ * keys or values contiained in the hash. Entries still within a hash, like
+ * those passed to the hash_free_deep callback, are left to the hash.
  * @param h  hash entry to free
  */
 void hash_entry_free(HashEntry* h);
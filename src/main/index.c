@@ -0,0 +1,325 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "fs.h"
+#include "str.h"
+
+#define INDEX_MAGIC "MTPSIDX"
+#define INDEX_VERSION 4
+#define INDEX_INIT_SIZE 512
+
+// header flags
+#define INDEX_FLAG_STALE 0x1
+
+// record flags
+#define INDEX_RECORD_FOLDER 0x1
+#define INDEX_RECORD_LOADED 0x2
+
+typedef struct {
+    char magic[8];          // INDEX_MAGIC, null terminated
+    uint32_t version;       // INDEX_VERSION
+    uint32_t flags;         // INDEX_FLAG_* bits
+    uint64_t free_space;    // Storage free space when the index was saved
+    uint64_t max_capacity;  // Storage capacity when the index was saved
+    uint64_t count;         // Number of records following the header
+    uint64_t strings_size;  // Size of the string table following the records
+} IndexHeader;
+
+typedef struct {
+    uint32_t id;           // Object ID on the device
+    uint32_t parent_id;    // Object ID of the parent folder
+    uint64_t size;         // Size of the object in bytes
+    int64_t mtime;         // Modification time of the object, zero if unknown
+    uint32_t flags;        // INDEX_RECORD_* bits
+    uint32_t path_offset;  // Offset of the path within the string table
+} IndexRecord;
+
+struct DeviceIndex {
+    void* map;                   // Mapped index file
+    size_t map_size;             // Size of the mapping
+    const IndexHeader* header;   // Header at the start of the mapping
+    const IndexRecord* records;  // Records following the header
+    const char* strings;         // String table following the records
+};
+
+struct IndexWriter {
+    IndexHeader header;    // Header to write
+    IndexRecord* records;  // Records accumulated so far
+    size_t capacity;       // Capacity of the records array
+    char* strings;         // String table accumulated so far
+    size_t strings_cap;    // Capacity of the string table
+};
+
+static char* index_dir() {
+    char* dir = getenv("MTPSYNC_CACHE_DIR");
+    if (dir && *dir) return strdup(dir);
+
+    dir = getenv("XDG_CACHE_HOME");
+    if (dir && *dir) return fs_path_join(dir, "mtpsync");
+
+    dir = getenv("HOME");
+    if (dir && *dir) return str_join(2, dir, "/.cache/mtpsync");
+
+    return NULL;
+}
+
+char* index_cache_path(const char* name) {
+    char* dir = index_dir();
+    if (!dir) return NULL;
+
+    char* path = fs_path_join(dir, name);
+    free(dir);
+    return path;
+}
+
+char* index_path(const char* serial, uint32_t storage_id) {
+    char* name = NULL;
+    char* path = NULL;
+
+    name = malloc(strlen(serial) + 16);
+    if (!name) goto done;
+
+    // keep the serial number from escaping the cache directory
+    size_t i = 0;
+    for (; serial[i]; i++) {
+        char c = serial[i];
+        int safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        name[i] = safe ? c : '_';
+    }
+    sprintf(name+i, "-%08x.idx", storage_id);
+
+    path = index_cache_path(name);
+
+done:
+    free(name);
+    return path;
+}
+
+DeviceIndex* index_open(const char* path) {
+    DeviceIndex* idx = NULL;
+    void* map = MAP_FAILED;
+    int fd = -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) goto error;
+
+    struct stat s;
+    if (fstat(fd, &s) != 0) goto error;
+    if ((size_t)s.st_size < sizeof(IndexHeader)) goto error;
+
+    map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) goto error;
+
+    const IndexHeader* h = map;
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) goto error;
+    if (h->version != INDEX_VERSION) goto error;
+
+    // sizes are checked against what remains, as their sum could wrap around
+    size_t records_size = h->count * sizeof(IndexRecord);
+    if (h->count > s.st_size / sizeof(IndexRecord)) goto error;
+    if (records_size > (size_t)s.st_size - sizeof(IndexHeader)) goto error;
+    if (h->strings_size != (size_t)s.st_size - sizeof(IndexHeader) - records_size) goto error;
+
+    const IndexRecord* records = (const IndexRecord*)(h + 1);
+    const char* strings = (const char*)(records + h->count);
+
+    // all paths must be terminated within the string table
+    if (h->count && (!h->strings_size || strings[h->strings_size-1])) goto error;
+    for (size_t i = 0; i < h->count; i++) {
+        if (records[i].path_offset >= h->strings_size) goto error;
+    }
+
+    idx = malloc(sizeof(DeviceIndex));
+    if (!idx) goto error;
+    idx->map = map;
+    idx->map_size = s.st_size;
+    idx->header = h;
+    idx->records = records;
+    idx->strings = strings;
+
+    close(fd);
+    return idx;
+
+error:
+    if (map != MAP_FAILED) munmap(map, s.st_size);
+    if (fd >= 0) close(fd);
+    free(idx);
+    return NULL;
+}
+
+IndexFingerprint index_fingerprint(DeviceIndex* idx) {
+    IndexFingerprint fp = {
+        .free_space = idx->header->free_space,
+        .max_capacity = idx->header->max_capacity,
+        .is_stale = (idx->header->flags & INDEX_FLAG_STALE) != 0,
+    };
+    return fp;
+}
+
+inline size_t index_size(DeviceIndex* idx) {
+    return idx ? idx->header->count : 0;
+}
+
+IndexEntry index_get(DeviceIndex* idx, size_t i) {
+    const IndexRecord* r = &idx->records[i];
+    IndexEntry e = {
+        .id = r->id,
+        .parent_id = r->parent_id,
+        .size = r->size,
+        .mtime = r->mtime,
+        .is_folder = (r->flags & INDEX_RECORD_FOLDER) != 0,
+        .is_loaded = (r->flags & INDEX_RECORD_LOADED) != 0,
+        .path = idx->strings + r->path_offset,
+    };
+    return e;
+}
+
+void index_close(DeviceIndex* idx) {
+    if (idx) munmap(idx->map, idx->map_size);
+    free(idx);
+}
+
+IndexWriter* index_writer_new(IndexFingerprint fp) {
+    IndexWriter* w = NULL;
+
+    w = calloc(1, sizeof(IndexWriter));
+    if (!w) goto error;
+
+    w->records = malloc(INDEX_INIT_SIZE * sizeof(IndexRecord));
+    if (!w->records) goto error;
+    w->capacity = INDEX_INIT_SIZE;
+
+    w->strings = malloc(INDEX_INIT_SIZE * 32);
+    if (!w->strings) goto error;
+    w->strings_cap = INDEX_INIT_SIZE * 32;
+
+    memcpy(w->header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    w->header.version = INDEX_VERSION;
+    w->header.flags = fp.is_stale ? INDEX_FLAG_STALE : 0;
+    w->header.free_space = fp.free_space;
+    w->header.max_capacity = fp.max_capacity;
+
+    return w;
+
+error:
+    index_writer_free(w);
+    return NULL;
+}
+
+IndexStatusCode index_writer_add(IndexWriter* w, IndexEntry* e) {
+    size_t path_len = strlen(e->path) + 1;
+    size_t offset = w->header.strings_size;
+
+    if (offset + path_len > UINT32_MAX) return INDEX_STATUS_EFAIL;
+
+    if (w->header.count == w->capacity) {
+        IndexRecord* records = realloc(w->records, 2 * w->capacity * sizeof(IndexRecord));
+        if (!records) return INDEX_STATUS_ENOMEM;
+        w->records = records;
+        w->capacity *= 2;
+    }
+
+    if (offset + path_len > w->strings_cap) {
+        size_t cap = 2 * (offset + path_len);
+        char* strings = realloc(w->strings, cap);
+        if (!strings) return INDEX_STATUS_ENOMEM;
+        w->strings = strings;
+        w->strings_cap = cap;
+    }
+
+    memcpy(w->strings + offset, e->path, path_len);
+    w->header.strings_size += path_len;
+
+    IndexRecord* r = &w->records[w->header.count++];
+    memset(r, 0, sizeof(IndexRecord));
+    r->id = e->id;
+    r->parent_id = e->parent_id;
+    r->size = e->size;
+    r->mtime = e->mtime;
+    r->flags = e->is_folder ? INDEX_RECORD_FOLDER : 0;
+    if (e->is_loaded) r->flags |= INDEX_RECORD_LOADED;
+    r->path_offset = offset;
+
+    return INDEX_STATUS_OK;
+}
+
+IndexStatusCode index_writer_save(IndexWriter* w, const char* path) {
+    IndexStatusCode code = INDEX_STATUS_EFAIL;
+    char* dir = NULL;
+    char* tmp_path = NULL;
+    int fd = -1;
+
+    dir = fs_dirname((char*)path);
+    if (!dir) goto done;
+    if (fs_mkdirp(dir) != FS_STATUS_OK) goto done;
+
+    tmp_path = str_join(2, path, ".tmp");
+    if (!tmp_path) goto done;
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) goto done;
+
+    if (fs_write_all(fd, &w->header, sizeof(IndexHeader)) != 0) goto done;
+    if (fs_write_all(fd, w->records, w->header.count * sizeof(IndexRecord)) != 0) goto done;
+    if (fs_write_all(fd, w->strings, w->header.strings_size) != 0) goto done;
+
+    if (close(fd) != 0) {
+        fd = -1;
+        goto done;
+    }
+    fd = -1;
+
+    if (rename(tmp_path, path) != 0) goto done;
+
+    code = INDEX_STATUS_OK;
+
+done:
+    if (fd >= 0) close(fd);
+    if (code != INDEX_STATUS_OK && tmp_path) unlink(tmp_path);
+    free(tmp_path);
+    free(dir);
+    return code;
+}
+
+void index_writer_free(IndexWriter* w) {
+    if (w) {
+        free(w->records);
+        free(w->strings);
+    }
+    free(w);
+}
+
+IndexStatusCode index_stamp(const char* path, IndexFingerprint fp) {
+    IndexStatusCode code = INDEX_STATUS_EFAIL;
+    IndexHeader h;
+    int fd = -1;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) goto done;
+
+    if (pread(fd, &h, sizeof(IndexHeader), 0) != sizeof(IndexHeader)) goto done;
+    if (memcmp(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) goto done;
+    if (h.version != INDEX_VERSION) goto done;
+
+    if (h.flags & INDEX_FLAG_STALE) {
+        h.flags &= ~INDEX_FLAG_STALE;
+        h.free_space = fp.free_space;
+        h.max_capacity = fp.max_capacity;
+        if (pwrite(fd, &h, sizeof(IndexHeader), 0) != sizeof(IndexHeader)) goto done;
+    }
+
+    code = INDEX_STATUS_OK;
+
+done:
+    if (fd >= 0 && close(fd) != 0) code = INDEX_STATUS_EFAIL;
+    return code;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file index.h
+ * Persistent on-disk index of the files on an MTP storage volume. The index is
+ * a compact binary snapshot which is memory mapped when read, so a warm start
+ * does not need to walk the entire device.
+ */
+
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Status codes for index operations.
+ */
+typedef enum {
+    INDEX_STATUS_OK,      ///< Operation successful
+    INDEX_STATUS_EFAIL,   ///< Failed due to a general runtime error
+    INDEX_STATUS_ENOMEM,  ///< Failed due to allocation error
+} IndexStatusCode;
+
+/**
+ * Cheap summary of the storage volume state, used to detect whether the
+ * index is still valid for the attached device.
+ */
+typedef struct {
+    uint64_t free_space;    ///< Free space of the storage in bytes
+    uint64_t max_capacity;  ///< Total capacity of the storage in bytes
+    int is_stale;           ///< Truthy if free_space is not known to be current
+} IndexFingerprint;
+
+/**
+ * A single file or folder recorded in the index.
+ */
+typedef struct {
+    uint32_t id;         ///< Unique ID of the file on the device
+    uint32_t parent_id;  ///< ID of the parent folder, zero for the root folder
+    uint64_t size;       ///< Size of the file in bytes
+    int64_t mtime;       ///< Time the file was last modified, zero if unknown
+    int is_folder;       ///< Truthy if this represents a folder
+    int is_loaded;       ///< Truthy if all children of the folder are indexed
+    const char* path;    ///< Full, canonical path of the file
+} IndexEntry;
+
+/**
+ * A read-only, memory mapped index. Use index_open to create one.
+ */
+typedef struct DeviceIndex DeviceIndex;
+
+/**
+ * Accumulates entries for a new index. Use index_writer_new to create one.
+ */
+typedef struct IndexWriter IndexWriter;
+
+/**
+ * Determine the path of a file in the cache directory. The directory is taken
+ * from $MTPSYNC_CACHE_DIR, $XDG_CACHE_HOME/mtpsync or $HOME/.cache/mtpsync, in
+ * that order. Allocates the result on the heap, free it when done.
+ * @param name  name of the file within the cache directory
+ * @return      path of the file, or NULL if none can be determined
+ */
+char* index_cache_path(const char* name);
+
+/**
+ * Determine where the index for a specific device and storage is kept. The
+ * directory is taken from $MTPSYNC_CACHE_DIR, $XDG_CACHE_HOME/mtpsync or
+ * $HOME/.cache/mtpsync, in that order. Allocates the result on the heap, free
+ * it when done.
+ * @param serial      serial number of the device
+ * @param storage_id  ID of the storage volume
+ * @return            path of the index file, or NULL if none can be determined
+ */
+char* index_path(const char* serial, uint32_t storage_id);
+
+/**
+ * Open and map an existing index. Returns NULL if the index does not exist or
+ * is not valid. Close it with index_close when done.
+ * @param path  path of the index file
+ * @return      the mapped index, or NULL if unavailable
+ */
+DeviceIndex* index_open(const char* path);
+
+/**
+ * Retrieve the storage fingerprint recorded with the index.
+ * @param idx  index to operate on
+ * @return     the recorded fingerprint
+ */
+IndexFingerprint index_fingerprint(DeviceIndex* idx);
+
+/**
+ * Retrieve the number of entries in the index.
+ * @param idx  index to operate on
+ * @return     number of entries
+ */
+size_t index_size(DeviceIndex* idx);
+
+/**
+ * Retrieve an entry from the index. The path of the entry points in to the
+ * mapped index and is only valid until index_close is called.
+ * @param idx  index to operate on
+ * @param i    position of the entry
+ * @return     the entry at the position
+ */
+IndexEntry index_get(DeviceIndex* idx, size_t i);
+
+/**
+ * Unmap and free an index.
+ * @param idx  index to close
+ */
+void index_close(DeviceIndex* idx);
+
+/**
+ * Create a writer for a new index. Free it with index_writer_free when done.
+ * @param fp  fingerprint of the storage the entries were read from
+ * @return    new writer, or NULL in case of failure
+ */
+IndexWriter* index_writer_new(IndexFingerprint fp);
+
+/**
+ * Append an entry to the index. The path is copied.
+ * @param w  writer to append to
+ * @param e  entry to append
+ * @return   status code of the operation
+ */
+IndexStatusCode index_writer_add(IndexWriter* w, IndexEntry* e);
+
+/**
+ * Write the index to disk. The file is replaced atomically, and any missing
+ * parent directories are created.
+ * @param w     writer to save
+ * @param path  path of the index file
+ * @return      status code of the operation
+ */
+IndexStatusCode index_writer_save(IndexWriter* w, const char* path);
+
+/**
+ * Free an index writer.
+ * @param w  writer to free
+ */
+void index_writer_free(IndexWriter* w);
+
+/**
+ * Update the fingerprint of an existing index in place, if and only if the
+ * index was saved with a stale fingerprint.
+ * @param path  path of the index file
+ * @param fp    current fingerprint of the storage
+ * @return      status code of the operation
+ */
+IndexStatusCode index_stamp(const char* path, IndexFingerprint fp);
+
+#endif
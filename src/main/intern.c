@@ -0,0 +1,160 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "intern.h"
+
+#define INTERN_INIT_SIZE 1024
+
+#define INTERN_OF(p) ((InternPath*)((p) - offsetof(InternPath, path)))
+
+typedef struct InternPath {
+    size_t refs;                // Number of references to the path
+    size_t hc;                  // Hash code of the path
+    struct InternPath* parent;  // Parent folder, NULL for the root folder
+    char path[];                // The path itself
+} InternPath;
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Interned paths by path, freed once the pool is empty
+static Hash* intern_paths = NULL;
+
+static InternPath* intern_locked(const char* path);
+
+static void intern_release_locked(InternPath* ip) {
+    while (ip && --ip->refs == 0) {
+        InternPath* parent = ip->parent;
+        // the path must leave the pool before it is freed, which cannot fail
+        // when nothing is allocated to remove it
+        hash_delete_hc(intern_paths, ip->path, ip->hc);
+        free(ip);
+        ip = parent;
+    }
+
+    if (hash_size(intern_paths) == 0) {
+        hash_free(intern_paths);
+        intern_paths = NULL;
+    }
+}
+
+static InternPath* intern_new_locked(const char* path, size_t hc) {
+    InternPath* ip = NULL;
+    size_t len = strlen(path);
+
+    ip = malloc(sizeof(InternPath) + len + 1);
+    if (!ip) goto error;
+
+    memcpy(ip->path, path, len + 1);
+    ip->refs = 1;
+    ip->hc = hc;
+    ip->parent = NULL;
+
+    char* slash = strrchr(ip->path, '/');
+    if (slash == ip->path && slash[1]) {
+        ip->parent = intern_locked("/");
+        if (!ip->parent) goto error;
+    } else if (slash && slash != ip->path) {
+        // look the parent up in place, rather than copying it
+        *slash = 0;
+        ip->parent = intern_locked(ip->path);
+        *slash = '/';
+        if (!ip->parent) goto error;
+    }
+
+    HashPutResult r = hash_put_hc(intern_paths, ip->path, hc, ip);
+    if (r.status != HASH_STATUS_OK) goto error;
+
+    return ip;
+
+error:
+    if (ip) intern_release_locked(ip->parent);
+    free(ip);
+    errno = ENOMEM;
+    return NULL;
+}
+
+static InternPath* intern_locked(const char* path) {
+    size_t hc = hash_code_str((void*)path);
+
+    if (!intern_paths) {
+        intern_paths = hash_new_str(INTERN_INIT_SIZE);
+        if (!intern_paths) return NULL;
+    }
+
+    InternPath* ip = hash_get_hc(intern_paths, (void*)path, hc);
+    if (ip) {
+        ip->refs++;
+        return ip;
+    }
+
+    return intern_new_locked(path, hc);
+}
+
+char* intern_path(const char* path) {
+    pthread_mutex_lock(&intern_lock);
+    InternPath* ip = intern_locked(path);
+    if (!ip && hash_size(intern_paths) == 0) {
+        hash_free(intern_paths);
+        intern_paths = NULL;
+    }
+    pthread_mutex_unlock(&intern_lock);
+    return ip ? ip->path : NULL;
+}
+
+// Releases the paths held by an arena, taking the lock once for all of them.
+static void intern_release_batch(void** paths, size_t n) {
+    pthread_mutex_lock(&intern_lock);
+    for (size_t i = 0; i < n; i++) intern_release_locked(INTERN_OF((char*)paths[i]));
+    pthread_mutex_unlock(&intern_lock);
+}
+
+static char* intern_hold(Arena* a, char* path) {
+    if (path && arena_defer_batch(a, intern_release_batch, path) != ARENA_STATUS_OK) {
+        intern_release(path);
+        return NULL;
+    }
+    return path;
+}
+
+char* intern_path_arena(Arena* a, const char* path) {
+    return intern_hold(a, intern_path(path));
+}
+
+char* intern_ref_arena(Arena* a, char* path) {
+    return intern_hold(a, intern_ref(path));
+}
+
+char* intern_ref(char* path) {
+    pthread_mutex_lock(&intern_lock);
+    INTERN_OF(path)->refs++;
+    pthread_mutex_unlock(&intern_lock);
+    return path;
+}
+
+void intern_release(char* path) {
+    if (!path) return;
+
+    pthread_mutex_lock(&intern_lock);
+    intern_release_locked(INTERN_OF(path));
+    pthread_mutex_unlock(&intern_lock);
+}
+
+char* intern_parent(char* path) {
+    InternPath* parent = INTERN_OF(path)->parent;
+    return parent ? parent->path : NULL;
+}
+
+size_t intern_hc(char* path) {
+    return INTERN_OF(path)->hc;
+}
+
+size_t intern_size() {
+    pthread_mutex_lock(&intern_lock);
+    size_t size = hash_size(intern_paths);
+    pthread_mutex_unlock(&intern_lock);
+    return size;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file intern.h
+ * Process-wide pool of canonical paths. Each distinct path is stored once and
+ * shared by every File, DeviceFile and SyncSpec referring to it, so interned
+ * paths are equal if and only if they are the same pointer. Interned paths are
+ * reference counted, and each one holds a reference to its parent folder, so
+ * walking up a path never allocates. The pool is safe to use from multiple
+ * threads.
+ */
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stddef.h>
+
+#include "arena.h"
+
+/**
+ * Intern a path, adding it to the pool if it is not there already. Release the
+ * result with intern_release when done. Interned paths must not be modified.
+ * @param path  canonical path to intern, will be copied if new
+ * @return      the interned path, or NULL in case of failure
+ */
+char* intern_path(const char* path);
+
+/**
+ * Intern a path, holding the reference until an arena is freed.
+ * @param a     arena to hold the reference
+ * @param path  canonical path to intern, will be copied if new
+ * @return      the interned path, or NULL in case of failure
+ */
+char* intern_path_arena(Arena* a, const char* path);
+
+/**
+ * Take another reference to an interned path. Release it with
+ * intern_release when done.
+ * @param path  interned path
+ * @return      the same path
+ */
+char* intern_ref(char* path);
+
+/**
+ * Take another reference to an interned path, holding it until an arena is
+ * freed.
+ * @param a     arena to hold the reference
+ * @param path  interned path
+ * @return      the same path, or NULL in case of failure
+ */
+char* intern_ref_arena(Arena* a, char* path);
+
+/**
+ * Release a reference to an interned path. The path is removed from the pool
+ * once the last reference to it is released. Accepts NULL.
+ * @param path  interned path to release
+ */
+void intern_release(char* path);
+
+/**
+ * Get the parent folder of an interned path, without taking a reference. The
+ * parent remains valid for as long as the path itself.
+ * @param path  interned path
+ * @return      interned path of the parent, or NULL for the root folder
+ */
+char* intern_parent(char* path);
+
+/**
+ * Get the hash code of an interned path, as returned by hash_code_str.
+ * @param path  interned path
+ * @return      cached hash code of the path
+ */
+size_t intern_hc(char* path);
+
+/**
+ * Retrieve the number of distinct paths in the pool.
+ * @return  number of interned paths
+ */
+size_t intern_size();
+
+#endif
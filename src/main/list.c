@@ -184,6 +184,36 @@ inline void* list_set(List* l, size_t i, void* it) {
     return tmp;
 }
 
+ListStatusCode list_insert(List* l, size_t i, void* item) {
+    if (i > l->size) i = l->size;
+
+    if (l->size == l->capacity) {
+        if (list_resize(l, l->capacity * 2) != LIST_STATUS_OK) goto error;
+    }
+
+    l->size++;
+    for (size_t j = l->size - 1; j > i; j--) {
+        list_set(l, j, list_get(l, j - 1));
+    }
+    list_set(l, i, item);
+    return LIST_STATUS_OK;
+
+error:
+    errno = ENOMEM;
+    return LIST_STATUS_ENOMEM;
+}
+
+void* list_remove(List* l, size_t i) {
+    if (!list_valid_index(l, i)) return NULL;
+
+    void* item = list_get(l, i);
+    for (size_t j = i; j + 1 < l->size; j++) {
+        list_set(l, j, list_get(l, j + 1));
+    }
+    l->size--;
+    return item;
+}
+
 void list_free(List* l) {
     if (l != NULL) {
         free(l->items);
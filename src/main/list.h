@@ -186,6 +186,27 @@ void* list_get(List* l, size_t i);
  */
 void* list_set(List* l, size_t i, void* item);
 
+/**
+ * Insert an item at a specific index, moving later items back by one.
+ * May expand the size of the list if the capacity is less than the
+ * new size. Check the return status to make sure it worked.
+ * O(n) time to move the later items.
+ * @param l     list to insert in to
+ * @param i     index to insert at, at most the size of the list
+ * @param item  to insert in to the list
+ * @return      list status
+ */
+ListStatusCode list_insert(List* l, size_t i, void* item);
+
+/**
+ * Remove the item at a specific index, moving later items forward by one.
+ * O(n) time to move the later items.
+ * @param l  list to remove from
+ * @param i  index to remove
+ * @return   the removed item, or NULL if the index is out of range
+ */
+void* list_remove(List* l, size_t i);
+
 /**
  * Free the list. Does not free individual items.
  * @param l  list to free
@@ -1,21 +1,30 @@
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <libmtp.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "device.h"
 #include "mtp.h"
-#include "str.h"
 #include "fs.h"
+#include "intern.h"
 #include "list.h"
 #include "array.h"
+#include "progress.h"
+#include "queue.h"
+#include "resume.h"
+#include "ring.h"
+
+#define MTP_RESOLVE_INIT_SIZE 64
 
 typedef struct {
     MtpStatusCode status;
@@ -147,13 +156,19 @@ error:
 }
 
 static inline int mtp_progress(const uint64_t sent, const uint64_t total, void const * const data) {
-    MtpOperationData* op = (MtpOperationData*)data;
-    int percent = (sent*100)/total;
-    printf("\33[2K\r%s: %s: %d%%", op->name, op->file, percent);
-    fflush(stdout);
+    progress_update((Progress*)data, sent, total);
     return 0;
 }
 
+// Prints and clears the errors of a device, without output of other devices in
+// between, since libmtp prints them to stderr itself.
+static void mtp_dump_errors(Progress* progress, LIBMTP_mtpdevice_t* device) {
+    progress_hold(progress);
+    LIBMTP_Dump_Errorstack(device);
+    LIBMTP_Clear_Errorstack(device);
+    progress_release(progress);
+}
+
 static inline int match_device(Device* dev, MtpArgs* params) {
     int device_match = 1;
     int storage_match = 1;
@@ -181,11 +196,165 @@ static inline int match_device(Device* dev, MtpArgs* params) {
     return device_match && storage_match;
 }
 
-MtpStatusCode mtp_each_device(MtpDeviceFn callback, MtpArgs* params, void* data) {
+static void mtp_stamp_indexes(LIBMTP_mtpdevice_t* device, int number) {
+    Device* d = NULL;
+
+    // storage info must be read again to learn the free space after changes
+    if (LIBMTP_Get_Storage(device, LIBMTP_STORAGE_SORTBY_NOTSORTED) != 0) {
+        LIBMTP_Clear_Errorstack(device);
+        return;
+    }
+
+    for (LIBMTP_devicestorage_t* storage = device->storage; storage != 0; storage = storage->next) {
+        d = device_new(number, device, storage);
+        if (d && device_stamp(d) != DEVICE_STATUS_OK) {
+            fprintf(stderr, "Failed to update device index: %s\n", d->index_path);
+        }
+        device_free(d);
+    }
+}
+
+// Runs the callback for each matching storage of a raw device, counting the
+// storages matched.
+static MtpStatusCode mtp_each_storage(MtpDeviceFn callback, MtpArgs* params, void* data, LIBMTP_raw_device_t* raw_device, int i, Progress* progress, int* matched) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
     LIBMTP_mtpdevice_t* device = NULL;
     Device* d = NULL;
 
+    device = mtp_open_raw_device(raw_device, i);
+    if (!device) return MTP_STATUS_EDEVICE;
+
+    int is_changed = 0;
+    for (LIBMTP_devicestorage_t* storage = device->storage; storage != 0; storage = storage->next) {
+        d = device_new(i, device, storage);
+        if (!d) goto done;
+
+        d->rescan = params->rescan;
+        d->progress = progress;
+
+        if (match_device(d, params)) {
+            (*matched)++;
+            MtpStatusCode callback_status = callback(d, data);
+
+            // keep the index in sync with any changes, even after failure
+            is_changed = is_changed || d->is_modified;
+            device_save(d);
+
+            if (callback_status != MTP_STATUS_OK) {
+                code = callback_status;
+                goto done;
+            }
+        }
+
+        device_free(d);
+        d = NULL;
+    }
+
+    if (is_changed) mtp_stamp_indexes(device, i);
+
+    code = MTP_STATUS_OK;
+
+done:
+    device_free(d);
+    mtp_release_device(device);
+    return code;
+}
+
+typedef struct {
+    LIBMTP_raw_device_t* raw_device;  // Device to run the callback for
+    int number;                       // Number of the device
+    Progress* progress;               // Reports on this device alone
+    int matched;                      // Number of storages matched
+    MtpStatusCode code;               // Status once the device is done
+} MtpDeviceJob;
+
+typedef struct {
+    MtpDeviceFn callback;  // Runs for each storage
+    MtpArgs* args;         // Selects the devices and storages
+    void* data;            // Passed to the callback
+    Queue* jobs;           // Devices waiting for a thread
+} MtpDevicePool;
+
+static void* mtp_device_thread(void* data) {
+    MtpDevicePool* p = data;
+    MtpDeviceJob* job = NULL;
+
+    while (queue_pop(p->jobs, (void**)&job) == QUEUE_STATUS_OK) {
+        job->code = mtp_each_storage(p->callback, p->args, p->data, job->raw_device, job->number, job->progress, &job->matched);
+        if (job->code != MTP_STATUS_OK) progress_log(job->progress, "Failed, continuing with the other devices.\n");
+    }
+
+    return NULL;
+}
+
+// Runs the devices on several threads. A device which fails does not stop the
+// others, the first failure is returned once every device is done.
+static MtpStatusCode mtp_each_device_pool(MtpDeviceFn callback, MtpArgs* params, void* data, MtpRawDevices* raw_devices, Progress* progress, size_t threads) {
+    MtpStatusCode code = MTP_STATUS_ENOMEM;
+    MtpDevicePool p = { .callback = callback, .args = params, .data = data, .jobs = NULL };
+    MtpDeviceJob* jobs = NULL;
+    pthread_t* pool = NULL;
+    size_t started = 0;
+    size_t n = raw_devices->count;
+
+    jobs = calloc(n, sizeof(MtpDeviceJob));
+    pool = calloc(threads, sizeof(pthread_t));
+    p.jobs = queue_new(n);
+    if (!jobs || !pool || !p.jobs) goto done;
+
+    for (size_t i = 0; i < n; i++) {
+        char name[32];
+        sprintf(name, "Device %zu", i);
+
+        jobs[i].raw_device = &raw_devices->devices[i];
+        jobs[i].number = i;
+        jobs[i].progress = progress_new_child(progress, name);
+        if (!jobs[i].progress) goto done;
+
+        if (queue_push(p.jobs, &jobs[i]) != QUEUE_STATUS_OK) goto done;
+    }
+    queue_close(p.jobs);
+
+    code = MTP_STATUS_EFAIL;
+    for (; started < threads; started++) {
+        if (pthread_create(&pool[started], NULL, mtp_device_thread, &p) != 0) break;
+    }
+    if (!started) goto done;
+
+    for (size_t i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    started = 0;
+
+    int matched = 0;
+    size_t failed = 0;
+    code = MTP_STATUS_OK;
+    for (size_t i = 0; i < n; i++) {
+        matched += jobs[i].matched;
+        if (jobs[i].code == MTP_STATUS_OK) continue;
+        if (!failed++) code = jobs[i].code;
+    }
+
+    if (failed) fprintf(stderr, "Failed on %zu of %zu devices\n", failed, n);
+    if (code == MTP_STATUS_OK && !matched) code = MTP_STATUS_ENODEV;
+
+done:
+    if (p.jobs && started) {
+        // skip any devices not started yet, then wait for those in progress
+        queue_close(p.jobs);
+        void* job = NULL;
+        while (queue_pop(p.jobs, &job) == QUEUE_STATUS_OK);
+    }
+    for (size_t i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    for (size_t i = 0; jobs && i < n; i++) progress_free(jobs[i].progress);
+    queue_free(p.jobs);
+    free(pool);
+    free(jobs);
+    return code;
+}
+
+static MtpStatusCode mtp_each_device_jobs(MtpDeviceFn callback, MtpArgs* params, void* data, size_t jobs) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    Progress* progress = NULL;
+
     mtp_init_once();
 
     MtpRawDevices raw_devices = mtp_detect_raw_devices();
@@ -195,50 +364,148 @@ MtpStatusCode mtp_each_device(MtpDeviceFn callback, MtpArgs* params, void* data)
         goto done;
     }
 
+    progress = progress_new(stdout);
+    if (!progress) goto done;
+
+    if (jobs > 1 && raw_devices.count > 1) {
+        if (jobs > (size_t)raw_devices.count) jobs = raw_devices.count;
+        code = mtp_each_device_pool(callback, params, data, &raw_devices, progress, jobs);
+        goto done;
+    }
+
     int matched_devices = 0;
     for (int i = 0; i < raw_devices.count; i++) {
+        code = mtp_each_storage(callback, params, data, &raw_devices.devices[i], i, progress, &matched_devices);
+        if (code != MTP_STATUS_OK) goto done;
+    }
+
+    code = matched_devices ? MTP_STATUS_OK : MTP_STATUS_ENODEV;
+
+done:
+    free(raw_devices.devices);
+    progress_free(progress);
+    return code;
+}
+
+MtpStatusCode mtp_each_device(MtpDeviceFn callback, MtpArgs* params, void* data) {
+    return mtp_each_device_jobs(callback, params, data, 1);
+}
+
+MtpStatusCode mtp_each_device_parallel(MtpDeviceFn callback, MtpArgs* params, void* data) {
+    return mtp_each_device_jobs(callback, params, data, params->jobs);
+}
+
+// Releases a device of a pair along with its raw device.
+static void mtp_free_pair_device(Device* d) {
+    if (d) {
+        LIBMTP_mtpdevice_t* device = d->device;
+        device_free(d);
+        mtp_release_device(device);
+    }
+}
+
+MtpStatusCode mtp_each_device_pair(MtpDevicePairFn callback, MtpArgs* params, void* data) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    Progress* progress = NULL;
+    LIBMTP_mtpdevice_t* device = NULL;
+    Device* d = NULL;
+    Device* pair[2] = { NULL, NULL };
+
+    // the target is matched like the source, but by the target ID
+    MtpArgs match[2] = { *params, *params };
+    match[1].device_id = params->target_id;
+
+    mtp_init_once();
+
+    MtpRawDevices raw_devices = mtp_detect_raw_devices();
+
+    if (raw_devices.status != MTP_STATUS_OK) {
+        code = raw_devices.status;
+        goto done;
+    }
+
+    progress = progress_new(stdout);
+    if (!progress) goto done;
+
+    for (int i = 0; i < raw_devices.count && !(pair[0] && pair[1]); i++) {
         device = mtp_open_raw_device(&raw_devices.devices[i], i);
         if (!device) {
             code = MTP_STATUS_EDEVICE;
             goto done;
         }
 
+        int matched = 0;
         for (LIBMTP_devicestorage_t* storage = device->storage; storage != 0; storage = storage->next) {
             d = device_new(i, device, storage);
             if (!d) goto done;
 
-            if (match_device(d, params)) {
-                matched_devices++;
-                MtpStatusCode callback_status = callback(d, data);
-                if (callback_status != MTP_STATUS_OK) {
-                    code = callback_status;
+            for (int j = 0; j < 2; j++) {
+                if (pair[j] || !match_device(d, &match[j])) continue;
+                if (matched) {
+                    fprintf(stderr, "The source and target must be different devices\n");
+                    code = MTP_STATUS_ESYNTAX;
                     goto done;
                 }
+                pair[j] = d;
+                matched = 1;
             }
 
-            device_free(d);
+            if (d != pair[0] && d != pair[1]) device_free(d);
             d = NULL;
         }
 
-        mtp_release_device(device);
+        // the device now belongs to its Device, if any
+        if (!matched) mtp_release_device(device);
         device = NULL;
     }
 
-    code = matched_devices ? MTP_STATUS_OK : MTP_STATUS_ENODEV;
+    if (!pair[0] || !pair[1]) {
+        code = MTP_STATUS_ENODEV;
+        goto done;
+    }
+
+    for (int j = 0; j < 2; j++) {
+        pair[j]->rescan = params->rescan;
+        pair[j]->progress = progress;
+    }
+
+    code = callback(pair[0], pair[1], data);
+
+    // keep the indexes in sync with any changes, even after failure
+    for (int j = 0; j < 2; j++) {
+        device_save(pair[j]);
+        if (pair[j]->is_modified) mtp_stamp_indexes(pair[j]->device, pair[j]->number);
+    }
 
 done:
-    mtp_release_device(device);
+    // a device matched by one of the pair is released along with it
+    if (d != pair[0] && d != pair[1]) device_free(d);
+    if (device && !(pair[0] && pair[0]->device == device) && !(pair[1] && pair[1]->device == device)) {
+        mtp_release_device(device);
+    }
+    mtp_free_pair_device(pair[0]);
+    mtp_free_pair_device(pair[1]);
     free(raw_devices.devices);
-    device_free(d);
+    progress_free(progress);
     return code;
 }
 
+// Finds the ID of the folder an interned path is in, zero for the top level.
+// The parent is interned along with the path, so nothing is allocated.
+static int mtp_parent_id(Device* dev, char* path, uint32_t* parent_id) {
+    char* parent = intern_parent(path);
+    *parent_id = 0;
+    if (!parent || strcmp("/", parent) == 0) return 0;
+
+    File* parent_dir = device_get_file(dev, parent);
+    if (!parent_dir || !parent_dir->is_folder || !parent_dir->data) return -1;
+    *parent_id = ((DeviceFile*)parent_dir->data)->id;
+    return 0;
+}
+
 MtpStatusCode mtp_mkdir(Device* dev, SyncPlan* plan) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
     DeviceFile* dfile = NULL;
-    char* new_path = NULL;
-    char* path_dname = NULL;
-    char* path_bname = NULL;
 
     char* path = plan->target->path;
     if (strcmp(path, "/") == 0) {
@@ -256,54 +523,41 @@ MtpStatusCode mtp_mkdir(Device* dev, SyncPlan* plan) {
         goto done;
     }
 
-    new_path = strdup(path);
-    if (!new_path) goto done;
-
-    path_dname = fs_dirname(path);
-    if (!path_dname) goto done;
-
-    path_bname = fs_basename(path);
-    if (!path_bname) goto done;
-
     uint32_t parent_id = 0;
-    if (strcmp("/", path_dname) != 0) {
-        File* parent_dir = device_get_file(dev, path_dname);
-        if (!parent_dir || !parent_dir->is_folder || !parent_dir->data) goto done;
-        DeviceFile* parent_df = parent_dir->data;
-        parent_id = parent_df->id;
-    }
+    if (mtp_parent_id(dev, path, &parent_id) != 0) goto done;
 
-    dfile = malloc(sizeof(DeviceFile));
+    dfile = device_file_new(dev->arena, 0, parent_id, 0, 1, path);
     if (!dfile) goto done;
-    dfile->is_folder = 1;
-    dfile->path = new_path;
-    dfile->size = 0;
-    dfile->id = LIBMTP_Create_Folder(dev->device, path_bname, parent_id, dev->storage->id);
+    dfile->is_loaded = 1;
+    dfile->id = LIBMTP_Create_Folder(dev->device, path + fs_path_name(path).offset, parent_id, dev->storage->id);
 
-    printf("%s: %s/: ", MTP_MKDIR_MSG, path);
+    progress_item(dev->progress, MTP_MKDIR_MSG, path, 1);
     if (dfile->id == 0) {
-        printf("Failed!\n");
+        progress_item_done(dev->progress, 0, "Failed!");
         code = MTP_STATUS_EDEVICE;
-        LIBMTP_Dump_Errorstack(dev->device);
-        LIBMTP_Clear_Errorstack(dev->device);
+        mtp_dump_errors(dev->progress, dev->device);
         goto done;
     }
-    printf("OK\n");
+    progress_item_done(dev->progress, 0, "OK");
 
     if (device_add_file(dev, dfile) != DEVICE_STATUS_OK) goto done;
 
     code = MTP_STATUS_OK;
-    dfile = NULL;
-    new_path = NULL;
 
 done:
-    free(dfile);
-    free(new_path);
-    free(path_bname);
-    free(path_dname);
     return code;
 }
 
+static int mtp_get_object(void* data, uint32_t id, int fd) {
+    Device* dev = data;
+    return LIBMTP_Get_File_To_File_Descriptor(dev->device, id, fd, mtp_progress, dev->progress);
+}
+
+static int mtp_get_partial_object(void* data, uint32_t id, uint64_t offset, uint32_t max, unsigned char** out, unsigned int* size) {
+    Device* dev = data;
+    return LIBMTP_GetPartialObject(dev->device, id, offset, max, out, size);
+}
+
 MtpStatusCode mtp_get_file(Device* dev, SyncPlan* plan) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
     File* f = device_get_file(dev, plan->source->path);
@@ -311,16 +565,33 @@ MtpStatusCode mtp_get_file(Device* dev, SyncPlan* plan) {
 
     if (!f || !f->data || f->is_folder) goto done;
 
+    // an interrupted pull of the same object is continued where it stopped
+    ResumeSource src = {
+        .get = mtp_get_object,
+        .get_partial = LIBMTP_Check_Capability(dev->device, LIBMTP_DEVICECAP_GetPartialObject) ? mtp_get_partial_object : NULL,
+        .data = dev,
+    };
+
     DeviceFile* df = f->data;
-    MtpOperationData op = { .name = MTP_PULL_MSG, .file = target };
-    if (LIBMTP_Get_File_To_File(dev->device, df->id, target, mtp_progress, &op) != 0) {
-        fprintf(stdout, "\n");
-        fprintf(stderr, "Error getting file from MTP device.\n");
-        LIBMTP_Dump_Errorstack(dev->device);
-        LIBMTP_Clear_Errorstack(dev->device);
+    progress_item(dev->progress, MTP_PULL_MSG, target, 0);
+    ResumeStatusCode resumed = resume_get(&src, df->id, df->size, target, dev->progress);
+    if (resumed != RESUME_STATUS_OK) {
+        int error = errno;
+        progress_item_done(dev->progress, 0, "Failed!");
+        if (resumed == RESUME_STATUS_EDEVICE) {
+            progress_error(dev->progress, "Error getting file from MTP device.\n");
+            mtp_dump_errors(dev->progress, dev->device);
+        } else {
+            progress_error(dev->progress, "Error writing file: %s: %s\n", target, strerror(error));
+        }
         goto done;
     }
-    printf("\n");
+    progress_item_done(dev->progress, df->size, "OK");
+
+    // keep the time of the device, so later comparisons find the file unchanged
+    if (df->mtime && fs_set_mtime(target, df->mtime) != FS_STATUS_OK) {
+        progress_error(dev->progress, "fs_set_mtime(%s) failed: %s\n", target, strerror(errno));
+    }
 
     code = MTP_STATUS_OK;
 
@@ -328,98 +599,149 @@ done:
     return code;
 }
 
+typedef struct {
+    Device* dev;  // Device the object is read from
+    uint32_t id;  // Object to read
+    Ring* ring;   // Receives the contents of the object
+    int result;   // Result of reading the object, zero on success
+} MtpCloneReader;
+
+static uint16_t mtp_clone_put(void* params, void* priv, uint32_t sendlen, unsigned char* data, uint32_t* putlen) {
+    if (ring_write(priv, data, sendlen) != RING_STATUS_OK) return LIBMTP_HANDLER_RETURN_CANCEL;
+    *putlen = sendlen;
+    return LIBMTP_HANDLER_RETURN_OK;
+}
+
+static uint16_t mtp_clone_get(void* params, void* priv, uint32_t wantlen, unsigned char* data, uint32_t* gotlen) {
+    size_t n = 0;
+    if (ring_read(priv, data, wantlen, &n) != RING_STATUS_OK) return LIBMTP_HANDLER_RETURN_ERROR;
+    *gotlen = n;
+    return LIBMTP_HANDLER_RETURN_OK;
+}
+
+static void* mtp_clone_thread(void* data) {
+    MtpCloneReader* r = data;
+    r->result = LIBMTP_Get_File_To_Handler(r->dev->device, r->id, mtp_clone_put, r->ring, NULL, NULL);
+
+    // the sender must not wait for the rest of a failed read
+    if (r->result != 0) {
+        ring_cancel(r->ring);
+    } else {
+        ring_close(r->ring);
+    }
+    return NULL;
+}
+
+// Sends an object read from the device files are cloned from. The object is
+// read on a thread of its own and passed through a bounded buffer, so both
+// devices transfer at the same time, and nothing is written to disk. On
+// failure, is_source tells whether reading the source failed the clone.
+static int mtp_send_cloned(Device* dev, SyncPlan* plan, LIBMTP_file_t* mtp_file, int* is_source) {
+    Device* from = dev->clone_from;
+    pthread_t thread;
+
+    File* f = device_get_file(from, plan->source->path);
+    if (!f || !f->data || f->is_folder) return -1;
+
+    MtpCloneReader reader = { .dev = from, .id = ((DeviceFile*)f->data)->id, .ring = NULL, .result = -1 };
+    reader.ring = ring_new(MTP_CLONE_BUFFER_SIZE);
+    if (!reader.ring) return -1;
+
+    if (pthread_create(&thread, NULL, mtp_clone_thread, &reader) != 0) {
+        ring_free(reader.ring);
+        return -1;
+    }
+
+    int result = LIBMTP_Send_File_From_Handler(dev->device, mtp_clone_get, reader.ring, mtp_file, mtp_progress, dev->progress);
+
+    // the reader may still wait for space after a failed send, or if the
+    // object grew since it was listed, either of which fails the clone. A
+    // failed read cancels the buffer itself, which fails the send in turn.
+    int is_read_first = !ring_cancel(reader.ring);
+    pthread_join(thread, NULL);
+    ring_free(reader.ring);
+
+    *is_source = reader.result != 0 && (is_read_first || result == 0);
+    return *is_source ? -1 : result;
+}
+
 MtpStatusCode mtp_send_file(Device* dev, SyncPlan* plan) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
     DeviceFile* dfile = NULL;
     LIBMTP_file_t* mtp_file = NULL;
-    char* new_path = NULL;
-    char* dname = NULL;
-    char* bname = NULL;
-    char* lcname = NULL;
+    char* path = plan->target->path;
 
     if (device_get_file(dev, plan->target->path)) {
-        fprintf(stderr, "File already exists: %s, skipping\n", plan->target->path);
+        progress_error(dev->progress, "File already exists: %s, skipping\n", plan->target->path);
         code = MTP_STATUS_EEXIST;
         goto done;
     }
 
-    struct stat s;
-    if (lstat(plan->source->path, &s) != 0) goto done;
-
-    new_path = strdup(plan->target->path);
-    if (!new_path) goto done;
-
-    dname = fs_dirname(plan->target->path);
-    if (!dname) goto done;
-
-    bname = fs_basename(plan->target->path);
-    if (!bname) goto done;
-
-    lcname = str_lower(bname);
-    if (!lcname) goto done;
+    // the size and modification time were recorded when collecting the file
+    File* source = plan->source;
+    if (source->mode && !S_ISREG(source->mode)) {
+        progress_error(dev->progress, "Not a regular file: %s\n", source->path);
+        goto done;
+    }
 
-    if (s.st_size > dev->capacity) {
+    if (source->size > dev->capacity) {
         code = MTP_STATUS_ENOSPC;
         goto done;
     }
 
     uint32_t parent_id = 0;
-    if (strcmp("/", dname) != 0) {
-        File* parent_dir = device_get_file(dev, dname);
-        if (!parent_dir || !parent_dir->is_folder || !parent_dir->data) goto done;
-        DeviceFile* parent_df = parent_dir->data;
-        parent_id = parent_df->id;
-    }
+    if (mtp_parent_id(dev, path, &parent_id) != 0) goto done;
 
     mtp_file = LIBMTP_new_file_t();
     if (!mtp_file) goto done;
-    mtp_file->filesize = s.st_size;
+
+    // libmtp frees the name along with the file, so it needs a copy of its own
+    mtp_file->filename = strdup(path + fs_path_name(path).offset);
+    if (!mtp_file->filename) goto done;
+    mtp_file->filesize = source->size;
     mtp_file->filetype = LIBMTP_FILETYPE_UNKNOWN;
-    mtp_file->filename = bname;
     mtp_file->parent_id = parent_id;
     mtp_file->storage_id = dev->storage->id;
-    bname = NULL;
+    mtp_file->modificationdate = source->mtime;
 
-    dfile = malloc(sizeof(DeviceFile));
+    dfile = device_file_new(dev->arena, 0, parent_id, source->size, 0, plan->target->path);
     if (!dfile) goto done;
-    dfile->is_folder = 0;
-    dfile->size = s.st_size;
-    dfile->path = new_path;
-    dfile->id = 0;
+    dfile->mtime = source->mtime;
 
+    char* ext = path + fs_path_ext(path).offset;
     for (size_t i = 0; i < ARRAY_LEN(file_types); i++) {
         MtpPushFileType t = file_types[i];
-        if (str_ends_with(lcname, t.extension)) {
+        if (strcasecmp(ext, t.extension) == 0) {
             mtp_file->filetype = t.type;
             break;
         }
     }
 
-    MtpOperationData op = { .name = MTP_PUSH_MSG, .file = plan->target->path };
-    if (LIBMTP_Send_File_From_File(dev->device, plan->source->path, mtp_file, mtp_progress, &op) != 0) {
-        fprintf(stdout, "\n");
-        fprintf(stderr, "Error getting file from MTP device.\n");
-        LIBMTP_Dump_Errorstack(dev->device);
-        LIBMTP_Clear_Errorstack(dev->device);
+    progress_item(dev->progress, dev->clone_from ? MTP_CLONE_MSG : MTP_PUSH_MSG, plan->target->path, 0);
+    int is_source = 0;
+    int sent = dev->clone_from ? mtp_send_cloned(dev, plan, mtp_file, &is_source) : LIBMTP_Send_File_From_File(dev->device, plan->source->path, mtp_file, mtp_progress, dev->progress);
+    if (sent != 0) {
+        progress_item_done(dev->progress, 0, "Failed!");
+
+        // only the side which failed first is reported, the other merely
+        // stopped along with it
+        LIBMTP_mtpdevice_t* failed = is_source ? dev->clone_from->device : dev->device;
+        LIBMTP_mtpdevice_t* other = is_source ? dev->device : dev->clone_from ? dev->clone_from->device : NULL;
+        progress_error(dev->progress, is_source ? "Error getting file from MTP device.\n" : "Error sending file to MTP device.\n");
+        mtp_dump_errors(dev->progress, failed);
+        if (other) LIBMTP_Clear_Errorstack(other);
         goto done;
     }
-    printf("\n");
+    progress_item_done(dev->progress, source->size, "OK");
 
     dfile->id = mtp_file->item_id;
 
     if (device_add_file(dev, dfile) != DEVICE_STATUS_OK) goto done;
-    dev->capacity -= s.st_size;
+    dev->capacity -= source->size;
 
     code = MTP_STATUS_OK;
-    dfile = NULL;
-    new_path = NULL;
 
 done:
-    free(dfile);
-    free(new_path);
-    free(dname);
-    free(bname);
-    free(lcname);
     LIBMTP_destroy_file_t(mtp_file);
     return code;
 }
@@ -428,103 +750,641 @@ MtpStatusCode mtp_rm_file(Device* dev, SyncPlan* plan) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
     HashEntry* entry = NULL;
 
-    entry = hash_remove(dev->files, plan->target->path);
+    entry = device_remove_file(dev, plan->target->path);
     if (!entry) goto done;
 
     File* f = hash_entry_value(entry);
     DeviceFile* df = f->data;
 
-    printf("%s: %s%s: ", MTP_RM_MSG, f->path, f->is_folder ? "/" : "");
+    progress_item(dev->progress, MTP_RM_MSG, f->path, f->is_folder);
+    if (LIBMTP_Delete_Object(dev->device, df->id) != 0) {
+        progress_item_done(dev->progress, 0, "Failed!");
+        code = MTP_STATUS_EDEVICE;
+        mtp_dump_errors(dev->progress, dev->device);
+        goto done;
+    }
+    progress_item_done(dev->progress, 0, "OK");
+
+    code = MTP_STATUS_OK;
+
+done:
+    device_hash_entry_free(entry);
+    return code;
+}
+
+MtpStatusCode mtp_replace_file(Device* dev, SyncPlan* plan) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    HashEntry* entry = NULL;
+
+    File* existing = device_get_file(dev, plan->target->path);
+    if (!existing || !existing->data) goto done;
+    if (existing->is_folder) {
+        progress_error(dev->progress, "Folder already exists: %s, skipping\n", plan->target->path);
+        code = MTP_STATUS_EEXIST;
+        goto done;
+    }
+
+    // MTP has no way to overwrite an object, so the old one goes first. It
+    // stays in the files hash until it is gone from the device, so that the
+    // index still has it if deleting fails.
+    DeviceFile* df = existing->data;
     if (LIBMTP_Delete_Object(dev->device, df->id) != 0) {
-        printf("Failed!\n");
+        progress_error(dev->progress, "Error removing changed file from MTP device: %s\n", plan->target->path);
         code = MTP_STATUS_EDEVICE;
-        LIBMTP_Dump_Errorstack(dev->device);
+        mtp_dump_errors(dev->progress, dev->device);
+        goto done;
+    }
+    dev->capacity += df->size;
+
+    entry = device_remove_file(dev, plan->target->path);
+    if (!entry) goto done;
+
+    code = mtp_send_file(dev, plan);
+
+done:
+    device_hash_entry_free(entry);
+    return code;
+}
+
+// Renames an object, without touching the files hash.
+static int mtp_rename_object(Device* dev, uint32_t id, uint32_t parent_id, char* bname) {
+    LIBMTP_file_t* mtp_file = LIBMTP_new_file_t();
+    if (!mtp_file) return -1;
+
+    mtp_file->item_id = id;
+    mtp_file->parent_id = parent_id;
+    mtp_file->storage_id = dev->storage->id;
+    mtp_file->filetype = LIBMTP_FILETYPE_UNKNOWN;
+
+    int r = LIBMTP_Set_File_Name(dev->device, mtp_file, bname);
+    LIBMTP_destroy_file_t(mtp_file);
+    return r;
+}
+
+// Moves and renames an object, without touching the files hash. Sets is_moved
+// once the object is in the new folder, even if renaming it then fails.
+static int mtp_move_object(Device* dev, DeviceFile* df, uint32_t parent_id, char* old_bname, char* bname, int* is_moved) {
+    *is_moved = 0;
+    if (df->parent_id != parent_id) {
+        if (LIBMTP_Move_Object(dev->device, df->id, dev->storage->id, parent_id) != 0) return -1;
+        *is_moved = 1;
+    }
+    if (strcmp(old_bname, bname) != 0 && mtp_rename_object(dev, df->id, parent_id, bname) != 0) return -1;
+    return 0;
+}
+
+// Records a file under the path the device moved it to, in place of the
+// path it had before.
+static MtpStatusCode mtp_index_move(Device* dev, DeviceFile* df, uint32_t parent_id, char* path) {
+    DeviceFile* dfile = device_file_new(dev->arena, df->id, parent_id, df->size, 0, path);
+    if (!dfile) return MTP_STATUS_ENOMEM;
+    dfile->mtime = df->mtime;
+
+    HashEntry* entry = device_remove_file(dev, df->path);
+    if (!entry) return MTP_STATUS_EFAIL;
+    device_hash_entry_free(entry);
+
+    return device_add_file(dev, dfile) == DEVICE_STATUS_OK ? MTP_STATUS_OK : MTP_STATUS_EFAIL;
+}
+
+// Copies an object in to a folder, returning the ID of the copy or zero. MTP
+// does not report the ID of the copy, so it is found by listing the folder.
+static uint32_t mtp_copy_object(Device* dev, DeviceFile* df, uint32_t parent_id, char* dname, char* old_bname) {
+    uint32_t id = 0;
+    List* entries = NULL;
+    char* path = NULL;
+
+    if (LIBMTP_Copy_Object(dev->device, df->id, dev->storage->id, parent_id) != 0) goto done;
+
+    // a file of the same name may already be in the folder
+    path = fs_path_join(dname, old_bname);
+    if (!path) goto done;
+
+    File* known = device_get_file(dev, path);
+    uint32_t known_id = known && known->data ? ((DeviceFile*)known->data)->id : 0;
+
+    if (dev->source.list_folder(dev->source.data, parent_id, &entries) != ENUM_STATUS_OK) goto done;
+
+    for (size_t i = 0; i < list_size(entries); i++) {
+        EnumEntry* e = list_get(entries, i);
+        if (!e->is_folder && e->id != known_id && e->id != df->id && strcmp(e->name, old_bname) == 0) {
+            id = e->id;
+            break;
+        }
+    }
+
+done:
+    list_free_deep(entries, (ListItemFreeFn)enum_entry_free);
+    free(path);
+    return id;
+}
+
+MtpStatusCode mtp_copy_file(Device* dev, SyncPlan* plan) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    char* bname = plan->target->path + fs_path_name(plan->target->path).offset;
+
+    if (device_get_file(dev, plan->target->path)) {
+        progress_error(dev->progress, "File already exists: %s, skipping\n", plan->target->path);
+        code = MTP_STATUS_EEXIST;
+        goto done;
+    }
+
+    File* origin = device_get_file(dev, plan->origin->path);
+    if (!origin || !origin->data || origin->is_folder) goto done;
+    DeviceFile* df = origin->data;
+
+    if (df->size > dev->capacity) {
+        code = MTP_STATUS_ENOSPC;
+        goto done;
+    }
+
+    char* old_bname = origin->path + fs_path_name(origin->path).offset;
+
+    uint32_t parent_id = 0;
+    if (mtp_parent_id(dev, plan->target->path, &parent_id) != 0) goto done;
+
+    progress_item(dev->progress, MTP_COPY_MSG, plan->target->path, 0);
+    uint32_t id = mtp_copy_object(dev, df, parent_id, intern_parent(plan->target->path), old_bname);
+    if (id && strcmp(old_bname, bname) != 0 && mtp_rename_object(dev, id, parent_id, bname) != 0) {
+        LIBMTP_Delete_Object(dev->device, id);
+        id = 0;
+    }
+    if (!id) {
+        progress_item_done(dev->progress, 0, "Failed!");
         LIBMTP_Clear_Errorstack(dev->device);
+
+        // not every device supports copying, so send the file instead
+        code = mtp_send_file(dev, plan);
         goto done;
     }
-    printf("OK\n");
+    progress_item_done(dev->progress, 0, "OK");
+
+    DeviceFile* dfile = device_file_new(dev->arena, id, parent_id, df->size, 0, plan->target->path);
+    if (!dfile) goto done;
+    dfile->mtime = df->mtime;
+
+    if (device_add_file(dev, dfile) != DEVICE_STATUS_OK) goto done;
+    dev->capacity -= df->size;
 
     code = MTP_STATUS_OK;
 
 done:
+    return code;
+}
+
+MtpStatusCode mtp_move_file(Device* dev, SyncPlan* plan) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    HashEntry* entry = NULL;
+    char* stray = NULL;
+    char* bname = plan->target->path + fs_path_name(plan->target->path).offset;
+
+    if (device_get_file(dev, plan->target->path)) {
+        progress_error(dev->progress, "File already exists: %s, skipping\n", plan->target->path);
+        code = MTP_STATUS_EEXIST;
+        goto done;
+    }
+
+    File* origin = device_get_file(dev, plan->origin->path);
+    if (!origin || !origin->data || origin->is_folder) goto done;
+    DeviceFile* df = origin->data;
+
+    char* old_bname = origin->path + fs_path_name(origin->path).offset;
+
+    uint32_t parent_id = 0;
+    if (mtp_parent_id(dev, plan->target->path, &parent_id) != 0) goto done;
+
+    // the file stays in the files hash as it is until the device changed it,
+    // so that the index matches the device whatever fails
+    progress_item(dev->progress, MTP_MOVE_MSG, plan->target->path, 0);
+    int is_moved = 0;
+    if (mtp_move_object(dev, df, parent_id, old_bname, bname, &is_moved) != 0) {
+        progress_item_done(dev->progress, 0, "Failed!");
+        LIBMTP_Clear_Errorstack(dev->device);
+
+        // not every device supports moving, so send the file again instead
+        if (LIBMTP_Delete_Object(dev->device, df->id) != 0) {
+            progress_error(dev->progress, "Error removing stray file from MTP device: %s\n", plan->origin->path);
+            code = MTP_STATUS_EDEVICE;
+            mtp_dump_errors(dev->progress, dev->device);
+
+            // a file moved but not renamed is in the new folder by its old
+            // name, unless another file has that name already
+            if (is_moved) {
+                stray = fs_path_join(intern_parent(plan->target->path), old_bname);
+                if (stray && !device_get_file(dev, stray)) mtp_index_move(dev, df, parent_id, stray);
+            }
+            goto done;
+        }
+        dev->capacity += df->size;
+
+        entry = device_remove_file(dev, origin->path);
+        if (!entry) goto done;
+
+        code = mtp_send_file(dev, plan);
+        goto done;
+    }
+    progress_item_done(dev->progress, 0, "OK");
+
+    code = mtp_index_move(dev, df, parent_id, plan->target->path);
+
+done:
+    free(stray);
     device_hash_entry_free(entry);
     return code;
 }
 
-static MtpStatusCode local_mkdir(SyncPlan* plan) {
+static MtpStatusCode local_mkdir(Progress* progress, SyncPlan* plan) {
     char* path = plan->target->path;
-    printf("%s: %s/: ", MTP_MKDIR_MSG, path);
+    progress_item(progress, MTP_MKDIR_MSG, path, 1);
     if (fs_mkdir(path) != FS_STATUS_OK) {
-        printf("Failed!\n");
-        fprintf(stderr, "fs_mkdir(%s) failed: ", path);
-        perror(NULL);
+        progress_item_done(progress, 0, "Failed!");
+        progress_error(progress, "fs_mkdir(%s) failed: %s\n", path, strerror(errno));
         return MTP_STATUS_EFAIL;
     }
-    printf("OK\n");
+    progress_item_done(progress, 0, "OK");
     return MTP_STATUS_OK;
 }
 
-static MtpStatusCode local_rm(SyncPlan* plan) {
+static MtpStatusCode local_rm(Progress* progress, SyncPlan* plan) {
     char* path = plan->target->path;
-    printf("%s: %s%s: ", MTP_RM_MSG, path, plan->target->is_folder ? "/" : "");
+    progress_item(progress, MTP_RM_MSG, path, plan->target->is_folder);
     if (fs_rm(path) != FS_STATUS_OK) {
-        printf("Failed!\n");
-        fprintf(stderr, "fs_rm(%s) failed: ", path);
-        perror(NULL);
+        progress_item_done(progress, 0, "Failed!");
+        progress_error(progress, "fs_rm(%s) failed: %s\n", path, strerror(errno));
         return MTP_STATUS_EFAIL;
     }
-    printf("OK\n");
+    progress_item_done(progress, 0, "OK");
     return MTP_STATUS_OK;
 }
 
-MtpStatusCode mtp_execute_pull_plan(Device* dev, List* plans) {
-    MtpStatusCode code = MTP_STATUS_OK;
+static MtpStatusCode local_move(Device* dev, SyncPlan* plan) {
+    char* path = plan->target->path;
+    progress_item(dev->progress, MTP_MOVE_MSG, path, 0);
+    if (rename(plan->origin->path, path) != 0) {
+        progress_item_done(dev->progress, 0, "Failed!");
+
+        // the stray file may be on another file system, so pull it instead
+        MtpStatusCode code = mtp_get_file(dev, plan);
+        if (code != MTP_STATUS_OK) return code;
+
+        SyncPlan rm = { .source = NULL, .target = plan->origin, .action = SYNC_ACTION_RM };
+        return local_rm(dev->progress, &rm);
+    }
+    progress_item_done(dev->progress, 0, "OK");
+    return MTP_STATUS_OK;
+}
+
+// Determines the number of bytes to be transferred by a plan.
+static uint64_t mtp_plan_bytes(Device* dev, List* plans, int is_push) {
+    uint64_t bytes = 0;
 
     for (size_t i = 0; i < list_size(plans); i++) {
         SyncPlan* plan = list_get(plans, i);
+        if (plan->action != SYNC_ACTION_XFER && plan->action != SYNC_ACTION_REPLACE) continue;
 
-        switch (plan->action) {
-            case SYNC_ACTION_MKDIR:
-                code = local_mkdir(plan);
-                break;
+        if (is_push) {
+            bytes += plan->source->size;
+        } else {
+            File* f = device_get_file(dev, plan->source->path);
+            if (f && f->data) bytes += ((DeviceFile*)f->data)->size;
+        }
+    }
 
-            case SYNC_ACTION_XFER:
-                code = mtp_get_file(dev, plan);
-                break;
+    return bytes;
+}
 
-            case SYNC_ACTION_RM:
-                code = local_rm(plan);
-                break;
-        }
+MtpStatusCode mtp_execute_pull_action(Device* dev, SyncPlan* plan) {
+    switch (plan->action) {
+        case SYNC_ACTION_MKDIR:
+            return local_mkdir(dev->progress, plan);
+
+        case SYNC_ACTION_XFER:
+        case SYNC_ACTION_REPLACE:
+        case SYNC_ACTION_COPY:
+            return mtp_get_file(dev, plan);
 
+        case SYNC_ACTION_MOVE:
+            return local_move(dev, plan);
+
+        case SYNC_ACTION_RM:
+            return local_rm(dev->progress, plan);
+    }
+
+    return MTP_STATUS_EFAIL;
+}
+
+MtpStatusCode mtp_execute_push_action(Device* dev, SyncPlan* plan) {
+    switch (plan->action) {
+        case SYNC_ACTION_MKDIR:
+            return mtp_mkdir(dev, plan);
+
+        case SYNC_ACTION_XFER:
+            return mtp_send_file(dev, plan);
+
+        case SYNC_ACTION_REPLACE:
+            return mtp_replace_file(dev, plan);
+
+        case SYNC_ACTION_MOVE:
+            return mtp_move_file(dev, plan);
+
+        case SYNC_ACTION_COPY:
+            return mtp_copy_file(dev, plan);
+
+        case SYNC_ACTION_RM:
+            return mtp_rm_file(dev, plan);
+    }
+
+    return MTP_STATUS_EFAIL;
+}
+
+static MtpStatusCode mtp_execute_plan(Device* dev, List* plans, int is_push) {
+    MtpStatusCode code = MTP_STATUS_OK;
+    MtpActionFn fn = is_push ? mtp_execute_push_action : mtp_execute_pull_action;
+
+    progress_start(dev->progress, list_size(plans), mtp_plan_bytes(dev, plans, is_push));
+
+    for (size_t i = 0; i < list_size(plans); i++) {
+        code = fn(dev, list_get(plans, i));
         if (code != MTP_STATUS_OK) break;
     }
 
+    progress_end(dev->progress);
     return code;
 }
 
+MtpStatusCode mtp_execute_pull_plan(Device* dev, List* plans) {
+    return mtp_execute_plan(dev, plans, 0);
+}
+
 MtpStatusCode mtp_execute_push_plan(Device* dev, List* plans) {
-    MtpStatusCode code = MTP_STATUS_OK;
+    return mtp_execute_plan(dev, plans, 1);
+}
+
+SyncStatusCode mtp_digest_file(File* f, uint64_t* digest, void* data) {
+    MtpDigests* d = data;
+
+    uint64_t* known = d && d->files ? hash_get_hc(d->files, f->path, f->hc) : NULL;
+    if (known) {
+        *digest = *known;
+        return SYNC_STATUS_OK;
+    }
+
+    if (d && d->manifest) {
+        if (d->lock) pthread_mutex_lock(d->lock);
+        DigestStatusCode code = digest_file(d->manifest, f->path, digest);
+        if (d->lock) pthread_mutex_unlock(d->lock);
+        if (code != DIGEST_STATUS_OK) fprintf(stderr, "Failed to digest file: %s\n", f->path);
+        return code == DIGEST_STATUS_OK ? SYNC_STATUS_OK : SYNC_STATUS_EFAIL;
+    }
+
+    // the size is known from collecting the file, so it is not stat'ed again
+    int fd = open(f->path, O_RDONLY);
+    FsStatusCode code = fd >= 0 ? fs_hash_fd(fd, f->size, digest) : FS_STATUS_EFAIL;
+    if (code != FS_STATUS_OK) {
+        fprintf(stderr, "fs_hash_fd(%s) failed: ", f->path);
+        perror(NULL);
+    }
+    if (fd >= 0) close(fd);
+    return code == FS_STATUS_OK ? SYNC_STATUS_OK : SYNC_STATUS_EFAIL;
+}
+
+static int mtp_file_size_cmp(const void* a, const void* b) {
+    uint64_t x = (*(File**)a)->size;
+    uint64_t y = (*(File**)b)->size;
+    return (x > y) - (x < y);
+}
+
+MtpStatusCode mtp_digest_plans(MtpDigests* d, Arena* arena, List* plans) {
+    MtpStatusCode code = MTP_STATUS_ENOMEM;
+    List* sources = NULL;
+    List* sorted = NULL;
+    List* files = NULL;
+    uint64_t* digests = NULL;
+
+    sources = list_new(list_size(plans));
+    if (!sources) goto done;
 
     for (size_t i = 0; i < list_size(plans); i++) {
         SyncPlan* plan = list_get(plans, i);
+        if (plan->action != SYNC_ACTION_XFER || !plan->source || plan->source->is_folder || !plan->source->size) continue;
+        if (list_push(sources, plan->source) != LIST_STATUS_OK) goto done;
+    }
+
+    sorted = list_sort(sources, mtp_file_size_cmp);
+    files = list_new(list_size(sources));
+    if (!sorted || !files) goto done;
+
+    // a file is only compared with files of the same size
+    for (size_t i = 0; i < list_size(sorted); i++) {
+        File* f = list_get(sorted, i);
+        File* prev = i > 0 ? list_get(sorted, i - 1) : NULL;
+        File* next = i + 1 < list_size(sorted) ? list_get(sorted, i + 1) : NULL;
+        if ((!prev || prev->size != f->size) && (!next || next->size != f->size)) continue;
+        if (list_push(files, f) != LIST_STATUS_OK) goto done;
+    }
 
-        switch (plan->action) {
-            case SYNC_ACTION_MKDIR:
-                code = mtp_mkdir(dev, plan);
-                break;
+    if (!list_size(files)) {
+        code = MTP_STATUS_OK;
+        goto done;
+    }
 
-            case SYNC_ACTION_XFER:
-                code = mtp_send_file(dev, plan);
-                break;
+    if (!d->files) d->files = hash_new_str(list_size(files));
+    digests = calloc(list_size(files), sizeof(uint64_t));
+    if (!d->files || !digests) goto done;
 
-            case SYNC_ACTION_RM:
-                code = mtp_rm_file(dev, plan);
-                break;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+
+    if (d->lock) pthread_mutex_lock(d->lock);
+    DigestStatusCode digest_code = digest_files(d->manifest, files, threads, digests, NULL);
+    if (d->lock) pthread_mutex_unlock(d->lock);
+    if (digest_code == DIGEST_STATUS_ENOMEM) goto done;
+
+    // files which could not be read are left out, and fail when compared
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        if (!digests[i]) continue;
+
+        uint64_t* digest = arena_alloc(arena, sizeof(uint64_t));
+        if (!digest) goto done;
+        *digest = digests[i];
+
+        HashPutResult r = hash_put_hc(d->files, f->path, f->hc, digest);
+        if (r.status != HASH_STATUS_OK) goto done;
+        hash_entry_free(r.old_entry);
+    }
+
+    code = MTP_STATUS_OK;
+
+done:
+    free(digests);
+    list_free(files);
+    list_free(sorted);
+    list_free(sources);
+    return code;
+}
+
+typedef struct {
+    Device* dev;         // Device to operate on
+    MtpActionFn fn;      // Executes each plan
+    SyncCopies* copies;  // Finds transfers of files sent before, or NULL
+    MtpStatusCode code;  // Status of the last plan executed
+    size_t count;        // Number of plans executed
+} MtpStreamData;
+
+static SyncStatusCode mtp_stream_action(SyncPlan* plan, void* data) {
+    MtpStreamData* d = data;
+    File* origin = NULL;
+
+    if (d->copies && sync_copies_match(d->copies, plan, &origin) != SYNC_STATUS_OK) {
+        d->code = MTP_STATUS_EFAIL;
+        return SYNC_STATUS_EFAIL;
+    }
+
+    d->count++;
+    if (origin) {
+        SyncPlan copy = *plan;
+        copy.action = SYNC_ACTION_COPY;
+        copy.origin = origin;
+        d->code = d->fn(d->dev, &copy);
+    } else {
+        d->code = d->fn(d->dev, plan);
+    }
+    return d->code == MTP_STATUS_OK ? SYNC_STATUS_OK : SYNC_STATUS_EFAIL;
+}
+
+MtpStatusCode mtp_execute_stream(Device* dev, List* source_files, List* target_files, List* specs, MtpArgs* args, int is_push, MtpDigests* digests, size_t* count) {
+    MtpStreamData d = {
+        .dev = dev,
+        .fn = is_push ? mtp_execute_push_action : mtp_execute_pull_action,
+        .copies = NULL,
+        .code = MTP_STATUS_OK,
+        .count = 0,
+    };
+
+    // only the device can copy files, and only local files can be digested
+    if (is_push && !dev->clone_from) {
+        d.copies = sync_copies_new(mtp_digest_file, digests);
+        if (!d.copies) return MTP_STATUS_ENOMEM;
+    }
+
+    // the amount of work is not known up front
+    progress_start(dev->progress, 0, 0);
+    SyncStatusCode code = sync_plan_stream(source_files, target_files, specs, args->cleanup, args->compare, mtp_stream_action, &d);
+    progress_end(dev->progress);
+    sync_copies_free(d.copies);
+
+    if (count) *count = d.count;
+    if (d.code != MTP_STATUS_OK) return d.code;
+    return code == SYNC_STATUS_OK ? MTP_STATUS_OK : MTP_STATUS_EFAIL;
+}
+
+MtpStatusCode mtp_folder_digests(DigestManifest* m, Arena* arena, List* files, Hash* digests) {
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        uint64_t digest = 0;
+        if (!f->is_folder || !digest_folder(m, f->path, &digest)) continue;
+
+        uint64_t* d = arena_alloc(arena, sizeof(uint64_t));
+        if (!d) return MTP_STATUS_ENOMEM;
+        *d = digest;
+
+        HashPutResult r = hash_put_hc(digests, f->path, f->hc, d);
+        if (r.status != HASH_STATUS_OK) return MTP_STATUS_ENOMEM;
+        hash_entry_free(r.old_entry);
+    }
+    return MTP_STATUS_OK;
+}
+
+// Lists the files within a folder which differs from the device, and looks up
+// the digests of the folders among them.
+static List* mtp_resolve_more(DigestManifest* m, pthread_mutex_t* lock, Hash* digests, Arena* arena, char* path) {
+    if (lock) pthread_mutex_lock(lock);
+    List* more = digest_collect_files(m, arena, path);
+    if (more && mtp_folder_digests(m, arena, more, digests) != MTP_STATUS_OK) {
+        list_free(more);
+        more = NULL;
+    }
+    if (lock) pthread_mutex_unlock(lock);
+    return more;
+}
+
+MtpStatusCode mtp_resolve_folders(DigestManifest* m, pthread_mutex_t* lock, Hash* digests, Arena* arena, List* local_files, List* device_files, char* local_path, char* device_path, int is_push, List* specs) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    SyncTree* tree = NULL;
+    Hash* found = NULL;
+    List* more = NULL;
+    char* device = NULL;
+
+    // the given digests may be read by other threads at the same time, so the
+    // digests of folders found while resolving are kept apart
+    found = hash_new_str(MTP_RESOLVE_INIT_SIZE);
+    if (!found) goto done;
+
+    if (!digests) {
+        if (lock) pthread_mutex_lock(lock);
+        code = mtp_folder_digests(m, arena, local_files, found);
+        if (lock) pthread_mutex_unlock(lock);
+        if (code != MTP_STATUS_OK) goto done;
+        code = MTP_STATUS_EFAIL;
+    }
+
+    // like the local folders, only the names of the device files are compared,
+    // and only the pushed side keeps its empty folders
+    tree = sync_tree_new(device_files, is_push, SYNC_COMPARE_EXISTS);
+    if (!tree) goto done;
+
+    size_t local_path_len = strlen(local_path);
+    size_t i = 0;
+    while (i < list_size(local_files)) {
+        File* f = list_get(local_files, i);
+
+        // only unchanged folders are listed within the path, unlike the
+        // ancestors of the path a pull is listed with
+        int is_within = strncmp(f->path, local_path, local_path_len) == 0 && (f->path[local_path_len] == '/' || strcmp(local_path, "/") == 0) && f->path[local_path_len];
+        if (!f->is_folder || !is_within) {
+            i++;
+            continue;
         }
 
-        if (code != MTP_STATUS_OK) break;
+        device = fs_path_join(device_path, f->path + local_path_len);
+        if (!device) goto done;
+
+        uint64_t* local_digest = digests ? hash_get_hc(digests, f->path, f->hc) : NULL;
+        if (!local_digest) local_digest = hash_get_hc(found, f->path, f->hc);
+
+        uint64_t device_digest = 0;
+        if (local_digest && sync_tree_digest(tree, device, &device_digest) && *local_digest == device_digest) {
+            SyncSpec* spec = is_push ? sync_spec_new(arena, f->path, device) : sync_spec_new(arena, device, f->path);
+            if (!spec || list_push(specs, spec) != LIST_STATUS_OK) goto done;
+            i++;
+        } else {
+            // the files within are appended, so they are resolved in turn
+            more = mtp_resolve_more(m, lock, found, arena, f->path);
+            if (!more) {
+                fprintf(stderr, "Failed to list %s: ", f->path);
+                perror(NULL);
+                goto done;
+            }
+
+            list_set(local_files, i, list_get(local_files, list_size(local_files) - 1));
+            list_pop(local_files);
+            if (list_push_all(local_files, more) != LIST_STATUS_OK) goto done;
+
+            list_free(more);
+            more = NULL;
+        }
+
+        free(device);
+        device = NULL;
     }
 
+    code = MTP_STATUS_OK;
+
+done:
+    free(device);
+    list_free(more);
+    sync_tree_free(tree);
+    hash_free(found);
     return code;
 }
@@ -6,8 +6,11 @@
 #ifndef _MTP_H_
 #define _MTP_H_
 
+#include <pthread.h>
+
 #include "device.h"
 #include "color.h"
+#include "digest.h"
 #include "sync.h"
 
 #define MTP_SKIP_MSG   C_BOLD C_YELLOW "SKIP" C_RESET ///< skipped message
@@ -15,6 +18,12 @@
 #define MTP_PUSH_MSG   C_BOLD C_GREEN "PUSH" C_RESET  ///< push file to device
 #define MTP_RM_MSG     C_BOLD C_RED "RM" C_RESET      ///< remove file message
 #define MTP_MKDIR_MSG  C_BOLD C_BLUE "MKDIR" C_RESET  ///< mkdir message
+#define MTP_MOVE_MSG   C_BOLD C_MAGENTA "MOVE" C_RESET ///< move file message
+#define MTP_COPY_MSG   C_BOLD C_MAGENTA "COPY" C_RESET ///< copy file message
+#define MTP_CLONE_MSG  C_BOLD C_GREEN "CLONE" C_RESET ///< clone file between devices
+
+#define MTP_ARENA_BLOCK_SIZE (64 * 1024) ///< block size of per-command arenas
+#define MTP_CLONE_BUFFER_SIZE (4 * 1024 * 1024) ///< bytes buffered between the devices of a clone
 
 /**
  * Status codes for various MTP operations.
@@ -33,22 +42,19 @@ typedef enum {
     MTP_STATUS_ENODEV,   ///< No applicable device attached
 } MtpStatusCode;
 
-/**
- * Data struct provided to the mtp_progress callback function.
- */
-typedef struct {
-    char* name;  ///< Name of the MTP operation
-    char* file;  ///< Name of the file being processed
-} MtpOperationData;
-
 /**
  * Program command-line arguments.
  */
 typedef struct {
-    char* device_id;  ///< Device index, serial number, or NULL for all
-    char* storage_id; ///< Storage ID, or NULL for all
-    int yes;          ///< If truthy, skip interaction and assume "yes"
-    int cleanup;      ///< If truthy, remove stray files after push/pull
+    char* device_id;     ///< Device index, serial number, or NULL for all
+    char* target_id;     ///< Device index or serial number to clone to, or NULL
+    char* storage_id;    ///< Storage ID, or NULL for all
+    int yes;             ///< If truthy, skip interaction and assume "yes"
+    int cleanup;         ///< If truthy, remove stray files after push/pull
+    int rescan;          ///< If truthy, walk the device instead of using the index
+    SyncPlanner planner; ///< Algorithm to plan pushes and pulls with
+    SyncCompare compare; ///< Policy for replacing files present on both sides
+    size_t jobs;         ///< Number of devices to operate on at once, one if zero
 } MtpArgs;
 
 /**
@@ -59,6 +65,23 @@ typedef struct {
  */
 typedef MtpStatusCode (*MtpDeviceFn)(Device* dev, void* data);
 
+/**
+ * Callback function for mtp_each_device_pair.
+ * @param source  the device selected by the device ID
+ * @param target  the device selected by the target ID
+ * @param data    additional context data passed to the callback
+ * @return        status code
+ */
+typedef MtpStatusCode (*MtpDevicePairFn)(Device* source, Device* target, void* data);
+
+/**
+ * Executes a single plan on a device.
+ * @param dev   the device to operate on
+ * @param plan  the plan to execute
+ * @return      status code
+ */
+typedef MtpStatusCode (*MtpActionFn)(Device* dev, SyncPlan* plan);
+
 /**
  * Execute a callback for each connected MTP device and storage combination.
  * This function handles scanning devices and storages, opening, and releasing
@@ -72,7 +95,38 @@ typedef MtpStatusCode (*MtpDeviceFn)(Device* dev, void* data);
 MtpStatusCode mtp_each_device(MtpDeviceFn callback, MtpArgs* args, void* data);
 
 /**
- * Send a local file to an MTP device.
+ * Execute a callback for each connected MTP device and storage combination,
+ * like mtp_each_device, but for up to args->jobs devices at once, each on a
+ * thread of its own. The storages of one device are still done in turn. The
+ * callback must be safe to run on several threads at once, and each device
+ * reports through a child of the progress reporter, see progress_new_child.
+ * A device which fails does not stop the others.
+ * @param callback  to invoke for each device & storage combination
+ * @param args      used to select specific devices or storage by ID, and
+ *                  how many devices to operate on at once
+ * @param data      additional context data provided to the callback function
+ * @return          status code of the first device which failed, once every
+ *                  device is done
+ */
+MtpStatusCode mtp_each_device_parallel(MtpDeviceFn callback, MtpArgs* args, void* data);
+
+/**
+ * Execute a callback for two connected MTP devices at once, such as the
+ * source and target of a clone. The source is selected by args->device_id and
+ * the target by args->target_id, which must select different devices. On each
+ * device, the first storage matching args->storage_id, or the first storage
+ * if it is NULL, is used. Both devices stay open until the callback returns,
+ * and their indexes are kept in sync with any changes afterwards.
+ * @param callback  to invoke for the pair of devices
+ * @param args      used to select the devices and storage by ID
+ * @param data      additional context data provided to the callback function
+ * @return          status code indicating success or failure
+ */
+MtpStatusCode mtp_each_device_pair(MtpDevicePairFn callback, MtpArgs* args, void* data);
+
+/**
+ * Send a file to an MTP device. The file is read from the local system, or
+ * streamed from dev->clone_from if set.
  * @param dev   device to operate on
  * @param plan  plan for file to send
  * @return      status code
@@ -87,6 +141,70 @@ MtpStatusCode mtp_send_file(Device* dev, SyncPlan* plan);
  */
 MtpStatusCode mtp_get_file(Device* dev, SyncPlan* plan);
 
+/**
+ * Replace a changed file on an MTP device. The existing file is deleted, since
+ * MTP objects cannot be overwritten, before the local file is sent.
+ * @param dev   device to operate on
+ * @param plan  plan for file to replace
+ * @return      status code
+ */
+MtpStatusCode mtp_replace_file(Device* dev, SyncPlan* plan);
+
+/**
+ * Move a stray file on an MTP device in to place, instead of sending the local
+ * file. If the device rejects the move, the stray file is deleted and the
+ * local file is sent instead.
+ * @param dev   device to operate on
+ * @param plan  plan for file to move
+ * @return      status code
+ */
+MtpStatusCode mtp_move_file(Device* dev, SyncPlan* plan);
+
+/**
+ * Copy a file already on an MTP device, instead of sending a local file with
+ * the same contents. If the device rejects the copy, the local file is sent
+ * instead.
+ * @param dev   device to operate on
+ * @param plan  plan for file to copy
+ * @return      status code
+ */
+MtpStatusCode mtp_copy_file(Device* dev, SyncPlan* plan);
+
+/**
+ * Digests of local files, for finding duplicate transfers with
+ * mtp_digest_file.
+ */
+typedef struct {
+    DigestManifest* manifest;  ///< Manifest to look up and record digests in, or NULL
+    pthread_mutex_t* lock;     ///< Guards the manifest, or NULL if no other thread uses it
+    Hash* files;               ///< Digests found by mtp_digest_plans by path, or NULL
+} MtpDigests;
+
+/**
+ * Computes the digest of a local file, for finding duplicate transfers. This
+ * is a SyncDigestFn. The digest is taken from the digests found up front, or
+ * else from the manifest if the file did not change, and is only computed if
+ * neither has it.
+ * @param f       local file
+ * @param digest  set to the digest of the file
+ * @param data    an MtpDigests, or NULL to always compute the digest
+ * @return        status code
+ */
+SyncStatusCode mtp_digest_file(File* f, uint64_t* digest, void* data);
+
+/**
+ * Digests the source files of the transfers in a list of plans which may be
+ * compared by sync_plan_copies, because another transfer has the same size.
+ * Files which are not in the manifest are read on a pool of threads. The
+ * digests are kept in the files hash, which is created if needed; free it
+ * with hash_free when done.
+ * @param d      digests to add to
+ * @param arena  arena to allocate the digests from
+ * @param plans  plans returned by sync_plan_push or sync_plan_moves
+ * @return       status code
+ */
+MtpStatusCode mtp_digest_plans(MtpDigests* d, Arena* arena, List* plans);
+
 /**
  * Delete a file or directory from an MTP device.
  * @param dev   device to operate on
@@ -103,6 +221,22 @@ MtpStatusCode mtp_rm_file(Device* dev, SyncPlan* plan);
  */
 MtpStatusCode mtp_mkdir(Device* dev, SyncPlan* plan);
 
+/**
+ * Executes a single plan, as part of pushing files to a device.
+ * @param dev   device to operate on
+ * @param plan  plan to execute
+ * @return      status code
+ */
+MtpStatusCode mtp_execute_push_action(Device* dev, SyncPlan* plan);
+
+/**
+ * Executes a single plan, as part of pulling files from a device.
+ * @param dev   device to operate on
+ * @param plan  plan to execute
+ * @return      status code
+ */
+MtpStatusCode mtp_execute_pull_action(Device* dev, SyncPlan* plan);
+
 /**
  * Execute plan to push files to a device.
  * @param dev   device to operate on
@@ -119,4 +253,58 @@ MtpStatusCode mtp_execute_push_plan(Device* dev, List* plan);
  */
 MtpStatusCode mtp_execute_pull_plan(Device* dev, List* plan);
 
+/**
+ * Plan and execute a push or pull at the same time, executing each plan as
+ * soon as it is known, rather than planning everything first. See
+ * sync_plan_stream for the order plans are executed in. When pushing, files
+ * with the same contents as a file sent before are copied on the device.
+ * @param dev           device to operate on
+ * @param source_files  current files on the source side
+ * @param target_files  current files on the target side
+ * @param specs         specifications for source-to-target file mapping
+ * @param args          cleanup and compare options of the command
+ * @param is_push       truthy to push to the device, falsy to pull from it
+ * @param digests       digests of local files to pass to mtp_digest_file,
+ *                      may be NULL
+ * @param count         set to the number of plans executed, may be NULL
+ * @return              status code
+ */
+MtpStatusCode mtp_execute_stream(Device* dev, List* source_files, List* target_files, List* specs, MtpArgs* args, int is_push, MtpDigests* digests, size_t* count);
+
+/**
+ * Look up the digests of the unchanged folders in a list of local files
+ * collected by digest_collect_files, so that several devices may resolve the
+ * same folders at once without reading the manifest.
+ * @param m        manifest the local files were collected with
+ * @param arena    arena to allocate the digests from
+ * @param files    local files
+ * @param digests  hash from hash_new_str, each folder's digest is put by path
+ * @return         status code
+ */
+MtpStatusCode mtp_folder_digests(DigestManifest* m, Arena* arena, List* files, Hash* digests);
+
+/**
+ * Resolve the unchanged folders in a list of local files collected by
+ * digest_collect_files. A folder holding the same names as the matching folder
+ * on the device is kept, and mapped by a spec of its own for sync_prune_push
+ * to leave out. Any other folder is replaced by the files within it, which
+ * may include more unchanged folders in turn. Only meaningful with
+ * SYNC_COMPARE_EXISTS, since the manifest only knows the names in a folder.
+ * The manifest is only used, under the lock, to list the files within a
+ * folder which is replaced, if the digests of the local files are given.
+ * @param m             manifest the local files were collected with
+ * @param lock          guards the manifest, or NULL if no other thread uses it
+ * @param digests       digests of the local folders from mtp_folder_digests,
+ *                      or NULL to look them up here
+ * @param arena         arena to allocate files and specs from
+ * @param local_files   local files, resolved in place
+ * @param device_files  current files on the device
+ * @param local_path    local path the files were collected from
+ * @param device_path   device path the local path maps to
+ * @param is_push       truthy if the local files are pushed, falsy if pulled
+ * @param specs         a spec is appended for each folder which is kept
+ * @return              status code
+ */
+MtpStatusCode mtp_resolve_folders(DigestManifest* m, pthread_mutex_t* lock, Hash* digests, Arena* arena, List* local_files, List* device_files, char* local_path, char* device_path, int is_push, List* specs);
+
 #endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "device.h"
+#include "list.h"
+#include "mtp.h"
+#include "mtp_clone.h"
+#include "fs.h"
+#include "progress.h"
+#include "sync.h"
+
+typedef struct {
+    MtpArgs* args;
+    char* from_path;
+    char* to_path;
+} MtpCloneParams;
+
+static MtpStatusCode mtp_clone_callback(Device* source, Device* target, void* data) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    Arena* arena = NULL;
+    List* plans = NULL;
+    List* source_files = NULL;
+    List* target_files = NULL;
+    List* clone_specs = NULL;
+
+    MtpCloneParams* params = (MtpCloneParams*)data;
+
+    arena = arena_new(MTP_ARENA_BLOCK_SIZE);
+    if (!arena) goto done;
+
+    if (device_load_path(source, params->from_path) != DEVICE_STATUS_OK || device_load_path(target, params->to_path) != DEVICE_STATUS_OK) {
+        code = MTP_STATUS_EDEVICE;
+        progress_error(target->progress, "Failed to load device\n");
+        goto done;
+    }
+
+    source_files = device_filter_files(source, params->from_path);
+    if (!source_files) goto done;
+
+    if (!list_size(source_files)) {
+        printf("No files in source path: %s\n", params->from_path);
+        goto done;
+    }
+
+    target_files = device_filter_files(target, params->to_path);
+    if (!target_files) goto done;
+
+    clone_specs = sync_spec_create(arena, source_files, params->from_path, params->to_path);
+    if (!clone_specs) goto done;
+
+    if (sync_prune_push(arena, source_files, target_files, clone_specs, params->args->compare, NULL) != SYNC_STATUS_OK) goto done;
+
+    // files are sent from the source device rather than the local system
+    target->clone_from = source;
+
+    // nothing needs confirming, so start transferring while still planning,
+    // unless stray files may be moved, which needs the whole plan
+    if (params->args->yes && !params->args->cleanup) {
+        size_t count = 0;
+        code = mtp_execute_stream(target, source_files, target_files, clone_specs, params->args, 1, NULL, &count);
+        if (code == MTP_STATUS_OK && !count) printf("All files already present on the target device.\n");
+        goto done;
+    }
+
+    plans = sync_plan_push(arena, source_files, target_files, clone_specs, params->args->cleanup, params->args->compare, params->args->planner);
+    if (!plans) goto done;
+
+    uint64_t saved = 0;
+    if (params->args->cleanup) {
+        List* moved = sync_plan_moves(arena, plans, &saved);
+        if (!moved) goto done;
+        list_free(plans);
+        plans = moved;
+    }
+
+    if (list_size(plans)) {
+        int yes = params->args->yes;
+        if (!yes) {
+            sync_plan_print(target->progress, plans, MTP_CLONE_MSG);
+            if (saved) {
+                char buf[32];
+                progress_log(target->progress, "Moving stray files avoids transferring %s.\n", progress_format_bytes(buf, sizeof(buf), saved));
+            }
+            yes = progress_confirm(target->progress, "Proceed [y/n]? ");
+        }
+
+        if (!yes) {
+            code = MTP_STATUS_EREJECT;
+            goto done;
+        }
+
+        if (mtp_execute_push_plan(target, plans) != MTP_STATUS_OK) goto done;
+    } else {
+        printf("All files already present on the target device.\n");
+    }
+
+    code = MTP_STATUS_OK;
+
+done:
+    target->clone_from = NULL;
+    list_free(source_files);
+    list_free(target_files);
+    list_free(clone_specs);
+    list_free(plans);
+    arena_free(arena);
+    return code;
+}
+
+MtpStatusCode mtp_clone(MtpArgs* args, char* from_path, char* to_path) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    char* from_path_r = NULL;
+    char* to_path_r = NULL;
+
+    if (!args->device_id || !args->target_id) {
+        fprintf(stderr, "Specify the source and target devices, with -d for each\n");
+        code = MTP_STATUS_ESYNTAX;
+        goto done;
+    }
+
+    from_path_r = fs_resolve_cwd("/", from_path);
+    if (!from_path_r) goto done;
+
+    to_path_r = fs_resolve_cwd("/", to_path ? to_path : from_path);
+    if (!to_path_r) goto done;
+
+    MtpCloneParams params = {
+        .args = args,
+        .from_path = from_path_r,
+        .to_path = to_path_r,
+    };
+    code = mtp_each_device_pair(mtp_clone_callback, args, &params);
+
+done:
+    free(from_path_r);
+    free(to_path_r);
+    return code;
+}
@@ -0,0 +1,20 @@
+/**
+ * @file mtp_clone.h
+ * Implements the "clone" sub-command.
+ */
+
+#ifndef _MTP_CLONE_H_
+#define _MTP_CLONE_H_
+
+/**
+ * Implements the "clone" sub-command, which pushes files from one device to
+ * another, streaming each file between the devices without writing it to
+ * disk. The devices are selected by args->device_id and args->target_id.
+ * @param args       command-line arguments
+ * @param from_path  path on the source device to clone files from
+ * @param to_path    path on the target device to send files to
+ * @return           status code of the operation
+ */
+MtpStatusCode mtp_clone(MtpArgs* args, char* from_path, char* to_path);
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "digest.h"
+#include "file.h"
+#include "fs.h"
+#include "list.h"
+#include "mtp.h"
+#include "progress.h"
+
+MtpStatusCode mtp_hash(MtpArgs* args, char* hash_path) {
+    MtpStatusCode code = MTP_STATUS_EFAIL;
+    Arena* arena = NULL;
+    List* files = NULL;
+    DigestManifest* manifest = NULL;
+    uint64_t* digests = NULL;
+    char* hash_path_r = NULL;
+    char* manifest_path = NULL;
+    char bytes_buf[32];
+    char rate_buf[32];
+
+    hash_path_r = fs_resolve(hash_path);
+    if (!hash_path_r) goto done;
+
+    arena = arena_new(MTP_ARENA_BLOCK_SIZE);
+    if (!arena) goto done;
+
+    files = fs_collect_files(arena, hash_path_r);
+    if (!files) goto done;
+
+    digests = calloc(list_size(files) + 1, sizeof(uint64_t));
+    if (!digests) goto done;
+
+    // without a cache directory, every file is simply read
+    manifest_path = digest_manifest_path();
+    manifest = digest_manifest_open(manifest_path);
+    if (!manifest) goto done;
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+
+    DigestStats stats;
+    DigestStatusCode digest_code = digest_files(manifest, files, threads, digests, &stats);
+    if (digest_code == DIGEST_STATUS_ENOMEM) {
+        code = MTP_STATUS_ENOMEM;
+        goto done;
+    }
+
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        // files which could not be read were already reported
+        if (f->is_folder || (!digests[i] && f->size)) continue;
+        printf("%016llx  %s\n", (unsigned long long)digests[i], f->path);
+    }
+
+    double seconds = stats.nanos / 1e9;
+    uint64_t rate = seconds > 0 ? stats.read / seconds : 0;
+    fprintf(
+        stderr,
+        "Hashed %zu files (%zu from manifest), read %s in %.2fs (%s/s)\n",
+        stats.files,
+        stats.cached,
+        progress_format_bytes(bytes_buf, sizeof(bytes_buf), stats.read),
+        seconds,
+        progress_format_bytes(rate_buf, sizeof(rate_buf), rate)
+    );
+
+    if (manifest_path) {
+        if (digest_manifest_prune(manifest, hash_path_r, files) != DIGEST_STATUS_OK) goto done;
+        if (digest_manifest_save(manifest, manifest_path) != DIGEST_STATUS_OK) {
+            fprintf(stderr, "Failed to save manifest: %s\n", manifest_path);
+        }
+    }
+
+    code = digest_code == DIGEST_STATUS_OK ? MTP_STATUS_OK : MTP_STATUS_EFAIL;
+
+done:
+    free(hash_path_r);
+    free(manifest_path);
+    free(digests);
+    digest_manifest_free(manifest);
+    list_free(files);
+    arena_free(arena);
+    return code;
+}
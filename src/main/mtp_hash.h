@@ -0,0 +1,18 @@
+/**
+ * @file mtp_hash.h
+ * Implements the "hash" sub-command.
+ */
+#ifndef _MTP_HASH_H_
+#define _MTP_HASH_H_
+
+/**
+ * Implements the "hash" sub-command, printing the content digest of every
+ * local file within a path. Digests of files which did not change since the
+ * last run are taken from the on-disk manifest.
+ * @param args       command-line parameters
+ * @param hash_path  local path to digest the files of
+ * @return           status code of the operation
+ */
+MtpStatusCode mtp_hash(MtpArgs* args, char* hash_path);
+
+#endif
@@ -14,9 +14,9 @@ static MtpStatusCode mtp_ls_callback(Device* dev, void* ls_path) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
     List* ls_files = NULL;
 
-    if (device_load(dev) != DEVICE_STATUS_OK) {
+    if (device_load_path(dev, ls_path) != DEVICE_STATUS_OK) {
         code = MTP_STATUS_EDEVICE;
-        fprintf(stderr, "Failed to load device\n");
+        progress_error(dev->progress, "Failed to load device\n");
         goto done;
     }
 
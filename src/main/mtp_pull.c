@@ -11,24 +11,26 @@
 #include "mtp.h"
 #include "str.h"
 #include "fs.h"
-#include "io.h"
+#include "progress.h"
+#include "resume.h"
 
 typedef struct {
     MtpArgs* args;
     char* from_path;
     char* to_path;
+    DigestManifest* manifest;
 } MtpPullParams;
 
-static List* collect_local_files(char* path) {
+static List* collect_local_files(DigestManifest* m, Arena* arena, char* path) {
     List* child_files = NULL;
     List* parent_dirs = NULL;
     List* all_files = NULL;
 
-    child_files = fs_collect_files(path);
+    child_files = m ? digest_collect_files(m, arena, path) : fs_collect_files(arena, path);
     if (!child_files && errno == ENOENT) child_files = list_new(0);
     if (!child_files) goto error;
 
-    parent_dirs = fs_collect_ancestors(path);
+    parent_dirs = fs_collect_ancestors(arena, path);
     if (!parent_dirs) goto error;
 
     all_files = list_new(list_size(child_files) + list_size(parent_dirs));
@@ -45,14 +47,15 @@ done:
     return all_files;
 
 error:
-    list_free_deep(all_files, (ListItemFreeFn)child_files);
-    list_free_deep(all_files, (ListItemFreeFn)parent_dirs);
+    list_free(child_files);
+    list_free(parent_dirs);
     list_free(all_files);
     return NULL;
 }
 
 static MtpStatusCode mtp_pull_callback(Device* dev, void* data) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
+    Arena* arena = NULL;
     List* local_files = NULL;
     List* pull_specs = NULL;
     List* source_files = NULL;
@@ -60,29 +63,67 @@ static MtpStatusCode mtp_pull_callback(Device* dev, void* data) {
 
     MtpPullParams* params = (MtpPullParams*)data;
 
-    if (device_load(dev) != DEVICE_STATUS_OK) {
+    arena = arena_new(MTP_ARENA_BLOCK_SIZE);
+    if (!arena) goto done;
+
+    if (device_load_path(dev, params->from_path) != DEVICE_STATUS_OK) {
         code = MTP_STATUS_EDEVICE;
-        fprintf(stderr, "Failed to load device\n");
+        progress_error(dev->progress, "Failed to load device\n");
         goto done;
     }
 
     source_files = device_filter_files(dev, params->from_path);
     if (!source_files) goto done;
 
-    local_files = collect_local_files(params->to_path);
+    local_files = collect_local_files(params->manifest, arena, params->to_path);
     if (!local_files) goto done;
 
-    pull_specs = sync_spec_create(source_files, params->from_path, params->to_path);
+    pull_specs = sync_spec_create(arena, source_files, params->from_path, params->to_path);
     if (!pull_specs) goto done;
 
-    plans = sync_plan_push(source_files, local_files, pull_specs, params->args->cleanup);
+    if (params->manifest) {
+        code = mtp_resolve_folders(params->manifest, NULL, NULL, arena, local_files, source_files, params->to_path, params->from_path, 0, pull_specs);
+        if (code != MTP_STATUS_OK) goto done;
+        code = MTP_STATUS_EFAIL;
+    }
+
+    if (sync_prune_push(arena, source_files, local_files, pull_specs, params->args->compare, NULL) != SYNC_STATUS_OK) goto done;
+
+    // nothing needs confirming, so start transferring while still planning,
+    // unless stray files may be moved, which needs the whole plan
+    if (params->args->yes && !params->args->cleanup) {
+        size_t count = 0;
+        code = mtp_execute_stream(dev, source_files, local_files, pull_specs, params->args, 0, NULL, &count);
+        if (code == MTP_STATUS_OK && !count) printf("All files already present on the local system.\n");
+        goto done;
+    }
+
+    plans = sync_plan_push(arena, source_files, local_files, pull_specs, params->args->cleanup, params->args->compare, params->args->planner);
     if (!plans) goto done;
 
+    uint64_t saved = 0;
+    if (params->args->cleanup) {
+        List* moved = sync_plan_moves(arena, plans, &saved);
+        if (!moved) goto done;
+        list_free(plans);
+        plans = moved;
+
+        // partial files of transfers no longer planned are strays too
+        List* cleaned = resume_plan_cleanup(arena, plans, params->to_path);
+        if (!cleaned) goto done;
+        list_free(plans);
+        plans = cleaned;
+    }
+
     if (list_size(plans)) {
         int yes = params->args->yes;
         if (!yes) {
-            sync_plan_print(plans, MTP_PULL_MSG);
-            yes = io_confirm("Proceed [y/n]? ");
+            sync_plan_print(dev->progress, plans, MTP_PULL_MSG);
+            if (saved) {
+                char buf[32];
+                progress_log(dev->progress, "Moving stray files avoids transferring %s.\n", progress_format_bytes(buf, sizeof(buf), saved));
+            }
+            yes = progress_confirm(dev->progress, "Proceed [y/n]? ");
         }
 
         if (!yes) {
@@ -99,9 +140,10 @@ static MtpStatusCode mtp_pull_callback(Device* dev, void* data) {
 
 done:
     list_free(source_files);
-    list_free_deep(local_files, (ListItemFreeFn)file_free);
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
-    list_free_deep(pull_specs, (ListItemFreeFn)sync_spec_free);
+    list_free(local_files);
+    list_free(plans);
+    list_free(pull_specs);
+    arena_free(arena);
     return code;
 }
 
@@ -111,6 +153,8 @@ MtpStatusCode mtp_pull(MtpArgs* args, char* from_path, char* to_path) {
     char* to_path_tmp = NULL;
     char* from_path_r = NULL;
     char* to_path_r = NULL;
+    DigestManifest* manifest = NULL;
+    char* manifest_path = NULL;
 
     from_path_r = fs_resolve_cwd("/", from_path);
     if (!from_path_r) goto done;
@@ -134,14 +178,29 @@ MtpStatusCode mtp_pull(MtpArgs* args, char* from_path, char* to_path) {
         if (!to_path_r) goto done;
     }
 
+    // the manifest only knows which names are in a folder, so only folders
+    // which need not be compared any further can be left unlisted
+    if (args->compare == SYNC_COMPARE_EXISTS) manifest_path = digest_manifest_path();
+    if (manifest_path) {
+        manifest = digest_manifest_open(manifest_path);
+        if (!manifest) goto done;
+    }
+
     MtpPullParams pull_params = {
         .args = args,
         .from_path = from_path_r,
         .to_path = to_path_r,
+        .manifest = manifest,
     };
     code = mtp_each_device(mtp_pull_callback, args, &pull_params);
 
+    if (manifest && digest_manifest_save(manifest, manifest_path) != DIGEST_STATUS_OK) {
+        fprintf(stderr, "Failed to save manifest: %s\n", manifest_path);
+    }
+
 done:
+    free(manifest_path);
+    digest_manifest_free(manifest);
     free(from_path_r);
     free(to_path_r);
     free(from_path_bname);
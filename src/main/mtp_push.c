@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,7 +16,7 @@
 #include "mtp_rm.h"
 #include "str.h"
 #include "fs.h"
-#include "io.h"
+#include "progress.h"
 #include "hash.h"
 #include "sync.h"
 #include "array.h"
@@ -24,35 +25,96 @@
 
 typedef struct {
     MtpArgs* args;
+    Arena* arena;
     List* source_files;
     List* push_specs;
+    DigestManifest* manifest;
+    Hash* folders;         // Digests of the unchanged local folders by path, or NULL
+    pthread_mutex_t lock;  // Guards the manifest, when pushing to several devices at once
+    char* from_path;
     char* to_path;
 } MtpPushParams;
 
 static MtpStatusCode mtp_push_callback(Device* dev, void* data) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
+    Arena* arena = NULL;
     List* plans = NULL;
     List* target_files = NULL;
+    List* source_files = NULL;
+    List* push_specs = NULL;
+
+    MtpPushParams* params = (MtpPushParams*)data;
+    MtpDigests digests = { .manifest = params->manifest, .lock = &params->lock, .files = NULL };
 
-    if (device_load(dev) != DEVICE_STATUS_OK) {
+    arena = arena_new(MTP_ARENA_BLOCK_SIZE);
+    if (!arena) goto done;
+
+    if (device_load_path(dev, params->to_path) != DEVICE_STATUS_OK) {
         code = MTP_STATUS_EDEVICE;
-        fprintf(stderr, "Failed to load device\n");
+        progress_error(dev->progress, "Failed to load device\n");
         goto done;
     }
 
-    MtpPushParams* params = (MtpPushParams*)data;
-
     target_files = device_filter_files(dev, params->to_path);
     if (!target_files) goto done;
 
-    plans = sync_plan_push(params->source_files, target_files, params->push_specs, params->args->cleanup);
+    // the lists are shared by every device, but pruned for this one
+    source_files = list_new(list_size(params->source_files));
+    push_specs = list_new(list_size(params->push_specs));
+    if (!source_files || !push_specs) goto done;
+    if (list_push_all(source_files, params->source_files) != LIST_STATUS_OK) goto done;
+    if (list_push_all(push_specs, params->push_specs) != LIST_STATUS_OK) goto done;
+
+    if (params->folders) {
+        code = mtp_resolve_folders(params->manifest, &params->lock, params->folders, arena, source_files, target_files, params->from_path, params->to_path, 1, push_specs);
+        if (code != MTP_STATUS_OK) goto done;
+        code = MTP_STATUS_EFAIL;
+    }
+
+    if (sync_prune_push(arena, source_files, target_files, push_specs, params->args->compare, NULL) != SYNC_STATUS_OK) goto done;
+
+    // nothing needs confirming, so start transferring while still planning,
+    // unless stray files may be moved, which needs the whole plan
+    if (params->args->yes && !params->args->cleanup) {
+        size_t count = 0;
+        code = mtp_execute_stream(dev, source_files, target_files, push_specs, params->args, 1, &digests, &count);
+        if (code == MTP_STATUS_OK && !count) progress_log(dev->progress, "All files already present on the device.\n");
+        goto done;
+    }
+
+    plans = sync_plan_push(arena, source_files, target_files, push_specs, params->args->cleanup, params->args->compare, params->args->planner);
     if (!plans) goto done;
 
+    uint64_t saved = 0;
+    if (params->args->cleanup) {
+        List* moved = sync_plan_moves(arena, plans, &saved);
+        if (!moved) goto done;
+        list_free(plans);
+        plans = moved;
+    }
+
+    // files of the same size are digested together, rather than as compared
+    if (mtp_digest_plans(&digests, arena, plans) != MTP_STATUS_OK) goto done;
+
+    uint64_t copied = 0;
+    List* copies = sync_plan_copies(arena, plans, mtp_digest_file, &digests, &copied);
+    if (!copies) goto done;
+    list_free(plans);
+    plans = copies;
+    saved += copied;
+
     if (list_size(plans)) {
         int yes = params->args->yes;
         if (!yes) {
-            sync_plan_print(plans, MTP_PUSH_MSG);
-            yes = io_confirm("Proceed [y/n]? ");
+            // other devices wait rather than print over the plan or prompt
+            progress_hold(dev->progress);
+            sync_plan_print(dev->progress, plans, MTP_PUSH_MSG);
+            if (saved) {
+                char buf[32];
+                progress_log(dev->progress, "Moving or copying files on the device avoids transferring %s.\n", progress_format_bytes(buf, sizeof(buf), saved));
+            }
+            yes = progress_confirm(dev->progress, "Proceed [y/n]? ");
+            progress_release(dev->progress);
         }
 
         if (!yes) {
@@ -62,21 +124,29 @@ static MtpStatusCode mtp_push_callback(Device* dev, void* data) {
 
         if (mtp_execute_push_plan(dev, plans) != MTP_STATUS_OK) goto done;
     } else {
-        printf("All files already present on the device.\n");
+        progress_log(dev->progress, "All files already present on the device.\n");
     }
 
     code = MTP_STATUS_OK;
 
 done:
     list_free(target_files);
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
+    list_free(source_files);
+    list_free(push_specs);
+    list_free(plans);
+    hash_free(digests.files);
+    arena_free(arena);
     return code;
 }
 
 MtpStatusCode mtp_push(MtpArgs* args, char* from_path, char* to_path) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
+    Arena* arena = NULL;
     List* source_files = NULL;
     List* push_specs = NULL;
+    DigestManifest* manifest = NULL;
+    Hash* folders = NULL;
+    char* manifest_path = NULL;
     char* from_path_r = NULL;
     char* to_path_r = NULL;
 
@@ -86,7 +156,29 @@ MtpStatusCode mtp_push(MtpArgs* args, char* from_path, char* to_path) {
     to_path_r = fs_resolve_cwd("/", to_path);
     if (!to_path_r) goto done;
 
-    source_files = fs_collect_files(from_path_r);
+    arena = arena_new(MTP_ARENA_BLOCK_SIZE);
+    if (!arena) goto done;
+
+    // the manifest also keeps the digests used to find duplicate transfers
+    manifest_path = digest_manifest_path();
+    if (manifest_path) {
+        manifest = digest_manifest_open(manifest_path);
+        if (!manifest) goto done;
+    }
+
+    // the manifest only knows which names are in a folder, so only folders
+    // which need not be compared any further can be left unlisted
+    if (manifest && args->compare == SYNC_COMPARE_EXISTS) {
+        source_files = digest_collect_files(manifest, arena, from_path_r);
+        if (!source_files) goto done;
+
+        // each device compares the same folders, so they are looked up once
+        folders = hash_new_str(MTP_PUSH_LIST_INIT_SIZE);
+        if (!folders) goto done;
+        if (mtp_folder_digests(manifest, arena, source_files, folders) != MTP_STATUS_OK) goto done;
+    } else {
+        source_files = fs_collect_files(arena, from_path_r);
+    }
     if (!source_files) goto done;
 
     if (!list_size(source_files)) {
@@ -94,21 +186,35 @@ MtpStatusCode mtp_push(MtpArgs* args, char* from_path, char* to_path) {
         goto done;
     }
 
-    push_specs = sync_spec_create(source_files, from_path_r, to_path_r);
+    push_specs = sync_spec_create(arena, source_files, from_path_r, to_path_r);
     if (!push_specs) goto done;
 
     MtpPushParams params = {
         .args = args,
+        .arena = arena,
         .source_files = source_files,
         .push_specs = push_specs,
+        .manifest = manifest,
+        .folders = folders,
+        .from_path = from_path_r,
         .to_path = to_path_r,
     };
-    code = mtp_each_device(mtp_push_callback, args, &params);
+    pthread_mutex_init(&params.lock, NULL);
+    code = mtp_each_device_parallel(mtp_push_callback, args, &params);
+    pthread_mutex_destroy(&params.lock);
+
+    if (manifest && digest_manifest_save(manifest, manifest_path) != DIGEST_STATUS_OK) {
+        fprintf(stderr, "Failed to save manifest: %s\n", manifest_path);
+    }
 
 done:
+    free(manifest_path);
+    hash_free(folders);
+    digest_manifest_free(manifest);
     free(from_path_r);
     free(to_path_r);
-    list_free_deep(source_files, (ListItemFreeFn)file_free);
-    list_free_deep(push_specs, (ListItemFreeFn)sync_spec_free);
+    list_free(source_files);
+    list_free(push_specs);
+    arena_free(arena);
     return code;
 }
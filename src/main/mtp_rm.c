@@ -9,7 +9,7 @@
 #include "mtp.h"
 #include "str.h"
 #include "fs.h"
-#include "io.h"
+#include "progress.h"
 
 #define MTP_RM_INIT_SIZE 512
 
@@ -20,21 +20,28 @@ typedef struct {
 
 static MtpStatusCode mtp_rm_files(Device* dev, MtpArgs* args, List* rm_files) {
     MtpStatusCode code = MTP_STATUS_EFAIL;
+    Arena* arena = NULL;
     List* plans = NULL;
 
-    plans = sync_plan_rm(rm_files);
+    arena = arena_new(MTP_ARENA_BLOCK_SIZE);
+    if (!arena) goto done;
+
+    plans = sync_plan_rm(arena, rm_files);
     if (!plans) goto done;
 
     if (!list_size(plans)) {
-        printf("No files to delete.\n");
+        progress_log(dev->progress, "No files to delete.\n");
         code = MTP_STATUS_OK;
         goto done;
     }
 
     int yes = args->yes;
     if (!yes) {
-        sync_plan_print(plans, MTP_PUSH_MSG);
-        yes = io_confirm("Proceed [y/n]? ");
+        // other devices wait rather than print over the plan or prompt
+        progress_hold(dev->progress);
+        sync_plan_print(dev->progress, plans, MTP_PUSH_MSG);
+        yes = progress_confirm(dev->progress, "Proceed [y/n]? ");
+        progress_release(dev->progress);
     }
 
     if (!yes) {
@@ -47,7 +54,8 @@ static MtpStatusCode mtp_rm_files(Device* dev, MtpArgs* args, List* rm_files) {
     code = MTP_STATUS_OK;
 
 done:
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
+    list_free(plans);
+    arena_free(arena);
     return code;
 }
 
@@ -56,18 +64,18 @@ static MtpStatusCode mtp_rm_paths(Device* dev, MtpArgs* args, List* rm_paths) {
     List* tmp_files = NULL;
     List* rm_files = NULL;
 
-    if (device_load(dev) != DEVICE_STATUS_OK) {
-        fprintf(stderr, "Failed to load device\n");
-        code = MTP_STATUS_EDEVICE;
-        goto done;
-    }
-
     rm_files = list_new(MTP_RM_INIT_SIZE);
     if (!rm_files) goto done;
 
     for (size_t i = 0; i < list_size(rm_paths); i++) {
         char* rm_path = list_get(rm_paths, i);
 
+        if (device_load_path(dev, rm_path) != DEVICE_STATUS_OK) {
+            progress_error(dev->progress, "Failed to load device\n");
+            code = MTP_STATUS_EDEVICE;
+            goto done;
+        }
+
         tmp_files = device_filter_files(dev, rm_path);
         if (!tmp_files) goto done;
 
@@ -109,9 +117,9 @@ MtpStatusCode mtp_rm(MtpArgs* args, List* rm_paths) {
 
     MtpRmParams rm_params = {
         .args = args,
-        .rm_paths = rm_paths,
+        .rm_paths = rm_paths_r,
     };
-    code = mtp_each_device(mtp_rm_callback, args, &rm_params);
+    code = mtp_each_device_parallel(mtp_rm_callback, args, &rm_params);
 
 done:
     free(rm_path_r);
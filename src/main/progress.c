@@ -0,0 +1,433 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "array.h"
+#include "io.h"
+#include "progress.h"
+
+// Minimum time between redraws of the status line on a terminal
+#define PROGRESS_TTY_INTERVAL_NS 100000000ULL
+
+// Minimum time between summary lines when not writing to a terminal
+#define PROGRESS_LOG_INTERVAL_NS 5000000000ULL
+
+// Longer paths are shortened on the status line, so that it fits on one line
+#define PROGRESS_PATH_WIDTH 48
+
+struct Progress {
+    FILE* out;              // Stream to report on
+    int is_tty;             // Truthy if the stream is a terminal
+    int is_drawn;           // Truthy if the status line is on the terminal
+    uint64_t interval_ns;   // Minimum time between redraws
+    uint64_t start_ns;      // Time the operation started
+    uint64_t last_draw_ns;  // Time the status was last drawn
+    size_t total_items;     // Number of items expected, or zero if unknown
+    size_t done_items;      // Number of items done
+    uint64_t total_bytes;   // Number of bytes expected, or zero if unknown
+    uint64_t done_bytes;    // Bytes of all items done
+    uint64_t item_bytes;    // Bytes of the current item processed so far
+    uint64_t item_total;    // Size of the current item in bytes
+    const char* label;      // Description of the current item
+    const char* path;       // Path of the current item
+    int is_folder;          // Truthy if the current item is a folder
+    struct Progress* root;  // Reporter which owns the stream, itself unless a child
+    struct Progress* children; // First child reporting through this one
+    struct Progress* next;  // Next child of the same root
+    char* name;             // Printed before each line of a child, or NULL
+    struct Progress* holder; // Reporter holding back the output of the others, only used on the root
+    pthread_mutex_t lock;   // Guards the stream and every child, only used on the root
+    pthread_cond_t cond;    // Signalled when the output is released, only used on the root
+};
+
+// Totals shown on the status line, of one reporter or all children of a root
+typedef struct {
+    size_t total_items;     // Number of items expected, or zero if unknown
+    size_t done_items;      // Number of items done
+    uint64_t total_bytes;   // Number of bytes expected, or zero if unknown
+    uint64_t bytes;         // Bytes processed, including the current items
+    uint64_t start_ns;      // Time the earliest operation started
+} ProgressTotals;
+
+static uint64_t progress_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+char* progress_format_bytes(char* buf, size_t size, uint64_t bytes) {
+    static const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    double value = bytes;
+    size_t unit = 0;
+
+    while (value >= 1024 && unit < ARRAY_LEN(units) - 1) {
+        value /= 1024;
+        unit++;
+    }
+
+    if (unit == 0) {
+        snprintf(buf, size, "%llu B", (unsigned long long)bytes);
+    } else {
+        snprintf(buf, size, "%.1f %s", value, units[unit]);
+    }
+    return buf;
+}
+
+char* progress_format_duration(char* buf, size_t size, uint64_t seconds) {
+    uint64_t h = seconds / 3600;
+    uint64_t m = (seconds / 60) % 60;
+    uint64_t s = seconds % 60;
+
+    if (h) {
+        snprintf(buf, size, "%llu:%02llu:%02llu", (unsigned long long)h, (unsigned long long)m, (unsigned long long)s);
+    } else {
+        snprintf(buf, size, "%llu:%02llu", (unsigned long long)m, (unsigned long long)s);
+    }
+    return buf;
+}
+
+static void progress_add(ProgressTotals* t, Progress* p) {
+    t->total_items += p->total_items;
+    t->done_items += p->done_items;
+    t->total_bytes += p->total_bytes;
+    t->bytes += p->done_bytes + p->item_bytes;
+    if (p->start_ns < t->start_ns) t->start_ns = p->start_ns;
+}
+
+// Adds up the totals of every child of a root, or of a reporter without any.
+static void progress_totals(Progress* p, ProgressTotals* t) {
+    memset(t, 0, sizeof(ProgressTotals));
+    t->start_ns = UINT64_MAX;
+
+    if (!p->root->children) {
+        progress_add(t, p);
+        return;
+    }
+    for (Progress* c = p->root->children; c; c = c->next) progress_add(t, c);
+}
+
+// Formats the totals of the operation, like "3/10, 1.5 MiB/4.0 MiB, 1.2 MiB/s, ETA 0:02".
+static void progress_format_totals(ProgressTotals* t, char* buf, size_t size, uint64_t now) {
+    char done[16], total[16], rate[16], eta[16];
+    uint64_t bytes = t->bytes;
+    double elapsed = (now - t->start_ns) / 1e9;
+    size_t n = 0;
+
+    n += snprintf(buf + n, size - n, "%zu", t->done_items);
+    if (t->total_items && n < size) n += snprintf(buf + n, size - n, "/%zu", t->total_items);
+
+    if (t->total_bytes && n < size) {
+        progress_format_bytes(done, sizeof(done), bytes);
+        progress_format_bytes(total, sizeof(total), t->total_bytes);
+        n += snprintf(buf + n, size - n, ", %s/%s", done, total);
+
+        if (elapsed >= 1 && bytes && n < size) {
+            double bytes_per_sec = bytes / elapsed;
+            progress_format_bytes(rate, sizeof(rate), bytes_per_sec);
+            n += snprintf(buf + n, size - n, ", %s/s", rate);
+
+            if (t->total_bytes > bytes && n < size) {
+                progress_format_duration(eta, sizeof(eta), (t->total_bytes - bytes) / bytes_per_sec);
+                snprintf(buf + n, size - n, ", ETA %s", eta);
+            }
+        }
+    }
+}
+
+static inline const char* progress_sep(Progress* p) {
+    return p->name ? ": " : "";
+}
+
+static inline const char* progress_name(Progress* p) {
+    return p->name ? p->name : "";
+}
+
+// Locks the root, once no other reporter holds back the output.
+static void progress_lock(Progress* p) {
+    Progress* r = p->root;
+    pthread_mutex_lock(&r->lock);
+    while (r->holder && r->holder != p) pthread_cond_wait(&r->cond, &r->lock);
+}
+
+static void progress_unlock(Progress* p) {
+    pthread_mutex_unlock(&p->root->lock);
+}
+
+// Clears the status line of the root. The lock of the root must be held.
+static void progress_clear_locked(Progress* p) {
+    Progress* r = p->root;
+    if (r->is_drawn) {
+        fputs("\33[2K\r", r->out);
+        fflush(r->out);
+        r->is_drawn = 0;
+    }
+}
+
+static void progress_draw(Progress* p, uint64_t now) {
+    Progress* r = p->root;
+    ProgressTotals t;
+    char totals[128];
+
+    r->last_draw_ns = now;
+    progress_totals(p, &t);
+    progress_format_totals(&t, totals, sizeof(totals), now);
+
+    if (!r->is_tty) {
+        fprintf(r->out, "%s%s%s: %s\n", progress_name(p), progress_sep(p), p->label ? p->label : "Progress", totals);
+        fflush(r->out);
+        return;
+    }
+
+    const char* path = p->path ? p->path : "";
+    size_t len = strlen(path);
+    const char* ellipsis = "";
+    if (len > PROGRESS_PATH_WIDTH) {
+        path += len - PROGRESS_PATH_WIDTH + 3;
+        ellipsis = "...";
+    }
+
+    fprintf(r->out, "\33[2K\r%s%s%s: %s%s%s", progress_name(p), progress_sep(p), p->label ? p->label : "", ellipsis, path, p->is_folder ? "/" : "");
+    if (p->item_total) fprintf(r->out, ": %d%%", (int)(p->item_bytes * 100 / p->item_total));
+    fprintf(r->out, " [%s]", totals);
+    fflush(r->out);
+    r->is_drawn = 1;
+}
+
+static void progress_maybe_draw(Progress* p) {
+    Progress* r = p->root;
+    uint64_t now = progress_now();
+    if (!r->last_draw_ns || now - r->last_draw_ns >= r->interval_ns) progress_draw(p, now);
+}
+
+static void progress_start_locked(Progress* p, size_t total_items, uint64_t total_bytes) {
+    Progress* r = p->root;
+
+    progress_clear_locked(p);
+    p->start_ns = progress_now();
+    p->total_items = total_items;
+    p->total_bytes = total_bytes;
+    p->done_items = 0;
+    p->done_bytes = 0;
+    p->item_bytes = 0;
+    p->item_total = 0;
+    p->label = NULL;
+    p->path = NULL;
+    p->is_folder = 0;
+
+    // the first summary of a log is only worth printing after an interval
+    if (p == r) r->last_draw_ns = r->is_tty ? 0 : p->start_ns;
+}
+
+Progress* progress_new(FILE* out) {
+    Progress* p = calloc(1, sizeof(Progress));
+    if (!p) return NULL;
+
+    p->out = out;
+    p->is_tty = isatty(fileno(out));
+    p->interval_ns = p->is_tty ? PROGRESS_TTY_INTERVAL_NS : PROGRESS_LOG_INTERVAL_NS;
+    p->root = p;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    progress_start(p, 0, 0);
+    return p;
+}
+
+Progress* progress_new_child(Progress* parent, const char* name) {
+    if (!parent) return NULL;
+
+    Progress* p = calloc(1, sizeof(Progress));
+    if (!p) return NULL;
+
+    p->name = strdup(name);
+    if (!p->name) {
+        free(p);
+        return NULL;
+    }
+
+    Progress* r = parent->root;
+    p->out = r->out;
+    p->is_tty = r->is_tty;
+    p->interval_ns = r->interval_ns;
+    p->root = r;
+
+    progress_lock(p);
+    progress_start_locked(p, 0, 0);
+    p->next = r->children;
+    r->children = p;
+    progress_unlock(p);
+    return p;
+}
+
+void progress_start(Progress* p, size_t total_items, uint64_t total_bytes) {
+    if (!p) return;
+
+    progress_lock(p);
+    progress_start_locked(p, total_items, total_bytes);
+    progress_unlock(p);
+}
+
+void progress_item(Progress* p, const char* label, const char* path, int is_folder) {
+    if (!p) return;
+
+    progress_lock(p);
+    p->label = label;
+    p->path = path;
+    p->is_folder = is_folder;
+    p->item_bytes = 0;
+    p->item_total = 0;
+    progress_maybe_draw(p);
+    progress_unlock(p);
+}
+
+void progress_update(Progress* p, uint64_t bytes, uint64_t total) {
+    if (!p) return;
+
+    progress_lock(p);
+    p->item_bytes = bytes;
+    p->item_total = total;
+    progress_maybe_draw(p);
+    progress_unlock(p);
+}
+
+void progress_item_done(Progress* p, uint64_t bytes, const char* result) {
+    if (!p) return;
+
+    progress_lock(p);
+    progress_clear_locked(p);
+    fprintf(p->out, "%s%s%s: %s%s: %s\n", progress_name(p), progress_sep(p), p->label, p->path, p->is_folder ? "/" : "", result);
+
+    p->done_items++;
+    p->done_bytes += bytes;
+    p->item_bytes = 0;
+    p->item_total = 0;
+    progress_maybe_draw(p);
+    progress_unlock(p);
+}
+
+void progress_tick(Progress* p, const char* label, const char* path) {
+    if (!p) return;
+
+    progress_lock(p);
+    p->label = label;
+    p->path = path;
+    p->is_folder = 0;
+    p->done_items++;
+    progress_maybe_draw(p);
+
+    // the path is not retained past this call
+    p->path = NULL;
+    progress_unlock(p);
+}
+
+// Prints a line of other output to the given stream, after clearing the status
+static void progress_vprint(Progress* p, FILE* out, const char* fmt, va_list arg) {
+    if (!p) {
+        vfprintf(out, fmt, arg);
+        return;
+    }
+
+    progress_lock(p);
+    progress_clear_locked(p);
+    fprintf(out, "%s%s", progress_name(p), progress_sep(p));
+    vfprintf(out, fmt, arg);
+    fflush(out);
+    progress_unlock(p);
+}
+
+void progress_log(Progress* p, const char* fmt, ...) {
+    va_list arg;
+    va_start(arg, fmt);
+    progress_vprint(p, p ? p->out : stdout, fmt, arg);
+    va_end(arg);
+}
+
+void progress_error(Progress* p, const char* fmt, ...) {
+    va_list arg;
+    va_start(arg, fmt);
+    progress_vprint(p, stderr, fmt, arg);
+    va_end(arg);
+}
+
+void progress_clear(Progress* p) {
+    if (!p) return;
+
+    progress_lock(p);
+    progress_clear_locked(p);
+    progress_unlock(p);
+}
+
+void progress_hold(Progress* p) {
+    if (!p) return;
+
+    Progress* r = p->root;
+    pthread_mutex_lock(&r->lock);
+    while (r->holder) pthread_cond_wait(&r->cond, &r->lock);
+    r->holder = p;
+    progress_clear_locked(p);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void progress_release(Progress* p) {
+    if (!p) return;
+
+    Progress* r = p->root;
+    pthread_mutex_lock(&r->lock);
+    if (r->holder == p) r->holder = NULL;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+int progress_confirm(Progress* p, const char* prompt) {
+    if (!p) return io_confirm("%s", prompt);
+
+    progress_clear(p);
+    return io_confirm("%s%s%s", progress_name(p), progress_sep(p), prompt);
+}
+
+void progress_end(Progress* p) {
+    char bytes[16], duration[16], rate[16];
+
+    if (!p) return;
+
+    progress_lock(p);
+    progress_clear_locked(p);
+
+    if (p->done_bytes) {
+        double elapsed = (progress_now() - p->start_ns) / 1e9;
+        progress_format_bytes(bytes, sizeof(bytes), p->done_bytes);
+        progress_format_duration(duration, sizeof(duration), elapsed);
+        progress_format_bytes(rate, sizeof(rate), elapsed > 0 ? p->done_bytes / elapsed : p->done_bytes);
+        fprintf(p->out, "%s%sTransferred %s in %s (%s/s).\n", progress_name(p), progress_sep(p), bytes, duration, rate);
+    }
+
+    fflush(p->out);
+    progress_start_locked(p, 0, 0);
+    progress_unlock(p);
+}
+
+void progress_free(Progress* p) {
+    if (!p) return;
+
+    Progress* r = p->root;
+    progress_lock(p);
+    progress_clear_locked(p);
+    for (Progress** c = &r->children; *c; c = &(*c)->next) {
+        if (*c == p) {
+            *c = p->next;
+            break;
+        }
+    }
+    progress_unlock(p);
+
+    if (p == r) {
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+    }
+    free(p->name);
+    free(p);
+}
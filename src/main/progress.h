@@ -0,0 +1,163 @@
+/**
+ * @file progress.h
+ * Reports the progress of long running operations, like loading a device or
+ * executing a sync plan. The status line is redrawn at a bounded rate however
+ * often it is updated. When the output is not a terminal, a plain summary
+ * line is printed periodically instead. Several operations running at once on
+ * separate threads may report through children of one reporter, which share
+ * its status line.
+ */
+
+#ifndef _PROGRESS_H_
+#define _PROGRESS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Progress reporter. Use progress_new to create one. All functions accept a
+ * NULL reporter, in which case nothing is reported.
+ */
+typedef struct Progress Progress;
+
+/**
+ * Create a new progress reporter. Free it with progress_free when done.
+ * @param out  stream to report progress on
+ * @return     new reporter, or NULL in case of failure
+ */
+Progress* progress_new(FILE* out);
+
+/**
+ * Create a reporter for one of several operations running at once, such as
+ * one device of many, which reports through another. Each line it prints
+ * starts with its name, and the status line shows the totals of every child
+ * of the same parent. Its functions may be called from any thread. Free it
+ * with progress_free before the parent.
+ * @param parent  reporter to report through
+ * @param name    printed before each line, such as "Device 1"
+ * @return        new reporter, or NULL in case of failure
+ */
+Progress* progress_new_child(Progress* parent, const char* name);
+
+/**
+ * Begin reporting on a new operation, resetting all counters.
+ * @param p            reporter to use
+ * @param total_items  number of items expected, or zero if unknown
+ * @param total_bytes  number of bytes expected, or zero if unknown
+ */
+void progress_start(Progress* p, size_t total_items, uint64_t total_bytes);
+
+/**
+ * Begin processing an item of the operation.
+ * @param p          reporter to use
+ * @param label      short description of what is done to the item
+ * @param path       path of the item, must remain valid until the item is done
+ * @param is_folder  truthy if the item is a folder
+ */
+void progress_item(Progress* p, const char* label, const char* path, int is_folder);
+
+/**
+ * Update the number of bytes processed for the current item.
+ * @param p      reporter to use
+ * @param bytes  bytes of the current item processed so far
+ * @param total  total size of the current item in bytes
+ */
+void progress_update(Progress* p, uint64_t bytes, uint64_t total);
+
+/**
+ * Finish processing the current item, printing a line with its result.
+ * @param p       reporter to use
+ * @param bytes   total bytes processed for the item
+ * @param result  short description of the result, like "OK"
+ */
+void progress_item_done(Progress* p, uint64_t bytes, const char* result);
+
+/**
+ * Count an item without printing a result for it, like a file found while
+ * loading a device.
+ * @param p      reporter to use
+ * @param label  short description of the operation
+ * @param path   path of the item
+ */
+void progress_tick(Progress* p, const char* label, const char* path);
+
+/**
+ * Print a line of other output, clearing the status line first. Lines of a
+ * child start with its name. Prints to stdout if the reporter is NULL.
+ * @param p    reporter to use
+ * @param fmt  printf style format string of the line
+ * @param ...  format arguments
+ */
+void progress_log(Progress* p, const char* fmt, ...);
+
+/**
+ * Print an error message like progress_log, but to stderr. Prints to stderr
+ * if the reporter is NULL.
+ * @param p    reporter to use
+ * @param fmt  printf style format string of the line
+ * @param ...  format arguments
+ */
+void progress_error(Progress* p, const char* fmt, ...);
+
+/**
+ * Clear the status line, so that other output may be printed.
+ * @param p  reporter to use
+ */
+void progress_clear(Progress* p);
+
+/**
+ * Hold back the output of every other reporter of the same root, such as the
+ * other devices, until progress_release. Their threads wait in calls to their
+ * reporters meanwhile. Use this to print something through this reporter and
+ * ask the user to confirm it, without other output in between.
+ * @param p  reporter to hold the output for, waits if another holds it
+ */
+void progress_hold(Progress* p);
+
+/**
+ * Let other reporters continue, after progress_hold.
+ * @param p  reporter which holds the output
+ */
+void progress_release(Progress* p);
+
+/**
+ * Prompt the user for a y/n confirmation, clearing the status line first. The
+ * prompt of a child starts with its name. Hold the output with progress_hold
+ * first if other reporters may be printing.
+ * @param p       reporter to use
+ * @param prompt  prompt to print
+ * @return        non-zero when the user replies affirmatively, zero otherwise
+ */
+int progress_confirm(Progress* p, const char* prompt);
+
+/**
+ * Finish the operation, printing a summary if any bytes were processed.
+ * @param p  reporter to use
+ */
+void progress_end(Progress* p);
+
+/**
+ * Free a progress reporter.
+ * @param p  reporter to free
+ */
+void progress_free(Progress* p);
+
+/**
+ * Format a number of bytes for humans, like "1.5 MiB".
+ * @param buf    buffer to write to
+ * @param size   size of the buffer
+ * @param bytes  number of bytes to format
+ * @return       the buffer
+ */
+char* progress_format_bytes(char* buf, size_t size, uint64_t bytes);
+
+/**
+ * Format a duration for humans, like "1:05" or "2:03:07".
+ * @param buf      buffer to write to
+ * @param size     size of the buffer
+ * @param seconds  duration to format
+ * @return         the buffer
+ */
+char* progress_format_duration(char* buf, size_t size, uint64_t seconds);
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "list.h"
+#include "queue.h"
+
+struct Queue {
+    List* items;            // Items waiting to be popped
+    int is_closed;          // Truthy once queue_close is called
+    pthread_mutex_t mutex;  // Guards all other members
+    pthread_cond_t cond;    // Signalled when an item is pushed or on close
+};
+
+Queue* queue_new(size_t capacity) {
+    Queue* q = NULL;
+
+    q = malloc(sizeof(Queue));
+    if (!q) goto error;
+
+    q->items = list_new(capacity);
+    if (!q->items) goto error;
+
+    q->is_closed = 0;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    return q;
+
+error:
+    free(q);
+    return NULL;
+}
+
+QueueStatusCode queue_push(Queue* q, void* item) {
+    QueueStatusCode code = QUEUE_STATUS_CLOSED;
+
+    pthread_mutex_lock(&q->mutex);
+    if (!q->is_closed) {
+        code = list_push(q->items, item) == LIST_STATUS_OK ? QUEUE_STATUS_OK : QUEUE_STATUS_ENOMEM;
+        if (code == QUEUE_STATUS_OK) pthread_cond_signal(&q->cond);
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return code;
+}
+
+QueueStatusCode queue_pop(Queue* q, void** item) {
+    QueueStatusCode code = QUEUE_STATUS_OK;
+
+    pthread_mutex_lock(&q->mutex);
+    while (!list_size(q->items) && !q->is_closed) {
+        pthread_cond_wait(&q->cond, &q->mutex);
+    }
+    if (list_size(q->items)) {
+        *item = list_shift(q->items);
+    } else {
+        code = QUEUE_STATUS_CLOSED;
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return code;
+}
+
+void queue_close(Queue* q) {
+    pthread_mutex_lock(&q->mutex);
+    q->is_closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+void queue_free(Queue* q) {
+    if (q) {
+        pthread_cond_destroy(&q->cond);
+        pthread_mutex_destroy(&q->mutex);
+        list_free(q->items);
+    }
+    free(q);
+}
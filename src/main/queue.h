@@ -0,0 +1,65 @@
+/**
+ * @file queue.h
+ * Blocking FIFO queue for handing work between threads.
+ */
+
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include <stddef.h>
+
+/**
+ * Status codes for queue operations.
+ */
+typedef enum {
+    QUEUE_STATUS_OK,      ///< Operation successful
+    QUEUE_STATUS_ENOMEM,  ///< Failed due to allocation error
+    QUEUE_STATUS_CLOSED,  ///< The queue is closed and, when popping, empty
+} QueueStatusCode;
+
+/**
+ * Queue structure. Use queue_new to create one.
+ */
+typedef struct Queue Queue;
+
+/**
+ * Allocate a new queue. The queue is unbounded, pushing never blocks. Free it
+ * with queue_free when you're done.
+ * @param capacity  initial queue capacity
+ * @return          pointer to the new Queue, or NULL in case of failure
+ */
+Queue* queue_new(size_t capacity);
+
+/**
+ * Append an item to the end of the queue, waking a thread waiting to pop.
+ * @param q     queue to push to
+ * @param item  to append to the queue
+ * @return      queue status, QUEUE_STATUS_CLOSED if the queue was closed
+ */
+QueueStatusCode queue_push(Queue* q, void* item);
+
+/**
+ * Remove the first item of the queue, waiting until one is available. Items
+ * pushed before the queue was closed are still returned after closing.
+ * @param q     queue to pop from
+ * @param item  populated with the former first item of the queue
+ * @return      queue status, QUEUE_STATUS_CLOSED if the queue is closed and
+ *              empty
+ */
+QueueStatusCode queue_pop(Queue* q, void** item);
+
+/**
+ * Close the queue. Further pushes fail, and threads waiting to pop are woken
+ * once the queue is empty.
+ * @param q  queue to close
+ */
+void queue_close(Queue* q);
+
+/**
+ * Free the queue. Does not free individual items, pop them first if needed.
+ * No thread may be waiting on the queue.
+ * @param q  queue to free
+ */
+void queue_free(Queue* q);
+
+#endif
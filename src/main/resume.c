@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "hash.h"
+#include "progress.h"
+#include "resume.h"
+#include "walk.h"
+
+#define RESUME_PART_EXT ".mtpsync-part"
+#define RESUME_INFO_EXT ".info"
+
+char* resume_part_path(const char* path) {
+    FsPathView name = fs_path_name(path);
+    size_t len = strlen(path) + strlen(RESUME_PART_EXT) + 2;
+
+    char* part = malloc(len);
+    if (!part) return NULL;
+
+    snprintf(part, len, "%.*s.%s" RESUME_PART_EXT, (int)name.offset, path, path + name.offset);
+    return part;
+}
+
+// Determines the length of the suffix of a partial file or sidecar name, or
+// zero if the name is neither.
+static size_t resume_suffix_len(const char* name) {
+    static const char info_ext[] = RESUME_PART_EXT RESUME_INFO_EXT;
+    size_t len = strlen(name);
+    size_t part_len = strlen(RESUME_PART_EXT);
+    size_t info_len = strlen(info_ext);
+
+    if (name[0] != '.') return 0;
+    if (len > part_len + 1 && strcmp(name + len - part_len, RESUME_PART_EXT) == 0) return part_len;
+    if (len > info_len + 1 && strcmp(name + len - info_len, info_ext) == 0) return info_len;
+    return 0;
+}
+
+int resume_is_part_name(const char* name) {
+    return resume_suffix_len(name) != 0;
+}
+
+char* resume_part_target(const char* part) {
+    FsPathView name = fs_path_name(part);
+    size_t suffix = resume_suffix_len(part + name.offset);
+    if (!suffix) return NULL;
+
+    // the target is named like the partial file, without the dot and suffix
+    size_t len = strlen(part) - suffix - 1;
+    char* path = malloc(len + 1);
+    if (!path) return NULL;
+
+    memcpy(path, part, name.offset);
+    memcpy(path + name.offset, part + name.offset + 1, len - name.offset);
+    path[len] = '\0';
+    return path;
+}
+
+List* resume_plan_cleanup(Arena* arena, List* plans, const char* path) {
+    List* result = NULL;
+    Hash* pulled = NULL;
+    char* target = NULL;
+    int error = ENOMEM;
+
+    List* parts = walk_collect_parts(arena, path, 0);
+    if (!parts && errno == ENOENT) parts = list_new(0);
+    if (!parts) {
+        error = errno;
+        goto done;
+    }
+
+    pulled = hash_new_str(list_size(plans) + 1);
+    result = list_new(list_size(plans) + list_size(parts));
+    if (!pulled || !result) goto error;
+
+    for (size_t i = 0; i < list_size(plans); i++) {
+        SyncPlan* plan = list_get(plans, i);
+        if (plan->action != SYNC_ACTION_XFER && plan->action != SYNC_ACTION_REPLACE) continue;
+
+        HashPutResult r = hash_put_hc(pulled, plan->target->path, plan->target->hc, plan);
+        if (r.status != HASH_STATUS_OK) goto error;
+        hash_entry_free(r.old_entry);
+    }
+
+    // partial files go first, before a stray folder holding them is removed
+    for (size_t i = 0; i < list_size(parts); i++) {
+        File* part = list_get(parts, i);
+        target = resume_part_target(part->path);
+        if (!target) goto error;
+
+        // a planned transfer of the target continues from the partial file
+        int is_resumed = hash_get(pulled, target) != NULL;
+        free(target);
+        target = NULL;
+        if (is_resumed) continue;
+
+        SyncPlan* plan = sync_plan_new(arena, NULL, part, SYNC_ACTION_RM);
+        if (!plan || list_push(result, plan) != LIST_STATUS_OK) goto error;
+    }
+
+    if (list_push_all(result, plans) != LIST_STATUS_OK) goto error;
+    goto done;
+
+error:
+    list_free(result);
+    result = NULL;
+
+done:
+    free(target);
+    hash_free(pulled);
+    list_free(parts);
+    if (!result) errno = error;
+    return result;
+}
+
+// Determines how much of the object the partial file holds, which is nothing
+// unless the sidecar records the same object.
+static uint64_t resume_offset(const char* part, const char* info, uint32_t id, uint64_t size) {
+    uint32_t info_id = 0;
+    uint64_t info_size = 0;
+    struct stat st;
+
+    FILE* f = fopen(info, "r");
+    if (!f) return 0;
+    int n = fscanf(f, "%" SCNu32 " %" SCNu64, &info_id, &info_size);
+    fclose(f);
+
+    if (n != 2 || info_id != id || info_size != size) return 0;
+    if (stat(part, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > size) return 0;
+    return st.st_size;
+}
+
+static int resume_write_info(const char* info, uint32_t id, uint64_t size) {
+    FILE* f = fopen(info, "w");
+    if (!f) return -1;
+    int failed = fprintf(f, "%" PRIu32 " %" PRIu64 "\n", id, size) < 0;
+    if (fclose(f) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+ResumeStatusCode resume_get(ResumeSource* src, uint32_t id, uint64_t size, const char* path, Progress* progress) {
+    ResumeStatusCode code = RESUME_STATUS_EFAIL;
+    char* part = NULL;
+    char* info = NULL;
+    unsigned char* chunk = NULL;
+    int fd = -1;
+
+    part = resume_part_path(path);
+    if (!part) goto done;
+
+    info = malloc(strlen(part) + sizeof(RESUME_INFO_EXT));
+    if (!info) goto done;
+    sprintf(info, "%s" RESUME_INFO_EXT, part);
+
+    // only partial reads can continue where the last transfer stopped
+    uint64_t offset = src->get_partial ? resume_offset(part, info, id, size) : 0;
+
+    if (offset) {
+        fd = open(part, O_WRONLY);
+        if (fd < 0 || lseek(fd, offset, SEEK_SET) < 0) goto done;
+
+        progress_update(progress, offset, size);
+        for (uint64_t start = offset; offset < size;) {
+            unsigned int n = 0;
+            uint32_t max = size - offset < RESUME_CHUNK_SIZE ? size - offset : RESUME_CHUNK_SIZE;
+
+            // a device which cannot read from the offset at all, such as one
+            // limited to 32-bit offsets resuming past 4 GiB, would fail the
+            // same way on every pull, so the object is read whole instead
+            int failed = src->get_partial(src->data, id, offset, max, &chunk, &n) != 0;
+            if (failed && offset == start) {
+                offset = 0;
+                break;
+            }
+
+            // an object which ends early has changed since it was listed
+            code = RESUME_STATUS_EDEVICE;
+            if (failed || !n) goto done;
+
+            code = RESUME_STATUS_EFAIL;
+            if (fs_write_all(fd, chunk, n) != 0) goto done;
+            free(chunk);
+            chunk = NULL;
+
+            offset += n;
+            progress_update(progress, offset, size);
+        }
+    }
+
+    if (!offset) {
+        // emptied before the sidecar names the object, so that bytes of
+        // another object are never taken for this one
+        if (fd < 0) fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        else if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) < 0) goto done;
+        if (fd < 0) goto done;
+        if (resume_write_info(info, id, size) != 0) goto done;
+
+        code = RESUME_STATUS_EDEVICE;
+        if (src->get(src->data, id, fd) != 0) goto done;
+    }
+
+    code = RESUME_STATUS_EFAIL;
+    int closed = close(fd);
+    fd = -1;
+    if (closed != 0) goto done;
+
+    if (rename(part, path) != 0) goto done;
+    unlink(info);
+
+    code = RESUME_STATUS_OK;
+
+done:
+    if (fd >= 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+    }
+    free(chunk);
+    free(part);
+    free(info);
+    return code;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file resume.h
+ * Resumable transfers of objects from a device to local files. An object is
+ * written to a hidden partial file next to the target, along with a sidecar
+ * recording the ID and size of the object. When a transfer is interrupted,
+ * the next transfer of the same object keeps the bytes already written and
+ * reads only the rest, where the device supports partial reads. The partial
+ * file is renamed in to place once complete, so the target never holds part
+ * of an object.
+ */
+
+#ifndef _RESUME_H_
+#define _RESUME_H_
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "list.h"
+#include "progress.h"
+#include "sync.h"
+
+#define RESUME_CHUNK_SIZE (1024 * 1024) ///< bytes read at once when resuming
+
+/**
+ * Status codes for resumable transfers.
+ */
+typedef enum {
+    RESUME_STATUS_OK,       ///< Operation successful
+    RESUME_STATUS_EFAIL,    ///< Failed to write the local file, errno is set
+    RESUME_STATUS_EDEVICE,  ///< Failed to read the object from the device
+} ResumeStatusCode;
+
+/**
+ * Reads a whole object in to a file, reporting progress by itself.
+ * @param data  opaque data of the source
+ * @param id    ID of the object to read
+ * @param fd    file to write the object to, at its current offset
+ * @return      zero on success
+ */
+typedef int (*ResumeGetFn)(void* data, uint32_t id, int fd);
+
+/**
+ * Reads part of an object.
+ * @param data    opaque data of the source
+ * @param id      ID of the object to read
+ * @param offset  offset of the first byte to read
+ * @param max     number of bytes to read at most
+ * @param out     set to the bytes read, free it when done
+ * @param size    set to the number of bytes read, zero past the end
+ * @return        zero on success
+ */
+typedef int (*ResumeGetPartialFn)(void* data, uint32_t id, uint64_t offset, uint32_t max, unsigned char** out, unsigned int* size);
+
+/**
+ * A device that objects can be read from.
+ */
+typedef struct {
+    ResumeGetFn get;                 ///< Reads a whole object
+    ResumeGetPartialFn get_partial;  ///< Reads part of an object, NULL if unsupported
+    void* data;                      ///< Opaque data passed to the functions
+} ResumeSource;
+
+/**
+ * Determine the path of the partial file of a target path, which is a
+ * hidden file in the same folder. Allocates the result on the heap, free it
+ * when done.
+ * @param path  path of the target file
+ * @return      path of the partial file, or NULL in case of failure
+ */
+char* resume_part_path(const char* path);
+
+/**
+ * Determine whether a file name is that of a partial file or its sidecar.
+ * These belong to unfinished transfers rather than to the folder holding
+ * them, so local files by these names are neither pushed nor removed as
+ * strays, see resume_plan_cleanup instead.
+ * @param name  name of the file, without its folder
+ * @return      truthy if the name is that of a partial file or a sidecar
+ */
+int resume_is_part_name(const char* name);
+
+/**
+ * Determine the path of the target file of a partial file or its sidecar,
+ * the inverse of resume_part_path. Allocates the result on the heap, free it
+ * when done.
+ * @param part  path of the partial file or sidecar
+ * @return      path of the target file, or NULL if the path is not that of
+ *              a partial file, or in case of failure
+ */
+char* resume_part_target(const char* part);
+
+/**
+ * Plan the removal of the partial files within a folder which no planned
+ * transfer will continue, along with their sidecars. The removals come
+ * before the other plans, so a stray folder is not removed beneath them.
+ * @param arena  arena to allocate the plans from
+ * @param plans  plans of a pull to the folder
+ * @param path   path of the folder pulled to, which may not exist
+ * @return       new list of the removals followed by the plans, or NULL
+ *               with errno set in case of failure
+ */
+List* resume_plan_cleanup(Arena* arena, List* plans, const char* path);
+
+/**
+ * Read an object in to a local file. A partial file left behind by an
+ * earlier transfer of the same object, with the same size, is continued
+ * rather than started over, unless the source has no partial reads, or the
+ * first partial read fails, in which case the whole object is read again.
+ * The partial file and its sidecar are kept after a failure, for the next
+ * transfer to continue.
+ * @param src       source to read the object from
+ * @param id        ID of the object
+ * @param size      size of the object in bytes
+ * @param path      path of the target file, replaced once the object is read
+ * @param progress  reports the progress of partial reads, may be NULL
+ * @return          status code of the operation
+ */
+ResumeStatusCode resume_get(ResumeSource* src, uint32_t id, uint64_t size, const char* path, Progress* progress);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ring.h"
+
+struct Ring {
+    unsigned char* data;    // Buffered bytes, wrapping around at the capacity
+    size_t capacity;        // Size of data
+    size_t start;           // Offset of the first buffered byte
+    size_t size;            // Number of buffered bytes
+    int is_closed;          // Truthy once the writer called ring_close
+    int is_canceled;        // Truthy once either side called ring_cancel
+    pthread_mutex_t mutex;  // Guards all other members
+    pthread_cond_t cond;    // Signalled when bytes are written or read
+};
+
+Ring* ring_new(size_t capacity) {
+    Ring* r = NULL;
+
+    r = calloc(1, sizeof(Ring));
+    if (!r) goto error;
+
+    r->capacity = capacity ? capacity : 1;
+    r->data = malloc(r->capacity);
+    if (!r->data) goto error;
+
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return r;
+
+error:
+    free(r);
+    return NULL;
+}
+
+RingStatusCode ring_write(Ring* r, const void* data, size_t len) {
+    const unsigned char* bytes = data;
+
+    pthread_mutex_lock(&r->mutex);
+    while (len && !r->is_canceled) {
+        if (r->size == r->capacity) {
+            pthread_cond_wait(&r->cond, &r->mutex);
+            continue;
+        }
+
+        // copy up to the end of the free space, or of the buffer if it wraps
+        size_t end = (r->start + r->size) % r->capacity;
+        size_t n = end < r->start ? r->start - end : r->capacity - end;
+        if (n > len) n = len;
+
+        memcpy(r->data + end, bytes, n);
+        r->size += n;
+        bytes += n;
+        len -= n;
+        pthread_cond_broadcast(&r->cond);
+    }
+    RingStatusCode code = r->is_canceled ? RING_STATUS_CANCELED : RING_STATUS_OK;
+    pthread_mutex_unlock(&r->mutex);
+
+    return code;
+}
+
+RingStatusCode ring_read(Ring* r, void* data, size_t len, size_t* read) {
+    unsigned char* bytes = data;
+    *read = 0;
+
+    pthread_mutex_lock(&r->mutex);
+    while (*read < len && !r->is_canceled) {
+        if (!r->size) {
+            if (r->is_closed) break;
+            pthread_cond_wait(&r->cond, &r->mutex);
+            continue;
+        }
+
+        size_t n = r->capacity - r->start;
+        if (n > r->size) n = r->size;
+        if (n > len - *read) n = len - *read;
+
+        memcpy(bytes + *read, r->data + r->start, n);
+        r->start = (r->start + n) % r->capacity;
+        r->size -= n;
+        *read += n;
+        pthread_cond_broadcast(&r->cond);
+    }
+    RingStatusCode code = r->is_canceled ? RING_STATUS_CANCELED : RING_STATUS_OK;
+    pthread_mutex_unlock(&r->mutex);
+
+    return code;
+}
+
+void ring_close(Ring* r) {
+    pthread_mutex_lock(&r->mutex);
+    r->is_closed = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+int ring_cancel(Ring* r) {
+    pthread_mutex_lock(&r->mutex);
+    int is_first = !r->is_canceled;
+    r->is_canceled = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+    return is_first;
+}
+
+void ring_free(Ring* r) {
+    if (r) {
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->mutex);
+        free(r->data);
+    }
+    free(r);
+}
@@ -0,0 +1,77 @@
+/**
+ * @file ring.h
+ * Bounded, blocking byte buffer for streaming data from one thread to
+ * another. The writer waits while the buffer is full, and the reader waits
+ * while it is empty, so memory stays bounded however much passes through.
+ */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stddef.h>
+
+/**
+ * Status codes for ring buffer operations.
+ */
+typedef enum {
+    RING_STATUS_OK,        ///< Operation successful
+    RING_STATUS_CANCELED,  ///< The stream was canceled by either side
+} RingStatusCode;
+
+/**
+ * Ring buffer structure. Use ring_new to create one.
+ */
+typedef struct Ring Ring;
+
+/**
+ * Allocate a new ring buffer. Free it with ring_free when done.
+ * @param capacity  number of bytes buffered at most
+ * @return          new ring buffer, or NULL in case of failure
+ */
+Ring* ring_new(size_t capacity);
+
+/**
+ * Append bytes to the buffer, waiting for space as often as needed.
+ * @param r     buffer to write to
+ * @param data  bytes to append
+ * @param len   number of bytes to append
+ * @return      status code, RING_STATUS_CANCELED if the stream was canceled,
+ *              in which case only some of the bytes may have been appended
+ */
+RingStatusCode ring_write(Ring* r, const void* data, size_t len);
+
+/**
+ * Remove bytes from the buffer, waiting until len bytes are read or the
+ * writer has closed the buffer.
+ * @param r     buffer to read from
+ * @param data  set to the bytes read
+ * @param len   number of bytes to read at most
+ * @param read  set to the number of bytes read, which is only less than len
+ *              at the end of the stream
+ * @return      status code, RING_STATUS_CANCELED if the stream was canceled
+ */
+RingStatusCode ring_read(Ring* r, void* data, size_t len, size_t* read);
+
+/**
+ * End the stream from the writing side. Bytes already written can still be
+ * read.
+ * @param r  buffer to close
+ */
+void ring_close(Ring* r);
+
+/**
+ * Cancel the stream from either side, after a failure. Both sides are woken,
+ * and all further reads and writes fail.
+ * @param r  buffer to cancel
+ * @return   truthy if this call canceled the stream, falsy if it was canceled
+ *           already, which tells which side failed first
+ */
+int ring_cancel(Ring* r);
+
+/**
+ * Free a ring buffer. No thread may be waiting on it.
+ * @param r  buffer to free
+ */
+void ring_free(Ring* r);
+
+#endif
@@ -8,21 +8,44 @@
 #include "file.h"
 #include "list.h"
 #include "hash.h"
+#include "intern.h"
 #include "fs.h"
 #include "mtp.h"
+#include "array.h"
+#include "progress.h"
 
-typedef enum {
-    SYNC_STATUS_OK,
-    SYNC_STATUS_EFAIL,
-} SyncStatusCode;
+#define SYNC_ARENA_BLOCK_SIZE (64 * 1024)
+
+// Modification times this many seconds apart are considered equal
+#define SYNC_MTIME_TOLERANCE 2
+
+// Digest of a folder known to be the same on both sides, whatever it holds
+#define SYNC_TREE_SAME 1
 
 typedef struct {
+    Arena* arena;
     List* plans;
     File* source;
 } SyncAncestorData;
 
 typedef SyncStatusCode (*SyncAncestorFn)(File* target, int is_ancestor, void* data);
 
+typedef char* (*SyncPathFn)(void* item);
+
+// Walks a list sorted with fs_path_cmp, yielding the ancestors of each item
+// before the item itself, each path only once.
+typedef struct {
+    List* items;      // Items sorted by path
+    SyncPathFn path;  // Returns the interned path of an item
+    size_t i;         // Index of the next item
+    char* last;       // Path yielded last, or NULL
+} SyncCursor;
+
+typedef struct {
+    char* path;  // Interned path
+    void* item;  // Listed item, or NULL for an ancestor of one
+} SyncCursorItem;
+
 static inline int sync_plan_cmp(const void* a, const void* b) {
     const SyncPlan* aa = *(const SyncPlan**)a;
     const SyncPlan* bb = *(const SyncPlan**)b;
@@ -59,134 +82,79 @@ static inline int sync_plan_cmp(const void* a, const void* b) {
     return cmp;
 }
 
-void sync_plan_free(SyncPlan* plan) {
-    if (plan) {
-        file_free(plan->source);
-        file_free(plan->target);
-        free(plan);
-    }
-}
+SyncPlan* sync_plan_new(Arena* arena, File* source, File* target, SyncAction action) {
+    SyncPlan* plan = arena_alloc(arena, sizeof(SyncPlan));
+    if (!plan) return NULL;
 
-SyncPlan* sync_plan_new(File* source, File* target, SyncAction action) {
-    SyncPlan* plan = NULL;
-    File* source_dup = NULL;
-    File* target_dup = NULL;
+    plan->source = NULL;
+    plan->target = NULL;
+    plan->origin = NULL;
+    plan->action = action;
 
     if (source) {
-        source_dup = file_dup(source);
-        if (!source_dup) goto error;
+        plan->source = file_dup(arena, source);
+        if (!plan->source) return NULL;
     }
 
     if (target) {
-        target_dup = file_dup(target);
-        if (!target_dup) goto error;
+        plan->target = file_dup(arena, target);
+        if (!plan->target) return NULL;
     }
 
-    plan = malloc(sizeof(SyncPlan));
-    if (!plan) goto error;
-    plan->source = source_dup;
-    plan->target = target_dup;
-    plan->action = action;
     return plan;
-
-error:
-    file_free(source_dup);
-    file_free(target_dup);
-    free(plan);
-    return NULL;
-}
-
-void sync_spec_free(SyncSpec* spec) {
-    if (spec) {
-        free(spec->source);
-        free(spec->target);
-        free(spec);
-    }
 }
 
-SyncSpec* sync_spec_new(char* source, char* target) {
-    SyncSpec* spec = NULL;
-    char* source_dup = NULL;
-    char* target_dup = NULL;
+SyncSpec* sync_spec_new(Arena* arena, char* source, char* target) {
+    SyncSpec* spec = arena_alloc(arena, sizeof(SyncSpec));
+    if (!spec) return NULL;
 
-    source_dup = strdup(source);
-    if (!source_dup) goto error;
+    spec->source = intern_path_arena(arena, source);
+    if (!spec->source) return NULL;
 
-    target_dup = strdup(target);
-    if (!target_dup) goto error;
+    spec->target = intern_path_arena(arena, target);
+    if (!spec->target) return NULL;
 
-    spec = malloc(sizeof(SyncSpec));
-    if (!spec) goto error;
-    spec->source = source_dup;
-    spec->target = target_dup;
     return spec;
-
-error:
-    free(source_dup);
-    free(target_dup);
-    free(spec);
-    return NULL;
 }
 
-static SyncStatusCode put_ancestors(Hash* hash, File* f, SyncAncestorFn fn, void* data) {
-    int code = SYNC_STATUS_EFAIL;
-    File* target = NULL;
-    char* target_path = NULL;
-
-    target_path = strdup(f->path);
-    if (!target_path) goto done;
+static SyncStatusCode put_ancestors(Arena* arena, Hash* hash, File* f, SyncAncestorFn fn, void* data) {
+    // interned paths know their parents, so walking up does not allocate
+    char* target_path = f->path;
 
     int is_ancestor = 0;
 
-    while (!hash_get(hash, target_path)) {
-        target = file_new(target_path, is_ancestor || f->is_folder);
+    while (target_path && !hash_get_hc(hash, target_path, intern_hc(target_path))) {
+        File* target = is_ancestor ? file_new_interned(arena, target_path, 1, NULL) : file_dup(arena, f);
+        if (!target) return SYNC_STATUS_EFAIL;
+        target->data = NULL;
 
-        if (!target) goto done;
+        if (fn && (fn(target, is_ancestor, data) != SYNC_STATUS_OK)) return SYNC_STATUS_EFAIL;
 
-        if (fn && (fn(target, is_ancestor, data) != SYNC_STATUS_OK)) goto done;
-
-        HashPutResult r = hash_put(hash, target->path, target);
-        file_hash_entry_free(r.old_entry);
-        if (r.status != HASH_STATUS_OK) goto done;
-
-        target = NULL;
-
-        char* old_target_path = target_path;
-        target_path = fs_dirname(target_path);
-        free(old_target_path);
-        if (!target_path) goto done;
+        HashPutResult r = hash_put_hc(hash, target->path, target->hc, target);
+        hash_entry_free(r.old_entry);
+        if (r.status != HASH_STATUS_OK) return SYNC_STATUS_EFAIL;
 
+        target_path = intern_parent(target_path);
         is_ancestor = 1;
     }
 
-    code = SYNC_STATUS_OK;
-
-done:
-    file_free(target);
-    free(target_path);
-    return code;
+    return SYNC_STATUS_OK;
 }
 
 static inline SyncStatusCode ancestor_cb(File* target, int is_ancestor, void* data) {
-    SyncPlan* plan = NULL;
-
     SyncAncestorData* d = data;
     File* source = is_ancestor ? NULL : d->source;
     SyncAction action = target->is_folder ? SYNC_ACTION_MKDIR : SYNC_ACTION_XFER;
 
-    plan = sync_plan_new(source, target, action);
-    if (!plan) goto error;
+    SyncPlan* plan = sync_plan_new(d->arena, source, target, action);
+    if (!plan) return SYNC_STATUS_EFAIL;
 
-    if (list_push(d->plans, plan) != LIST_STATUS_OK) goto error;
+    if (list_push(d->plans, plan) != LIST_STATUS_OK) return SYNC_STATUS_EFAIL;
 
     return SYNC_STATUS_OK;
-
-error:
-    sync_plan_free(plan);
-    return SYNC_STATUS_EFAIL;
 }
 
-Hash* hash_of_files(List* files) {
+static Hash* hash_of_files(Arena* arena, List* files) {
     Hash* hash = NULL;
 
     hash = hash_new_str(list_size(files) * 2);
@@ -194,152 +162,1081 @@ Hash* hash_of_files(List* files) {
 
     for (size_t i = 0; i < list_size(files); i++) {
         File* f = list_get(files, i);
-        if (put_ancestors(hash, f, NULL, NULL) != SYNC_STATUS_OK) goto error;
+        if (put_ancestors(arena, hash, f, NULL, NULL) != SYNC_STATUS_OK) goto error;
     }
 
     return hash;
 
 error:
-    hash_free_deep(hash, file_hash_entry_free);
+    hash_free(hash);
     return NULL;
 }
 
-List* sync_plan_rm(List* rm_files) {
-    SyncPlan* plan = NULL;
+List* sync_plan_rm(Arena* arena, List* rm_files) {
     List* rm_files_unique = NULL;
     List* plans = NULL;
     List* plans_sorted = NULL;
 
     rm_files_unique = hash_unique(rm_files, file_hc, file_cmp);
-    if (!rm_files_unique) goto error;
+    if (!rm_files_unique) goto done;
 
     plans = list_new(list_size(rm_files_unique));
-    if (!plans) goto error;
+    if (!plans) goto done;
 
     for (size_t i = 0; i < list_size(rm_files_unique); i++) {
         File* f = list_get(rm_files_unique, i);
-        plan = sync_plan_new(NULL, f, SYNC_ACTION_RM);
-        if (!plan) goto error;
+        SyncPlan* plan = sync_plan_new(arena, NULL, f, SYNC_ACTION_RM);
+        if (!plan) goto done;
 
-        if (list_push(plans, plan) != LIST_STATUS_OK) goto error;
-        plan = NULL;
+        if (list_push(plans, plan) != LIST_STATUS_OK) goto done;
     }
 
     plans_sorted = list_sort(plans, sync_plan_cmp);
-    if (!plans_sorted) goto error;
-
-    goto done; // success
-
-error:
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
-    plans = NULL; // don't double-free
 
 done:
-    sync_plan_free(plan);
     list_free(rm_files_unique);
     list_free(plans);
     return plans_sorted;
 }
 
-List* sync_plan_push(List* source_files, List* target_files, List* specs, int cleanup) {
+int sync_is_changed(File* source, File* target, SyncCompare compare) {
+    if (source->is_folder || target->is_folder) return 0;
+
+    switch (compare) {
+        case SYNC_COMPARE_ALWAYS:
+            return 1;
+
+        case SYNC_COMPARE_MTIME:
+            if (source->size != target->size) return 1;
+            if (!source->mtime || !target->mtime) return 0;
+            return llabs((long long)source->mtime - (long long)target->mtime) > SYNC_MTIME_TOLERANCE;
+
+        case SYNC_COMPARE_SIZE:
+            return source->size != target->size;
+
+        case SYNC_COMPARE_EXISTS:
+        default:
+            return 0;
+    }
+}
+
+static List* sync_plan_push_hash(Arena* arena, List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare) {
+    Arena* scratch = NULL;
     Hash* source_hash = NULL;
     Hash* target_hash = NULL;
     Hash* expected_hash = NULL;
     List* target_files_after = NULL;
     List* plans = NULL;
     List* plans_sorted = NULL;
-    File* file_tmp = NULL;
-    SyncPlan* plan_tmp = NULL;
+
+    // the hashes and the files within them are only needed while planning
+    scratch = arena_new(SYNC_ARENA_BLOCK_SIZE);
+    if (!scratch) goto done;
 
     plans = list_new(list_size(target_files) + list_size(source_files));
-    if (!plans) goto error;
+    if (!plans) goto done;
 
-    target_hash = hash_of_files(target_files);
-    if (!target_hash) goto error;
+    target_hash = hash_of_files(scratch, target_files);
+    if (!target_hash) goto done;
 
-    source_hash = hash_of_files(source_files);
-    if (!source_hash) goto error;
+    source_hash = hash_of_files(scratch, source_files);
+    if (!source_hash) goto done;
 
     expected_hash = hash_new_str(list_size(specs) * 2);
-    if (!expected_hash) goto error;
+    if (!expected_hash) goto done;
 
     for (size_t i = 0; i < list_size(specs); i++) {
         SyncSpec* spec = list_get(specs, i);
         File* f = hash_get(source_hash, spec->source);
 
-        if (!f) goto error;
+        if (!f) goto done;
+
+        File* target = file_new_interned(scratch, spec->target, f->is_folder, NULL);
+        if (!target) goto done;
+        target->size = f->size;
+        target->mtime = f->mtime;
+
+        File* existing = hash_get_hc(target_hash, target->path, target->hc);
+        if (existing && sync_is_changed(f, existing, compare)) {
+            SyncPlan* plan = sync_plan_new(arena, f, existing, SYNC_ACTION_REPLACE);
+            if (!plan) goto done;
 
-        file_tmp = file_new(spec->target, f->is_folder);
-        if (!file_tmp) goto error;
+            if (list_push(plans, plan) != LIST_STATUS_OK) goto done;
+        }
 
         SyncAncestorData data = {
+            .arena = arena,
             .source = f,
             .plans = plans,
         };
 
-        if (put_ancestors(expected_hash, file_tmp, NULL, NULL) != SYNC_STATUS_OK) goto error;
-        if (put_ancestors(target_hash, file_tmp, ancestor_cb, &data) != SYNC_STATUS_OK) goto error;
-
-        file_free(file_tmp);
-        file_tmp = NULL;
+        if (put_ancestors(scratch, expected_hash, target, NULL, NULL) != SYNC_STATUS_OK) goto done;
+        if (put_ancestors(scratch, target_hash, target, ancestor_cb, &data) != SYNC_STATUS_OK) goto done;
     }
 
     if (cleanup) {
         target_files_after = hash_values(target_hash);
-        if (!target_files_after) goto error;
+        if (!target_files_after) goto done;
 
         for (size_t i = 0; i < list_size(target_files_after); i++) {
             File* f = list_get(target_files_after, i);
-            if (strcmp(f->path, "/") != 0 && !hash_get(expected_hash, f->path)) {
-                plan_tmp = sync_plan_new(NULL, f, SYNC_ACTION_RM);
-                if (!plan_tmp) goto error;
+            if (strcmp(f->path, "/") != 0 && !hash_get_hc(expected_hash, f->path, f->hc)) {
+                SyncPlan* plan = sync_plan_new(arena, NULL, f, SYNC_ACTION_RM);
+                if (!plan) goto done;
 
-                if (list_push(plans, plan_tmp) != LIST_STATUS_OK) goto error;
-                plan_tmp = NULL;
+                if (list_push(plans, plan) != LIST_STATUS_OK) goto done;
             }
         }
     }
 
     plans_sorted = list_sort(plans, sync_plan_cmp);
-    if (!plans_sorted) goto error;
-
-    goto done; // success
-
-error:
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
-    plans = NULL; // don't double-free
 
 done:
-    hash_free_deep(target_hash, file_hash_entry_free);
-    hash_free_deep(source_hash, file_hash_entry_free);
-    hash_free_deep(expected_hash, file_hash_entry_free);
+    hash_free(target_hash);
+    hash_free(source_hash);
+    hash_free(expected_hash);
+    arena_free(scratch);
     list_free(target_files_after);
-    file_free(file_tmp);
-    sync_plan_free(plan_tmp);
     list_free(plans);
     return plans_sorted;
 }
 
-void sync_plan_print(List* plans, char* xfer_msg) {
+static char* sync_file_path(void* item) {
+    return ((File*)item)->path;
+}
+
+static char* sync_spec_target(void* item) {
+    return ((SyncSpec*)item)->target;
+}
+
+static int sync_file_cmp(const void* a, const void* b) {
+    return fs_path_cmp((*(File* const*)a)->path, (*(File* const*)b)->path);
+}
+
+static int sync_spec_cmp(const void* a, const void* b) {
+    return fs_path_cmp((*(SyncSpec* const*)a)->target, (*(SyncSpec* const*)b)->target);
+}
+
+// Truthy if path is the folder or within it.
+static inline int sync_is_within(const char* path, const char* folder) {
+    if (!path) return 0;
+    if (path == folder || strcmp(folder, "/") == 0) return 1;
+
+    size_t len = strlen(folder);
+    return strncmp(path, folder, len) == 0 && path[len] == '/';
+}
+
+static int sync_cursor_next(SyncCursor* c, SyncCursorItem* out) {
+    for (; c->i < list_size(c->items); c->i++) {
+        void* item = list_get(c->items, c->i);
+        char* path = c->path(item);
+        if (path == c->last) continue;
+
+        // in path order, any ancestor not yielded yet is outside the last path
+        char* next = path;
+        for (char* p = intern_parent(path); p && !sync_is_within(c->last, p); p = intern_parent(p)) {
+            next = p;
+        }
+
+        c->last = next;
+        out->path = next;
+        out->item = next == path ? item : NULL;
+        if (next == path) c->i++;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Finds the source file of a spec by binary search. Folders which are only
+// implied by the files within them are returned in tmp.
+static File* sync_find_source(List* sources, char* path, File* tmp) {
+    size_t lo = 0;
+    size_t hi = list_size(sources);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        File* f = list_get(sources, mid);
+        int cmp = f->path == path ? 0 : fs_path_cmp(f->path, path);
+        if (cmp == 0) return f;
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < list_size(sources)) {
+        File* f = list_get(sources, lo);
+        if (sync_is_within(f->path, path)) {
+            tmp->path = path;
+            tmp->hc = intern_hc(path);
+            tmp->is_folder = 1;
+            tmp->data = NULL;
+            return tmp;
+        }
+    }
+
+    return NULL;
+}
+
+// Yields the plan for a path which is expected, but missing from the target.
+static SyncStatusCode sync_yield_expected(List* sources, SyncCursorItem* e, SyncPlanFn fn, void* data) {
+    File implied;
+    File* source = NULL;
+    File target = {
+        .path = e->path,
+        .hc = intern_hc(e->path),
+        .is_folder = 1,
+        .data = NULL,
+    };
+
+    if (e->item) {
+        SyncSpec* spec = e->item;
+        source = sync_find_source(sources, spec->source, &implied);
+        if (!source) return SYNC_STATUS_EFAIL;
+        target.is_folder = source->is_folder;
+        target.size = source->size;
+        target.mtime = source->mtime;
+    }
+
+    SyncPlan plan = {
+        .source = source,
+        .target = &target,
+        .action = target.is_folder ? SYNC_ACTION_MKDIR : SYNC_ACTION_XFER,
+    };
+    return fn(&plan, data);
+}
+
+static SyncStatusCode sync_yield_rm(File* target, SyncPlanFn fn, void* data) {
+    SyncPlan plan = { .source = NULL, .target = target, .action = SYNC_ACTION_RM };
+    return fn(&plan, data);
+}
+
+// Removes the folders waiting for their contents to be removed first, up to
+// the first one the path is within. Pass NULL to remove all of them.
+static SyncStatusCode sync_yield_pending_rms(List* pending, char* path, SyncPlanFn fn, void* data) {
+    while (list_size(pending)) {
+        char* folder = list_get(pending, list_size(pending) - 1);
+        if (path && sync_is_within(path, folder)) break;
+
+        list_pop(pending);
+
+        File target = {
+            .path = folder,
+            .hc = intern_hc(folder),
+            .is_folder = 1,
+            .data = NULL,
+        };
+        if (sync_yield_rm(&target, fn, data) != SYNC_STATUS_OK) return SYNC_STATUS_EFAIL;
+    }
+
+    return SYNC_STATUS_OK;
+}
+
+SyncStatusCode sync_plan_stream(List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare, SyncPlanFn fn, void* data) {
+    SyncStatusCode code = SYNC_STATUS_EFAIL;
+    List* sources = NULL;
+    List* targets = NULL;
+    List* expected = NULL;
+    List* pending = NULL;
+
+    sources = list_sort(source_files, sync_file_cmp);
+    targets = list_sort(target_files, sync_file_cmp);
+    expected = list_sort(specs, sync_spec_cmp);
+    pending = list_new(16);
+    if (!sources || !targets || !expected || !pending) goto done;
+
+    SyncCursor ec = { .items = expected, .path = sync_spec_target, .i = 0, .last = NULL };
+    SyncCursor tc = { .items = targets, .path = sync_file_path, .i = 0, .last = NULL };
+    SyncCursorItem e;
+    SyncCursorItem t;
+    int has_e = sync_cursor_next(&ec, &e);
+    int has_t = sync_cursor_next(&tc, &t);
+
+    while (has_e || has_t) {
+        int cmp = !has_e ? 1 : !has_t ? -1 : e.path == t.path ? 0 : fs_path_cmp(e.path, t.path);
+
+        // leaving a stray folder, so everything within it has been removed
+        if (sync_yield_pending_rms(pending, cmp <= 0 ? e.path : t.path, fn, data) != SYNC_STATUS_OK) goto done;
+
+        if (cmp < 0) {
+            // expected, but missing from the target
+            if (sync_yield_expected(sources, &e, fn, data) != SYNC_STATUS_OK) goto done;
+        } else if (cmp > 0 && cleanup && strcmp(t.path, "/") != 0) {
+            // present on the target, but not expected
+            File* f = t.item;
+            if (f && !f->is_folder) {
+                if (sync_yield_rm(f, fn, data) != SYNC_STATUS_OK) goto done;
+            } else if (list_push(pending, t.path) != LIST_STATUS_OK) {
+                goto done;
+            }
+        } else if (cmp == 0 && e.item) {
+            // already present, but the source must still exist
+            File implied;
+            SyncSpec* spec = e.item;
+            File* source = sync_find_source(sources, spec->source, &implied);
+            if (!source) goto done;
+
+            File* target = t.item;
+            if (target && sync_is_changed(source, target, compare)) {
+                SyncPlan plan = { .source = source, .target = target, .action = SYNC_ACTION_REPLACE };
+                if (fn(&plan, data) != SYNC_STATUS_OK) goto done;
+            }
+        }
+
+        if (cmp <= 0) has_e = sync_cursor_next(&ec, &e);
+        if (cmp >= 0) has_t = sync_cursor_next(&tc, &t);
+    }
+
+    if (sync_yield_pending_rms(pending, NULL, fn, data) != SYNC_STATUS_OK) goto done;
+
+    code = SYNC_STATUS_OK;
+
+done:
+    list_free(sources);
+    list_free(targets);
+    list_free(expected);
+    list_free(pending);
+    return code;
+}
+
+typedef struct {
+    Arena* arena;
+    List* lists[SYNC_ACTION_XFER + 1];  // Plans of each action
+} SyncCollectData;
+
+static SyncStatusCode sync_collect(SyncPlan* plan, void* data) {
+    SyncCollectData* d = data;
+
+    SyncPlan* copy = sync_plan_new(d->arena, plan->source, plan->target, plan->action);
+    if (!copy) return SYNC_STATUS_EFAIL;
+
+    return list_push(d->lists[plan->action], copy) == LIST_STATUS_OK ? SYNC_STATUS_OK : SYNC_STATUS_EFAIL;
+}
+
+static List* sync_plan_push_merge(Arena* arena, List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare) {
+    List* plans = NULL;
+    SyncCollectData d = { .arena = arena };
+    size_t size = 0;
+
+    for (size_t i = 0; i < ARRAY_LEN(d.lists); i++) {
+        d.lists[i] = list_new(16);
+        if (!d.lists[i]) goto error;
+    }
+
+    if (sync_plan_stream(source_files, target_files, specs, cleanup, compare, sync_collect, &d) != SYNC_STATUS_OK) goto error;
+
+    // keep the order within each action, but run the actions one after another
+    for (size_t i = 0; i < ARRAY_LEN(d.lists); i++) size += list_size(d.lists[i]);
+
+    plans = list_new(size);
+    if (!plans) goto error;
+
+    for (size_t i = 0; i < ARRAY_LEN(d.lists); i++) {
+        if (list_push_all(plans, d.lists[i]) != LIST_STATUS_OK) goto error;
+    }
+
+    goto done;
+
+error:
+    list_free(plans);
+    plans = NULL;
+
+done:
+    for (size_t i = 0; i < ARRAY_LEN(d.lists); i++) list_free(d.lists[i]);
+    return plans;
+}
+
+List* sync_plan_push(Arena* arena, List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare, SyncPlanner planner) {
+    switch (planner) {
+        case SYNC_PLANNER_MERGE:
+            return sync_plan_push_merge(arena, source_files, target_files, specs, cleanup, compare);
+        case SYNC_PLANNER_HASH:
+        default:
+            return sync_plan_push_hash(arena, source_files, target_files, specs, cleanup, compare);
+    }
+}
+
+// Truthy if a stray file may be moved in place of a new file.
+static int sync_is_same(File* source, File* origin) {
+    if (source->is_folder || origin->is_folder) return 0;
+    if (!source->size || source->size != origin->size) return 0;
+
+    int has_mtime = source->mtime && origin->mtime;
+    if (has_mtime && llabs((long long)source->mtime - (long long)origin->mtime) > SYNC_MTIME_TOLERANCE) return 0;
+
+    return has_mtime || strcmp(source->path + fs_path_name(source->path).offset, origin->path + fs_path_name(origin->path).offset) == 0;
+}
+
+static int sync_plan_size_cmp(const void* a, const void* b) {
+    const SyncPlan* aa = *(const SyncPlan**)a;
+    const SyncPlan* bb = *(const SyncPlan**)b;
+
+    if (aa->target->size != bb->target->size) return aa->target->size < bb->target->size ? -1 : 1;
+    return strcmp(aa->target->path, bb->target->path);
+}
+
+// Finds the only unclaimed stray file which may be moved in place of a new
+// file, or NULL if there are none or several.
+static SyncPlan* sync_find_origin(List* rms, Hash* claimed, SyncPlan* xfer) {
+    SyncPlan* found = NULL;
+    File* f = xfer->target;
+    size_t lo = 0;
+    size_t hi = list_size(rms);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        SyncPlan* rm = list_get(rms, mid);
+        if (rm->target->size < f->size) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (size_t i = lo; i < list_size(rms); i++) {
+        SyncPlan* rm = list_get(rms, i);
+        if (rm->target->size != f->size) break;
+        if (hash_get_hc(claimed, rm->target->path, rm->target->hc)) continue;
+        if (!sync_is_same(f, rm->target)) continue;
+        if (found) return NULL;
+        found = rm;
+    }
+
+    return found;
+}
+
+List* sync_plan_moves(Arena* arena, List* plans, uint64_t* saved) {
+    List* rms = NULL;
+    List* moves = NULL;
+    List* result = NULL;
+    Hash* claimed = NULL;
+    Hash* moved = NULL;
+    Hash* deferred = NULL;
+    Hash* removed = NULL;
+    uint64_t bytes = 0;
+
+    rms = list_new(16);
+    moves = list_new(16);
+    claimed = hash_new_str(16);
+    moved = hash_new_str(16);
+    deferred = hash_new_str(16);
+    removed = hash_new_str(16);
+    if (!rms || !moves || !claimed || !moved || !deferred || !removed) goto done;
+
+    for (size_t i = 0; i < list_size(plans); i++) {
+        SyncPlan* plan = list_get(plans, i);
+        if (plan->action != SYNC_ACTION_RM) continue;
+
+        HashPutResult r = hash_put_hc(removed, plan->target->path, plan->target->hc, plan);
+        if (r.status != HASH_STATUS_OK) goto done;
+
+        if (!plan->target->is_folder && list_push(rms, plan) != LIST_STATUS_OK) goto done;
+    }
+
+    List* sorted = list_sort(rms, sync_plan_size_cmp);
+    if (!sorted) goto done;
+    list_free(rms);
+    rms = sorted;
+
+    for (size_t i = 0; i < list_size(plans) && list_size(rms); i++) {
+        SyncPlan* plan = list_get(plans, i);
+        if (plan->action != SYNC_ACTION_XFER) continue;
+
+        // a stray folder in the way must be removed before anything is moved
+        if (hash_get_hc(removed, plan->target->path, plan->target->hc)) continue;
+
+        SyncPlan* rm = sync_find_origin(rms, claimed, plan);
+        if (!rm) continue;
+
+        SyncPlan* move = sync_plan_new(arena, plan->source, plan->target, SYNC_ACTION_MOVE);
+        if (!move) goto done;
+
+        move->origin = file_dup(arena, rm->target);
+        if (!move->origin) goto done;
+
+        if (list_push(moves, move) != LIST_STATUS_OK) goto done;
+        if (hash_put_hc(claimed, rm->target->path, rm->target->hc, rm).status != HASH_STATUS_OK) goto done;
+        if (hash_put_hc(moved, plan->target->path, plan->target->hc, plan).status != HASH_STATUS_OK) goto done;
+        bytes += plan->target->size;
+
+        // removing a folder removes everything within, so wait for the move
+        for (char* p = intern_parent(rm->target->path); p; p = intern_parent(p)) {
+            if (hash_get_hc(deferred, p, intern_hc(p))) break;
+            if (hash_put_hc(deferred, p, intern_hc(p), p).status != HASH_STATUS_OK) goto done;
+        }
+    }
+
+    result = list_new(list_size(plans));
+    if (!result) goto done;
+
+    for (size_t i = 0; i < list_size(plans); i++) {
+        SyncPlan* plan = list_get(plans, i);
+        if (plan->action != SYNC_ACTION_RM && plan->action != SYNC_ACTION_MKDIR) continue;
+        if (hash_get_hc(claimed, plan->target->path, plan->target->hc) == plan) continue;
+        if (plan->action == SYNC_ACTION_RM && hash_get_hc(deferred, plan->target->path, plan->target->hc)) continue;
+        if (list_push(result, plan) != LIST_STATUS_OK) goto error;
+    }
+
+    if (list_push_all(result, moves) != LIST_STATUS_OK) goto error;
+
+    for (size_t i = 0; i < list_size(plans); i++) {
+        SyncPlan* plan = list_get(plans, i);
+        if (plan->action == SYNC_ACTION_RM && hash_get_hc(deferred, plan->target->path, plan->target->hc)) {
+            if (list_push(result, plan) != LIST_STATUS_OK) goto error;
+        }
+    }
+
+    for (size_t i = 0; i < list_size(plans); i++) {
+        SyncPlan* plan = list_get(plans, i);
+        if (plan->action != SYNC_ACTION_REPLACE && plan->action != SYNC_ACTION_XFER) continue;
+        if (hash_get_hc(moved, plan->target->path, plan->target->hc) == plan) continue;
+        if (list_push(result, plan) != LIST_STATUS_OK) goto error;
+    }
+
+    if (saved) *saved = bytes;
+    goto done;
+
+error:
+    list_free(result);
+    result = NULL;
+
+done:
+    list_free(rms);
+    list_free(moves);
+    hash_free(claimed);
+    hash_free(moved);
+    hash_free(deferred);
+    hash_free(removed);
+    return result;
+}
+
+typedef struct SyncCopyEntry {
+    File* source;                // Source of the transfer
+    File* target;                // Target of the transfer
+    uint64_t digest;             // Digest of the source, once computed
+    int has_digest;              // Truthy once the digest is computed
+    struct SyncCopyEntry* next;  // Next transfer of the same size, or NULL
+} SyncCopyEntry;
+
+struct SyncCopies {
+    SyncDigestFn fn;  // Computes digests of source files
+    void* data;       // Opaque context data passed to fn
+    Arena* arena;     // Holds the entries, their files and the sizes
+    Hash* sizes;      // First entry of each size
+};
+
+static size_t sync_size_hc(void* key) {
+    return hash_bytes(key, sizeof(uint64_t), 0);
+}
+
+static int sync_size_cmp(void* a, void* b) {
+    return *(uint64_t*)a != *(uint64_t*)b;
+}
+
+static SyncStatusCode sync_copy_digest(SyncCopies* c, SyncCopyEntry* e) {
+    if (e->has_digest) return SYNC_STATUS_OK;
+    if (c->fn(e->source, &e->digest, c->data) != SYNC_STATUS_OK) return SYNC_STATUS_EFAIL;
+    e->has_digest = 1;
+    return SYNC_STATUS_OK;
+}
+
+SyncCopies* sync_copies_new(SyncDigestFn fn, void* data) {
+    SyncCopies* c = malloc(sizeof(SyncCopies));
+    if (!c) return NULL;
+
+    c->fn = fn;
+    c->data = data;
+    c->arena = arena_new(SYNC_ARENA_BLOCK_SIZE);
+    c->sizes = hash_new(16, sync_size_hc, sync_size_cmp);
+    if (!c->arena || !c->sizes) {
+        sync_copies_free(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+SyncStatusCode sync_copies_match(SyncCopies* c, SyncPlan* plan, File** origin) {
+    *origin = NULL;
+    if (plan->action != SYNC_ACTION_XFER || !plan->source || plan->source->is_folder || !plan->source->size) {
+        return SYNC_STATUS_OK;
+    }
+
+    SyncCopyEntry* e = arena_alloc(c->arena, sizeof(SyncCopyEntry));
+    if (!e) return SYNC_STATUS_EFAIL;
+
+    e->source = file_dup(c->arena, plan->source);
+    e->target = file_dup(c->arena, plan->target);
+    e->has_digest = 0;
+    e->next = NULL;
+    if (!e->source || !e->target) return SYNC_STATUS_EFAIL;
+
+    SyncCopyEntry* first = hash_get(c->sizes, &e->source->size);
+    if (!first) {
+        // the only file of its size so far, so there is nothing to compare
+        HashPutResult r = hash_put(c->sizes, &e->source->size, e);
+        return r.status == HASH_STATUS_OK ? SYNC_STATUS_OK : SYNC_STATUS_EFAIL;
+    }
+
+    if (sync_copy_digest(c, e) != SYNC_STATUS_OK) return SYNC_STATUS_EFAIL;
+
+    SyncCopyEntry* last = NULL;
+    for (SyncCopyEntry* other = first; other; other = other->next) {
+        if (sync_copy_digest(c, other) != SYNC_STATUS_OK) return SYNC_STATUS_EFAIL;
+        if (other->digest == e->digest) {
+            *origin = other->target;
+            return SYNC_STATUS_OK;
+        }
+        last = other;
+    }
+
+    last->next = e;
+    return SYNC_STATUS_OK;
+}
+
+void sync_copies_free(SyncCopies* c) {
+    if (c) {
+        hash_free(c->sizes);
+        arena_free(c->arena);
+        free(c);
+    }
+}
+
+List* sync_plan_copies(Arena* arena, List* plans, SyncDigestFn fn, void* data, uint64_t* saved) {
+    SyncCopies* c = NULL;
+    List* copies = NULL;
+    List* result = NULL;
+    uint64_t bytes = 0;
+
+    c = sync_copies_new(fn, data);
+    copies = list_new(16);
+    result = list_new(list_size(plans));
+    if (!c || !copies || !result) goto error;
+
+    for (size_t i = 0; i < list_size(plans); i++) {
+        SyncPlan* plan = list_get(plans, i);
+
+        File* origin = NULL;
+        if (sync_copies_match(c, plan, &origin) != SYNC_STATUS_OK) goto error;
+
+        if (!origin) {
+            if (list_push(result, plan) != LIST_STATUS_OK) goto error;
+            continue;
+        }
+
+        SyncPlan* copy = sync_plan_new(arena, plan->source, plan->target, SYNC_ACTION_COPY);
+        if (!copy) goto error;
+
+        copy->origin = file_dup(arena, origin);
+        if (!copy->origin) goto error;
+
+        if (list_push(copies, copy) != LIST_STATUS_OK) goto error;
+        bytes += plan->source->size;
+    }
+
+    // every file copied from is transferred by then
+    if (list_push_all(result, copies) != LIST_STATUS_OK) goto error;
+
+    if (saved) *saved = bytes;
+    goto done;
+
+error:
+    list_free(result);
+    result = NULL;
+
+done:
+    list_free(copies);
+    sync_copies_free(c);
+    return result;
+}
+
+typedef struct SyncTreeNode {
+    char* path;                   // Interned path of the folder
+    uint64_t digest;              // Sum of the entries within the folder
+    size_t depth;                 // Number of components in the path
+    int is_same;                  // Truthy if known to be the same on both sides
+    SyncSpec* sample;             // Any spec within the folder, or NULL
+    struct SyncTreeNode* parent;  // Node of the parent folder, or NULL
+} SyncTreeNode;
+
+struct SyncTree {
+    Arena* arena;         // Holds the nodes
+    Hash* folders;        // Nodes by path
+    SyncCompare compare;  // Policy deciding what the digests of files cover
+};
+
+uint64_t sync_tree_entry(const char* name, int is_folder, uint64_t value) {
+    uint64_t h = hash_bytes(name, strlen(name), value);
+    return hash_bytes(&h, sizeof(h), is_folder ? 2 : 1);
+}
+
+// Covers whatever the compare policy looks at, so files which would be
+// replaced never have the same digest.
+static uint64_t sync_tree_value(File* f, SyncCompare compare) {
+    switch (compare) {
+        case SYNC_COMPARE_MTIME: {
+            int64_t mtime = f->mtime;
+            return hash_bytes(&mtime, sizeof(mtime), f->size);
+        }
+        case SYNC_COMPARE_SIZE:
+            return f->size;
+        case SYNC_COMPARE_EXISTS:
+        case SYNC_COMPARE_ALWAYS:
+        default:
+            return 0;
+    }
+}
+
+static inline const char* sync_tree_name(const char* path) {
+    return path + fs_path_name(path).offset;
+}
+
+static SyncTree* sync_tree_alloc(size_t size, SyncCompare compare) {
+    SyncTree* t = malloc(sizeof(SyncTree));
+    if (!t) return NULL;
+
+    t->compare = compare;
+    t->arena = arena_new(SYNC_ARENA_BLOCK_SIZE);
+    t->folders = hash_new_str(size + 1);
+    if (!t->arena || !t->folders) {
+        sync_tree_free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+// Finds the node of a folder, creating it along with its ancestors.
+static SyncTreeNode* sync_tree_node(SyncTree* t, char* path) {
+    size_t hc = intern_hc(path);
+    SyncTreeNode* n = hash_get_hc(t->folders, path, hc);
+    if (n) return n;
+
+    SyncTreeNode* parent = NULL;
+    char* parent_path = intern_parent(path);
+    if (parent_path) {
+        parent = sync_tree_node(t, parent_path);
+        if (!parent) return NULL;
+    }
+
+    n = arena_alloc(t->arena, sizeof(SyncTreeNode));
+    if (!n) return NULL;
+
+    n->path = path;
+    n->digest = 0;
+    n->depth = parent ? parent->depth + 1 : 0;
+    n->is_same = 0;
+    n->sample = NULL;
+    n->parent = parent;
+
+    HashPutResult r = hash_put_hc(t->folders, path, hc, n);
+    if (r.status != HASH_STATUS_OK) return NULL;
+
+    return n;
+}
+
+// Adds a file to the digest of its folder.
+static SyncStatusCode sync_tree_add(SyncTree* t, char* path, File* f, SyncSpec* sample) {
+    char* parent_path = intern_parent(path);
+    if (!parent_path) return SYNC_STATUS_OK;
+
+    SyncTreeNode* n = sync_tree_node(t, parent_path);
+    if (!n) return SYNC_STATUS_EFAIL;
+
+    n->digest += sync_tree_entry(sync_tree_name(path), 0, sync_tree_value(f, t->compare));
+    for (; sample && n && !n->sample; n = n->parent) n->sample = sample;
+
+    return SYNC_STATUS_OK;
+}
+
+static int sync_tree_path_cmp(const void* a, const void* b) {
+    return fs_path_cmp((*(SyncTreeNode* const*)a)->path, (*(SyncTreeNode* const*)b)->path);
+}
+
+static int sync_tree_depth_cmp(const void* a, const void* b) {
+    size_t aa = (*(SyncTreeNode* const*)a)->depth;
+    size_t bb = (*(SyncTreeNode* const*)b)->depth;
+    return aa < bb ? 1 : aa > bb ? -1 : 0;
+}
+
+// Adds the digest of each folder to that of its parent, deepest first.
+static SyncStatusCode sync_tree_finish(SyncTree* t) {
+    List* nodes = NULL;
+    List* sorted = NULL;
+
+    nodes = hash_values(t->folders);
+    if (nodes) sorted = list_sort(nodes, sync_tree_depth_cmp);
+    list_free(nodes);
+    if (!sorted) return SYNC_STATUS_EFAIL;
+
+    for (size_t i = 0; i < list_size(sorted); i++) {
+        SyncTreeNode* n = list_get(sorted, i);
+        if (n->is_same) n->digest = SYNC_TREE_SAME;
+        if (n->parent) n->parent->digest += sync_tree_entry(sync_tree_name(n->path), 1, n->digest);
+    }
+
+    list_free(sorted);
+    return SYNC_STATUS_OK;
+}
+
+// Adds every file in a list, leaving the digests of the folders unfinished.
+static SyncStatusCode sync_tree_add_files(SyncTree* t, List* files, int folders) {
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        if (!f->is_folder) {
+            if (sync_tree_add(t, f->path, f, NULL) != SYNC_STATUS_OK) return SYNC_STATUS_EFAIL;
+        } else if (folders && !sync_tree_node(t, f->path)) {
+            return SYNC_STATUS_EFAIL;
+        }
+    }
+
+    return SYNC_STATUS_OK;
+}
+
+SyncTree* sync_tree_new(List* files, int folders, SyncCompare compare) {
+    SyncTree* t = sync_tree_alloc(list_size(files), compare);
+    if (!t) return NULL;
+
+    if (sync_tree_add_files(t, files, folders) != SYNC_STATUS_OK) goto error;
+    if (sync_tree_finish(t) != SYNC_STATUS_OK) goto error;
+
+    return t;
+
+error:
+    sync_tree_free(t);
+    return NULL;
+}
+
+int sync_tree_digest(SyncTree* t, char* path, uint64_t* digest) {
+    SyncTreeNode* n = hash_get(t->folders, path);
+    if (!n) return 0;
+
+    *digest = n->digest;
+    return 1;
+}
+
+void sync_tree_free(SyncTree* t) {
+    if (t) {
+        hash_free(t->folders);
+        arena_free(t->arena);
+    }
+    free(t);
+}
+
+// Truthy if the path is within one of the folders, but not one itself.
+static inline int sync_is_pruned(Hash* folders, char* path) {
+    for (char* p = intern_parent(path); p; p = intern_parent(p)) {
+        if (hash_get_hc(folders, p, intern_hc(p))) return 1;
+    }
+    return 0;
+}
+
+// Finds the source folder mapped to a target folder by the specs within it.
+static char* sync_source_folder(Arena* arena, SyncSpec* spec, char* target) {
+    const char* rel = spec->target + (strcmp(target, "/") == 0 ? 0 : strlen(target));
+    size_t source_len = strlen(spec->source);
+    size_t rel_len = strlen(rel);
+
+    if (rel_len > source_len || strcmp(spec->source + source_len - rel_len, rel) != 0) return NULL;
+
+    char* source = strndup(spec->source, source_len - rel_len);
+    if (!source) return NULL;
+
+    char* interned = intern_path_arena(arena, *source ? source : "/");
+    free(source);
+    return interned;
+}
+
+static SyncStatusCode sync_prune_files(Arena* arena, List* files, Hash* folders) {
+    size_t kept = 0;
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        if (sync_is_pruned(folders, f->path)) continue;
+
+        File** present = hash_get_hc(folders, f->path, f->hc);
+        if (present) *present = f;
+        list_set(files, kept++, f);
+    }
+    while (list_size(files) > kept) list_pop(files);
+
+    // each pruned folder must still be present, even if only implied before
+    List* entries = hash_entries(folders);
+    if (!entries) return SYNC_STATUS_EFAIL;
+
+    SyncStatusCode code = SYNC_STATUS_OK;
+    for (size_t i = 0; i < list_size(entries) && code == SYNC_STATUS_OK; i++) {
+        HashEntry* e = list_get(entries, i);
+        File** present = hash_entry_value(e);
+        if (*present || sync_is_pruned(folders, hash_entry_key(e))) continue;
+
+        File* folder = file_new_interned(arena, hash_entry_key(e), 1, NULL);
+        if (!folder || list_push(files, folder) != LIST_STATUS_OK) code = SYNC_STATUS_EFAIL;
+    }
+
+    list_free(entries);
+    return code;
+}
+
+// Marks the folders of a spec as pruned, each with a slot for the file of the
+// folder once it is found in the list of files.
+static SyncStatusCode sync_prune_mark(Arena* scratch, Hash* source_folders, Hash* target_folders, SyncSpec* spec) {
+    File** source = arena_alloc(scratch, sizeof(File*));
+    File** target = arena_alloc(scratch, sizeof(File*));
+    if (!source || !target) return SYNC_STATUS_EFAIL;
+
+    *source = NULL;
+    *target = NULL;
+    if (hash_put(source_folders, spec->source, source).status != HASH_STATUS_OK) return SYNC_STATUS_EFAIL;
+    if (hash_put(target_folders, spec->target, target).status != HASH_STATUS_OK) return SYNC_STATUS_EFAIL;
+
+    return SYNC_STATUS_OK;
+}
+
+SyncStatusCode sync_prune_push(Arena* arena, List* source_files, List* target_files, List* specs, SyncCompare compare, size_t* pruned) {
+    SyncStatusCode code = SYNC_STATUS_EFAIL;
+    Arena* scratch = NULL;
+    Hash* sources = NULL;
+    Hash* source_folders = NULL;
+    Hash* target_folders = NULL;
+    SyncTree* source_tree = NULL;
+    SyncTree* target_tree = NULL;
+    List* nodes = NULL;
+    List* sorted = NULL;
+    size_t count = 0;
+
+    if (pruned) *pruned = 0;
+
+    scratch = arena_new(SYNC_ARENA_BLOCK_SIZE);
+    sources = hash_new_str(list_size(source_files) * 2 + 1);
+    source_folders = hash_new_str(16);
+    target_folders = hash_new_str(16);
+    source_tree = sync_tree_alloc(list_size(specs), compare);
+    target_tree = sync_tree_alloc(list_size(target_files), compare);
+    if (!scratch || !sources || !source_folders || !target_folders || !source_tree || !target_tree) goto done;
+
+    if (sync_tree_add_files(target_tree, target_files, 1) != SYNC_STATUS_OK) goto done;
+
+    for (size_t i = 0; i < list_size(source_files); i++) {
+        File* f = list_get(source_files, i);
+        HashPutResult r = hash_put_hc(sources, f->path, f->hc, f);
+        if (r.status != HASH_STATUS_OK) goto done;
+    }
+
+    for (size_t i = 0; i < list_size(specs); i++) {
+        SyncSpec* spec = list_get(specs, i);
+        File* f = hash_get_hc(sources, spec->source, intern_hc(spec->source));
+        if (!f) continue;
+
+        if (f->is_folder) {
+            SyncTreeNode* n = sync_tree_node(source_tree, spec->target);
+            if (!n) goto done;
+            n->is_same = 1;
+            for (; n && !n->sample; n = n->parent) n->sample = spec;
+
+            if (sync_prune_mark(scratch, source_folders, target_folders, spec) != SYNC_STATUS_OK) goto done;
+        } else if (sync_tree_add(source_tree, spec->target, f, spec) != SYNC_STATUS_OK) {
+            goto done;
+        }
+    }
+
+    // folders known to be the same may be missing their contents on either side
+    nodes = hash_keys(target_folders);
+    if (!nodes) goto done;
+    for (size_t i = 0; i < list_size(nodes); i++) {
+        SyncTreeNode* n = hash_get(target_tree->folders, list_get(nodes, i));
+        if (n) n->is_same = 1;
+    }
+    list_free(nodes);
+    nodes = NULL;
+
+    if (sync_tree_finish(source_tree) != SYNC_STATUS_OK) goto done;
+    if (sync_tree_finish(target_tree) != SYNC_STATUS_OK) goto done;
+
+    // in order of path, the outermost folder which is the same comes first
+    nodes = hash_values(target_tree->folders);
+    if (nodes) sorted = list_sort(nodes, sync_tree_path_cmp);
+    if (!sorted) goto done;
+
+    // every file is replaced anyway, so no folder is the same
+    char* last = NULL;
+    for (size_t i = 0; i < list_size(sorted) && compare != SYNC_COMPARE_ALWAYS; i++) {
+        SyncTreeNode* t = list_get(sorted, i);
+        if (!t->parent || (last && sync_is_within(t->path, last))) continue;
+
+        SyncTreeNode* s = hash_get_hc(source_tree->folders, t->path, intern_hc(t->path));
+        if (!s || !s->sample || s->digest != t->digest) continue;
+        if (s->is_same) {
+            last = t->path;
+            continue;
+        }
+
+        char* source = sync_source_folder(arena, s->sample, t->path);
+        if (!source) continue;
+
+        SyncSpec* spec = sync_spec_new(arena, source, t->path);
+        if (!spec || list_push(specs, spec) != LIST_STATUS_OK) goto done;
+        if (sync_prune_mark(scratch, source_folders, target_folders, spec) != SYNC_STATUS_OK) goto done;
+
+        last = t->path;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < list_size(specs); i++) {
+        SyncSpec* spec = list_get(specs, i);
+        if (sync_is_pruned(target_folders, spec->target)) {
+            File* f = hash_get_hc(sources, spec->source, intern_hc(spec->source));
+            if (f && !f->is_folder) count++;
+            continue;
+        }
+        list_set(specs, kept++, spec);
+    }
+    while (list_size(specs) > kept) list_pop(specs);
+
+    if (sync_prune_files(arena, source_files, source_folders) != SYNC_STATUS_OK) goto done;
+    if (sync_prune_files(arena, target_files, target_folders) != SYNC_STATUS_OK) goto done;
+
+    if (pruned) *pruned = count;
+    code = SYNC_STATUS_OK;
+
+done:
+    list_free(nodes);
+    list_free(sorted);
+    sync_tree_free(source_tree);
+    sync_tree_free(target_tree);
+    hash_free(sources);
+    hash_free(source_folders);
+    hash_free(target_folders);
+    arena_free(scratch);
+    return code;
+}
+
+void sync_plan_print(Progress* progress, List* plans, char* xfer_msg) {
     for (size_t i = 0; i < list_size(plans); i++) {
         SyncPlan* plan = list_get(plans, i);
         switch (plan->action) {
             case SYNC_ACTION_MKDIR:
-                printf("%s: %s/\n", MTP_MKDIR_MSG, plan->target->path);
+                progress_log(progress, "%s: %s/\n", MTP_MKDIR_MSG, plan->target->path);
                 break;
             case SYNC_ACTION_XFER:
-                printf("%s: %s\n", xfer_msg, plan->target->path);
+                progress_log(progress, "%s: %s\n", xfer_msg, plan->target->path);
+                break;
+            case SYNC_ACTION_REPLACE:
+                progress_log(progress, "%s: %s (changed)\n", xfer_msg, plan->target->path);
+                break;
+            case SYNC_ACTION_MOVE:
+                progress_log(progress, "%s: %s -> %s\n", MTP_MOVE_MSG, plan->origin->path, plan->target->path);
+                break;
+            case SYNC_ACTION_COPY:
+                progress_log(progress, "%s: %s -> %s\n", MTP_COPY_MSG, plan->origin->path, plan->target->path);
                 break;
             case SYNC_ACTION_RM:
-                printf("%s: %s%s\n", MTP_RM_MSG, plan->target->path, plan->target->is_folder ? "/" : "");
+                progress_log(progress, "%s: %s%s\n", MTP_RM_MSG, plan->target->path, plan->target->is_folder ? "/" : "");
                 break;
         }
     }
 }
 
-List* sync_spec_create(List* files, char* from_path, char* to_path) {
+List* sync_spec_create(Arena* arena, List* files, char* from_path, char* to_path) {
     List* specs = NULL;
-    SyncSpec* spec = NULL;
     char* target = NULL;
 
     specs = list_new(list_size(files));
@@ -353,25 +1250,19 @@ List* sync_spec_create(List* files, char* from_path, char* to_path) {
         target = fs_path_join(to_path, f->path + from_path_len);
         if (!target) goto error;
 
-        spec = sync_spec_new(f->path, target);
+        SyncSpec* spec = sync_spec_new(arena, f->path, target);
         if (!spec) goto error;
 
         if (list_push(specs, spec) != LIST_STATUS_OK) goto error;
 
         free(target);
-
-        spec = NULL;
         target = NULL;
     }
 
-    goto done;
+    return specs;
 
 error:
-    list_free_deep(specs, (ListItemFreeFn)sync_spec_free);
-    specs = NULL;
-
-done:
     free(target);
-    sync_spec_free(spec);
-    return specs;
+    list_free(specs);
+    return NULL;
 }
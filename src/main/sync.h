@@ -9,25 +9,57 @@
 #ifndef _SYNC_H_
 #define _SYNC_H_
 
+#include "arena.h"
 #include "file.h"
 #include "list.h"
+#include "progress.h"
 
 /**
  * File-specific action types for a sync plan. Order of the enum is important
  * since it determines which order actions are executed.
  */
 typedef enum {
-    SYNC_ACTION_RM,    ///< Delete a file or directory
-    SYNC_ACTION_MKDIR, ///< Create a new directory
-    SYNC_ACTION_XFER,  ///< Transfer the file from source to target
+    SYNC_ACTION_RM,      ///< Delete a file or directory
+    SYNC_ACTION_MKDIR,   ///< Create a new directory
+    SYNC_ACTION_MOVE,    ///< Move a stray target file in to place
+    SYNC_ACTION_REPLACE, ///< Transfer the file over a changed target file
+    SYNC_ACTION_XFER,    ///< Transfer the file from source to target
+    SYNC_ACTION_COPY,    ///< Copy a transferred file with the same contents
 } SyncAction;
 
+/**
+ * Policies for deciding whether a file present on both sides has changed and
+ * must be transferred again.
+ */
+typedef enum {
+    SYNC_COMPARE_EXISTS, ///< Never, a file which exists is skipped
+    SYNC_COMPARE_SIZE,   ///< When the sizes differ
+    SYNC_COMPARE_MTIME,  ///< When the sizes or modification times differ
+    SYNC_COMPARE_ALWAYS, ///< Always
+} SyncCompare;
+
+/**
+ * Status codes for sync operations.
+ */
+typedef enum {
+    SYNC_STATUS_OK,     ///< Operation successful
+    SYNC_STATUS_EFAIL,  ///< Failed due to a general runtime error
+} SyncStatusCode;
+
+/**
+ * Algorithms for planning a push.
+ */
+typedef enum {
+    SYNC_PLANNER_HASH,   ///< Look up every file in hashes of both sides
+    SYNC_PLANNER_MERGE,  ///< Walk both sides at once in order of path
+} SyncPlanner;
+
 /**
  * A request to synchronize a file from a source to a target.
  */
 typedef struct {
-    char* source; ///< Path of the source file to send
-    char* target; ///< Path of the target file
+    char* source; ///< Path of the source file to send, interned
+    char* target; ///< Path of the target file, interned
 } SyncSpec;
 
 /**
@@ -37,75 +69,265 @@ typedef struct {
 typedef struct {
     File* source;  ///< The source file (may be NULL for some actions)
     File* target;  ///< The target file
+    File* origin;  ///< The target file to move or copy, only for SYNC_ACTION_MOVE and SYNC_ACTION_COPY
     SyncAction action; ///< The action to perform
 } SyncPlan;
 
 /**
- * Free a SyncPlan.
- * @param plan  plan to free
- */
-void sync_plan_free(SyncPlan* plan);
-
-/**
- * Create a new SyncPlan. Returns NULL in case of failure. Free it when done.
+ * Create a new SyncPlan in an arena. Returns NULL in case of failure. The plan
+ * and its files live until the arena is freed.
+ * @param arena   arena to allocate the plan from
  * @param source  source file, will be copied
  * @param target  target file, will be copied
  * @param action  action to take
  * @return        a new SyncPlan, or NULL in case of an error
  */
-SyncPlan* sync_plan_new(File* source, File* target, SyncAction action);
-
-/**
- * Free a SyncSpec.
- * @param spec  spec to free
- */
-void sync_spec_free(SyncSpec* spec);
+SyncPlan* sync_plan_new(Arena* arena, File* source, File* target, SyncAction action);
 
 /**
- * Create a new SyncSpec. Returns NULL in case of failure. Free it when done.
- * @param source  source file path, will be copied
- * @param target  target file path, will be copied
+ * Create a new SyncSpec in an arena. Returns NULL in case of failure. The spec
+ * lives until the arena is freed.
+ * @param arena   arena to allocate the spec from
+ * @param source  source file path, will be interned
+ * @param target  target file path, will be interned
  * @return        a new SyncSpec, or NULL in case of an error
  */
-SyncSpec* sync_spec_new(char* source, char* target);
+SyncSpec* sync_spec_new(Arena* arena, char* source, char* target);
 
 /**
- * Create a plan for removing files.
+ * Create a plan for removing files. The plans are allocated from the arena,
+ * free the returned list with list_free.
+ * @param arena     arena to allocate the plans from
  * @param rm_files  list of file paths to remove, must be canonicalized
  * @return          plans to remove the items, or NULL in case of error
  */
-List* sync_plan_rm(List* rm_files);
+List* sync_plan_rm(Arena* arena, List* rm_files);
 
 /**
  * Create a plan for pushing files from source to target device. This will
  * generally do the following for each item in the specs list:
- *  - If file exists in the target_files, it will be skipped.
+ *  - If file exists in the target_files, it will be replaced if it changed
+ *    according to the compare policy, and skipped otherwise.
  *  - If file does not exist in the target_files, parent directories will be
  *    created as needed and the file will be pushed to the target.
  *  - If the cleanup option is enabled, any files present in the target_files
  *    that do not have a matching spec in the specs list will be removed
+ *
+ * With SYNC_PLANNER_HASH, every file on either side is put in a hash along
+ * with its ancestors, and the plans are sorted afterwards. With
+ * SYNC_PLANNER_MERGE, the specs and target files are sorted by path and walked
+ * together once, which needs no memory beyond the sorted copies. Both plan the
+ * same actions, but within each action the merge planner orders removals
+ * children first and new folders parents first rather than by depth.
+ *
+ * The plans are allocated from the arena, free the returned list with
+ * list_free.
+ * @param arena         arena to allocate the plans from
  * @param source_files  current files on the source device
  * @param target_files  current files on the target device
  * @param specs         specifications for source-to-target file mapping
  * @param cleanup       if truthy, stray files on the target will be deleted
+ * @param compare       policy for detecting changed files
+ * @param planner       algorithm to plan with
  * @return              plans to sync files, or NULL in case of error
  */
-List* sync_plan_push(List* source_files, List* target_files, List* specs, int cleanup);
+List* sync_plan_push(Arena* arena, List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare, SyncPlanner planner);
+
+/**
+ * Replaces the removal of a stray target file and the transfer of a new file
+ * with the same contents by a move of the stray file. MTP offers no content
+ * hashes, so files are considered the same when their sizes match, and either
+ * their names or their known modification times match. Files matching more
+ * than one other file are left alone. The returned plans are ordered like
+ * those of sync_plan_push, except that the removal of any folder holding a
+ * moved file follows the moves.
+ * @param arena  arena to allocate the new plans from
+ * @param plans  plans returned by sync_plan_push
+ * @param saved  set to the number of bytes no longer transferred, may be NULL
+ * @return       plans with moves, or NULL in case of error
+ */
+List* sync_plan_moves(Arena* arena, List* plans, uint64_t* saved);
+
+/**
+ * Computes a digest of the contents of a source file.
+ * @param f       the source file
+ * @param digest  set to the digest of the file
+ * @param data    opaque context data
+ * @return        status code of the operation
+ */
+typedef SyncStatusCode (*SyncDigestFn)(File* f, uint64_t* digest, void* data);
+
+/**
+ * Remembers the files transferred so far, to find later transfers of the same
+ * contents. Use sync_copies_new to create one.
+ */
+typedef struct SyncCopies SyncCopies;
+
+/**
+ * Create a new, empty record of transferred files. Free it with
+ * sync_copies_free when done.
+ * @param fn    computes digests of source files
+ * @param data  opaque context data to pass to fn
+ * @return      new record, or NULL in case of failure
+ */
+SyncCopies* sync_copies_new(SyncDigestFn fn, void* data);
+
+/**
+ * Checks whether a plan transfers the same contents as a transfer checked
+ * before, and remembers it otherwise. Only transfers of files which are not
+ * empty are matched. Files must have the same size to match, and digests are
+ * only computed for files sharing their size with another.
+ * @param c       record of transferred files
+ * @param plan    plan to check, need not outlive the call
+ * @param origin  set to the target of the matching transfer, or NULL, which
+ *                remains valid until the record is freed
+ * @return        status code of the operation
+ */
+SyncStatusCode sync_copies_match(SyncCopies* c, SyncPlan* plan, File** origin);
+
+/**
+ * Free a record of transferred files.
+ * @param c  record to free
+ */
+void sync_copies_free(SyncCopies* c);
+
+/**
+ * Replaces each transfer of the same contents as an earlier transfer by a copy
+ * of the target file of that transfer. The copies follow all other plans.
+ * @param arena  arena to allocate the new plans from
+ * @param plans  plans returned by sync_plan_push or sync_plan_moves
+ * @param fn     computes digests of source files
+ * @param data   opaque context data to pass to fn
+ * @param saved  set to the number of bytes no longer transferred, may be NULL
+ * @return       plans with copies, or NULL in case of error
+ */
+List* sync_plan_copies(Arena* arena, List* plans, SyncDigestFn fn, void* data, uint64_t* saved);
+
+/**
+ * Callback executed for each plan yielded by sync_plan_stream.
+ * @param plan  the plan, only valid until the callback returns
+ * @param data  opaque context data passed to sync_plan_stream
+ * @return      SYNC_STATUS_OK to continue, anything else to stop
+ */
+typedef SyncStatusCode (*SyncPlanFn)(SyncPlan* plan, void* data);
+
+/**
+ * Plan a push like sync_plan_push with SYNC_PLANNER_MERGE, but yield each plan
+ * as soon as it is known rather than collecting them. Plans are yielded in an
+ * order which is safe to execute straight away: folders are created before
+ * anything within them, and removed after everything within them. Nothing is
+ * allocated for each plan, so memory is bounded by the sorted copies of the
+ * input lists regardless of how much needs to be done.
+ * @param source_files  current files on the source device
+ * @param target_files  current files on the target device
+ * @param specs         specifications for source-to-target file mapping
+ * @param cleanup       if truthy, stray files on the target will be deleted
+ * @param compare       policy for detecting changed files
+ * @param fn            callback to execute for each plan
+ * @param data          opaque context data to pass to the callback
+ * @return              status code of the operation, SYNC_STATUS_EFAIL if the
+ *                      callback stopped it
+ */
+SyncStatusCode sync_plan_stream(List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare, SyncPlanFn fn, void* data);
+
+/**
+ * Merkle digests of the folders holding a list of files. The digest of a
+ * folder sums a digest of each entry within it, covering its name along with
+ * the digest of a folder or whatever the compare policy looks at for a file,
+ * so folders holding the same files have the same digest. Use sync_tree_new
+ * to create one.
+ */
+typedef struct SyncTree SyncTree;
+
+/**
+ * Computes the digest of an entry within a folder. The digest of a folder is
+ * the sum of the digests of its entries, in any order.
+ * @param name       name of the entry
+ * @param is_folder  truthy if the entry is a folder
+ * @param value      digest of the folder, or what the compare policy looks at
+ *                   for a file, which is zero for SYNC_COMPARE_EXISTS
+ * @return           digest of the entry
+ */
+uint64_t sync_tree_entry(const char* name, int is_folder, uint64_t value);
+
+/**
+ * Computes the digests of every folder holding a list of files, including
+ * their ancestors. Free it with sync_tree_free when done.
+ * @param files    files to compute the digests of
+ * @param folders  truthy to include the folders in the list which hold no
+ *                 files, as is done for the target side of a push
+ * @param compare  policy deciding what the digests of files cover
+ * @return         the digests, or NULL in case of failure
+ */
+SyncTree* sync_tree_new(List* files, int folders, SyncCompare compare);
+
+/**
+ * Looks up the digest of a folder.
+ * @param t       digests to look in
+ * @param path    canonical path of the folder
+ * @param digest  set to the digest of the folder
+ * @return        truthy if the folder holds any of the files
+ */
+int sync_tree_digest(SyncTree* t, char* path, uint64_t* digest);
+
+/**
+ * Free the digests of a tree.
+ * @param t  digests to free
+ */
+void sync_tree_free(SyncTree* t);
+
+/**
+ * Leaves folders holding the same files on both sides out of a push, before
+ * planning it with sync_plan_push or sync_plan_stream. The folders are found
+ * by comparing their digests on both sides, outermost first, so a folder that
+ * is the same is left out with a single comparison. The contents of such a
+ * folder are removed from all lists, but the folder itself is kept on both
+ * sides and mapped by a spec of its own, so it is neither created nor
+ * removed. A spec for a folder which is already in the list marks a folder
+ * known to be the same beforehand, whose contents may be missing from either
+ * side. Only those are left out with SYNC_COMPARE_ALWAYS.
+ * @param arena         arena to allocate new files and specs from
+ * @param source_files  current files on the source device, pruned in place
+ * @param target_files  current files on the target device, pruned in place
+ * @param specs         specifications for source-to-target file mapping,
+ *                      pruned in place
+ * @param compare       policy for detecting changed files
+ * @param pruned        set to the number of files left out, may be NULL
+ * @return              status code of the operation
+ */
+SyncStatusCode sync_prune_push(Arena* arena, List* source_files, List* target_files, List* specs, SyncCompare compare, size_t* pruned);
+
+/**
+ * Determines whether a file present on both sides has changed. Folders never
+ * change. Modification times within a couple of seconds are considered equal,
+ * since some file systems only store them with that precision, and unknown
+ * times are not compared.
+ * @param source   file on the source side
+ * @param target   file on the target side
+ * @param compare  policy for detecting changed files
+ * @return         truthy if the file must be transferred again
+ */
+int sync_is_changed(File* source, File* target, SyncCompare compare);
 
 /**
- * Print a sync plan to stdout for the user to review.
+ * Print a sync plan for the user to review, through a progress reporter so
+ * that each line starts with the device it is for.
+ * @param progress  reporter to print through, or NULL to print to stdout
  * @param plan      to print
- * @param xfer_msg  message to print for file transfers
+ * @param xfer_msg  message to print for file transfers, including the
+ *                  transfers which replace a changed file
  */
-void sync_plan_print(List* plan, char* xfer_msg);
+void sync_plan_print(Progress* progress, List* plan, char* xfer_msg);
 
 /**
- * Create a list of sync specs for provided files.
+ * Create a list of sync specs for provided files. The specs are allocated from
+ * the arena, free the returned list with list_free.
+ * @param arena      arena to allocate the specs from
  * @param files      files to create specs for
  * @param from_path  path to transfer from
  * @param to_path    path to transfer to
  * @return           list of sync specs, or NULL in case of error
  */
-List* sync_spec_create(List* files, char* from_path, char* to_path);
+List* sync_spec_create(Arena* arena, List* files, char* from_path, char* to_path);
 
 #endif
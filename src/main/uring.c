@@ -0,0 +1,233 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_SUPPORTED 1
+#endif
+#endif
+
+#ifdef URING_SUPPORTED
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#endif
+
+#include "uring.h"
+
+int uring_is_enabled() {
+    char* enabled = getenv("MTPSYNC_IO_URING");
+    return enabled && strcmp(enabled, "1") == 0;
+}
+
+#ifdef URING_SUPPORTED
+
+struct Uring {
+    int fd;                      // Descriptor of the ring
+    unsigned entries;            // Number of submission queue entries
+    unsigned* sq_tail;           // Tail of the submission queue, written by us
+    unsigned* sq_mask;           // Mask of submission queue indexes
+    unsigned* sq_array;          // Indexes of the submitted entries
+    struct io_uring_sqe* sqes;   // Submission queue entries
+    unsigned* cq_head;           // Head of the completion queue, written by us
+    unsigned* cq_tail;           // Tail of the completion queue
+    unsigned* cq_mask;           // Mask of completion queue indexes
+    struct io_uring_cqe* cqes;   // Completion queue entries
+    void* sq_ring;               // Mapping of the submission queue
+    size_t sq_ring_size;         // Size of the submission queue mapping
+    void* cq_ring;               // Mapping of the completion queue, may be sq_ring
+    size_t cq_ring_size;         // Size of the completion queue mapping
+    size_t sqes_size;            // Size of the mapping of sqes
+    int is_broken;               // Truthy once requests may be left in flight
+};
+
+// Waits for at least some completions after submitting any requests.
+static int uring_enter(Uring* u, unsigned submit, unsigned wait) {
+    for (;;) {
+        long n = syscall(__NR_io_uring_enter, u->fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0 || errno != EINTR) return n < 0 ? -1 : (int)n;
+    }
+}
+
+Uring* uring_new(unsigned entries) {
+    if (!uring_is_enabled()) return NULL;
+
+    Uring* u = calloc(1, sizeof(Uring));
+    if (!u) return NULL;
+    u->fd = -1;
+    u->sq_ring = MAP_FAILED;
+    u->cq_ring = MAP_FAILED;
+    u->sqes = MAP_FAILED;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0) goto error;
+
+    // statx requests were added after these features, so older kernels
+    // which lack them are not worth supporting
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) goto error;
+
+    u->entries = p.sq_entries;
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (u->cq_ring_size > u->sq_ring_size) u->sq_ring_size = u->cq_ring_size;
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) goto error;
+    u->cq_ring = u->sq_ring;
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) goto error;
+
+    char* sq = u->sq_ring;
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+
+    char* cq = u->cq_ring;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return u;
+
+error:
+    uring_free(u);
+    return NULL;
+}
+
+static void uring_stat_convert(struct statx* sx, struct stat* st) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = makedev(sx->stx_dev_major, sx->stx_dev_minor);
+    st->st_ino = sx->stx_ino;
+    st->st_mode = sx->stx_mode;
+    st->st_nlink = sx->stx_nlink;
+    st->st_uid = sx->stx_uid;
+    st->st_gid = sx->stx_gid;
+    st->st_size = sx->stx_size;
+    st->st_mtim.tv_sec = sx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = sx->stx_mtime.tv_nsec;
+}
+
+// Reaps every completion available, converting the status of each file.
+static unsigned uring_reap(Uring* u, struct statx* sx, struct stat* st, int* results) {
+    unsigned reaped = 0;
+    unsigned head = *u->cq_head;
+    unsigned cq_tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != cq_tail; head++, reaped++) {
+        struct io_uring_cqe* cqe = &u->cqes[head & *u->cq_mask];
+        size_t i = cqe->user_data;
+        results[i] = cqe->res;
+        if (cqe->res == 0) uring_stat_convert(&sx[i], &st[i]);
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    return reaped;
+}
+
+int uring_stat(Uring* u, int dirfd, const char** names, size_t count, int flags, struct stat* st, int* results) {
+    if (u->is_broken) {
+        errno = EIO;
+        return -1;
+    }
+
+    size_t batch_size = count < u->entries ? count : u->entries;
+    struct statx* sx = malloc(batch_size * sizeof(struct statx) + 1);
+    if (!sx) return -1;
+
+    size_t start = 0;
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    for (; start < count; start += batch_size) {
+        unsigned n = count - start < batch_size ? count - start : batch_size;
+
+        // the ring is only used by this thread, so nothing else moves the tail
+        unsigned tail = *u->sq_tail;
+        for (unsigned i = 0; i < n; i++) {
+            unsigned idx = tail & *u->sq_mask;
+            struct io_uring_sqe* sqe = &u->sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (uintptr_t)names[start + i];
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uintptr_t)&sx[i];
+            sqe->statx_flags = flags;
+            sqe->user_data = i;
+            u->sq_array[idx] = idx;
+            tail++;
+        }
+        __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+
+        submitted = 0;
+        completed = 0;
+        while (completed < n) {
+            int r = uring_enter(u, n - submitted, 1);
+            if (r < 0) goto error;
+            submitted += r;
+            completed += uring_reap(u, sx, st + start, results + start);
+        }
+    }
+
+    free(sx);
+    return 0;
+
+error:
+    // the kernel writes to sx until every submitted request completes, so
+    // those are waited for, and requests left unsubmitted in the queue must
+    // never be submitted along with a later batch
+    u->is_broken = 1;
+    int error = errno;
+    while (completed < submitted && uring_enter(u, 0, 1) >= 0) {
+        completed += uring_reap(u, sx, st + start, results + start);
+    }
+
+    // leaked rather than freed while the kernel may still write to it
+    if (completed == submitted) free(sx);
+    errno = error;
+    return -1;
+}
+
+void uring_free(Uring* u) {
+    if (u) {
+        if (u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+        if (u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_size);
+        if (u->fd >= 0) close(u->fd);
+        free(u);
+    }
+}
+
+#else
+
+// io_uring is not available, so callers always take the other path
+struct Uring {
+    int unused;
+};
+
+Uring* uring_new(unsigned entries) {
+    return NULL;
+}
+
+int uring_stat(Uring* u, int dirfd, const char** names, size_t count, int flags, struct stat* st, int* results) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_free(Uring* u) {
+}
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * @file uring.h
+ * Batched file status lookups with io_uring. A whole batch of statx requests
+ * is submitted and waited for with a single system call, rather than one call
+ * per file. Only available on Linux, and only used when enabled by setting
+ * MTPSYNC_IO_URING=1, since the kernel completes statx requests on worker
+ * threads of its own, which is only worth it where each lookup waits on
+ * storage or the network.
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/**
+ * A submission and completion queue of a single thread. Use uring_new to
+ * create one.
+ */
+typedef struct Uring Uring;
+
+/**
+ * Determine whether io_uring is enabled by the MTPSYNC_IO_URING environment
+ * variable.
+ * @return  truthy if enabled
+ */
+int uring_is_enabled();
+
+/**
+ * Create a queue. Each queue must only be used by one thread at a time.
+ * Free it with uring_free when done.
+ * @param entries  number of requests submitted at once
+ * @return         new queue, or NULL if io_uring is not enabled, not
+ *                 supported by the system, or in case of failure
+ */
+Uring* uring_new(unsigned entries);
+
+/**
+ * Look up the status of a batch of files, like fstatat. Requests are
+ * submitted as many at a time as fit the queue.
+ * @param u        queue to submit with
+ * @param dirfd    folder the names are relative to, or AT_FDCWD
+ * @param names    names of the files, absolute or relative to dirfd
+ * @param count    number of names
+ * @param flags    AT_* flags, such as AT_SYMLINK_NOFOLLOW
+ * @param st       set to the status of each file, in order
+ * @param results  set to zero for each file looked up, or a negated errno
+ * @return         zero if every request completed, regardless of results,
+ *                 otherwise -1 with errno set, after which the queue fails
+ *                 every later request, so free it and look up files another
+ *                 way
+ */
+int uring_stat(Uring* u, int dirfd, const char** names, size_t count, int flags, struct stat* st, int* results);
+
+/**
+ * Free a queue.
+ * @param u  queue to free
+ */
+void uring_free(Uring* u);
+
+#endif
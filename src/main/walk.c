@@ -0,0 +1,598 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "arena.h"
+#include "file.h"
+#include "fs.h"
+#include "hash.h"
+#include "intern.h"
+#include "list.h"
+#include "resume.h"
+#include "uring.h"
+#include "walk.h"
+
+#define WALK_ARENA_BLOCK_SIZE (64 * 1024)
+#define WALK_MIN_THREADS 4
+#define WALK_MAX_THREADS 32
+#define WALK_DENTS_SIZE (32 * 1024)
+#define WALK_IDLE_NANOS 2000000
+#define WALK_BATCH_SIZE 256
+
+#ifdef __linux__
+// Layout of the records read by getdents64
+struct walk_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+typedef struct {
+    uint64_t dev;  // Device of a folder
+    uint64_t ino;  // Inode of a folder
+} WalkId;
+
+typedef struct {
+    char* path;      // Canonical path of the file, allocated from the arena of a worker
+    struct stat st;  // Status of the file
+    int is_folder;   // Truthy for a folder collected rather than listed
+} WalkEntry;
+
+typedef struct {
+    char* paths[WALK_BATCH_SIZE];        // Paths of files waiting on their status
+    const char* names[WALK_BATCH_SIZE];  // Names of the files, within paths
+    struct stat st[WALK_BATCH_SIZE];     // Status of each file once looked up
+    int results[WALK_BATCH_SIZE];        // Zero or a negated errno for each file
+    size_t count;                        // Number of files waiting
+} WalkBatch;
+
+struct Walk;
+
+typedef struct {
+    struct Walk* walk;     // Walk the worker belongs to
+    pthread_t thread;      // Thread of the worker, unused for the first one
+    pthread_mutex_t lock;  // Guards dirs, which other workers take from
+    List* dirs;            // Paths of folders to list, newest last
+    List* found;           // Paths of folders found while listing one folder
+    Arena* arena;          // Holds the paths and entries found by the worker
+    List* entries;         // WalkEntry of every file found by the worker
+    Uring* ring;           // Queue to look up the status of files with, or NULL
+    WalkBatch* batch;      // Files of the folder being listed, when ring is set
+} WalkWorker;
+
+typedef struct Walk {
+    WalkWorker* workers;   // Every worker, the first runs on the calling thread
+    size_t count;          // Number of workers
+    pthread_mutex_t lock;  // Guards all other members
+    pthread_cond_t cond;   // Signalled when folders are queued or the walk ends
+    Hash* seen;            // WalkId of every folder listed
+    size_t pending;        // Number of folders queued or being listed
+    size_t idle;           // Number of workers waiting for folders
+    int error;             // errno of the first failure, or zero
+    WalkFolderFn fn;       // Decides whether to list each folder, or NULL
+    void* data;            // Opaque data passed to fn
+    int is_parts;          // Truthy to collect only partial files, see resume.h
+} Walk;
+
+static size_t walk_hc_id(void* key) {
+    return hash_bytes(key, sizeof(WalkId), 0);
+}
+
+static int walk_cmp_id(void* a, void* b) {
+    return memcmp(a, b, sizeof(WalkId));
+}
+
+static int walk_entry_cmp(const void* a, const void* b) {
+    WalkEntry* ea = *(WalkEntry**)a;
+    WalkEntry* eb = *(WalkEntry**)b;
+    return fs_path_cmp(ea->path, eb->path);
+}
+
+size_t walk_threads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < WALK_MIN_THREADS) return WALK_MIN_THREADS;
+    if (cpus > WALK_MAX_THREADS) return WALK_MAX_THREADS;
+    return cpus;
+}
+
+static void walk_fail(Walk* walk, int error) {
+    pthread_mutex_lock(&walk->lock);
+    if (!walk->error) walk->error = error;
+    pthread_cond_broadcast(&walk->cond);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+// Takes the newest folder of the worker, or else the oldest of another.
+static char* walk_take(WalkWorker* w) {
+    Walk* walk = w->walk;
+    char* dir = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    dir = list_pop(w->dirs);
+    pthread_mutex_unlock(&w->lock);
+
+    size_t self = w - walk->workers;
+    for (size_t i = 1; !dir && i < walk->count; i++) {
+        WalkWorker* other = &walk->workers[(self + i) % walk->count];
+        pthread_mutex_lock(&other->lock);
+        if (list_size(other->dirs)) dir = list_shift(other->dirs);
+        pthread_mutex_unlock(&other->lock);
+    }
+
+    return dir;
+}
+
+// Truthy if the folder was not listed before, by way of another link.
+static int walk_is_new(WalkWorker* w, struct stat* st) {
+    Walk* walk = w->walk;
+    WalkId id = { .dev = st->st_dev, .ino = st->st_ino };
+    int is_new = 0;
+
+    pthread_mutex_lock(&walk->lock);
+    if (!hash_get(walk->seen, &id)) {
+        WalkId* key = arena_alloc(w->arena, sizeof(WalkId));
+        if (key) {
+            *key = id;
+            is_new = hash_put(walk->seen, key, key).status == HASH_STATUS_OK;
+        }
+        if (!is_new && !walk->error) walk->error = ENOMEM;
+    }
+    pthread_mutex_unlock(&walk->lock);
+
+    return is_new;
+}
+
+static int walk_add_entry(WalkWorker* w, char* path, struct stat* st, int is_folder) {
+    WalkEntry* e = arena_alloc(w->arena, sizeof(WalkEntry));
+    if (!e) return ENOMEM;
+    e->path = path;
+    e->st = *st;
+    e->is_folder = is_folder;
+    return list_push(w->entries, e) == LIST_STATUS_OK ? 0 : ENOMEM;
+}
+
+// Adds a file, or queues a folder, by its status.
+static int walk_add(WalkWorker* w, char* path, struct stat* st) {
+    if (S_ISDIR(st->st_mode)) {
+        return list_push(w->found, path) == LIST_STATUS_OK ? 0 : ENOMEM;
+    }
+    if (resume_is_part_name(path + fs_path_name(path).offset) != w->walk->is_parts) return 0;
+
+    // only the contents of regular files can be transferred
+    if (!S_ISREG(st->st_mode)) {
+        fprintf(stderr, "Not a regular file: %s, skipping\n", path);
+        return 0;
+    }
+
+    return walk_add_entry(w, path, st, 0);
+}
+
+// Looks up the status of every batched file with a single submission.
+static int walk_flush(WalkWorker* w, int fd) {
+    WalkBatch* b = w->batch;
+    int code = 0;
+
+    if (!b->count) return 0;
+
+    int failed = uring_stat(w->ring, fd, b->names, b->count, 0, b->st, b->results) != 0;
+    if (failed) {
+        for (size_t i = 0; i < b->count; i++) b->results[i] = -errno;
+    }
+
+    // broken symbolic links are rare, so failures are retried one by one
+    for (size_t i = 0; i < b->count && !code; i++) {
+        const char* name = b->names[i];
+        struct stat* st = &b->st[i];
+        if (b->results[i] != 0 && fstatat(fd, name, st, 0) != 0 && fstatat(fd, name, st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        code = walk_add(w, b->paths[i], st);
+    }
+
+    b->count = 0;
+
+    // a failed queue cannot be used again, so the rest of the walk looks up
+    // each file as it is listed
+    if (failed) {
+        uring_free(w->ring);
+        w->ring = NULL;
+        free(w->batch);
+        w->batch = NULL;
+    }
+
+    return code;
+}
+
+static int walk_visit(WalkWorker* w, int fd, const char* dir, const char* name, unsigned char type) {
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return 0;
+
+    size_t dir_len = strcmp(dir, "/") == 0 ? 0 : strlen(dir);
+    size_t name_len = strlen(name);
+    char* path = arena_alloc(w->arena, dir_len + name_len + 2);
+    if (!path) return ENOMEM;
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+
+    // folders are listed later, so their status is not needed here
+    if (type == DT_DIR) {
+        return list_push(w->found, path) == LIST_STATUS_OK ? 0 : ENOMEM;
+    }
+
+    // the name is kept in the path, since the listing buffer is reused
+    if (w->batch) {
+        WalkBatch* b = w->batch;
+        b->paths[b->count] = path;
+        b->names[b->count] = path + dir_len + 1;
+        b->count++;
+        return b->count == WALK_BATCH_SIZE ? walk_flush(w, fd) : 0;
+    }
+
+    // symbolic links are followed, and broken ones collected like files
+    struct stat st;
+    if (fstatat(fd, name, &st, 0) != 0 && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return 0;
+
+    return walk_add(w, path, &st);
+}
+
+// Lists a single folder, adding its files to the entries of the worker and
+// its folders to found.
+static int walk_list(WalkWorker* w, char* dir) {
+    int code = 0;
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return 0; // like nftw, folders which cannot be read are skipped
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !walk_is_new(w, &st)) {
+        close(fd);
+        return 0;
+    }
+
+    WalkFolderAction action = w->walk->fn ? w->walk->fn(w->walk->data, dir, &st) : WALK_FOLDER_LIST;
+    if (action != WALK_FOLDER_LIST) {
+        close(fd);
+        return action == WALK_FOLDER_COLLECT ? walk_add_entry(w, dir, &st, 1) : 0;
+    }
+
+#ifdef __linux__
+    char buf[WALK_DENTS_SIZE];
+    for (;;) {
+        // a folder listed only in part would make its other files strays,
+        // so failing to read on fails the walk rather than ending the folder
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n < 0) code = errno ? errno : EIO;
+        if (n <= 0) break;
+
+        for (long off = 0; off < n && !code; ) {
+            struct walk_dirent64* d = (struct walk_dirent64*)(buf + off);
+            code = walk_visit(w, fd, dir, d->d_name, d->d_type);
+            off += d->d_reclen;
+        }
+        if (!code && w->batch) code = walk_flush(w, fd);
+        if (code) break;
+    }
+    if (w->batch) w->batch->count = 0;
+    close(fd);
+#else
+    DIR* d = fdopendir(fd);
+    if (!d) {
+        close(fd);
+        return 0;
+    }
+
+    // readdir only sets errno when it fails, rather than at the end
+    struct dirent* e;
+    while (!code) {
+        errno = 0;
+        e = readdir(d);
+        if (!e) {
+            if (errno) code = errno;
+            break;
+        }
+        code = walk_visit(w, fd, dir, e->d_name, e->d_type);
+    }
+    if (!code && w->batch) code = walk_flush(w, fd);
+    if (w->batch) w->batch->count = 0;
+    closedir(d);
+#endif
+
+    return code;
+}
+
+// Queues the folders found while listing one, which is then done.
+static void walk_publish(WalkWorker* w) {
+    Walk* walk = w->walk;
+    size_t n = list_size(w->found);
+
+    // the folders are counted before others may take them, so the count
+    // never drops to zero while any remain
+    pthread_mutex_lock(&walk->lock);
+    walk->pending += n;
+    walk->pending--;
+    if (!walk->pending) pthread_cond_broadcast(&walk->cond);
+    pthread_mutex_unlock(&walk->lock);
+
+    if (!n) return;
+
+    pthread_mutex_lock(&w->lock);
+    int code = list_push_all(w->dirs, w->found);
+    pthread_mutex_unlock(&w->lock);
+    while (list_size(w->found)) list_pop(w->found);
+
+    if (code != LIST_STATUS_OK) {
+        walk_fail(walk, ENOMEM);
+        return;
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    if (walk->idle) pthread_cond_broadcast(&walk->cond);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+static void* walk_worker(void* data) {
+    WalkWorker* w = data;
+    Walk* walk = w->walk;
+
+    for (;;) {
+        char* dir = walk_take(w);
+        if (dir) {
+            int code = walk_list(w, dir);
+            if (code) {
+                walk_fail(walk, code);
+                break;
+            }
+            walk_publish(w);
+            continue;
+        }
+
+        pthread_mutex_lock(&walk->lock);
+        int is_done = !walk->pending || walk->error;
+        if (!is_done) {
+            // a folder may be queued between looking and waiting, so the
+            // wait is short rather than relying on the signal alone
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += WALK_IDLE_NANOS;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            walk->idle++;
+            pthread_cond_timedwait(&walk->cond, &walk->lock, &until);
+            walk->idle--;
+        }
+        pthread_mutex_unlock(&walk->lock);
+
+        if (is_done) break;
+    }
+
+    return NULL;
+}
+
+// Creates the files of every worker in the arena, in order of path.
+static List* walk_merge(Walk* walk, Arena* arena) {
+    List* entries = NULL;
+    List* sorted = NULL;
+    List* files = NULL;
+    File* file = NULL;
+    char* path = NULL;
+
+    size_t total = 0;
+    for (size_t i = 0; i < walk->count; i++) total += list_size(walk->workers[i].entries);
+
+    entries = list_new(total + 1);
+    if (!entries) goto error;
+    for (size_t i = 0; i < walk->count; i++) {
+        if (list_push_all(entries, walk->workers[i].entries) != LIST_STATUS_OK) goto error;
+    }
+
+    sorted = list_sort(entries, walk_entry_cmp);
+    if (!sorted) goto error;
+
+    files = list_new(total + 1);
+    if (!files) goto error;
+
+    // paths are canonical already, so they are interned without resolving
+    for (size_t i = 0; i < list_size(sorted); i++) {
+        WalkEntry* e = list_get(sorted, i);
+
+        path = intern_path(e->path);
+        if (!path) goto error;
+
+        file = file_new_interned(arena, path, e->is_folder, NULL);
+        if (!file) goto error;
+        file_set_stat(file, &e->st);
+
+        intern_release(path);
+        path = NULL;
+
+        if (list_push(files, file) != LIST_STATUS_OK) goto error;
+        file = NULL;
+    }
+
+    list_free(entries);
+    list_free(sorted);
+    return files;
+
+error:
+    intern_release(path);
+    if (!arena) file_free(file);
+    if (arena) {
+        list_free(files);
+    } else {
+        list_free_deep(files, (ListItemFreeFn)file_free);
+    }
+    list_free(entries);
+    list_free(sorted);
+    errno = ENOMEM;
+    return NULL;
+}
+
+static List* walk_folder(Arena* arena, char* path, size_t threads, WalkFolderFn fn, void* data, int is_parts) {
+    List* files = NULL;
+    size_t started = 1;
+    int error = ENOMEM;
+
+    Walk walk = {
+        .workers = calloc(threads, sizeof(WalkWorker)),
+        .count = threads,
+        .seen = hash_new(WALK_MIN_THREADS * 64, walk_hc_id, walk_cmp_id),
+        .pending = 1,
+        .idle = 0,
+        .error = 0,
+        .fn = fn,
+        .data = data,
+        .is_parts = is_parts,
+    };
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.cond, NULL);
+    if (!walk.workers || !walk.seen) goto done;
+
+    for (size_t i = 0; i < threads; i++) {
+        walk.workers[i].walk = &walk;
+        pthread_mutex_init(&walk.workers[i].lock, NULL);
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        WalkWorker* w = &walk.workers[i];
+        w->dirs = list_new(32);
+        w->found = list_new(32);
+        w->arena = arena_new(WALK_ARENA_BLOCK_SIZE);
+        w->entries = list_new(128);
+        if (!w->dirs || !w->found || !w->arena || !w->entries) goto done;
+
+        // without io_uring, each file is looked up as it is listed instead
+        w->ring = uring_new(WALK_BATCH_SIZE);
+        if (w->ring) {
+            w->batch = malloc(sizeof(WalkBatch));
+            if (!w->batch) goto done;
+            w->batch->count = 0;
+        }
+    }
+
+    if (list_push(walk.workers[0].dirs, path) != LIST_STATUS_OK) goto done;
+
+    // the calling thread is the first worker, so fewer threads will do
+    for (; started < threads; started++) {
+        WalkWorker* w = &walk.workers[started];
+        if (pthread_create(&w->thread, NULL, walk_worker, w) != 0) break;
+    }
+    walk_worker(&walk.workers[0]);
+    for (size_t i = 1; i < started; i++) pthread_join(walk.workers[i].thread, NULL);
+
+    if (walk.error) {
+        error = walk.error;
+        goto done;
+    }
+
+    files = walk_merge(&walk, arena);
+    if (!files) error = errno;
+
+done:
+    for (size_t i = 0; walk.workers && i < threads; i++) {
+        WalkWorker* w = &walk.workers[i];
+        list_free(w->dirs);
+        list_free(w->found);
+        list_free(w->entries);
+        arena_free(w->arena);
+        uring_free(w->ring);
+        free(w->batch);
+        pthread_mutex_destroy(&w->lock);
+    }
+    free(walk.workers);
+    hash_free(walk.seen);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.cond);
+
+    if (!files) errno = error;
+    return files;
+}
+
+static List* walk_collect_mode(Arena* arena, const char* path, size_t threads, WalkFolderFn fn, void* data, int is_parts) {
+    List* files = NULL;
+    File* file = NULL;
+    char* path_r = NULL;
+    int error = ENOMEM;
+
+    if (!threads) threads = walk_threads();
+
+    // like the files within a folder, a symbolic link is followed
+    struct stat s;
+    if (stat(path, &s) != 0 && lstat(path, &s) != 0) {
+        error = errno;
+        goto error;
+    }
+
+    path_r = fs_resolve(path);
+    if (!path_r) goto error;
+
+    if (S_ISDIR(s.st_mode)) {
+        files = walk_folder(arena, path_r, threads, fn, data, is_parts);
+        if (!files) {
+            error = errno;
+            goto error;
+        }
+    } else {
+        files = list_new(1);
+        if (!files) goto error;
+
+        // partial files are only looked for within a folder
+        if (is_parts) {
+            free(path_r);
+            return files;
+        }
+
+        if (!S_ISREG(s.st_mode)) {
+            fprintf(stderr, "Not a regular file: %s, skipping\n", path_r);
+            free(path_r);
+            return files;
+        }
+
+        file = file_new_canonical(arena, path_r, 0, NULL);
+        if (!file) goto error;
+        file_set_stat(file, &s);
+
+        if (list_push(files, file) != LIST_STATUS_OK) goto error;
+        file = NULL;
+    }
+
+    free(path_r);
+    return files;
+
+error:
+    if (!arena) file_free(file);
+    list_free(files);
+    free(path_r);
+    errno = error;
+    return NULL;
+}
+
+List* walk_collect_files(Arena* arena, const char* path, size_t threads) {
+    return walk_collect_mode(arena, path, threads, NULL, NULL, 0);
+}
+
+List* walk_collect(Arena* arena, const char* path, size_t threads, WalkFolderFn fn, void* data) {
+    return walk_collect_mode(arena, path, threads, fn, data, 0);
+}
+
+List* walk_collect_parts(Arena* arena, const char* path, size_t threads) {
+    return walk_collect_mode(arena, path, threads, NULL, NULL, 1);
+}
@@ -0,0 +1,93 @@
+/**
+ * @file walk.h
+ * Parallel walk of a local folder tree. Each thread lists folders from a
+ * queue of its own, taking the most recently found folder first, and takes
+ * the oldest folder from the queue of another thread once its own is empty.
+ * Files are kept in a buffer per thread, and merged once every folder is
+ * listed. Folders are known by the type of each entry, without a stat. When
+ * io_uring is enabled, the status of the files of each folder is looked up in
+ * batches, see uring.h.
+ */
+
+#ifndef _WALK_H_
+#define _WALK_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "list.h"
+
+/**
+ * Actions to take on a folder reached by a walk.
+ */
+typedef enum {
+    WALK_FOLDER_LIST,     ///< List the folder, collecting the files within it
+    WALK_FOLDER_COLLECT,  ///< Collect the folder itself rather than listing it
+    WALK_FOLDER_SKIP,     ///< Neither list nor collect the folder
+} WalkFolderAction;
+
+/**
+ * Decides what to do with a folder reached by a walk, before it is listed.
+ * Called on the threads of the walk, so it must be thread safe.
+ * @param data  opaque data passed to walk_collect
+ * @param path  canonical path of the folder, copy it to keep it
+ * @param st    status of the folder
+ * @return      action to take on the folder
+ */
+typedef WalkFolderAction (*WalkFolderFn)(void* data, const char* path, struct stat* st);
+
+/**
+ * Determine how many threads walk_collect_files uses by default. Walking is
+ * dominated by waiting on the file system rather than the CPU, so this is
+ * at least a few threads even on a single CPU.
+ * @return  number of threads
+ */
+size_t walk_threads();
+
+/**
+ * Collect all regular files within a path into a list, ordered like
+ * fs_path_cmp. Symbolic links are followed, and each folder is listed once
+ * even if several links lead to it. Folders which cannot be read are
+ * skipped. Anything else which is not a regular file, like a broken link, is
+ * skipped with a warning. A path which is not a folder is collected by itself.
+ * @param arena    arena to allocate the files from, or NULL to allocate them
+ *                 normally, in which case free them with file_free
+ * @param path     path to collect files from
+ * @param threads  number of threads to list folders on, or zero for the
+ *                 result of walk_threads
+ * @return         list of all files under the path, or NULL with errno set
+ *                 in case of failure
+ */
+List* walk_collect_files(Arena* arena, const char* path, size_t threads);
+
+/**
+ * Collect files like walk_collect_files, deciding whether to list each folder
+ * along the way. The folder at the path itself is passed to the function
+ * first, before any folder within it. Folders which are collected rather
+ * than listed are part of the result, ordered along with the files.
+ * @param arena    arena to allocate the files from, as walk_collect_files
+ * @param path     path to collect files from
+ * @param threads  number of threads to list folders on, or zero for the
+ *                 result of walk_threads
+ * @param fn       function deciding whether to list each folder
+ * @param data     opaque data passed to the function
+ * @return         list of the files and collected folders under the path, or
+ *                 NULL with errno set in case of failure
+ */
+List* walk_collect(Arena* arena, const char* path, size_t threads, WalkFolderFn fn, void* data);
+
+/**
+ * Collect the partial files of interrupted transfers within a folder, and
+ * their sidecars, which walk_collect_files leaves out. See resume.h.
+ * @param arena    arena to allocate the files from, as walk_collect_files
+ * @param path     path of the folder to collect partial files from
+ * @param threads  number of threads to list folders on, or zero for the
+ *                 result of walk_threads
+ * @return         list of the partial files under the path, which is empty
+ *                 if the path is not a folder, or NULL with errno set in
+ *                 case of failure
+ */
+List* walk_collect_parts(Arena* arena, const char* path, size_t threads);
+
+#endif
@@ -4,6 +4,16 @@
 #include "test/str_test.h"
 #include "test/sync_test.h"
 #include "test/args_test.h"
+#include "test/index_test.h"
+#include "test/enum_test.h"
+#include "test/queue_test.h"
+#include "test/ring_test.h"
+#include "test/resume_test.h"
+#include "test/progress_test.h"
+#include "test/intern_test.h"
+#include "test/arena_test.h"
+#include "test/digest_test.h"
+#include "test/walk_test.h"
 
 int main(int argc, char **argv) {
     hash_test(1);
@@ -14,4 +24,14 @@ int main(int argc, char **argv) {
     str_test();
     sync_test();
     args_test();
+    index_test();
+    enum_test();
+    queue_test();
+    ring_test();
+    resume_test();
+    progress_test();
+    intern_test();
+    arena_test();
+    digest_test();
+    walk_test();
 }
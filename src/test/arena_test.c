@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../main/arena.h"
+#include "../main/intern.h"
+#include "arena_test.h"
+
+static size_t cleanups[4];
+static size_t cleanup_count = 0;
+
+static void record_cleanup(void* data) {
+    cleanups[cleanup_count++] = (uintptr_t)data;
+}
+
+static size_t batches[4];
+static size_t batch_count = 0;
+static size_t batch_items = 0;
+
+static void record_batch(void** data, size_t n) {
+    batches[batch_count++] = n;
+    for (size_t i = 0; i < n; i++) assert((uintptr_t)data[i] == batch_items++);
+}
+
+static void assert_allocations(Arena* a) {
+    // TEST ALLOCATIONS ARE ALIGNED AND DISTINCT
+    char* prev = NULL;
+    for (size_t i = 1; i < 100; i++) {
+        char* p = arena_alloc(a, i);
+        assert(p);
+        assert((uintptr_t)p % _Alignof(max_align_t) == 0);
+        assert(p != prev);
+        memset(p, 'x', i);
+        prev = p;
+    }
+
+    // TEST LARGE ALLOCATIONS
+    char* large = arena_alloc(a, 10000);
+    assert(large);
+    memset(large, 'y', 10000);
+    char* small = arena_alloc(a, 8);
+    assert(small);
+    assert(small < large || small >= large + 10000);
+    assert(arena_size(a) >= 10000 + 8);
+
+    // TEST STRDUP
+    char* str = arena_strdup(a, "/music/album");
+    assert(str);
+    assert(strcmp(str, "/music/album") == 0);
+}
+
+int arena_test() {
+    Arena* a = arena_new(256);
+    assert(a);
+    assert(arena_size(a) == 0);
+    assert_allocations(a);
+
+    // TEST CLEANUPS RUN IN REVERSE ORDER
+    for (size_t i = 0; i < 4; i++) {
+        assert(arena_defer(a, record_cleanup, (void*)(uintptr_t)i) == ARENA_STATUS_OK);
+    }
+    assert(cleanup_count == 0);
+    arena_free(a);
+    assert(cleanup_count == 4);
+    for (size_t i = 0; i < 4; i++) assert(cleanups[i] == 3 - i);
+
+    // TEST BATCHED CLEANUPS
+    a = arena_new(256);
+    assert(a);
+    for (size_t i = 0; i < 300; i++) {
+        assert(arena_defer_batch(a, record_batch, (void*)(uintptr_t)(i < 256 ? i + 44 : i - 256)) == ARENA_STATUS_OK);
+    }
+    arena_free(a);
+    assert(batch_count == 2);
+    assert(batches[0] == 44);
+    assert(batches[1] == 256);
+    assert(batch_items == 300);
+
+    // TEST INTERNED PATHS ARE RELEASED WITH THE ARENA
+    size_t size = intern_size();
+    a = arena_new(256);
+    assert(a);
+    char* path = intern_path_arena(a, "/arena/test/path");
+    assert(path);
+    assert(intern_path_arena(a, "/arena/test/path") == path);
+    assert(intern_size() > size);
+    arena_free(a);
+    assert(intern_size() == size);
+
+    // TEST DEBUG MODE
+    char* debug = getenv("MTPSYNC_ARENA_DEBUG");
+    char* prev = debug ? strdup(debug) : NULL;
+    setenv("MTPSYNC_ARENA_DEBUG", "1", 1);
+    a = arena_new(256);
+    assert(a);
+    assert_allocations(a);
+    arena_free(a);
+    if (prev) {
+        setenv("MTPSYNC_ARENA_DEBUG", prev, 1);
+        free(prev);
+    } else {
+        unsetenv("MTPSYNC_ARENA_DEBUG");
+    }
+
+    arena_free(NULL);
+    return 0;
+}
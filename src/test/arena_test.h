@@ -0,0 +1,6 @@
+#ifndef _ARENA_TEST_H_
+#define _ARENA_TEST_H_
+
+int arena_test();
+
+#endif
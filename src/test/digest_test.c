@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../main/arena.h"
+#include "../main/digest.h"
+#include "../main/file.h"
+#include "../main/fs.h"
+#include "../main/list.h"
+#include "../main/sync.h"
+#include "digest_test.h"
+
+// Sizes of the header, ending with the record count and string table size,
+// and of each record within a manifest
+#define DIGEST_TEST_HEADER_SIZE 32
+#define DIGEST_TEST_RECORD_SIZE 56
+
+static void write_file(const char* path, const char* data, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    assert(fs_write_all(fd, data, len) == 0);
+    close(fd);
+}
+
+static int file_path_cmp(const void* a, const void* b) {
+    File* fa = *(File**)a;
+    File* fb = *(File**)b;
+    return strcmp(fa->path, fb->path);
+}
+
+static size_t count_folders(List* files) {
+    size_t count = 0;
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        if (f->is_folder) count++;
+    }
+    return count;
+}
+
+static void digest_collect_test() {
+    char dir[] = "/tmp/mtpsync_collect_test_XXXXXX";
+    assert(mkdtemp(dir));
+
+    char a[sizeof(dir) + 32];
+    char b[sizeof(dir) + 32];
+    char c[sizeof(dir) + 32];
+    char e[sizeof(dir) + 32];
+    char path[sizeof(dir) + 32];
+    sprintf(a, "%s/a", dir);
+    sprintf(b, "%s/a/b", dir);
+    sprintf(c, "%s/c", dir);
+    sprintf(e, "%s/e", dir);
+
+    assert(fs_mkdir(a) == FS_STATUS_OK);
+    assert(fs_mkdir(b) == FS_STATUS_OK);
+    assert(fs_mkdir(c) == FS_STATUS_OK);
+    assert(fs_mkdir(e) == FS_STATUS_OK);
+    sprintf(path, "%s/top", dir);
+    write_file(path, "top", 3);
+    sprintf(path, "%s/a/x", dir);
+    write_file(path, "x", 1);
+    sprintf(path, "%s/a/b/y", dir);
+    write_file(path, "y", 1);
+    sprintf(path, "%s/c/z", dir);
+    write_file(path, "z", 1);
+
+    // folders modified just now are listed every time
+    time_t old = time(NULL) - 3600;
+    assert(fs_set_mtime(dir, old) == FS_STATUS_OK);
+    assert(fs_set_mtime(a, old) == FS_STATUS_OK);
+    assert(fs_set_mtime(b, old) == FS_STATUS_OK);
+    assert(fs_set_mtime(c, old) == FS_STATUS_OK);
+    assert(fs_set_mtime(e, old) == FS_STATUS_OK);
+
+    Arena* arena = arena_new(1024);
+    assert(arena);
+    DigestManifest* m = digest_manifest_open(NULL);
+    assert(m);
+
+    // TEST FIRST WALK LISTS EVERYTHING
+    List* files = digest_collect_files(m, arena, dir);
+    assert(files);
+    assert(list_size(files) == 4);
+    assert(count_folders(files) == 0);
+
+    // the digests are those of the synced folders
+    uint64_t digest = 0;
+    uint64_t expected = 0;
+    SyncTree* tree = sync_tree_new(files, 0, SYNC_COMPARE_EXISTS);
+    assert(tree);
+    assert(digest_folder(m, dir, &digest));
+    assert(sync_tree_digest(tree, dir, &expected));
+    assert(digest == expected);
+    assert(digest_folder(m, b, &digest));
+    assert(sync_tree_digest(tree, b, &expected));
+    assert(digest == expected);
+    assert(digest_folder(m, e, &digest));
+    assert(digest == 0);
+    sync_tree_free(tree);
+    list_free(files);
+
+    // TEST UNCHANGED FOLDERS ARE NOT LISTED
+    files = digest_collect_files(m, arena, dir);
+    assert(files);
+    assert(list_size(files) == 3);
+    assert(count_folders(files) == 2);
+    list_free(files);
+
+    // the folder where the walk starts is listed
+    files = digest_collect_files(m, arena, a);
+    assert(files);
+    assert(list_size(files) == 2);
+    assert(count_folders(files) == 1);
+    list_free(files);
+
+    // TEST CHANGED SUBFOLDER
+    sprintf(path, "%s/a/b/new", dir);
+    write_file(path, "new", 3);
+    assert(fs_set_mtime(b, old + 1) == FS_STATUS_OK);
+
+    files = digest_collect_files(m, arena, dir);
+    assert(files);
+    assert(list_size(files) == 5);
+    assert(count_folders(files) == 1);
+    list_free(files);
+
+    // TEST SAVE & LOAD FOLDERS
+    sprintf(path, "%s/manifest", dir);
+    assert(digest_manifest_save(m, path) == DIGEST_STATUS_OK);
+    digest_manifest_free(m);
+    m = digest_manifest_open(path);
+    assert(m);
+    unlink(path);
+
+    files = digest_collect_files(m, arena, dir);
+    assert(files);
+    assert(list_size(files) == 3);
+    assert(count_folders(files) == 2);
+    list_free(files);
+
+    // TEST REMOVED FOLDER
+    sprintf(path, "%s/c/z", dir);
+    unlink(path);
+    rmdir(c);
+    assert(fs_set_mtime(dir, old + 1) == FS_STATUS_OK);
+
+    files = digest_collect_files(m, arena, dir);
+    assert(files);
+    assert(list_size(files) == 2);
+    assert(count_folders(files) == 1);
+    assert(!digest_folder(m, c, &digest));
+    list_free(files);
+
+    // TEST MISSING PATH
+    assert(!digest_collect_files(m, arena, c));
+
+    // CLEANUP
+    sprintf(path, "%s/top", dir);
+    unlink(path);
+    sprintf(path, "%s/a/x", dir);
+    unlink(path);
+    sprintf(path, "%s/a/b/y", dir);
+    unlink(path);
+    sprintf(path, "%s/a/b/new", dir);
+    unlink(path);
+    rmdir(b);
+    rmdir(a);
+    rmdir(e);
+    rmdir(dir);
+
+    digest_manifest_free(m);
+    arena_free(arena);
+}
+
+int digest_test() {
+    char dir[] = "/tmp/mtpsync_digest_test_XXXXXX";
+    assert(mkdtemp(dir));
+
+    char root[sizeof(dir) + 32];
+    char a_path[sizeof(dir) + 32];
+    char b_path[sizeof(dir) + 32];
+    char c_path[sizeof(dir) + 32];
+    char manifest_path[sizeof(dir) + 32];
+    sprintf(root, "%s/files", dir);
+    sprintf(a_path, "%s/files/a", dir);
+    sprintf(b_path, "%s/files/b", dir);
+    sprintf(c_path, "%s/files/c", dir);
+    sprintf(manifest_path, "%s/cache/manifest", dir);
+
+    // the large file spans several chunks
+    size_t big_size = 3 * 1024 * 1024 + 17;
+    char* big = malloc(big_size);
+    assert(big);
+    for (size_t i = 0; i < big_size; i++) big[i] = i * 31;
+
+    assert(fs_mkdir(root) == FS_STATUS_OK);
+    write_file(a_path, "hello", 5);
+    write_file(b_path, big, big_size);
+    write_file(c_path, "", 0);
+
+    Arena* arena = arena_new(1024);
+    assert(arena);
+    List* collected = fs_collect_files(arena, root);
+    assert(collected);
+    List* files = list_sort(collected, file_path_cmp);
+    assert(files);
+    list_free(collected);
+    assert(list_size(files) == 3);
+
+    uint64_t digests[3];
+    uint64_t expected[3];
+    for (size_t i = 0; i < 3; i++) {
+        File* f = list_get(files, i);
+        assert(fs_hash_file(f->path, &expected[i]) == FS_STATUS_OK);
+    }
+
+    // TEST MISSING MANIFEST
+    DigestManifest* m = digest_manifest_open(manifest_path);
+    assert(m);
+    assert(digest_manifest_size(m) == 0);
+
+    // TEST DIGEST FILES
+    DigestStats stats;
+    assert(digest_files(m, files, 4, digests, &stats) == DIGEST_STATUS_OK);
+    assert(stats.files == 3);
+    assert(stats.cached == 0);
+    assert(stats.bytes == big_size + 5);
+    assert(stats.read == big_size + 5);
+    assert(memcmp(digests, expected, sizeof(digests)) == 0);
+    assert(digest_manifest_size(m) == 3);
+
+    // a single thread gives the same digests
+    memset(digests, 0, sizeof(digests));
+    assert(digest_files(NULL, files, 1, digests, &stats) == DIGEST_STATUS_OK);
+    assert(stats.cached == 0);
+    assert(memcmp(digests, expected, sizeof(digests)) == 0);
+
+    // TEST SAVE & LOAD
+    assert(digest_manifest_save(m, manifest_path) == DIGEST_STATUS_OK);
+    digest_manifest_free(m);
+
+    m = digest_manifest_open(manifest_path);
+    assert(m);
+    assert(digest_manifest_size(m) == 3);
+
+    memset(digests, 0, sizeof(digests));
+    assert(digest_files(m, files, 4, digests, &stats) == DIGEST_STATUS_OK);
+    assert(stats.files == 3);
+    assert(stats.cached == 3);
+    assert(stats.read == 0);
+    assert(memcmp(digests, expected, sizeof(digests)) == 0);
+
+    // TEST CHANGED FILE
+    write_file(a_path, "hello!", 6);
+
+    uint64_t digest = 0;
+    assert(digest_file(m, a_path, &digest) == DIGEST_STATUS_OK);
+    assert(digest != expected[0]);
+
+    uint64_t fresh = 0;
+    assert(fs_hash_file(a_path, &fresh) == FS_STATUS_OK);
+    assert(digest == fresh);
+
+    assert(digest_files(m, files, 4, digests, &stats) == DIGEST_STATUS_OK);
+    assert(stats.cached == 3);
+    assert(digests[0] == fresh);
+
+    // TEST MISSING FILE
+    assert(digest_file(m, "/nonexistent/mtpsync", &digest) == DIGEST_STATUS_EFAIL);
+
+    // TEST PRUNE
+    assert(fs_rm(b_path) == FS_STATUS_OK);
+    list_remove(files, 1);
+    assert(digest_manifest_prune(m, "/nonexistent", files) == DIGEST_STATUS_OK);
+    assert(digest_manifest_size(m) == 3);
+    assert(digest_manifest_prune(m, root, files) == DIGEST_STATUS_OK);
+    assert(digest_manifest_size(m) == 2);
+    assert(digest_manifest_save(m, manifest_path) == DIGEST_STATUS_OK);
+    digest_manifest_free(m);
+
+    m = digest_manifest_open(manifest_path);
+    assert(m);
+    assert(digest_manifest_size(m) == 2);
+    digest_manifest_free(m);
+
+    // TEST WRAPPED SIZES: more records than fit, with a string table size
+    // which only adds up to the size of the file by wrapping around
+    struct stat st;
+    assert(stat(manifest_path, &st) == 0);
+    uint64_t sizes[2];
+    sizes[0] = st.st_size / DIGEST_TEST_RECORD_SIZE;
+    sizes[1] = st.st_size - DIGEST_TEST_HEADER_SIZE - sizes[0] * DIGEST_TEST_RECORD_SIZE;
+    FILE* f = fopen(manifest_path, "r+");
+    assert(f);
+    assert(fseek(f, DIGEST_TEST_HEADER_SIZE - sizeof(sizes), SEEK_SET) == 0);
+    assert(fwrite(sizes, sizeof(sizes), 1, f) == 1);
+    fclose(f);
+
+    m = digest_manifest_open(manifest_path);
+    assert(m);
+    assert(digest_manifest_size(m) == 0);
+    digest_manifest_free(m);
+
+    // TEST CORRUPT MANIFEST
+    f = fopen(manifest_path, "r+");
+    assert(f);
+    assert(ftruncate(fileno(f), 40) == 0);
+    fclose(f);
+
+    m = digest_manifest_open(manifest_path);
+    assert(m);
+    assert(digest_manifest_size(m) == 0);
+    digest_manifest_free(m);
+
+    // CLEANUP
+    unlink(a_path);
+    unlink(c_path);
+    unlink(manifest_path);
+    rmdir(root);
+    sprintf(root, "%s/cache", dir);
+    rmdir(root);
+    rmdir(dir);
+
+    list_free(files);
+    arena_free(arena);
+    free(big);
+
+    digest_collect_test();
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _DIGEST_TEST_H_
+#define _DIGEST_TEST_H_
+
+int digest_test();
+
+#endif
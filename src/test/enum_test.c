@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../main/enum.h"
+#include "../main/list.h"
+#include "../main/str.h"
+#include "sim_device.h"
+#include "enum_test.h"
+
+typedef struct {
+    List* visited;     // Paths visited so far
+    const char* skip;  // Path of a folder whose children are skipped
+} EnumTestVisit;
+
+static EnumVisitCode collect(EnumEntry* e, const char* path, void* data) {
+    EnumTestVisit* v = data;
+    assert(list_push(v->visited, strdup(path)) == LIST_STATUS_OK);
+    return v->skip && strcmp(v->skip, path) == 0 ? ENUM_VISIT_SKIP : ENUM_VISIT_CONTINUE;
+}
+
+static int cmp_str(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static List* enumerate(EnumSource* src, uint32_t id, const char* path, EnumStrategy s, const char* skip) {
+    EnumTestVisit v = { .visited = list_new(8), .skip = skip };
+    assert(v.visited);
+    assert(enum_tree(src, id, path, s, collect, &v) == ENUM_STATUS_OK);
+    return v.visited;
+}
+
+static void assert_paths(List* actual, const char** expected, size_t n) {
+    List* sorted = list_sort(actual, cmp_str);
+    assert(list_size(sorted) == n);
+    for (size_t i = 0; i < n; i++) {
+        assert(strcmp(list_get(sorted, i), expected[i]) == 0);
+    }
+    list_free(sorted);
+    list_free_deep(actual, free);
+}
+
+int enum_test() {
+    SimDevice* sd = sim_device_new(0);
+    assert(sd);
+
+    uint32_t a = sim_device_add(sd, 0, "A", 0, 1);
+    uint32_t b = sim_device_add(sd, a, "B", 0, 1);
+    assert(sim_device_add(sd, b, "2", 20, 0));
+    assert(sim_device_add(sd, a, "1", 10, 0));
+    assert(sim_device_add(sd, 0, "C", 0, 1));
+    assert(sim_device_add(sd, 0, "3", 30, 0));
+
+    // objects with a missing parent are never reachable from the root
+    assert(sim_device_add(sd, 999, "orphan", 1, 0));
+
+    EnumSource src = sim_device_source(sd);
+
+    const char* all[] = { "/3", "/A", "/A/1", "/A/B", "/A/B/2", "/C" };
+    const char* sub[] = { "/A/1", "/A/B", "/A/B/2" };
+    const char* skipped[] = { "/A/1", "/A/B" };
+
+    // TEST WALK
+    assert_paths(enumerate(&src, 0, "/", ENUM_STRATEGY_WALK, NULL), all, 6);
+    assert(sim_device_requests(sd) == 4);
+
+    // TEST BULK
+    assert_paths(enumerate(&src, 0, "/", ENUM_STRATEGY_BULK, NULL), all, 6);
+    assert(sim_device_requests(sd) == 1);
+
+    // TEST SUBTREE
+    assert_paths(enumerate(&src, a, "/A", ENUM_STRATEGY_WALK, NULL), sub, 3);
+    assert_paths(enumerate(&src, a, "/A", ENUM_STRATEGY_BULK, NULL), sub, 3);
+    sim_device_requests(sd);
+
+    // TEST SKIP
+    assert_paths(enumerate(&src, a, "/A", ENUM_STRATEGY_WALK, "/A/B"), skipped, 2);
+    assert_paths(enumerate(&src, a, "/A", ENUM_STRATEGY_BULK, "/A/B"), skipped, 2);
+
+    // TEST BULK ORDER: folders are visited before their children
+    List* ordered = enumerate(&src, 0, "/", ENUM_STRATEGY_BULK, NULL);
+    for (size_t i = 1; i < list_size(ordered); i++) {
+        assert(strcmp(list_get(ordered, i - 1), list_get(ordered, i)) < 0);
+    }
+    list_free_deep(ordered, free);
+
+    // TEST UNSUPPORTED
+    sim_device_set_bulk(sd, 0);
+    EnumTestVisit v = { .visited = list_new(8), .skip = NULL };
+    assert(enum_tree(&src, 0, "/", ENUM_STRATEGY_BULK, collect, &v) == ENUM_STATUS_EUNSUPPORTED);
+    assert(list_size(v.visited) == 0);
+    list_free(v.visited);
+
+    sim_device_free(sd);
+    return 0;
+}
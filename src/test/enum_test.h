@@ -0,0 +1,6 @@
+#ifndef _ENUM_TEST_H_
+#define _ENUM_TEST_H_
+
+int enum_test();
+
+#endif
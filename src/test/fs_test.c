@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "../main/file.h"
 #include "../main/str.h"
@@ -42,9 +45,15 @@ static void assert_resolve_rel(char* expect, char* input) {
     free(fullpath);
 }
 
+static void assert_view(char* expect, const char* path, FsPathView view) {
+    assert(view.offset + view.len <= strlen(path));
+    assert(strlen(expect) == view.len);
+    assert(strncmp(expect, path + view.offset, view.len) == 0);
+}
+
 int fs_test(int sz) {
     // TEST COLLECT FILES
-    List* files = fs_collect_files(".");
+    List* files = fs_collect_files(NULL, ".");
     assert(files);
 
     int found = 0;
@@ -65,21 +74,87 @@ int fs_test(int sz) {
     assert(found);
 
     // TEST COLLECT A SINGLE FILE
-    files = fs_collect_files("./src/test/fs_test.c");
+    files = fs_collect_files(NULL, "./src/test/fs_test.c");
     assert(files);
     assert(list_size(files) == 1);
 
     File* f = list_get(files, 0);
     assert(strcmp(expect_file, f->path) == 0);
     assert(!f->is_folder);
+    assert(f->size > 0);
+    assert(f->mtime > 0);
     list_free_deep(files, (ListItemFreeFn)file_free);
     free(expect_file);
 
+    // TEST SET MODIFICATION TIME
+    char tmp_path[] = "/tmp/mtpsync_fs_test_XXXXXX";
+    int fd = mkstemp(tmp_path);
+    assert(fd >= 0);
+    assert(write(fd, "12345", 5) == 5);
+    close(fd);
+
+    assert(fs_set_mtime(tmp_path, 1000000) == FS_STATUS_OK);
+    files = fs_collect_files(NULL, tmp_path);
+    assert(files && list_size(files) == 1);
+    f = list_get(files, 0);
+    assert(f->size == 5);
+    assert(f->mtime == 1000000);
+    list_free_deep(files, (ListItemFreeFn)file_free);
+
+    // TEST HASH FILE CONTENTS
+    uint64_t digest = 0;
+    uint64_t other = 0;
+    assert(fs_hash_file(tmp_path, &digest) == FS_STATUS_OK);
+    assert(fs_hash_file(tmp_path, &other) == FS_STATUS_OK);
+    assert(digest == other);
+
+    fd = open(tmp_path, O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    assert(write(fd, "6", 1) == 1);
+    close(fd);
+    assert(fs_hash_file(tmp_path, &other) == FS_STATUS_OK);
+    assert(digest != other);
+
+    // a size which is out of date gives the same digest
+    for (uint64_t size = 0; size < 8; size += 3) {
+        fd = open(tmp_path, O_RDONLY);
+        assert(fd >= 0);
+        assert(fs_hash_fd(fd, size, &digest) == FS_STATUS_OK);
+        assert(digest == other);
+        close(fd);
+    }
+
+    // TEST FILE STATUS
+    files = fs_collect_files(NULL, tmp_path);
+    assert(files && list_size(files) == 1);
+    f = list_get(files, 0);
+    assert(S_ISREG(f->mode));
+    assert(f->ino);
+    list_free_deep(files, (ListItemFreeFn)file_free);
+
+    // TEST MKDIR & RM
+    char dir_path[sizeof(tmp_path) + 8];
+    sprintf(dir_path, "%s.d", tmp_path);
+    assert(fs_mkdir(dir_path) == FS_STATUS_OK);
+    assert(fs_mkdir(dir_path) == FS_STATUS_OK);
+    assert(fs_mkdir(tmp_path) == FS_STATUS_EFAIL);
+    assert(errno == ENOTDIR);
+    assert(fs_rm(dir_path) == FS_STATUS_OK);
+    assert(fs_rm(dir_path) == FS_STATUS_EFAIL);
+    assert(errno == ENOENT);
+
+    assert(fs_rm(tmp_path) == FS_STATUS_OK);
+    assert(fs_set_mtime(tmp_path, 1000000) == FS_STATUS_EFAIL);
+    assert(fs_hash_file(tmp_path, &digest) == FS_STATUS_ENOENT);
+
     // TEST COLLECT ANCESTORS
     char* cwd = getcwd(NULL, 0);
     assert(cwd);
 
-    files = fs_collect_ancestors(cwd);
+    Arena* arena = arena_new(1024);
+    assert(arena);
+
+    files = fs_collect_ancestors(arena, cwd);
     assert(files);
     assert(list_size(files) >= 1);
 
@@ -96,7 +171,28 @@ int fs_test(int sz) {
         }
     }
     assert(found);
-    list_free_deep(files, (ListItemFreeFn)file_free);
+
+    // TEST COLLECT ANCESTORS WITH IO_URING
+    setenv("MTPSYNC_IO_URING", "1", 1);
+    char* missing = fs_path_join(cwd, "missing/child");
+    assert(missing);
+    List* batched = fs_collect_ancestors(arena, missing);
+    unsetenv("MTPSYNC_IO_URING");
+    free(missing);
+
+    // the missing folder ends the list, like without io_uring
+    assert(batched);
+    assert(list_size(batched) == list_size(files));
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* a = list_get(files, i);
+        File* b = list_get(batched, i);
+        assert(strcmp(a->path, b->path) == 0);
+        assert(a->is_folder == b->is_folder);
+    }
+    list_free(batched);
+
+    list_free(files);
+    arena_free(arena);
 
     // TEST RESOLVE
     assert_resolve("/", "/");
@@ -150,9 +246,65 @@ int fs_test(int sz) {
     result = fs_resolve_cwd("/home/", "abc/def");
     assert(strcmp("/home/abc/def", result) == 0); free(result);
 
+    // TEST CACHED CWD
+    char* cached = fs_path_join(cwd, "abc");
+    assert(cached);
+    assert(chdir("/tmp") == 0);
+    result = fs_resolve("abc");
+    assert(strcmp(result, cached) == 0); free(result);
+    free(cached);
+    fs_forget_cwd();
+    result = fs_resolve("abc");
+    assert(strcmp(result, "/tmp/abc") == 0); free(result);
+    assert(chdir(cwd) == 0);
+    fs_forget_cwd();
+    assert_resolve(cwd, ".");
+
+    // TEST CANONICAL
+    assert(fs_is_canonical("/"));
+    assert(fs_is_canonical("/abc"));
+    assert(fs_is_canonical("/abc/def"));
+    assert(fs_is_canonical("/.abc/..def/d.e"));
+    assert(fs_is_canonical("/..."));
+    assert(!fs_is_canonical(NULL));
+    assert(!fs_is_canonical(""));
+    assert(!fs_is_canonical("abc"));
+    assert(!fs_is_canonical("."));
+    assert(!fs_is_canonical("//"));
+    assert(!fs_is_canonical("/abc/"));
+    assert(!fs_is_canonical("/abc//def"));
+    assert(!fs_is_canonical("/abc/./def"));
+    assert(!fs_is_canonical("/abc/.."));
+    assert(!fs_is_canonical("/."));
+
     free(cwd);
     free(cwd_dup);
 
+    // TEST PATH VIEWS
+    assert_view("/a/bc", "/a/bc/d.mp3", fs_path_parent("/a/bc/d.mp3"));
+    assert_view("/", "/a", fs_path_parent("/a"));
+    assert_view("/", "/", fs_path_parent("/"));
+    assert_view("", "a", fs_path_parent("a"));
+
+    assert_view("d.mp3", "/a/bc/d.mp3", fs_path_name("/a/bc/d.mp3"));
+    assert_view("a", "/a", fs_path_name("/a"));
+    assert_view("/", "/", fs_path_name("/"));
+    assert(fs_path_name("/a/bc").offset == 3);
+
+    assert_view(".mp3", "/a/bc/d.mp3", fs_path_ext("/a/bc/d.mp3"));
+    assert_view(".gz", "/a/d.tar.gz", fs_path_ext("/a/d.tar.gz"));
+    assert_view("", "/a.b/c", fs_path_ext("/a.b/c"));
+    assert_view("", "/a/.profile", fs_path_ext("/a/.profile"));
+    assert_view(".", "/a/b.", fs_path_ext("/a/b."));
+    assert(fs_path_ext("/a.b/c").offset == 6);
+
+    assert_view("a", "/a/bc/d", fs_path_component("/a/bc/d", 0));
+    assert_view("bc", "/a/bc/d", fs_path_component("/a/bc/d", 1));
+    assert_view("d", "/a/bc/d", fs_path_component("/a/bc/d", 2));
+    assert_view("", "/a/bc/d", fs_path_component("/a/bc/d", 3));
+    assert(fs_path_component("/a/bc/d", 9).offset == 7);
+    assert_view("", "/", fs_path_component("/", 0));
+
     // TEST JOIN PATHS
     assert_join("one/two", "one", "two");
     assert_join("one/two/three", "one/two", "three");
@@ -175,5 +327,15 @@ int fs_test(int sz) {
     assert_join("a", "a", NULL);
     assert_join(".", NULL, NULL);
 
+    // TEST PATH ORDER
+    assert(fs_path_cmp("/a", "/a") == 0);
+    assert(fs_path_cmp("/", "/a") < 0);
+    assert(fs_path_cmp("/a", "/a/b") < 0);
+    assert(fs_path_cmp("/a/b", "/a-b") < 0);
+    assert(fs_path_cmp("/a/z", "/a.b") < 0);
+    assert(fs_path_cmp("/a-b", "/a/b") > 0);
+    assert(fs_path_cmp("/b", "/a/b") > 0);
+    assert(strcmp("/a/b", "/a-b") > 0);
+
     return 1;
 }
@@ -3,9 +3,107 @@
 #include <string.h>
 #include <assert.h>
 
+#include "../main/array.h"
 #include "../main/hash.h"
 #include "../main/list.h"
 
+#define HASH_TEST_KEYS 1000
+
+// Forces every key to collide, so that lookups rely on probing alone
+static size_t hash_code_same(void* key) {
+    return 42;
+}
+
+static void hash_test_many(HashCodeFn hc_fn) {
+    Hash* h = hash_new(1, hc_fn, hash_cmp_str);
+    char* keys[HASH_TEST_KEYS];
+
+    assert(h);
+
+    for (size_t i = 0; i < HASH_TEST_KEYS; i++) {
+        keys[i] = malloc(16);
+        assert(keys[i]);
+        sprintf(keys[i], "key%zu", i);
+
+        HashPutResult r = hash_put(h, keys[i], keys[i]);
+        assert(r.status == HASH_STATUS_OK);
+        assert(r.old_entry == NULL);
+        assert(hash_entry_value(r.new_entry) == keys[i]);
+    }
+    assert(hash_size(h) == HASH_TEST_KEYS);
+
+    // remove every other key, shifting the rest of each probe sequence back
+    for (size_t i = 0; i < HASH_TEST_KEYS; i += 2) {
+        HashEntry* e = hash_remove(h, keys[i]);
+        assert(e);
+        assert(hash_entry_key(e) == keys[i]);
+        hash_entry_free(e);
+    }
+    assert(hash_size(h) == HASH_TEST_KEYS / 2);
+
+    for (size_t i = 0; i < HASH_TEST_KEYS; i++) {
+        char key[16];
+        sprintf(key, "key%zu", i);
+        assert(hash_get(h, key) == (i % 2 ? keys[i] : NULL));
+    }
+
+    // shrinking stops at what the entries need
+    assert(hash_resize(h, 0) == HASH_STATUS_OK);
+    assert(hash_size(h) == HASH_TEST_KEYS / 2);
+    assert(hash_get(h, keys[1]) == keys[1]);
+
+    List* values = hash_values(h);
+    assert(list_size(values) == HASH_TEST_KEYS / 2);
+    list_free(values);
+
+    hash_free(h);
+    for (size_t i = 0; i < HASH_TEST_KEYS; i++) free(keys[i]);
+}
+
+// Test vectors of the wyhash reference implementation, seeded with their index
+static void hash_test_bytes() {
+    const char* inputs[] = {
+        "",
+        "a",
+        "abc",
+        "message digest",
+        "abcdefghijklmnopqrstuvwxyz",
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+        "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+    };
+    uint64_t expected[] = {
+        0x93228a4de0eec5a2ull,
+        0xc5bac3db178713c4ull,
+        0xa97f2f7b1d9b3314ull,
+        0x786d1f1df3801df4ull,
+        0xdca5a8138ad37c87ull,
+        0xb9e734f117cfaf70ull,
+        0x6cc5eab49a92d617ull,
+    };
+
+    for (size_t i = 0; i < ARRAY_LEN(expected); i++) {
+        assert(hash_bytes(inputs[i], strlen(inputs[i]), i) == expected[i]);
+    }
+
+    // hash codes of keys are interchangeable with hash_code_str
+    Hash* h = hash_new_str(1);
+    assert(h);
+    char key[] = "/GARMIN/Activity/2026-01-01.fit";
+    assert(hash_put_hc(h, key, hash_code_str(key), "fit").status == HASH_STATUS_OK);
+    assert(strcmp(hash_get(h, "/GARMIN/Activity/2026-01-01.fit"), "fit") == 0);
+    assert(strcmp(hash_get_hc(h, key, hash_code_str(key)), "fit") == 0);
+    hash_entry_free(hash_remove_hc(h, key, hash_code_str(key)));
+    assert(hash_size(h) == 0);
+
+    // entries can also be removed without detaching them
+    assert(hash_put_hc(h, key, hash_code_str(key), "fit").status == HASH_STATUS_OK);
+    assert(hash_delete_hc(h, key, hash_code_str(key)));
+    assert(!hash_delete_hc(h, key, hash_code_str(key)));
+    assert(hash_size(h) == 0);
+    assert(!hash_get(h, key));
+    hash_free(h);
+}
+
 int hash_test(int sz) {
     Hash* h = hash_new_str(sz);
     assert(h);
@@ -61,5 +159,9 @@ int hash_test(int sz) {
     list_free(l);
     hash_free(h);
 
+    hash_test_many(hash_code_str);
+    hash_test_many(hash_code_same);
+    hash_test_bytes();
+
     return 0;
 }
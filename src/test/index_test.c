@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../main/index.h"
+#include "../main/array.h"
+#include "index_test.h"
+
+// Sizes of the header, ending with the record count and string table size,
+// and of each record within an index file
+#define INDEX_TEST_HEADER_SIZE 48
+#define INDEX_TEST_RECORD_SIZE 32
+
+int index_test() {
+    char dir[] = "/tmp/mtpsync_index_test_XXXXXX";
+    assert(mkdtemp(dir));
+
+    char path[sizeof(dir) + 32];
+    sprintf(path, "%s/nested/test.idx", dir);
+
+    IndexEntry entries[] = {
+        { .id = 1, .parent_id = 0, .size = 0, .is_folder = 1, .is_loaded = 1, .path = "/GARMIN" },
+        { .id = 2, .parent_id = 1, .size = 0, .is_folder = 1, .is_loaded = 0, .path = "/GARMIN/Activity" },
+        { .id = 3, .parent_id = 2, .size = 1234, .mtime = 1767225600, .is_folder = 0, .is_loaded = 0, .path = "/GARMIN/Activity/01.fit" },
+    };
+
+    // TEST MISSING INDEX
+    assert(index_open(path) == NULL);
+
+    // TEST WRITE & READ
+    IndexFingerprint fp = { .free_space = 100, .max_capacity = 200, .is_stale = 1 };
+    IndexWriter* w = index_writer_new(fp);
+    assert(w);
+    for (size_t i = 0; i < ARRAY_LEN(entries); i++) {
+        assert(index_writer_add(w, &entries[i]) == INDEX_STATUS_OK);
+    }
+    assert(index_writer_save(w, path) == INDEX_STATUS_OK);
+    index_writer_free(w);
+
+    DeviceIndex* idx = index_open(path);
+    assert(idx);
+    assert(index_size(idx) == ARRAY_LEN(entries));
+    assert(index_fingerprint(idx).free_space == 100);
+    assert(index_fingerprint(idx).max_capacity == 200);
+    assert(index_fingerprint(idx).is_stale);
+
+    for (size_t i = 0; i < ARRAY_LEN(entries); i++) {
+        IndexEntry e = index_get(idx, i);
+        assert(e.id == entries[i].id);
+        assert(e.parent_id == entries[i].parent_id);
+        assert(e.size == entries[i].size);
+        assert(e.mtime == entries[i].mtime);
+        assert(e.is_folder == entries[i].is_folder);
+        assert(e.is_loaded == entries[i].is_loaded);
+        assert(strcmp(e.path, entries[i].path) == 0);
+    }
+    index_close(idx);
+
+    // TEST STAMP
+    IndexFingerprint fresh = { .free_space = 50, .max_capacity = 200, .is_stale = 0 };
+    assert(index_stamp(path, fresh) == INDEX_STATUS_OK);
+
+    idx = index_open(path);
+    assert(idx);
+    assert(index_fingerprint(idx).free_space == 50);
+    assert(!index_fingerprint(idx).is_stale);
+    index_close(idx);
+
+    // stamping a current index does not change it
+    fresh.free_space = 10;
+    assert(index_stamp(path, fresh) == INDEX_STATUS_OK);
+    idx = index_open(path);
+    assert(idx);
+    assert(index_fingerprint(idx).free_space == 50);
+    index_close(idx);
+
+    // TEST WRAPPED SIZES: more records than fit, with a string table size
+    // which only adds up to the size of the file by wrapping around
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    uint64_t sizes[2];
+    sizes[0] = st.st_size / INDEX_TEST_RECORD_SIZE;
+    sizes[1] = st.st_size - INDEX_TEST_HEADER_SIZE - sizes[0] * INDEX_TEST_RECORD_SIZE;
+    FILE* f = fopen(path, "r+");
+    assert(f);
+    assert(fseek(f, INDEX_TEST_HEADER_SIZE - sizeof(sizes), SEEK_SET) == 0);
+    assert(fwrite(sizes, sizeof(sizes), 1, f) == 1);
+    fclose(f);
+    assert(index_open(path) == NULL);
+
+    // TEST CORRUPT INDEX
+    f = fopen(path, "r+");
+    assert(f);
+    assert(ftruncate(fileno(f), 60) == 0);
+    fclose(f);
+    assert(index_open(path) == NULL);
+
+    // CLEANUP
+    unlink(path);
+    sprintf(path, "%s/nested", dir);
+    rmdir(path);
+    rmdir(dir);
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _INDEX_TEST_H_
+#define _INDEX_TEST_H_
+
+int index_test();
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../main/file.h"
+#include "../main/hash.h"
+#include "../main/intern.h"
+#include "intern_test.h"
+
+int intern_test() {
+    size_t size = intern_size();
+
+    // TEST EQUAL PATHS SHARE A POINTER
+    char buf[] = "/music/album/track.mp3";
+    char* a = intern_path(buf);
+    char* b = intern_path("/music/album/track.mp3");
+    assert(a && a == b);
+    assert(a != buf);
+    assert(strcmp(a, buf) == 0);
+    assert(intern_hc(a) == hash_code_str(buf));
+
+    // TEST ANCESTORS ARE INTERNED
+    assert(intern_size() == size + 4);
+    char* album = intern_parent(a);
+    assert(strcmp(album, "/music/album") == 0);
+    assert(album == intern_parent(b));
+    char* music = intern_parent(album);
+    assert(strcmp(music, "/music") == 0);
+    char* root = intern_parent(music);
+    assert(strcmp(root, "/") == 0);
+    assert(intern_parent(root) == NULL);
+
+    // TEST SIBLINGS SHARE ANCESTORS
+    char* c = intern_path("/music/album/other.mp3");
+    assert(intern_parent(c) == album);
+    assert(intern_size() == size + 5);
+
+    // TEST RELEASE
+    intern_release(c);
+    assert(intern_size() == size + 4);
+    intern_release(a);
+    assert(intern_size() == size + 4);
+    assert(intern_ref(b) == b);
+    intern_release(b);
+    intern_release(b);
+    assert(intern_size() == size);
+    intern_release(NULL);
+
+    // TEST FILES SHARE PATHS
+    File* f = file_new("/music/./album/../album/track.mp3", 0);
+    File* g = file_new("/music/album/track.mp3", 0);
+    File* h = file_dup(NULL, f);
+    assert(f && g && h);
+    assert(f->path == g->path && f->path == h->path);
+    assert(file_cmp(f, g) == 0);
+    assert(file_hc(f) == file_hc(g));
+    file_free(f);
+    file_free(g);
+    file_free(h);
+    assert(intern_size() == size);
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _INTERN_TEST_H_
+#define _INTERN_TEST_H_
+
+int intern_test();
+
+#endif
@@ -97,6 +97,27 @@ int list_test(int sz) {
     assert(strcmp("def", list_get(l, 0)) == 0);
     assert(strcmp("jklm", list_get(l, 1)) == 0);
 
+    // TEST INSERT & REMOVE
+    assert(list_insert(l, 0, "first") == LIST_STATUS_OK);
+    assert(list_insert(l, 2, "middle") == LIST_STATUS_OK);
+    assert(list_insert(l, 4, "last") == LIST_STATUS_OK);
+
+    assert(list_size(l) == 5);
+    assert(strcmp("first", list_get(l, 0)) == 0);
+    assert(strcmp("def", list_get(l, 1)) == 0);
+    assert(strcmp("middle", list_get(l, 2)) == 0);
+    assert(strcmp("jklm", list_get(l, 3)) == 0);
+    assert(strcmp("last", list_get(l, 4)) == 0);
+
+    assert(strcmp("middle", list_remove(l, 2)) == 0);
+    assert(strcmp("first", list_remove(l, 0)) == 0);
+    assert(list_remove(l, 3) == NULL);
+
+    assert(list_size(l) == 3);
+    assert(strcmp("def", list_get(l, 0)) == 0);
+    assert(strcmp("jklm", list_get(l, 1)) == 0);
+    assert(strcmp("last", list_get(l, 2)) == 0);
+
     // CLEANUP
     list_free(l);
 
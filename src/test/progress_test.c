@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../main/progress.h"
+#include "progress_test.h"
+
+static void* log_thread(void* data) {
+    progress_log(data, "Later.\n");
+    return NULL;
+}
+
+int progress_test() {
+    char buf[64];
+
+    // TEST FORMAT BYTES
+    assert(strcmp(progress_format_bytes(buf, sizeof(buf), 0), "0 B") == 0);
+    assert(strcmp(progress_format_bytes(buf, sizeof(buf), 1023), "1023 B") == 0);
+    assert(strcmp(progress_format_bytes(buf, sizeof(buf), 1536), "1.5 KiB") == 0);
+    assert(strcmp(progress_format_bytes(buf, sizeof(buf), 5ULL << 30), "5.0 GiB") == 0);
+
+    // TEST FORMAT DURATION
+    assert(strcmp(progress_format_duration(buf, sizeof(buf), 0), "0:00") == 0);
+    assert(strcmp(progress_format_duration(buf, sizeof(buf), 65), "1:05") == 0);
+    assert(strcmp(progress_format_duration(buf, sizeof(buf), 7387), "2:03:07") == 0);
+
+    // TEST NULL REPORTER
+    progress_start(NULL, 1, 1);
+    progress_item(NULL, "PUSH", "/a", 0);
+    progress_update(NULL, 1, 1);
+    progress_item_done(NULL, 1, "OK");
+    progress_end(NULL);
+
+    // TEST LOG OUTPUT: one line per item, no terminal control sequences
+    FILE* out = tmpfile();
+    assert(out);
+    Progress* p = progress_new(out);
+    assert(p);
+
+    progress_start(p, 2, 30);
+    for (int i = 0; i < 1000; i++) progress_tick(p, "Loading", "/a");
+    progress_item(p, "MKDIR", "/a", 1);
+    progress_item_done(p, 0, "OK");
+    progress_item(p, "PUSH", "/a/b", 0);
+    for (int i = 0; i <= 30; i++) progress_update(p, i, 30);
+    progress_item_done(p, 30, "OK");
+    progress_end(p);
+    progress_free(p);
+
+    char contents[512] = "";
+    rewind(out);
+    size_t n = fread(contents, 1, sizeof(contents) - 1, out);
+    contents[n] = 0;
+    fclose(out);
+
+    assert(strncmp(contents, "MKDIR: /a/: OK\nPUSH: /a/b: OK\nTransferred 30 B in ", 49) == 0);
+    assert(!strchr(contents, '\33'));
+    assert(!strchr(contents, '\r'));
+
+    // TEST CHILDREN: lines of each child start with its name
+    out = tmpfile();
+    assert(out);
+    p = progress_new(out);
+    assert(p);
+    Progress* c1 = progress_new_child(p, "Device 1");
+    Progress* c2 = progress_new_child(p, "Device 2");
+    assert(c1 && c2);
+
+    progress_start(c1, 1, 10);
+    progress_start(c2, 1, 10);
+    progress_item(c1, "PUSH", "/a", 0);
+    progress_item(c2, "PUSH", "/b", 0);
+    progress_update(c2, 5, 10);
+    progress_item_done(c2, 10, "OK");
+    progress_item_done(c1, 10, "OK");
+    progress_log(c1, "Loaded %d files.\n", 3);
+    progress_free(c2);
+    progress_free(c1);
+    progress_free(p);
+
+    rewind(out);
+    n = fread(contents, 1, sizeof(contents) - 1, out);
+    contents[n] = 0;
+    fclose(out);
+
+    assert(strcmp(contents, "Device 2: PUSH: /b: OK\nDevice 1: PUSH: /a: OK\nDevice 1: Loaded 3 files.\n") == 0);
+
+    // TEST HOLD: other children wait until the holder is done
+    out = tmpfile();
+    assert(out);
+    p = progress_new(out);
+    assert(p);
+    c1 = progress_new_child(p, "Device 1");
+    c2 = progress_new_child(p, "Device 2");
+    assert(c1 && c2);
+
+    pthread_t thread;
+    progress_hold(c1);
+    assert(pthread_create(&thread, NULL, log_thread, c2) == 0);
+    progress_log(c1, "Plan.\n");
+    usleep(10000);
+    progress_log(c1, "Proceed?\n");
+    progress_release(c1);
+    pthread_join(thread, NULL);
+    progress_free(c2);
+    progress_free(c1);
+    progress_free(p);
+
+    rewind(out);
+    n = fread(contents, 1, sizeof(contents) - 1, out);
+    contents[n] = 0;
+    fclose(out);
+
+    assert(strcmp(contents, "Device 1: Plan.\nDevice 1: Proceed?\nDevice 2: Later.\n") == 0);
+
+    return 0;
+}
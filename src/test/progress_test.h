@@ -0,0 +1,6 @@
+#ifndef _PROGRESS_TEST_H_
+#define _PROGRESS_TEST_H_
+
+int progress_test();
+
+#endif
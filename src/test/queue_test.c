@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "../main/queue.h"
+#include "queue_test.h"
+
+#define QUEUE_TEST_ITEMS 1000
+
+static void* produce(void* data) {
+    Queue* q = data;
+    for (uintptr_t i = 1; i <= QUEUE_TEST_ITEMS; i++) {
+        assert(queue_push(q, (void*)i) == QUEUE_STATUS_OK);
+    }
+    queue_close(q);
+    return NULL;
+}
+
+int queue_test() {
+    void* item = NULL;
+
+    // TEST PUSH, POP & CLOSE
+    Queue* q = queue_new(1);
+    assert(q);
+    assert(queue_push(q, (void*)1) == QUEUE_STATUS_OK);
+    assert(queue_push(q, (void*)2) == QUEUE_STATUS_OK);
+    queue_close(q);
+    assert(queue_push(q, (void*)3) == QUEUE_STATUS_CLOSED);
+    assert(queue_pop(q, &item) == QUEUE_STATUS_OK && item == (void*)1);
+    assert(queue_pop(q, &item) == QUEUE_STATUS_OK && item == (void*)2);
+    assert(queue_pop(q, &item) == QUEUE_STATUS_CLOSED);
+    queue_free(q);
+
+    // TEST ACROSS THREADS: items arrive in order, then the close
+    q = queue_new(4);
+    assert(q);
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, produce, q) == 0);
+    for (uintptr_t i = 1; i <= QUEUE_TEST_ITEMS; i++) {
+        assert(queue_pop(q, &item) == QUEUE_STATUS_OK);
+        assert(item == (void*)i);
+    }
+    assert(queue_pop(q, &item) == QUEUE_STATUS_CLOSED);
+    pthread_join(thread, NULL);
+    queue_free(q);
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _QUEUE_TEST_H_
+#define _QUEUE_TEST_H_
+
+int queue_test();
+
+#endif
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../main/digest.h"
+#include "../main/fs.h"
+#include "../main/resume.h"
+#include "../main/sync.h"
+#include "sim_device.h"
+#include "resume_test.h"
+
+#define RESUME_TEST_SIZE (3 * RESUME_CHUNK_SIZE + 1234)
+
+static int exists(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static uint64_t file_size(const char* path) {
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    return st.st_size;
+}
+
+// Asserts that neither the partial file nor its sidecar is taken for a local
+// file, which pull -x would remove as a stray before resuming, and that pull -x
+// removes only the given number of stale partial files, ahead of the rest.
+static void assert_cleanup(const char* dir, List* files, size_t stale) {
+    Arena* arena = arena_new(1024);
+    assert(arena);
+
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        assert(!resume_is_part_name(f->path + fs_path_name(f->path).offset));
+    }
+
+    List* sources = list_new(1);
+    assert(sources);
+    File* video = file_new_arena(arena, "/dev/video", 0, NULL);
+    assert(video);
+    video->size = RESUME_TEST_SIZE;
+    assert(list_push(sources, video) == LIST_STATUS_OK);
+
+    List* specs = sync_spec_create(arena, sources, "/dev", (char*)dir);
+    assert(specs);
+    List* plans = sync_plan_push(arena, sources, files, specs, 1, SYNC_COMPARE_EXISTS, SYNC_PLANNER_HASH);
+    assert(plans);
+    List* cleaned = resume_plan_cleanup(arena, plans, dir);
+    assert(cleaned);
+
+    // the folders are created, since the test lists no ancestors as pull does
+    size_t xfers = 0;
+    for (size_t i = 0; i < list_size(cleaned); i++) {
+        SyncPlan* plan = list_get(cleaned, i);
+        assert((plan->action == SYNC_ACTION_RM) == (i < stale));
+        if (plan->action == SYNC_ACTION_RM) assert(resume_is_part_name(plan->target->path + fs_path_name(plan->target->path).offset));
+        if (plan->action == SYNC_ACTION_XFER) xfers++;
+    }
+    assert(xfers == 1);
+
+    list_free(cleaned);
+    list_free(plans);
+    list_free(specs);
+    list_free(sources);
+    arena_free(arena);
+}
+
+static void assert_contents(const char* path, uint32_t id, uint64_t size) {
+    FILE* f = fopen(path, "rb");
+    assert(f);
+    for (uint64_t i = 0; i < size; i++) assert(fgetc(f) == sim_device_byte(id, i));
+    assert(fgetc(f) == EOF);
+    fclose(f);
+}
+
+int resume_test() {
+    char dir[] = "/tmp/mtpsync_resume_test_XXXXXX";
+    char target[64];
+    char info[96];
+    assert(mkdtemp(dir));
+    snprintf(target, sizeof(target), "%s/video", dir);
+
+    // TEST PART PATH: hidden, next to the target
+    char* part = resume_part_path(target);
+    assert(part);
+    snprintf(info, sizeof(info), "%s.info", part);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "%s/.video.mtpsync-part", dir);
+    assert(strcmp(part, expected) == 0);
+
+    // TEST PART TARGET: both the partial file and its sidecar lead back
+    char* back = resume_part_target(part);
+    assert(back && strcmp(back, target) == 0);
+    free(back);
+    back = resume_part_target(info);
+    assert(back && strcmp(back, target) == 0);
+    free(back);
+    assert(!resume_part_target(target));
+
+    SimDevice* sd = sim_device_new(0);
+    assert(sd);
+    uint32_t id = sim_device_add(sd, 0, "video", RESUME_TEST_SIZE, 0);
+    uint32_t other = sim_device_add(sd, 0, "other", RESUME_TEST_SIZE, 0);
+    assert(id && other);
+
+    // TEST FAIL MID-TRANSFER: the bytes read so far are kept aside
+    sim_device_set_fail_at(sd, RESUME_CHUNK_SIZE + 100);
+    ResumeSource src = sim_device_resume_source(sd);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_EDEVICE);
+    assert(!exists(target));
+    assert(exists(info));
+    assert(file_size(part) == RESUME_CHUNK_SIZE + 100);
+    assert(sim_device_bytes(sd) == RESUME_CHUNK_SIZE + 100);
+
+    // TEST PART NAMES: only hidden names ending like partial files match
+    assert(resume_is_part_name(".video.mtpsync-part"));
+    assert(resume_is_part_name(".video.mtpsync-part.info"));
+    assert(!resume_is_part_name("video.mtpsync-part"));
+    assert(!resume_is_part_name(".mtpsync-part"));
+    assert(!resume_is_part_name(".video.info"));
+    assert(!resume_is_part_name(".video.part"));
+    assert(!resume_is_part_name(".video.part.info"));
+
+    // TEST STRAY CLEANUP: the partial file is not collected, so pull -x only
+    // plans the transfer which resumes it
+    Arena* arena = arena_new(1024);
+    assert(arena);
+    List* files = fs_collect_files(arena, dir);
+    assert(files);
+    assert_cleanup(dir, files, 0);
+    list_free(files);
+
+    DigestManifest* m = digest_manifest_open(NULL);
+    assert(m);
+    files = digest_collect_files(m, arena, dir);
+    assert(files);
+    assert_cleanup(dir, files, 0);
+    list_free(files);
+
+    // TEST STALE PARTS: pull -x removes partial files no transfer continues
+    char stale[96];
+    char stale_info[112];
+    snprintf(stale, sizeof(stale), "%s/.gone.mtpsync-part", dir);
+    snprintf(stale_info, sizeof(stale_info), "%s.info", stale);
+    FILE* f = fopen(stale, "w");
+    assert(f && fclose(f) == 0);
+    f = fopen(stale_info, "w");
+    assert(f && fclose(f) == 0);
+
+    files = fs_collect_files(arena, dir);
+    assert(files);
+    assert_cleanup(dir, files, 2);
+    list_free(files);
+
+    files = digest_collect_files(m, arena, dir);
+    assert(files);
+    assert_cleanup(dir, files, 2);
+    list_free(files);
+    assert(unlink(stale) == 0 && unlink(stale_info) == 0);
+    digest_manifest_free(m);
+    arena_free(arena);
+
+    // TEST FAIL WHILE RESUMING: whole chunks read before the failure are kept
+    sim_device_set_fail_at(sd, 3 * RESUME_CHUNK_SIZE);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_EDEVICE);
+    assert(!exists(target));
+    assert(file_size(part) == 2 * RESUME_CHUNK_SIZE + 100);
+    assert(sim_device_bytes(sd) == RESUME_CHUNK_SIZE);
+
+    // TEST RESUME: only the rest is read, then renamed in to place
+    sim_device_set_fail_at(sd, 0);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_OK);
+    assert(sim_device_bytes(sd) == RESUME_TEST_SIZE - 2 * RESUME_CHUNK_SIZE - 100);
+    assert_contents(target, id, RESUME_TEST_SIZE);
+    assert(!exists(part));
+    assert(!exists(info));
+
+    // TEST PARTIAL READS FAIL: past the offsets the device can read from, the
+    // transfer is started over rather than failing the same way every time
+    sim_device_set_fail_at(sd, 2 * RESUME_CHUNK_SIZE);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_EDEVICE);
+    assert(file_size(part) == 2 * RESUME_CHUNK_SIZE);
+    sim_device_set_fail_at(sd, 0);
+    sim_device_set_max_offset(sd, RESUME_CHUNK_SIZE);
+    sim_device_bytes(sd);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_OK);
+    assert(sim_device_bytes(sd) == RESUME_TEST_SIZE);
+    assert_contents(target, id, RESUME_TEST_SIZE);
+    assert(!exists(part));
+    assert(!exists(info));
+    sim_device_set_max_offset(sd, 0);
+
+    // TEST OTHER OBJECT: a partial file of another object is started over
+    sim_device_set_fail_at(sd, 100);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_EDEVICE);
+    sim_device_set_fail_at(sd, 0);
+    sim_device_bytes(sd);
+    assert(resume_get(&src, other, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_OK);
+    assert(sim_device_bytes(sd) == RESUME_TEST_SIZE);
+    assert_contents(target, other, RESUME_TEST_SIZE);
+
+    // TEST NO PARTIAL READS: the transfer is started over
+    sim_device_set_fail_at(sd, 100);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_EDEVICE);
+    sim_device_set_fail_at(sd, 0);
+    sim_device_set_partial(sd, 0);
+    src = sim_device_resume_source(sd);
+    sim_device_bytes(sd);
+    assert(resume_get(&src, id, RESUME_TEST_SIZE, target, NULL) == RESUME_STATUS_OK);
+    assert(sim_device_bytes(sd) == RESUME_TEST_SIZE);
+    assert_contents(target, id, RESUME_TEST_SIZE);
+    assert(!exists(part));
+    assert(!exists(info));
+
+    sim_device_free(sd);
+    free(part);
+    assert(unlink(target) == 0);
+    assert(rmdir(dir) == 0);
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _RESUME_TEST_H_
+#define _RESUME_TEST_H_
+
+int resume_test();
+
+#endif
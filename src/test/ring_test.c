@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "../main/ring.h"
+#include "ring_test.h"
+
+#define RING_TEST_BYTES 100000
+
+static void* produce(void* data) {
+    Ring* r = data;
+    unsigned char chunk[257];
+
+    // odd sizes, so that writes wrap around the end of the buffer
+    for (size_t sent = 0; sent < RING_TEST_BYTES; ) {
+        size_t n = RING_TEST_BYTES - sent < sizeof(chunk) ? RING_TEST_BYTES - sent : sizeof(chunk);
+        for (size_t i = 0; i < n; i++) chunk[i] = (sent + i) % 251;
+        assert(ring_write(r, chunk, n) == RING_STATUS_OK);
+        sent += n;
+    }
+    ring_close(r);
+    return NULL;
+}
+
+static void* produce_forever(void* data) {
+    Ring* r = data;
+    unsigned char chunk[64] = {0};
+    while (ring_write(r, chunk, sizeof(chunk)) == RING_STATUS_OK);
+    return NULL;
+}
+
+int ring_test() {
+    char buf[16];
+    size_t n = 0;
+
+    // TEST WRITE, READ & CLOSE
+    Ring* r = ring_new(8);
+    assert(r);
+    assert(ring_write(r, "abcde", 5) == RING_STATUS_OK);
+    assert(ring_read(r, buf, 3, &n) == RING_STATUS_OK && n == 3);
+    assert(memcmp(buf, "abc", 3) == 0);
+    assert(ring_write(r, "fghijk", 6) == RING_STATUS_OK);
+    ring_close(r);
+    assert(ring_read(r, buf, sizeof(buf), &n) == RING_STATUS_OK && n == 8);
+    assert(memcmp(buf, "defghijk", 8) == 0);
+    assert(ring_read(r, buf, sizeof(buf), &n) == RING_STATUS_OK && n == 0);
+    ring_free(r);
+
+    // TEST ACROSS THREADS: bytes arrive in order through a smaller buffer
+    r = ring_new(1000);
+    assert(r);
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, produce, r) == 0);
+    unsigned char* all = malloc(RING_TEST_BYTES + 1);
+    assert(all);
+    size_t total = 0;
+    for (;;) {
+        // more than fits the buffer, so reads wait for the writer
+        size_t want = RING_TEST_BYTES + 1 - total < 4096 ? RING_TEST_BYTES + 1 - total : 4096;
+        assert(ring_read(r, all + total, want, &n) == RING_STATUS_OK);
+        total += n;
+        if (n < want) break;
+    }
+    assert(total == RING_TEST_BYTES);
+    for (size_t i = 0; i < RING_TEST_BYTES; i++) assert(all[i] == i % 251);
+    pthread_join(thread, NULL);
+    free(all);
+    ring_free(r);
+
+    // TEST CANCEL: a writer waiting on a full buffer is woken
+    r = ring_new(100);
+    assert(r);
+    assert(pthread_create(&thread, NULL, produce_forever, r) == 0);
+    assert(ring_read(r, buf, sizeof(buf), &n) == RING_STATUS_OK && n == sizeof(buf));
+    ring_cancel(r);
+    pthread_join(thread, NULL);
+    assert(ring_read(r, buf, sizeof(buf), &n) == RING_STATUS_CANCELED);
+    assert(ring_write(r, "a", 1) == RING_STATUS_CANCELED);
+    ring_free(r);
+
+    // TEST CANCEL ORDER: the writer fails first, so the reader's cancel is late
+    r = ring_new(100);
+    assert(r);
+    assert(ring_cancel(r));
+    assert(ring_read(r, buf, sizeof(buf), &n) == RING_STATUS_CANCELED);
+    assert(!ring_cancel(r));
+    ring_free(r);
+
+    // TEST CANCEL ORDER: the reader fails first, and the writer stops with it
+    r = ring_new(100);
+    assert(r);
+    assert(pthread_create(&thread, NULL, produce_forever, r) == 0);
+    assert(ring_read(r, buf, sizeof(buf), &n) == RING_STATUS_OK);
+    assert(ring_cancel(r));
+    pthread_join(thread, NULL);
+    assert(!ring_cancel(r));
+    ring_free(r);
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _RING_TEST_H_
+#define _RING_TEST_H_
+
+int ring_test();
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../main/enum.h"
+#include "../main/fs.h"
+#include "../main/list.h"
+#include "../main/resume.h"
+#include "sim_device.h"
+
+struct SimDevice {
+    List* objects;        // EnumEntry items for every object on the device
+    uint32_t next_id;     // ID of the next object to add
+    unsigned latency_us;  // Delay added to each request
+    int has_bulk;         // Truthy if bulk listing is supported
+    int has_partial;      // Truthy if partial reads are supported
+    uint64_t fail_at;     // Offset at which reads fail, zero to never fail
+    uint64_t max_offset;  // Offset partial reads fail from, zero for none
+    size_t requests;      // Requests made since last checked
+    uint64_t bytes;       // Bytes read since last checked
+};
+
+static void sim_device_request(SimDevice* sd) {
+    sd->requests++;
+    if (sd->latency_us) usleep(sd->latency_us);
+}
+
+static EnumStatusCode sim_device_copy(List* out, EnumEntry* e) {
+    EnumEntry* copy = enum_entry_new(e->id, e->parent_id, e->size, e->is_folder, e->name);
+    if (!copy) return ENUM_STATUS_ENOMEM;
+    copy->mtime = e->mtime;
+    if (list_push(out, copy) != LIST_STATUS_OK) {
+        enum_entry_free(copy);
+        return ENUM_STATUS_ENOMEM;
+    }
+    return ENUM_STATUS_OK;
+}
+
+static EnumStatusCode sim_device_list(SimDevice* sd, int is_all, uint32_t folder_id, List** out) {
+    List* entries = list_new(16);
+    if (!entries) return ENUM_STATUS_ENOMEM;
+
+    for (size_t i = 0; i < list_size(sd->objects); i++) {
+        EnumEntry* e = list_get(sd->objects, i);
+        if (!is_all && e->parent_id != folder_id) continue;
+        if (sim_device_copy(entries, e) != ENUM_STATUS_OK) {
+            list_free_deep(entries, (ListItemFreeFn)enum_entry_free);
+            return ENUM_STATUS_ENOMEM;
+        }
+    }
+
+    *out = entries;
+    return ENUM_STATUS_OK;
+}
+
+static EnumStatusCode sim_device_list_folder(void* data, uint32_t folder_id, List** out) {
+    SimDevice* sd = data;
+    sim_device_request(sd);
+    return sim_device_list(sd, 0, folder_id, out);
+}
+
+static EnumStatusCode sim_device_list_all(void* data, List** out) {
+    SimDevice* sd = data;
+    sim_device_request(sd);
+    if (!sd->has_bulk) return ENUM_STATUS_EUNSUPPORTED;
+    return sim_device_list(sd, 1, 0, out);
+}
+
+static EnumEntry* sim_device_find(SimDevice* sd, uint32_t id) {
+    for (size_t i = 0; i < list_size(sd->objects); i++) {
+        EnumEntry* e = list_get(sd->objects, i);
+        if (e->id == id) return e;
+    }
+    return NULL;
+}
+
+static int sim_device_get(void* data, uint32_t id, int fd) {
+    SimDevice* sd = data;
+    unsigned char buf[64 * 1024];
+    sim_device_request(sd);
+
+    EnumEntry* e = sim_device_find(sd, id);
+    if (!e || e->is_folder) return -1;
+
+    for (uint64_t offset = 0; offset < e->size; ) {
+        uint64_t n = e->size - offset < sizeof(buf) ? e->size - offset : sizeof(buf);
+        int fails = sd->fail_at && offset + n > sd->fail_at;
+        if (fails) n = sd->fail_at - offset;
+
+        for (uint64_t i = 0; i < n; i++) buf[i] = sim_device_byte(id, offset + i);
+        if (fs_write_all(fd, buf, n) != 0) return -1;
+        sd->bytes += n;
+        offset += n;
+
+        if (fails) return -1;
+    }
+
+    return 0;
+}
+
+static int sim_device_get_partial(void* data, uint32_t id, uint64_t offset, uint32_t max, unsigned char** out, unsigned int* size) {
+    SimDevice* sd = data;
+    sim_device_request(sd);
+
+    EnumEntry* e = sim_device_find(sd, id);
+    if (!e || e->is_folder) return -1;
+
+    uint64_t n = offset < e->size ? e->size - offset : 0;
+    if (n > max) n = max;
+    if (sd->fail_at && offset + n > sd->fail_at) return -1;
+    if (sd->max_offset && offset >= sd->max_offset) return -1;
+
+    *out = malloc(n ? n : 1);
+    if (!*out) return -1;
+    for (uint64_t i = 0; i < n; i++) (*out)[i] = sim_device_byte(id, offset + i);
+    *size = n;
+    sd->bytes += n;
+    return 0;
+}
+
+SimDevice* sim_device_new(unsigned latency_us) {
+    SimDevice* sd = calloc(1, sizeof(SimDevice));
+    if (!sd) return NULL;
+
+    sd->objects = list_new(64);
+    if (!sd->objects) {
+        free(sd);
+        return NULL;
+    }
+
+    sd->next_id = 1;
+    sd->latency_us = latency_us;
+    sd->has_bulk = 1;
+    sd->has_partial = 1;
+    return sd;
+}
+
+uint32_t sim_device_add(SimDevice* sd, uint32_t parent_id, const char* name, uint64_t size, int is_folder) {
+    EnumEntry* e = enum_entry_new(sd->next_id, parent_id, size, is_folder, name);
+    if (!e) return 0;
+    if (list_push(sd->objects, e) != LIST_STATUS_OK) {
+        enum_entry_free(e);
+        return 0;
+    }
+    return sd->next_id++;
+}
+
+void sim_device_set_bulk(SimDevice* sd, int is_supported) {
+    sd->has_bulk = is_supported;
+}
+
+void sim_device_set_partial(SimDevice* sd, int is_supported) {
+    sd->has_partial = is_supported;
+}
+
+void sim_device_set_fail_at(SimDevice* sd, uint64_t offset) {
+    sd->fail_at = offset;
+}
+
+void sim_device_set_max_offset(SimDevice* sd, uint64_t offset) {
+    sd->max_offset = offset;
+}
+
+unsigned char sim_device_byte(uint32_t id, uint64_t offset) {
+    return (id * 31 + offset) & 0xff;
+}
+
+uint64_t sim_device_bytes(SimDevice* sd) {
+    uint64_t bytes = sd->bytes;
+    sd->bytes = 0;
+    return bytes;
+}
+
+size_t sim_device_requests(SimDevice* sd) {
+    size_t requests = sd->requests;
+    sd->requests = 0;
+    return requests;
+}
+
+EnumSource sim_device_source(SimDevice* sd) {
+    EnumSource src = {
+        .list_folder = sim_device_list_folder,
+        .list_all = sim_device_list_all,
+        .data = sd,
+    };
+    return src;
+}
+
+ResumeSource sim_device_resume_source(SimDevice* sd) {
+    ResumeSource src = {
+        .get = sim_device_get,
+        .get_partial = sd->has_partial ? sim_device_get_partial : NULL,
+        .data = sd,
+    };
+    return src;
+}
+
+void sim_device_free(SimDevice* sd) {
+    if (sd) list_free_deep(sd->objects, (ListItemFreeFn)enum_entry_free);
+    free(sd);
+}
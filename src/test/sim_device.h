@@ -0,0 +1,108 @@
+#ifndef _SIM_DEVICE_H_
+#define _SIM_DEVICE_H_
+
+#include <stdint.h>
+
+#include "../main/enum.h"
+#include "../main/resume.h"
+
+/**
+ * An in-memory storage volume which can be enumerated like an MTP device.
+ * Every request made to it is counted and may be delayed, to simulate the
+ * round trip to a real device.
+ */
+typedef struct SimDevice SimDevice;
+
+/**
+ * Create an empty simulated device.
+ * @param latency_us  delay added to each request, in microseconds
+ * @return            new device, or NULL in case of failure
+ */
+SimDevice* sim_device_new(unsigned latency_us);
+
+/**
+ * Add an object to the simulated device.
+ * @param sd         device to add to
+ * @param parent_id  ID of the parent folder, zero for the root folder
+ * @param name       name of the object
+ * @param size       size of the object in bytes
+ * @param is_folder  truthy if the object is a folder
+ * @return           ID of the new object, or zero in case of failure
+ */
+uint32_t sim_device_add(SimDevice* sd, uint32_t parent_id, const char* name, uint64_t size, int is_folder);
+
+/**
+ * Enable or disable bulk listing of the simulated device.
+ * @param sd            device to update
+ * @param is_supported  truthy if bulk listing should be supported
+ */
+void sim_device_set_bulk(SimDevice* sd, int is_supported);
+
+/**
+ * Enable or disable partial reads of objects from the simulated device.
+ * @param sd            device to update
+ * @param is_supported  truthy if partial reads should be supported
+ */
+void sim_device_set_partial(SimDevice* sd, int is_supported);
+
+/**
+ * Make reads of objects fail once they reach an offset, like a device which
+ * is disconnected in the middle of a transfer. Whole reads write every byte
+ * before the offset first, partial reads which would pass it fail outright.
+ * @param sd      device to update
+ * @param offset  offset at which reads fail, or zero to never fail
+ */
+void sim_device_set_fail_at(SimDevice* sd, uint64_t offset);
+
+/**
+ * Make partial reads fail from an offset, like a device which only supports
+ * 32-bit offsets when reading from past 4 GiB.
+ * @param sd      device to update
+ * @param offset  offset from which partial reads fail, or zero for none
+ */
+void sim_device_set_max_offset(SimDevice* sd, uint64_t offset);
+
+/**
+ * Determine the contents of the objects on a simulated device.
+ * @param id      ID of the object
+ * @param offset  offset of the byte within the object
+ * @return        the byte at the offset
+ */
+unsigned char sim_device_byte(uint32_t id, uint64_t offset);
+
+/**
+ * Retrieve the number of bytes read from objects of the simulated device, and
+ * reset it.
+ * @param sd  device to check
+ * @return    number of bytes read since the last call
+ */
+uint64_t sim_device_bytes(SimDevice* sd);
+
+/**
+ * Retrieve the number of requests made to the simulated device, and reset it.
+ * @param sd  device to check
+ * @return    number of requests since the last call
+ */
+size_t sim_device_requests(SimDevice* sd);
+
+/**
+ * Create an enumeration source which lists objects from the simulated device.
+ * @param sd  device to list
+ * @return    source referencing the device
+ */
+EnumSource sim_device_source(SimDevice* sd);
+
+/**
+ * Create a source which reads objects from the simulated device.
+ * @param sd  device to read from
+ * @return    source referencing the device
+ */
+ResumeSource sim_device_resume_source(SimDevice* sd);
+
+/**
+ * Free the simulated device and all of its objects.
+ * @param sd  device to free
+ */
+void sim_device_free(SimDevice* sd);
+
+#endif
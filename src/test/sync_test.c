@@ -35,7 +35,10 @@ static void assert_push_cleanup(List* source_files, List* target_files, List* sp
         { SYNC_ACTION_XFER, "/tgt/three/21.mp3" },
     };
 
-    List* plans = sync_plan_push(source_files, target_files, specs, 1);
+    Arena* arena = arena_new(1024);
+    assert(arena);
+
+    List* plans = sync_plan_push(arena, source_files, target_files, specs, 1, SYNC_COMPARE_EXISTS, SYNC_PLANNER_HASH);
     assert(plans);
     assert(ARRAY_LEN(expected) == list_size(plans));
     for (size_t i = 0; i < ARRAY_LEN(expected); i++) {
@@ -43,7 +46,8 @@ static void assert_push_cleanup(List* source_files, List* target_files, List* sp
         assert(expected[i].action == plan->action);
         assert(strcmp(expected[i].path, plan->target->path) == 0);
     }
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
+    list_free(plans);
+    arena_free(arena);
 }
 
 static void assert_push_nocleanup(List* source_files, List* target_files, List* specs) {
@@ -61,7 +65,10 @@ static void assert_push_nocleanup(List* source_files, List* target_files, List*
         { SYNC_ACTION_XFER, "/tgt/three/21.mp3" },
     };
 
-    List* plans = sync_plan_push(source_files, target_files, specs, 0);
+    Arena* arena = arena_new(1024);
+    assert(arena);
+
+    List* plans = sync_plan_push(arena, source_files, target_files, specs, 0, SYNC_COMPARE_EXISTS, SYNC_PLANNER_HASH);
     assert(plans);
     assert(ARRAY_LEN(expected) == list_size(plans));
     for (size_t i = 0; i < ARRAY_LEN(expected); i++) {
@@ -69,7 +76,124 @@ static void assert_push_nocleanup(List* source_files, List* target_files, List*
         assert(expected[i].action == plan->action);
         assert(strcmp(expected[i].path, plan->target->path) == 0);
     }
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
+    list_free(plans);
+    arena_free(arena);
+}
+
+static int plan_cmp(const void* a, const void* b) {
+    const SyncPlan* aa = *(const SyncPlan**)a;
+    const SyncPlan* bb = *(const SyncPlan**)b;
+    if (aa->action != bb->action) return aa->action - bb->action;
+    return strcmp(aa->target->path, bb->target->path);
+}
+
+static int is_within(const char* path, const char* folder) {
+    size_t len = strlen(folder);
+    if (strcmp(folder, "/") == 0) return strcmp(path, "/") != 0;
+    return strncmp(path, folder, len) == 0 && path[len] == '/';
+}
+
+typedef struct {
+    Arena* arena;
+    List* plans;
+} StreamData;
+
+static SyncStatusCode stream_collect(SyncPlan* plan, void* data) {
+    StreamData* d = data;
+    SyncPlan* copy = sync_plan_new(d->arena, plan->source, plan->target, plan->action);
+    assert(copy);
+    assert(list_push(d->plans, copy) == LIST_STATUS_OK);
+    return SYNC_STATUS_OK;
+}
+
+static SyncStatusCode stream_stop(SyncPlan* plan, void* data) {
+    (*(size_t*)data)++;
+    return SYNC_STATUS_EFAIL;
+}
+
+// Checks streamed plans may be executed as they come, and are the same as the
+// plans of the merge planner.
+static void assert_stream(List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare, List* merge_plans, Arena* arena) {
+    StreamData d = { .arena = arena, .plans = list_new(16) };
+    assert(d.plans);
+    assert(sync_plan_stream(source_files, target_files, specs, cleanup, compare, stream_collect, &d) == SYNC_STATUS_OK);
+    assert(list_size(d.plans) == list_size(merge_plans));
+
+    for (size_t i = 0; i < list_size(d.plans); i++) {
+        SyncPlan* a = list_get(d.plans, i);
+        for (size_t j = 0; j < list_size(d.plans); j++) {
+            SyncPlan* b = list_get(d.plans, j);
+            if (j > i && a->action == SYNC_ACTION_RM) assert(!is_within(b->target->path, a->target->path));
+            if (j < i && a->action == SYNC_ACTION_MKDIR) assert(!is_within(b->target->path, a->target->path));
+        }
+    }
+
+    List* stream_sorted = list_sort(d.plans, plan_cmp);
+    List* merge_sorted = list_sort(merge_plans, plan_cmp);
+    assert(stream_sorted && merge_sorted);
+    for (size_t i = 0; i < list_size(stream_sorted); i++) {
+        SyncPlan* a = list_get(stream_sorted, i);
+        SyncPlan* b = list_get(merge_sorted, i);
+        assert(a->action == b->action);
+        assert(a->target->path == b->target->path);
+    }
+
+    list_free(stream_sorted);
+    list_free(merge_sorted);
+    list_free(d.plans);
+}
+
+// Checks the merge planner plans the same actions as the hash planner, in an
+// order which can be executed. Returns the plans sorted by action and path.
+static List* assert_planners_compare(List* source_files, List* target_files, List* specs, int cleanup, SyncCompare compare, Arena* arena) {
+    List* hash_plans = sync_plan_push(arena, source_files, target_files, specs, cleanup, compare, SYNC_PLANNER_HASH);
+    List* merge_plans = sync_plan_push(arena, source_files, target_files, specs, cleanup, compare, SYNC_PLANNER_MERGE);
+    assert(hash_plans && merge_plans);
+    assert(list_size(hash_plans) == list_size(merge_plans));
+
+    for (size_t i = 0; i < list_size(merge_plans); i++) {
+        SyncPlan* a = list_get(merge_plans, i);
+        for (size_t j = i + 1; j < list_size(merge_plans); j++) {
+            SyncPlan* b = list_get(merge_plans, j);
+            assert(a->action <= b->action);
+            if (a->action == SYNC_ACTION_RM && b->action == SYNC_ACTION_RM) {
+                assert(!is_within(b->target->path, a->target->path));
+            }
+            if (a->action == SYNC_ACTION_MKDIR && b->action == SYNC_ACTION_MKDIR) {
+                assert(!is_within(a->target->path, b->target->path));
+            }
+        }
+    }
+
+    List* hash_sorted = list_sort(hash_plans, plan_cmp);
+    List* merge_sorted = list_sort(merge_plans, plan_cmp);
+    assert(hash_sorted && merge_sorted);
+
+    for (size_t i = 0; i < list_size(hash_sorted); i++) {
+        SyncPlan* a = list_get(hash_sorted, i);
+        SyncPlan* b = list_get(merge_sorted, i);
+        assert(a->action == b->action);
+        assert(a->target->path == b->target->path);
+        assert(a->target->is_folder == b->target->is_folder);
+        assert(!a->source == !b->source);
+        if (a->source) {
+            assert(a->source->path == b->source->path);
+        }
+    }
+
+    assert_stream(source_files, target_files, specs, cleanup, compare, merge_plans, arena);
+
+    list_free(hash_sorted);
+    list_free(hash_plans);
+    list_free(merge_plans);
+    return merge_sorted;
+}
+
+static void assert_planners_agree(List* source_files, List* target_files, List* specs, int cleanup) {
+    Arena* arena = arena_new(1024);
+    assert(arena);
+    list_free(assert_planners_compare(source_files, target_files, specs, cleanup, SYNC_COMPARE_EXISTS, arena));
+    arena_free(arena);
 }
 
 static int sync_push_test() {
@@ -92,7 +216,8 @@ static int sync_push_test() {
     List* source_files = list_new(ARRAY_LEN(source_file_paths));
     List* target_files = list_new(ARRAY_LEN(target_file_paths));
     List* specs = list_new(ARRAY_LEN(source_file_paths));
-    assert(source_files && target_files && specs);
+    Arena* arena = arena_new(1024);
+    assert(source_files && target_files && specs && arena);
 
     for (size_t i = 0; i < ARRAY_LEN(source_file_paths); i++) {
         char* source = source_file_paths[i];
@@ -102,7 +227,7 @@ static int sync_push_test() {
         sprintf(target, "/tgt%s", source+4);
 
         assert(list_push(source_files, file_new(source_file_paths[i], 0)) == LIST_STATUS_OK);
-        assert(list_push(specs, sync_spec_new(source, target)) == LIST_STATUS_OK);
+        assert(list_push(specs, sync_spec_new(arena, source, target)) == LIST_STATUS_OK);
         free(target);
     }
 
@@ -112,10 +237,13 @@ static int sync_push_test() {
 
     assert_push_cleanup(source_files, target_files, specs);
     assert_push_nocleanup(source_files, target_files, specs);
+    assert_planners_agree(source_files, target_files, specs, 1);
+    assert_planners_agree(source_files, target_files, specs, 0);
 
     list_free_deep(source_files, (ListItemFreeFn)file_free);
     list_free_deep(target_files, (ListItemFreeFn)file_free);
-    list_free_deep(specs, (ListItemFreeFn)sync_spec_free);
+    list_free(specs);
+    arena_free(arena);
 
     return 0;
 }
@@ -155,7 +283,10 @@ static int sync_rm_test() {
         assert(list_push(rm_files, file_new(rm_file_paths[i], 0)) == LIST_STATUS_OK);
     }
 
-    List* plans = sync_plan_rm(rm_files);
+    Arena* arena = arena_new(1024);
+    assert(arena);
+
+    List* plans = sync_plan_rm(arena, rm_files);
     assert(plans);
     assert(ARRAY_LEN(expected) == list_size(plans));
     for (size_t i = 0; i < ARRAY_LEN(expected); i++) {
@@ -164,12 +295,588 @@ static int sync_rm_test() {
         //printf("%s = %s\n", expected[i], plan->target->path);
         assert(strcmp(expected[i], plan->target->path) == 0);
     }
-    list_free_deep(plans, (ListItemFreeFn)sync_plan_free);
+    list_free(plans);
+    arena_free(arena);
     list_free_deep(rm_files, (ListItemFreeFn)file_free);
 
     return 0;
 }
 
+static int sync_merge_test() {
+    char* source_paths[] = {
+        "/src/a/b/1.mp3",
+        "/src/a-b/2.mp3",
+        "/src/a.b/3.mp3",
+        "/src/a/4.mp3",
+        "/src/a/b/1.mp3",
+        "/src/c/d/e/5.mp3",
+        "/src/f",
+    };
+    char* target_paths[] = {
+        "/tgt",
+        "/tgt/a",
+        "/tgt/a/b",
+        "/tgt/a/b/1.mp3",
+        "/tgt/a-b/old.mp3",
+        "/tgt/a.b",
+        "/tgt/c/x/y.mp3",
+        "/tgt/f",
+        "/tgt/f/nested.mp3",
+        "/tgt/z/stray",
+    };
+    int target_folders[] = { 1, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+
+    Arena* arena = arena_new(1024);
+    List* source_files = list_new(ARRAY_LEN(source_paths));
+    List* target_files = list_new(ARRAY_LEN(target_paths));
+    List* no_files = list_new(1);
+    assert(arena && source_files && target_files && no_files);
+
+    for (size_t i = 0; i < ARRAY_LEN(source_paths); i++) {
+        File* f = file_new_arena(arena, source_paths[i], 0, source_paths[i]);
+        assert(f && list_push(source_files, f) == LIST_STATUS_OK);
+    }
+    for (size_t i = 0; i < ARRAY_LEN(target_paths); i++) {
+        File* f = file_new_arena(arena, target_paths[i], target_folders[i], NULL);
+        assert(f && list_push(target_files, f) == LIST_STATUS_OK);
+    }
+
+    // TEST PUSHING IN TO A POPULATED FOLDER
+    List* specs = sync_spec_create(arena, source_files, "/src", "/tgt");
+    assert(specs);
+    assert_planners_agree(source_files, target_files, specs, 1);
+    assert_planners_agree(source_files, target_files, specs, 0);
+
+    // TEST STOPPING A STREAM
+    size_t count = 0;
+    assert(sync_plan_stream(source_files, target_files, specs, 1, SYNC_COMPARE_EXISTS, stream_stop, &count) == SYNC_STATUS_EFAIL);
+    assert(count == 1);
+
+    // TEST PUSHING IN TO AN EMPTY DEVICE
+    assert_planners_agree(source_files, no_files, specs, 1);
+
+    // TEST CLEANING UP EVERYTHING
+    List* no_specs = list_new(1);
+    assert(no_specs);
+    assert_planners_agree(no_files, target_files, no_specs, 1);
+
+    // TEST A FOLDER IMPLIED BY THE SOURCE FILES
+    SyncSpec* spec = sync_spec_new(arena, "/src/c/d", "/tgt/c/d");
+    assert(spec && list_push(no_specs, spec) == LIST_STATUS_OK);
+    assert_planners_agree(source_files, target_files, no_specs, 1);
+
+    // TEST A MISSING SOURCE FAILS
+    spec = sync_spec_new(arena, "/src/missing", "/tgt/missing");
+    assert(spec && list_push(no_specs, spec) == LIST_STATUS_OK);
+    assert(!sync_plan_push(arena, source_files, target_files, no_specs, 1, SYNC_COMPARE_EXISTS, SYNC_PLANNER_HASH));
+    assert(!sync_plan_push(arena, source_files, target_files, no_specs, 1, SYNC_COMPARE_EXISTS, SYNC_PLANNER_MERGE));
+
+    list_free(no_specs);
+    list_free(specs);
+    list_free(no_files);
+    list_free(target_files);
+    list_free(source_files);
+    arena_free(arena);
+    return 0;
+}
+
+static int sync_compare_test() {
+    typedef struct {
+        char* name;
+        uint64_t source_size;
+        time_t source_mtime;
+        uint64_t target_size;
+        time_t target_mtime;
+    } CompareFile;
+
+    CompareFile files[] = {
+        { "same.mp3", 10, 1000, 10, 1000 },
+        { "resized.mp3", 10, 1000, 20, 1000 },
+        { "touched.mp3", 10, 1000, 10, 2000 },
+        { "rounded.mp3", 10, 1001, 10, 1000 },
+        { "unknown.mp3", 10, 1000, 10, 0 },
+        { "new.mp3", 10, 1000, 0, 0 },
+    };
+
+    struct {
+        SyncCompare compare;
+        char* replaced[ARRAY_LEN(files)];
+    } expected[] = {
+        { SYNC_COMPARE_EXISTS, { NULL } },
+        { SYNC_COMPARE_SIZE, { "/tgt/resized.mp3", NULL } },
+        { SYNC_COMPARE_MTIME, { "/tgt/resized.mp3", "/tgt/touched.mp3", NULL } },
+        { SYNC_COMPARE_ALWAYS, { "/tgt/resized.mp3", "/tgt/rounded.mp3", "/tgt/same.mp3", "/tgt/touched.mp3", "/tgt/unknown.mp3", NULL } },
+    };
+
+    Arena* arena = arena_new(1024);
+    List* source_files = list_new(ARRAY_LEN(files));
+    List* target_files = list_new(ARRAY_LEN(files) + 1);
+    assert(arena && source_files && target_files);
+
+    File* folder = file_new_arena(arena, "/tgt", 1, NULL);
+    assert(folder && list_push(target_files, folder) == LIST_STATUS_OK);
+
+    for (size_t i = 0; i < ARRAY_LEN(files); i++) {
+        char path[64];
+
+        sprintf(path, "/src/%s", files[i].name);
+        File* f = file_new_arena(arena, path, 0, NULL);
+        assert(f && list_push(source_files, f) == LIST_STATUS_OK);
+        f->size = files[i].source_size;
+        f->mtime = files[i].source_mtime;
+
+        if (!files[i].target_size) continue;
+
+        sprintf(path, "/tgt/%s", files[i].name);
+        f = file_new_arena(arena, path, 0, NULL);
+        assert(f && list_push(target_files, f) == LIST_STATUS_OK);
+        f->size = files[i].target_size;
+        f->mtime = files[i].target_mtime;
+    }
+
+    List* specs = sync_spec_create(arena, source_files, "/src", "/tgt");
+    assert(specs);
+
+    for (size_t i = 0; i < ARRAY_LEN(expected); i++) {
+        List* plans = assert_planners_compare(source_files, target_files, specs, 1, expected[i].compare, arena);
+
+        size_t replaced = 0;
+        for (size_t j = 0; j < list_size(plans); j++) {
+            SyncPlan* plan = list_get(plans, j);
+            if (plan->action != SYNC_ACTION_REPLACE) continue;
+
+            assert(expected[i].replaced[replaced]);
+            assert(strcmp(expected[i].replaced[replaced], plan->target->path) == 0);
+            assert(plan->source->size == 10);
+            replaced++;
+        }
+        assert(!expected[i].replaced[replaced]);
+
+        // the new file is transferred whatever the policy
+        SyncPlan* last = list_get(plans, list_size(plans) - 1);
+        assert(last->action == SYNC_ACTION_XFER);
+        assert(strcmp("/tgt/new.mp3", last->target->path) == 0);
+        list_free(plans);
+    }
+
+    // folders never change
+    folder = file_new_arena(arena, "/src", 1, NULL);
+    assert(folder);
+    assert(!sync_is_changed(folder, list_get(target_files, 0), SYNC_COMPARE_ALWAYS));
+
+    list_free(specs);
+    list_free(target_files);
+    list_free(source_files);
+    arena_free(arena);
+    return 0;
+}
+
+static int sync_move_test() {
+    typedef struct {
+        char* path;
+        uint64_t size;
+        time_t mtime;
+    } MoveFile;
+
+    MoveFile sources[] = {
+        { "/src/new/a.mp3", 100, 1000 },
+        { "/src/new/b.mp3", 200, 2000 },
+        { "/src/c.mp3", 300, 3000 },
+        { "/src/d.mp3", 600, 0 },
+        { "/src/dup1/x.mp3", 400, 0 },
+        { "/src/dup2/x.mp3", 400, 0 },
+        { "/src/empty", 0, 0 },
+    };
+    MoveFile targets[] = {
+        { "/tgt/old/a.mp3", 100, 1000 },
+        { "/tgt/old/renamed.mp3", 200, 2001 },
+        { "/tgt/old/other.mp3", 300, 5000 },
+        { "/tgt/old/x.mp3", 400, 0 },
+        { "/tgt/p/d.mp3", 600, 0 },
+        { "/tgt/q/d.mp3", 600, 0 },
+        { "/tgt/old/empty", 0, 0 },
+    };
+    struct {
+        char* origin;
+        char* target;
+    } expected[] = {
+        { "/tgt/old/a.mp3", "/tgt/new/a.mp3" },
+        { "/tgt/old/renamed.mp3", "/tgt/new/b.mp3" },
+        { "/tgt/old/x.mp3", "/tgt/dup1/x.mp3" },
+    };
+    SyncPlanner planners[] = { SYNC_PLANNER_HASH, SYNC_PLANNER_MERGE };
+
+    Arena* arena = arena_new(1024);
+    List* source_files = list_new(ARRAY_LEN(sources));
+    List* target_files = list_new(ARRAY_LEN(targets));
+    assert(arena && source_files && target_files);
+
+    for (size_t i = 0; i < ARRAY_LEN(sources); i++) {
+        File* f = file_new_arena(arena, sources[i].path, 0, NULL);
+        assert(f && list_push(source_files, f) == LIST_STATUS_OK);
+        f->size = sources[i].size;
+        f->mtime = sources[i].mtime;
+    }
+    for (size_t i = 0; i < ARRAY_LEN(targets); i++) {
+        File* f = file_new_arena(arena, targets[i].path, 0, NULL);
+        assert(f && list_push(target_files, f) == LIST_STATUS_OK);
+        f->size = targets[i].size;
+        f->mtime = targets[i].mtime;
+    }
+
+    List* specs = sync_spec_create(arena, source_files, "/src", "/tgt");
+    assert(specs);
+
+    for (size_t i = 0; i < ARRAY_LEN(planners); i++) {
+        List* plans = sync_plan_push(arena, source_files, target_files, specs, 1, SYNC_COMPARE_EXISTS, planners[i]);
+        assert(plans);
+
+        uint64_t saved = 0;
+        List* moved = sync_plan_moves(arena, plans, &saved);
+        assert(moved);
+        assert(saved == 100 + 200 + 400);
+        assert(list_size(moved) == list_size(plans) - ARRAY_LEN(expected));
+
+        size_t moves = 0;
+        size_t xfers = 0;
+        for (size_t j = 0; j < list_size(moved); j++) {
+            SyncPlan* a = list_get(moved, j);
+            if (a->action == SYNC_ACTION_XFER) xfers++;
+            if (a->action != SYNC_ACTION_MOVE) continue;
+
+            moves++;
+            int found = 0;
+            for (size_t k = 0; k < ARRAY_LEN(expected); k++) {
+                if (strcmp(expected[k].target, a->target->path) == 0) {
+                    assert(strcmp(expected[k].origin, a->origin->path) == 0);
+                    found = 1;
+                }
+            }
+            assert(found);
+
+            // folders are created before, and the stray files removed after
+            for (size_t k = 0; k < list_size(moved); k++) {
+                SyncPlan* b = list_get(moved, k);
+                assert(b->target->path != a->origin->path);
+                assert(b->target->path != a->target->path || b == a);
+                if (b->action == SYNC_ACTION_MKDIR) assert(k < j);
+                if (b->action == SYNC_ACTION_RM && is_within(a->origin->path, b->target->path)) assert(k > j);
+            }
+        }
+        assert(moves == ARRAY_LEN(expected));
+        assert(xfers == 4);
+
+        list_free(moved);
+        list_free(plans);
+    }
+
+    // nothing to move without stray files
+    List* plans = sync_plan_push(arena, source_files, target_files, specs, 0, SYNC_COMPARE_EXISTS, SYNC_PLANNER_HASH);
+    assert(plans);
+    uint64_t saved = 1;
+    List* moved = sync_plan_moves(arena, plans, &saved);
+    assert(moved && saved == 0);
+    assert(list_size(moved) == list_size(plans));
+    for (size_t i = 0; i < list_size(plans); i++) assert(list_get(moved, i) == list_get(plans, i));
+
+    list_free(moved);
+    list_free(plans);
+    list_free(specs);
+    list_free(target_files);
+    list_free(source_files);
+    arena_free(arena);
+    return 0;
+}
+
+typedef struct {
+    char* path;
+    uint64_t size;
+    uint64_t digest;
+} CopyFile;
+
+typedef struct {
+    CopyFile* files;
+    size_t len;
+    size_t calls;
+} CopyDigestData;
+
+static SyncStatusCode copy_digest(File* f, uint64_t* digest, void* data) {
+    CopyDigestData* d = data;
+    d->calls++;
+    for (size_t i = 0; i < d->len; i++) {
+        if (strcmp(d->files[i].path, f->path) == 0) {
+            *digest = d->files[i].digest;
+            return SYNC_STATUS_OK;
+        }
+    }
+    return SYNC_STATUS_EFAIL;
+}
+
+static int sync_copy_test() {
+    CopyFile sources[] = {
+        { "/src/a/1.mp3", 10, 1 },
+        { "/src/b/1.mp3", 10, 1 },
+        { "/src/c/2.mp3", 10, 2 },
+        { "/src/d/3.mp3", 20, 1 },
+        { "/src/e/4.mp3", 0, 3 },
+        { "/src/f/4.mp3", 0, 3 },
+        { "/src/g/5.mp3", 10, 2 },
+    };
+    struct {
+        char* origin;
+        char* target;
+    } expected[] = {
+        { "/tgt/a/1.mp3", "/tgt/b/1.mp3" },
+        { "/tgt/c/2.mp3", "/tgt/g/5.mp3" },
+    };
+    SyncPlanner planners[] = { SYNC_PLANNER_HASH, SYNC_PLANNER_MERGE };
+
+    Arena* arena = arena_new(1024);
+    List* source_files = list_new(ARRAY_LEN(sources));
+    List* no_files = list_new(1);
+    assert(arena && source_files && no_files);
+
+    for (size_t i = 0; i < ARRAY_LEN(sources); i++) {
+        File* f = file_new_arena(arena, sources[i].path, 0, NULL);
+        assert(f && list_push(source_files, f) == LIST_STATUS_OK);
+        f->size = sources[i].size;
+    }
+
+    List* specs = sync_spec_create(arena, source_files, "/src", "/tgt");
+    assert(specs);
+
+    for (size_t i = 0; i < ARRAY_LEN(planners); i++) {
+        List* plans = sync_plan_push(arena, source_files, no_files, specs, 0, SYNC_COMPARE_EXISTS, planners[i]);
+        assert(plans);
+
+        CopyDigestData d = { .files = sources, .len = ARRAY_LEN(sources), .calls = 0 };
+        uint64_t saved = 0;
+        List* copied = sync_plan_copies(arena, plans, copy_digest, &d, &saved);
+        assert(copied);
+        assert(saved == 20);
+        assert(list_size(copied) == list_size(plans));
+
+        // only files sharing their size with another are digested, each once
+        assert(d.calls == 4);
+
+        // the copies come last, in order of transfer
+        size_t first = list_size(copied) - ARRAY_LEN(expected);
+        for (size_t j = 0; j < list_size(copied); j++) {
+            SyncPlan* plan = list_get(copied, j);
+            if (j < first) {
+                assert(plan->action != SYNC_ACTION_COPY);
+                continue;
+            }
+
+            assert(plan->action == SYNC_ACTION_COPY);
+            assert(strcmp(expected[j - first].origin, plan->origin->path) == 0);
+            assert(strcmp(expected[j - first].target, plan->target->path) == 0);
+            assert(plan->source && plan->source->size == 10);
+        }
+
+        // digests which cannot be computed fail the plan
+        d.len = 1;
+        assert(!sync_plan_copies(arena, plans, copy_digest, &d, NULL));
+
+        list_free(copied);
+        list_free(plans);
+    }
+
+    list_free(specs);
+    list_free(no_files);
+    list_free(source_files);
+    arena_free(arena);
+    return 0;
+}
+
+static List* prune_copy(List* l) {
+    List* copy = list_new(list_size(l));
+    assert(copy && list_push_all(copy, l) == LIST_STATUS_OK);
+    return copy;
+}
+
+static int has_path(List* files, char* path) {
+    for (size_t i = 0; i < list_size(files); i++) {
+        File* f = list_get(files, i);
+        if (strcmp(f->path, path) == 0) return 1;
+    }
+    return 0;
+}
+
+static int sync_prune_test() {
+    typedef struct {
+        char* path;
+        int is_folder;
+        uint64_t size;
+    } PruneFile;
+
+    PruneFile sources[] = {
+        { "/src/a/1", 0, 10 },
+        { "/src/a/2", 0, 20 },
+        { "/src/b/c/3", 0, 30 },
+        { "/src/b/4", 0, 40 },
+        { "/src/d/5", 0, 50 },
+        { "/src/e", 1, 0 },
+        { "/src/top", 0, 60 },
+    };
+
+    PruneFile targets[] = {
+        { "/tgt", 1, 0 },
+        { "/tgt/a", 1, 0 },
+        { "/tgt/a/1", 0, 10 },
+        { "/tgt/a/2", 0, 21 },
+        { "/tgt/b", 1, 0 },
+        { "/tgt/b/c", 1, 0 },
+        { "/tgt/b/c/3", 0, 30 },
+        { "/tgt/b/x", 0, 70 },
+        { "/tgt/d", 1, 0 },
+        { "/tgt/e", 1, 0 },
+        { "/tgt/e/6", 0, 80 },
+    };
+
+    struct {
+        SyncCompare compare;
+        size_t pruned;
+        char* left_out[4];
+    } expected[] = {
+        { SYNC_COMPARE_EXISTS, 3, { "/tgt/a/1", "/tgt/a/2", "/tgt/b/c/3", "/tgt/e/6" } },
+        { SYNC_COMPARE_SIZE, 1, { "/tgt/b/c/3", "/tgt/e/6", NULL } },
+        { SYNC_COMPARE_MTIME, 1, { "/tgt/b/c/3", "/tgt/e/6", NULL } },
+        { SYNC_COMPARE_ALWAYS, 0, { "/tgt/e/6", NULL } },
+    };
+
+    Arena* arena = arena_new(1024);
+    List* source_files = list_new(ARRAY_LEN(sources));
+    List* target_files = list_new(ARRAY_LEN(targets));
+    assert(arena && source_files && target_files);
+
+    for (size_t i = 0; i < ARRAY_LEN(sources); i++) {
+        File* f = file_new_arena(arena, sources[i].path, sources[i].is_folder, NULL);
+        assert(f && list_push(source_files, f) == LIST_STATUS_OK);
+        f->size = sources[i].size;
+    }
+
+    for (size_t i = 0; i < ARRAY_LEN(targets); i++) {
+        File* f = file_new_arena(arena, targets[i].path, targets[i].is_folder, NULL);
+        assert(f && list_push(target_files, f) == LIST_STATUS_OK);
+        f->size = targets[i].size;
+    }
+
+    // the folder listed on the source is already known to be the same
+    List* specs = sync_spec_create(arena, source_files, "/src", "/tgt");
+    assert(specs);
+    assert(list_push(specs, sync_spec_new(arena, "/src/e", "/tgt/e")) == LIST_STATUS_OK);
+
+    for (size_t i = 0; i < ARRAY_LEN(expected); i++) {
+        SyncCompare compare = expected[i].compare;
+        List* pruned_sources = prune_copy(source_files);
+        List* pruned_targets = prune_copy(target_files);
+        List* pruned_specs = prune_copy(specs);
+
+        size_t pruned = 0;
+        assert(sync_prune_push(arena, pruned_sources, pruned_targets, pruned_specs, compare, &pruned) == SYNC_STATUS_OK);
+        assert(pruned == expected[i].pruned);
+
+        for (size_t j = 0; j < ARRAY_LEN(expected[i].left_out) && expected[i].left_out[j]; j++) {
+            char* path = expected[i].left_out[j];
+            assert(!has_path(pruned_targets, path));
+
+            // the folder itself is kept
+            path = strdup(path);
+            assert(path);
+            assert(has_path(pruned_targets, dirname(path)));
+            free(path);
+        }
+
+        if (compare == SYNC_COMPARE_EXISTS) {
+            assert(!has_path(pruned_sources, "/src/a/1"));
+            assert(has_path(pruned_sources, "/src/a"));
+            assert(has_path(pruned_sources, "/src/b/c"));
+            assert(has_path(pruned_sources, "/src/b/4"));
+        }
+
+        // pruning changes nothing that needs to be done
+        for (int cleanup = 0; cleanup <= 1; cleanup++) {
+            // the contents of the folder known to be the same are not listed
+            List* targets_without_e = list_new(list_size(target_files));
+            assert(targets_without_e);
+            for (size_t j = 0; j < list_size(target_files); j++) {
+                File* f = list_get(target_files, j);
+                if (strcmp(f->path, "/tgt/e/6") != 0) assert(list_push(targets_without_e, f) == LIST_STATUS_OK);
+            }
+
+            List* plans = assert_planners_compare(source_files, targets_without_e, specs, cleanup, compare, arena);
+            List* pruned_plans = assert_planners_compare(pruned_sources, pruned_targets, pruned_specs, cleanup, compare, arena);
+            assert(list_size(plans) == list_size(pruned_plans));
+            for (size_t j = 0; j < list_size(plans); j++) {
+                SyncPlan* a = list_get(plans, j);
+                SyncPlan* b = list_get(pruned_plans, j);
+                assert(a->action == b->action);
+                assert(a->target->path == b->target->path);
+            }
+
+            list_free(plans);
+            list_free(pruned_plans);
+            list_free(targets_without_e);
+        }
+
+        list_free(pruned_sources);
+        list_free(pruned_targets);
+        list_free(pruned_specs);
+    }
+
+    // once everything is the same, only the root folder is left
+    List* same_sources = list_new(4);
+    List* same_targets = list_new(4);
+    assert(same_sources && same_targets);
+    assert(list_push(same_sources, list_get(source_files, 0)) == LIST_STATUS_OK);
+    assert(list_push(same_sources, list_get(source_files, 5)) == LIST_STATUS_OK);
+    assert(list_push(same_targets, list_get(target_files, 0)) == LIST_STATUS_OK);
+    assert(list_push(same_targets, list_get(target_files, 1)) == LIST_STATUS_OK);
+    assert(list_push(same_targets, list_get(target_files, 2)) == LIST_STATUS_OK);
+    assert(list_push(same_targets, list_get(target_files, 9)) == LIST_STATUS_OK);
+    assert(list_push(same_targets, list_get(target_files, 10)) == LIST_STATUS_OK);
+
+    List* same_specs = sync_spec_create(arena, same_sources, "/src", "/tgt");
+    assert(same_specs);
+    assert(list_push(same_specs, sync_spec_new(arena, "/src/e", "/tgt/e")) == LIST_STATUS_OK);
+
+    size_t pruned = 0;
+    assert(sync_prune_push(arena, same_sources, same_targets, same_specs, SYNC_COMPARE_EXISTS, &pruned) == SYNC_STATUS_OK);
+    assert(pruned == 1);
+    assert(list_size(same_specs) == 1);
+    assert(list_size(same_sources) == 1);
+    assert(list_size(same_targets) == 1);
+
+    SyncSpec* spec = list_get(same_specs, 0);
+    assert(strcmp(spec->source, "/src") == 0);
+    assert(strcmp(spec->target, "/tgt") == 0);
+
+    List* plans = assert_planners_compare(same_sources, same_targets, same_specs, 1, SYNC_COMPARE_EXISTS, arena);
+    assert(list_size(plans) == 0);
+    list_free(plans);
+
+    // the digest of a folder covers the names within it
+    SyncTree* t = sync_tree_new(target_files, 1, SYNC_COMPARE_EXISTS);
+    assert(t);
+    uint64_t digest = 0;
+    assert(sync_tree_digest(t, "/tgt/a", &digest));
+    assert(digest == sync_tree_entry("1", 0, 0) + sync_tree_entry("2", 0, 0));
+    assert(sync_tree_digest(t, "/tgt/d", &digest));
+    assert(digest == 0);
+    assert(!sync_tree_digest(t, "/tgt/missing", &digest));
+    sync_tree_free(t);
+
+    list_free(same_specs);
+    list_free(same_sources);
+    list_free(same_targets);
+    list_free(specs);
+    list_free(source_files);
+    list_free(target_files);
+    arena_free(arena);
+    return 0;
+}
+
 int sync_spec_test() {
     char* files[] = {
         "/src/path/to/one",
@@ -190,7 +897,10 @@ int sync_spec_test() {
         assert(list_push(l, f) == LIST_STATUS_OK);
     }
 
-    List* specs = sync_spec_create(l, "/src/path", "/target");
+    Arena* arena = arena_new(1024);
+    assert(arena);
+
+    List* specs = sync_spec_create(arena, l, "/src/path", "/target");
     assert(specs);
     assert(list_size(specs) == ARRAY_LEN(files));
     for (size_t i = 0; i < ARRAY_LEN(files); i++) {
@@ -201,13 +911,19 @@ int sync_spec_test() {
     }
 
     list_free_deep(l, (ListItemFreeFn)file_free);
-    list_free_deep(specs, (ListItemFreeFn)sync_spec_free);
+    list_free(specs);
+    arena_free(arena);
     return 0;
 }
 
 int sync_test() {
     sync_push_test();
     sync_rm_test();
+    sync_merge_test();
+    sync_compare_test();
+    sync_move_test();
+    sync_copy_test();
+    sync_prune_test();
     sync_spec_test();
     return 0;
 }
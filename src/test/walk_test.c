@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../main/arena.h"
+#include "../main/file.h"
+#include "../main/fs.h"
+#include "../main/list.h"
+#include "../main/walk.h"
+#include "walk_test.h"
+
+#define WALK_TEST_FOLDERS 20
+#define WALK_TEST_FILES 10
+
+static void write_file(const char* path, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    for (size_t i = 0; i < len; i++) assert(write(fd, "x", 1) == 1);
+    close(fd);
+}
+
+static void assert_files(List* files, const char* dir) {
+    char path[256];
+
+    assert(files);
+    assert(list_size(files) == WALK_TEST_FOLDERS * WALK_TEST_FILES + 2);
+
+    // files are in order of path, whichever thread found them
+    for (size_t i = 1; i < list_size(files); i++) {
+        File* a = list_get(files, i - 1);
+        File* b = list_get(files, i);
+        assert(fs_path_cmp(a->path, b->path) < 0);
+    }
+
+    File* first = list_get(files, 0);
+    sprintf(path, "%s/d00/f0", dir);
+    assert(strcmp(first->path, path) == 0);
+    assert(!first->is_folder);
+    assert(first->size == 0);
+    assert(first->mtime > 0);
+
+    File* deep = list_get(files, WALK_TEST_FILES);
+    sprintf(path, "%s/d00/sub/deep", dir);
+    assert(strcmp(deep->path, path) == 0);
+    assert(deep->size == 4);
+
+    File* last = list_get(files, list_size(files) - 1);
+    sprintf(path, "%s/top", dir);
+    assert(strcmp(last->path, path) == 0);
+    assert(last->size == 3);
+}
+
+// Collects d00 as a folder and skips d01, listing every other folder.
+static WalkFolderAction walk_test_folder(void* data, const char* path, struct stat* st) {
+    const char* dir = data;
+    size_t len = strlen(dir);
+
+    assert(S_ISDIR(st->st_mode));
+    if (strncmp(path, dir, len) != 0) return WALK_FOLDER_LIST;
+    if (strcmp(path + len, "/d00") == 0) return WALK_FOLDER_COLLECT;
+    if (strcmp(path + len, "/d01") == 0) return WALK_FOLDER_SKIP;
+    return WALK_FOLDER_LIST;
+}
+
+int walk_test() {
+    char dir[] = "/tmp/mtpsync_walk_test_XXXXXX";
+    char path[256];
+    assert(mkdtemp(dir));
+
+    for (size_t i = 0; i < WALK_TEST_FOLDERS; i++) {
+        sprintf(path, "%s/d%02zu", dir, i);
+        assert(fs_mkdir(path) == FS_STATUS_OK);
+        for (size_t j = 0; j < WALK_TEST_FILES; j++) {
+            sprintf(path, "%s/d%02zu/f%zu", dir, i, j);
+            write_file(path, i % 3);
+        }
+    }
+    sprintf(path, "%s/d00/sub", dir);
+    assert(fs_mkdir(path) == FS_STATUS_OK);
+    sprintf(path, "%s/d00/sub/deep", dir);
+    write_file(path, 4);
+    sprintf(path, "%s/top", dir);
+    write_file(path, 3);
+    sprintf(path, "%s/empty", dir);
+    assert(fs_mkdir(path) == FS_STATUS_OK);
+
+    // a link back to the top is not followed in to a loop
+    sprintf(path, "%s/d01/loop", dir);
+    assert(symlink(dir, path) == 0);
+
+    Arena* arena = arena_new(1024);
+    assert(arena);
+
+    // TEST SINGLE THREAD
+    List* files = walk_collect_files(arena, dir, 1);
+    assert_files(files, dir);
+    list_free(files);
+
+    // TEST MANY THREADS
+    for (size_t i = 0; i < 10; i++) {
+        files = walk_collect_files(arena, dir, 8);
+        assert_files(files, dir);
+        list_free(files);
+    }
+
+    // TEST IO_URING, or the fallback where it is unavailable
+    setenv("MTPSYNC_IO_URING", "1", 1);
+    files = walk_collect_files(arena, dir, 1);
+    assert_files(files, dir);
+    list_free(files);
+    files = walk_collect_files(arena, dir, 8);
+    assert_files(files, dir);
+    list_free(files);
+    unsetenv("MTPSYNC_IO_URING");
+
+    // TEST WITHOUT ARENA
+    files = fs_collect_files(NULL, dir);
+    assert_files(files, dir);
+    list_free_deep(files, (ListItemFreeFn)file_free);
+
+    // TEST FOLDER ACTIONS
+    for (size_t threads = 1; threads <= 8; threads += 7) {
+        files = walk_collect(arena, dir, threads, walk_test_folder, dir);
+        assert(files);
+        assert(list_size(files) == (WALK_TEST_FOLDERS - 2) * WALK_TEST_FILES + 2);
+        File* folder = list_get(files, 0);
+        sprintf(path, "%s/d00", dir);
+        assert(strcmp(folder->path, path) == 0);
+        assert(folder->is_folder);
+        sprintf(path, "%s/d01/", dir);
+        for (size_t i = 1; i < list_size(files); i++) {
+            File* f = list_get(files, i);
+            assert(!f->is_folder);
+            assert(strncmp(f->path, path, strlen(path)) != 0);
+        }
+        list_free(files);
+    }
+
+    // TEST SINGLE FILE
+    sprintf(path, "%s/top", dir);
+    files = walk_collect_files(arena, path, 4);
+    assert(files && list_size(files) == 1);
+    assert(((File*)list_get(files, 0))->size == 3);
+    list_free(files);
+
+    // TEST BROKEN LINKS ARE SKIPPED
+    sprintf(path, "%s/d02/broken", dir);
+    assert(symlink("/nonexistent/mtpsync_walk_test", path) == 0);
+    files = walk_collect_files(arena, dir, 4);
+    assert_files(files, dir);
+    list_free(files);
+    files = walk_collect_files(arena, path, 4);
+    assert(files && list_size(files) == 0);
+    list_free(files);
+    unlink(path);
+
+    // TEST MISSING PATH
+    sprintf(path, "%s/missing", dir);
+    errno = 0;
+    assert(!walk_collect_files(arena, path, 4));
+    assert(errno == ENOENT);
+
+    // TEST DEFAULT THREADS
+    assert(walk_threads() >= 1);
+
+    // CLEANUP
+    sprintf(path, "%s/d01/loop", dir);
+    unlink(path);
+    for (size_t i = 0; i < WALK_TEST_FOLDERS; i++) {
+        for (size_t j = 0; j < WALK_TEST_FILES; j++) {
+            sprintf(path, "%s/d%02zu/f%zu", dir, i, j);
+            unlink(path);
+        }
+    }
+    sprintf(path, "%s/d00/sub/deep", dir);
+    unlink(path);
+    sprintf(path, "%s/d00/sub", dir);
+    rmdir(path);
+    for (size_t i = 0; i < WALK_TEST_FOLDERS; i++) {
+        sprintf(path, "%s/d%02zu", dir, i);
+        rmdir(path);
+    }
+    sprintf(path, "%s/top", dir);
+    unlink(path);
+    sprintf(path, "%s/empty", dir);
+    rmdir(path);
+    rmdir(dir);
+
+    arena_free(arena);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _WALK_TEST_H_
+#define _WALK_TEST_H_
+
+int walk_test();
+
+#endif